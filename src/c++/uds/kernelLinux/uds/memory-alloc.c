@@ -379,6 +379,29 @@ static INLINE bool use_kmalloc(size_t size)
 	return size <= PAGE_SIZE;
 }
 
+/*
+ * Allocate pages from vmalloc space, preferring a particular memory node.
+ *
+ * kvmalloc_node() is used when a node is requested since it is the exported
+ * interface which both takes a node and will map large allocations with huge
+ * pages where the architecture allows it. It may satisfy the request from
+ * the slab instead, so the caller must check which kind of memory it got.
+ *
+ * @param size       The number of bytes to allocate
+ * @param gfp_flags  The allocation flags
+ * @param node       The preferred node, or NUMA_NO_NODE
+ *
+ * @return The allocated memory, or NULL
+ */
+static void *vmalloc_on_node(size_t size, gfp_t gfp_flags, int node)
+{
+	if (node == NUMA_NO_NODE) {
+		return __vmalloc(size, gfp_flags);
+	}
+
+	return kvmalloc_node(size, gfp_flags, node);
+}
+
 /*
  * Allocate storage based on memory size and alignment, logging an error if
  * the allocation fails. The memory will be zeroed.
@@ -391,6 +414,29 @@ static INLINE bool use_kmalloc(size_t size)
  * @return UDS_SUCCESS or an error code
  */
 int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
+{
+	return uds_allocate_memory_on_node(size, align, NUMA_NO_NODE, what, ptr);
+}
+
+/*
+ * Allocate storage based on memory size and alignment, preferring memory on a
+ * particular node and logging an error if the allocation fails. The memory
+ * will be zeroed. Memory from other nodes will be used if the preferred node
+ * has none to spare.
+ *
+ * @param size   The size of an object
+ * @param align  The required alignment
+ * @param node   The preferred memory node, or NUMA_NO_NODE for any node
+ * @param what   What is being allocated (for error logging)
+ * @param ptr    A pointer to hold the allocated memory
+ *
+ * @return UDS_SUCCESS or an error code
+ */
+int uds_allocate_memory_on_node(size_t size,
+				size_t align,
+				int node,
+				const char *what,
+				void *ptr)
 {
 	/*
 	 * The __GFP_RETRY_MAYFAIL flag means the VM implementation will retry
@@ -439,7 +485,7 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 
 	start_time = jiffies;
 	if (use_kmalloc(size) && (align < PAGE_SIZE)) {
-		p = kmalloc(size, gfp_flags | __GFP_NOWARN);
+		p = kmalloc_node(size, gfp_flags | __GFP_NOWARN, node);
 		if (p == NULL) {
 			/*
 			 * It is possible for kmalloc to fail to allocate
@@ -448,7 +494,7 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 			 * reclaimer to free a page.
 			 */
 			fsleep(1000);
-			p = kmalloc(size, gfp_flags);
+			p = kmalloc_node(size, gfp_flags, node);
 		}
 
 		if (p != NULL) {
@@ -477,7 +523,9 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 			 * possible that more retries will succeed.
 			 */
 			for (;;) {
-				p = __vmalloc(size, gfp_flags | __GFP_NOWARN);
+				p = vmalloc_on_node(size,
+						    gfp_flags | __GFP_NOWARN,
+						    node);
 				if ((p != NULL) ||
 				    (jiffies_to_msecs(jiffies - start_time) >
 				     1000)) {
@@ -492,11 +540,18 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 				 * Try one more time, logging a failure for
 				 * this call.
 				 */
-				p = __vmalloc(size, gfp_flags);
+				p = vmalloc_on_node(size, gfp_flags, node);
 			}
 
 			if (p == NULL) {
 				UDS_FREE(block);
+			} else if (!is_vmalloc_addr(p)) {
+				/* kvmalloc_node() used the slab after all. */
+				UDS_FREE(block);
+				add_kmalloc_block(ksize(p));
+#if defined(TEST_INTERNAL) || defined(VDO_INTERNAL)
+				add_tracking_block(p, ksize(p), what);
+#endif /* TEST_INTERNAL or VDO_INTERNAL */
 			} else {
 				block->ptr = p;
 				block->size = PAGE_ALIGN(size);
@@ -573,6 +628,26 @@ void uds_free_memory(void *ptr)
 	}
 }
 
+/*
+ * Get the memory node holding the first page of an allocation.
+ *
+ * @param ptr  The allocated memory
+ *
+ * @return The node of the memory, or NUMA_NO_NODE if there is no memory
+ */
+int uds_get_memory_node(const void *ptr)
+{
+	if (ptr == NULL) {
+		return NUMA_NO_NODE;
+	}
+
+	if (is_vmalloc_addr(ptr)) {
+		return page_to_nid(vmalloc_to_page(ptr));
+	}
+
+	return page_to_nid(virt_to_page(ptr));
+}
+
 /*
  * Reallocate dynamically allocated memory. There are no alignment guarantees
  * for the reallocated memory. If the new memory is larger than the old memory,
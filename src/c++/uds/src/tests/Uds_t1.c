@@ -140,6 +140,61 @@ static void basicsTest(void)
   UDS_FREE(request);
 }
 
+/**********************************************************************/
+static void batchTest(void)
+{
+  enum { BATCH_SIZE = 16 };
+  struct uds_request *requests;
+  UDS_ASSERT_SUCCESS(UDS_ALLOCATE(BATCH_SIZE, struct uds_request, __func__,
+                                  &requests));
+  struct uds_request *batch[BATCH_SIZE];
+  for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+    requests[i].callback = callback;
+    requests[i].session  = indexSession;
+    requests[i].type     = UDS_POST;
+    requests[i].found    = true;
+    createRandomBlockName(&requests[i].chunk_name);
+    createRandomMetadata(&requests[i].new_metadata);
+    batch[i] = &requests[i];
+  }
+
+  struct uds_index_stats before, after;
+  UDS_ASSERT_SUCCESS(uds_get_index_stats(indexSession, &before));
+
+  // An invalid request prevents the whole batch from starting.
+  requests[BATCH_SIZE - 1].callback = NULL;
+  UDS_ASSERT_ERROR(-EINVAL, uds_launch_requests(batch, BATCH_SIZE));
+  requests[BATCH_SIZE - 1].callback = callback;
+  UDS_ASSERT_SUCCESS(uds_launch_requests(batch, 0));
+
+  // Post new entries
+  UDS_ASSERT_SUCCESS(uds_launch_requests(batch, BATCH_SIZE));
+  UDS_ASSERT_SUCCESS(uds_flush_index_session(indexSession));
+  for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+    CU_ASSERT_FALSE(requests[i].found);
+  }
+
+  // Query them back
+  for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+    requests[i].type  = UDS_QUERY;
+    requests[i].found = false;
+  }
+  UDS_ASSERT_SUCCESS(uds_launch_requests(batch, BATCH_SIZE));
+  UDS_ASSERT_SUCCESS(uds_flush_index_session(indexSession));
+  for (unsigned int i = 0; i < BATCH_SIZE; i++) {
+    CU_ASSERT_TRUE(requests[i].found);
+    UDS_ASSERT_BLOCKDATA_EQUAL(&requests[i].old_metadata,
+                               &requests[i].new_metadata);
+  }
+
+  UDS_ASSERT_SUCCESS(uds_get_index_stats(indexSession, &after));
+  CU_ASSERT_EQUAL(after.posts_not_found - before.posts_not_found, BATCH_SIZE);
+  CU_ASSERT_EQUAL(after.queries_found - before.queries_found, BATCH_SIZE);
+  CU_ASSERT_EQUAL(after.requests - before.requests, 2 * BATCH_SIZE);
+
+  UDS_FREE(requests);
+}
+
 /**********************************************************************/
 static void initializerWithSession(struct uds_index_session *is)
 {
@@ -149,6 +204,7 @@ static void initializerWithSession(struct uds_index_session *is)
 /**********************************************************************/
 static const CU_TestInfo tests[] = {
   {"uds_request basics", basicsTest },
+  {"uds_request batches", batchTest },
   CU_TEST_INFO_NULL,
 };
 
@@ -69,28 +69,39 @@ enum index_session_flag {
 	IS_FLAG_DESTROYING = (1 << IS_FLAG_BIT_DESTROYING),
 };
 
-/* Release a reference to an index session. */
-static void release_index_session(struct uds_index_session *index_session)
+/* Release some references to an index session. */
+static void
+release_index_session_references(struct uds_index_session *index_session,
+				 unsigned int count)
 {
 	uds_lock_mutex(&index_session->request_mutex);
-	if (--index_session->request_count == 0) {
+	index_session->request_count -= count;
+	if (index_session->request_count == 0) {
 		uds_broadcast_cond(&index_session->request_cond);
 	}
 	uds_unlock_mutex(&index_session->request_mutex);
 }
 
+/* Release a reference to an index session. */
+static void release_index_session(struct uds_index_session *index_session)
+{
+	release_index_session_references(index_session, 1);
+}
+
 /*
- * Acquire a reference to the index session for an asynchronous index request.
- * The reference must eventually be released with a corresponding call to
- * release_index_session().
+ * Acquire references to the index session for some asynchronous index
+ * requests. Each reference must eventually be released with a corresponding
+ * call to release_index_session().
  **/
-static int get_index_session(struct uds_index_session *index_session)
+static int
+get_index_session_references(struct uds_index_session *index_session,
+			     unsigned int count)
 {
 	unsigned int state;
 	int result = UDS_SUCCESS;
 
 	uds_lock_mutex(&index_session->request_mutex);
-	index_session->request_count++;
+	index_session->request_count += count;
 	state = index_session->state;
 	uds_unlock_mutex(&index_session->request_mutex);
 
@@ -106,15 +117,22 @@ static int get_index_session(struct uds_index_session *index_session)
 		result = UDS_NO_INDEX;
 	}
 
-	release_index_session(index_session);
+	release_index_session_references(index_session, count);
 	return result;
 }
 
-int uds_launch_request(struct uds_request *request)
+/*
+ * Acquire a reference to the index session for an asynchronous index request.
+ * The reference must eventually be released with a corresponding call to
+ * release_index_session().
+ **/
+static int get_index_session(struct uds_index_session *index_session)
 {
-	size_t internal_size;
-	int result;
+	return get_index_session_references(index_session, 1);
+}
 
+static int __must_check validate_request(const struct uds_request *request)
+{
 	if (request->callback == NULL) {
 		uds_log_error("missing required callback");
 		return -EINVAL;
@@ -132,12 +150,30 @@ int uds_launch_request(struct uds_request *request)
 		return -EINVAL;
 	}
 
-	/* Reset all internal fields before processing. */
-	internal_size = sizeof(struct uds_request) -
+	return UDS_SUCCESS;
+}
+
+static void reset_request_internals(struct uds_request *request)
+{
+	size_t internal_size = sizeof(struct uds_request) -
 		offsetof(struct uds_request, zone_number);
+
+	/* Reset all internal fields before processing. */
 	// FIXME should be using struct_group for this instead
 	memset((char *) request + sizeof(*request) - internal_size,
 	       0, internal_size);
+}
+
+int uds_launch_request(struct uds_request *request)
+{
+	int result;
+
+	result = validate_request(request);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	reset_request_internals(request);
 
 	result = get_index_session(request->session);
 	if (result != UDS_SUCCESS) {
@@ -152,6 +188,48 @@ int uds_launch_request(struct uds_request *request)
 	return UDS_SUCCESS;
 }
 
+int uds_launch_requests(struct uds_request **requests, unsigned int count)
+{
+	struct uds_index_session *session;
+	unsigned int i;
+	int result;
+
+	if (count == 0) {
+		return UDS_SUCCESS;
+	}
+
+	session = requests[0]->session;
+	for (i = 0; i < count; i++) {
+		result = validate_request(requests[i]);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+
+		if (requests[i]->session != session) {
+			uds_log_error("batched requests must share an index session");
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		reset_request_internals(requests[i]);
+	}
+
+	result = get_index_session_references(session, count);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (i = 0; i < count; i++) {
+		requests[i]->found = false;
+		requests[i]->unbatched = false;
+		requests[i]->index = session->index;
+	}
+
+	enqueue_new_requests(session->index, requests, count);
+	return UDS_SUCCESS;
+}
+
 static void enter_callback_stage(struct uds_request *request)
 {
 	if (request->status != UDS_SUCCESS) {
@@ -1630,3 +1630,52 @@ void enqueue_request(struct uds_request *request, enum request_stage stage)
 
 	uds_request_queue_enqueue(queue, request);
 }
+
+/*
+ * Enqueue a batch of new requests, making a single hand-off to the triage
+ * queue or to each zone queue which receives any of them. The requests are
+ * linked through their next_request fields, preserving their order within
+ * each zone.
+ */
+void enqueue_new_requests(struct uds_index *index,
+			  struct uds_request **requests,
+			  unsigned int count)
+{
+	struct uds_request *heads[MAX_ZONES] = { NULL };
+	struct uds_request *tails[MAX_ZONES];
+	unsigned int zone;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		struct uds_request *request = requests[i];
+
+		if (index->triage_queue != NULL) {
+			zone = 0;
+		} else {
+			zone = get_volume_index_zone(index->volume_index,
+						     &request->chunk_name);
+			request->zone_number = zone;
+		}
+
+		request->next_request = NULL;
+		if (heads[zone] == NULL) {
+			heads[zone] = request;
+		} else {
+			tails[zone]->next_request = request;
+		}
+
+		tails[zone] = request;
+	}
+
+	if (index->triage_queue != NULL) {
+		uds_request_queue_enqueue_list(index->triage_queue, heads[0]);
+		return;
+	}
+
+	for (zone = 0; zone < index->zone_count; zone++) {
+		if (heads[zone] != NULL) {
+			uds_request_queue_enqueue_list(index->zone_queues[zone],
+						       heads[zone]);
+		}
+	}
+}
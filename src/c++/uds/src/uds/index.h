@@ -74,6 +74,10 @@ void get_index_stats(struct uds_index *index,
 
 void enqueue_request(struct uds_request *request, enum request_stage stage);
 
+void enqueue_new_requests(struct uds_index *index,
+			  struct uds_request **requests,
+			  unsigned int count);
+
 void wait_for_idle_index(struct uds_index *index);
 
 #endif /* INDEX_H */
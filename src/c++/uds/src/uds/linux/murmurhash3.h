@@ -14,6 +14,32 @@
 #include "compiler.h"
 #endif
 
+enum {
+	/* The number of keys murmurhash3_128_multiple() hashes in lockstep */
+	MURMURHASH3_LANES = 4,
+};
+
 void murmurhash3_128(const void *key, int len, uint32_t seed, void *out);
 
+/*
+ * Copy a key to dest while hashing it, producing the same hash as
+ * murmurhash3_128(), so that the key is only read once. Returns true if every
+ * byte of the key is zero.
+ */
+bool murmurhash3_128_copy(const void *key,
+			  void *dest,
+			  int len,
+			  uint32_t seed,
+			  void *out);
+
+/*
+ * Hash count keys of the same length, producing exactly the same results as
+ * calling murmurhash3_128() on each key in turn.
+ */
+void murmurhash3_128_multiple(const void *const keys[],
+			      unsigned int count,
+			      int len,
+			      uint32_t seed,
+			      void *const outs[]);
+
 #endif /* _MURMURHASH3_H_ */
@@ -23,8 +23,16 @@ int __must_check uds_allocate_memory(size_t size,
 				     const char *what,
 				     void *ptr);
 
+int __must_check uds_allocate_memory_on_node(size_t size,
+					     size_t align,
+					     int node,
+					     const char *what,
+					     void *ptr);
+
 void uds_free_memory(void *ptr);
 
+int uds_get_memory_node(const void *ptr);
+
 /* Free memory allocated with UDS_ALLOCATE(). */
 #define UDS_FREE(PTR) uds_free_memory(PTR)
 
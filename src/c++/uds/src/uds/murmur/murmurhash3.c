@@ -52,114 +52,104 @@ static __always_inline uint64_t fmix64(uint64_t k)
 	return k;
 }
 
-void murmurhash3_128(const void *key, const int len, const uint32_t seed,
-			  void *out)
+static __always_inline void mix_block(uint64_t *h1,
+				      uint64_t *h2,
+				      uint64_t k1,
+				      uint64_t k2)
 {
-	const uint8_t *data = (const uint8_t *)key;
-	const int nblocks = len / 16;
-
-	uint64_t h1 = seed;
-	uint64_t h2 = seed;
-
 	const uint64_t c1 = 0x87c37b91114253d5LLU;
 	const uint64_t c2 = 0x4cf5ad432745937fLLU;
 
-	/* body */
-
-	const uint64_t *blocks = (const uint64_t *)(data);
+	k1 *= c1;
+	k1 = ROTL64(k1, 31);
+	k1 *= c2;
+	*h1 ^= k1;
 
-	int i;
+	*h1 = ROTL64(*h1, 27);
+	*h1 += *h2;
+	*h1 = *h1 * 5 + 0x52dce729;
 
-	for (i = 0; i < nblocks; i++) {
-		uint64_t k1 = getblock64(blocks, i * 2 + 0);
-		uint64_t k2 = getblock64(blocks, i * 2 + 1);
+	k2 *= c2;
+	k2 = ROTL64(k2, 33);
+	k2 *= c1;
+	*h2 ^= k2;
 
-		k1 *= c1;
-		k1 = ROTL64(k1, 31);
-		k1 *= c2;
-		h1 ^= k1;
+	*h2 = ROTL64(*h2, 31);
+	*h2 += *h1;
+	*h2 = *h2 * 5 + 0x38495ab5;
+}
 
-		h1 = ROTL64(h1, 27);
-		h1 += h2;
-		h1 = h1 * 5 + 0x52dce729;
+/* Mix in the bytes after the last full block and produce the final hash. */
+static __always_inline void finish_hash(const uint8_t *tail,
+					const int len,
+					uint64_t h1,
+					uint64_t h2,
+					void *out)
+{
+	const uint64_t c1 = 0x87c37b91114253d5LLU;
+	const uint64_t c2 = 0x4cf5ad432745937fLLU;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
 
+	switch (len & 15) {
+	case 15:
+		k2 ^= ((uint64_t)tail[14]) << 48;
+		fallthrough;
+	case 14:
+		k2 ^= ((uint64_t)tail[13]) << 40;
+		fallthrough;
+	case 13:
+		k2 ^= ((uint64_t)tail[12]) << 32;
+		fallthrough;
+	case 12:
+		k2 ^= ((uint64_t)tail[11]) << 24;
+		fallthrough;
+	case 11:
+		k2 ^= ((uint64_t)tail[10]) << 16;
+		fallthrough;
+	case 10:
+		k2 ^= ((uint64_t)tail[9]) << 8;
+		fallthrough;
+	case 9:
+		k2 ^= ((uint64_t)tail[8]) << 0;
 		k2 *= c2;
 		k2 = ROTL64(k2, 33);
 		k2 *= c1;
 		h2 ^= k2;
+		fallthrough;
 
-		h2 = ROTL64(h2, 31);
-		h2 += h1;
-		h2 = h2 * 5 + 0x38495ab5;
-	}
-
-	/* tail */
+	case 8:
+		k1 ^= ((uint64_t)tail[7]) << 56;
+		fallthrough;
+	case 7:
+		k1 ^= ((uint64_t)tail[6]) << 48;
+		fallthrough;
+	case 6:
+		k1 ^= ((uint64_t)tail[5]) << 40;
+		fallthrough;
+	case 5:
+		k1 ^= ((uint64_t)tail[4]) << 32;
+		fallthrough;
+	case 4:
+		k1 ^= ((uint64_t)tail[3]) << 24;
+		fallthrough;
+	case 3:
+		k1 ^= ((uint64_t)tail[2]) << 16;
+		fallthrough;
+	case 2:
+		k1 ^= ((uint64_t)tail[1]) << 8;
+		fallthrough;
+	case 1:
+		k1 ^= ((uint64_t)tail[0]) << 0;
+		k1 *= c1;
+		k1 = ROTL64(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+		break;
+	default:
+		break;
+	};
 
-	{
-		const uint8_t *tail = (const uint8_t *)(data + nblocks * 16);
-
-		uint64_t k1 = 0;
-		uint64_t k2 = 0;
-
-		switch (len & 15) {
-		case 15:
-			k2 ^= ((uint64_t)tail[14]) << 48;
-			fallthrough;
-		case 14:
-			k2 ^= ((uint64_t)tail[13]) << 40;
-			fallthrough;
-		case 13:
-			k2 ^= ((uint64_t)tail[12]) << 32;
-			fallthrough;
-		case 12:
-			k2 ^= ((uint64_t)tail[11]) << 24;
-			fallthrough;
-		case 11:
-			k2 ^= ((uint64_t)tail[10]) << 16;
-			fallthrough;
-		case 10:
-			k2 ^= ((uint64_t)tail[9]) << 8;
-			fallthrough;
-		case 9:
-			k2 ^= ((uint64_t)tail[8]) << 0;
-			k2 *= c2;
-			k2 = ROTL64(k2, 33);
-			k2 *= c1;
-			h2 ^= k2;
-			fallthrough;
-
-		case 8:
-			k1 ^= ((uint64_t)tail[7]) << 56;
-			fallthrough;
-		case 7:
-			k1 ^= ((uint64_t)tail[6]) << 48;
-			fallthrough;
-		case 6:
-			k1 ^= ((uint64_t)tail[5]) << 40;
-			fallthrough;
-		case 5:
-			k1 ^= ((uint64_t)tail[4]) << 32;
-			fallthrough;
-		case 4:
-			k1 ^= ((uint64_t)tail[3]) << 24;
-			fallthrough;
-		case 3:
-			k1 ^= ((uint64_t)tail[2]) << 16;
-			fallthrough;
-		case 2:
-			k1 ^= ((uint64_t)tail[1]) << 8;
-			fallthrough;
-		case 1:
-			k1 ^= ((uint64_t)tail[0]) << 0;
-			k1 *= c1;
-			k1 = ROTL64(k1, 31);
-			k1 *= c2;
-			h1 ^= k1;
-			break;
-		default:
-			break;
-		};
-	}
 	/* finalization */
 
 	h1 ^= len;
@@ -178,8 +168,130 @@ void murmurhash3_128(const void *key, const int len, const uint32_t seed,
 	putblock64((uint64_t *)out, 1, h2);
 }
 
+void murmurhash3_128(const void *key, const int len, const uint32_t seed,
+			  void *out)
+{
+	const uint8_t *data = (const uint8_t *)key;
+	const int nblocks = len / 16;
+
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+
+	/* body */
+
+	const uint64_t *blocks = (const uint64_t *)(data);
+
+	int i;
+
+	for (i = 0; i < nblocks; i++) {
+		mix_block(&h1,
+			  &h2,
+			  getblock64(blocks, i * 2 + 0),
+			  getblock64(blocks, i * 2 + 1));
+	}
+
+	/* tail */
+
+	finish_hash(data + nblocks * 16, len, h1, h2, out);
+}
+
+bool murmurhash3_128_copy(const void *key,
+			  void *dest,
+			  const int len,
+			  const uint32_t seed,
+			  void *out)
+{
+	const uint8_t *data = (const uint8_t *)key;
+	const int nblocks = len / 16;
+	const uint64_t *blocks = (const uint64_t *)(data);
+	uint64_t *dest_blocks = (uint64_t *)dest;
+	uint64_t bits = 0;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+	int i;
+
+	for (i = 0; i < nblocks; i++) {
+		uint64_t w1 = blocks[i * 2 + 0];
+		uint64_t w2 = blocks[i * 2 + 1];
+
+		dest_blocks[i * 2 + 0] = w1;
+		dest_blocks[i * 2 + 1] = w2;
+		bits |= w1 | w2;
+		mix_block(&h1, &h2, getblock64(&w1, 0), getblock64(&w2, 0));
+	}
+
+	for (i = nblocks * 16; i < len; i++) {
+		((uint8_t *)dest)[i] = data[i];
+		bits |= data[i];
+	}
+
+	finish_hash(data + nblocks * 16, len, h1, h2, out);
+	return (bits == 0);
+}
+
+/*
+ * Hash MURMURHASH3_LANES keys of the same length at once. The block loops of
+ * the lanes are interleaved so that their independent multiply chains can
+ * overlap in the CPU pipeline (and be vectorized where the compiler has 64-bit
+ * vector multiplies available), while each lane performs exactly the same
+ * arithmetic as murmurhash3_128().
+ */
+static void murmurhash3_128_lanes(const void *const keys[],
+				  const int len,
+				  const uint32_t seed,
+				  void *const outs[])
+{
+	const uint64_t *blocks[MURMURHASH3_LANES];
+	uint64_t h1[MURMURHASH3_LANES];
+	uint64_t h2[MURMURHASH3_LANES];
+	const int nblocks = len / 16;
+	int i, lane;
+
+	for (lane = 0; lane < MURMURHASH3_LANES; lane++) {
+		blocks[lane] = (const uint64_t *)keys[lane];
+		h1[lane] = seed;
+		h2[lane] = seed;
+	}
+
+	for (i = 0; i < nblocks; i++) {
+		for (lane = 0; lane < MURMURHASH3_LANES; lane++) {
+			mix_block(&h1[lane],
+				  &h2[lane],
+				  getblock64(blocks[lane], i * 2 + 0),
+				  getblock64(blocks[lane], i * 2 + 1));
+		}
+	}
+
+	for (lane = 0; lane < MURMURHASH3_LANES; lane++) {
+		finish_hash((const uint8_t *)keys[lane] + nblocks * 16,
+			    len,
+			    h1[lane],
+			    h2[lane],
+			    outs[lane]);
+	}
+}
+
+void murmurhash3_128_multiple(const void *const keys[],
+			      unsigned int count,
+			      const int len,
+			      const uint32_t seed,
+			      void *const outs[])
+{
+	unsigned int i = 0;
+
+	for (; i + MURMURHASH3_LANES <= count; i += MURMURHASH3_LANES) {
+		murmurhash3_128_lanes(&keys[i], len, seed, &outs[i]);
+	}
+
+	for (; i < count; i++) {
+		murmurhash3_128(keys[i], len, seed, outs[i]);
+	}
+}
+
 #ifdef __KERNEL__
 EXPORT_SYMBOL(murmurhash3_128);
+EXPORT_SYMBOL(murmurhash3_128_multiple);
+EXPORT_SYMBOL(murmurhash3_128_copy);
 #ifndef UDS_MURMURHASH3
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("MurmurHash3");
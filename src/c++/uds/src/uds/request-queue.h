@@ -22,6 +22,9 @@ make_uds_request_queue(const char *queue_name,
 void uds_request_queue_enqueue(struct uds_request_queue *queue,
 			       struct uds_request *request);
 
+void uds_request_queue_enqueue_list(struct uds_request_queue *queue,
+				    struct uds_request *requests);
+
 void uds_request_queue_finish(struct uds_request_queue *queue);
 
 #endif /* REQUEST_QUEUE_H */
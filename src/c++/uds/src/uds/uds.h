@@ -536,6 +536,21 @@ int __must_check uds_get_index_stats(struct uds_index_session *session,
  * @return Either #UDS_SUCCESS or an error code
  **/
 int __must_check uds_launch_request(struct uds_request *request);
+
+/**
+ * Start a batch of deduplication requests. This is equivalent to calling
+ * #uds_launch_request on each request, but the session is only acquired once
+ * and each index zone queue receives the requests bound for it in a single
+ * hand-off. If any request is invalid, none of them are started.
+ *
+ * @param [in] requests  The operations, which must all use the same index
+ *                       session and be set up as for #uds_launch_request
+ * @param [in] count     The number of requests
+ *
+ * @return Either #UDS_SUCCESS or an error code
+ **/
+int __must_check uds_launch_requests(struct uds_request **requests,
+				     unsigned int count);
 /** @} */
 
 #endif /* UDS_H */
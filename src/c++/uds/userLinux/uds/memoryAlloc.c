@@ -70,6 +70,28 @@ int uds_allocate_memory(size_t size, size_t align, const char *what, void *ptr)
 	return UDS_SUCCESS;
 }
 
+/**
+ * Allocate storage based on memory size and alignment, preferring memory on a
+ * particular node. User space leaves placement to the system, so the node is
+ * ignored.
+ *
+ * @param size   The size of an object
+ * @param align  The required alignment
+ * @param node   The preferred memory node (unused)
+ * @param what   What is being allocated (for error logging)
+ * @param ptr    A pointer to hold the allocated memory
+ *
+ * @return UDS_SUCCESS or an error code
+ **/
+int uds_allocate_memory_on_node(size_t size,
+				size_t align,
+				int node __attribute__((unused)),
+				const char *what,
+				void *ptr)
+{
+	return uds_allocate_memory(size, align, what, ptr);
+}
+
 /*
  * Allocate storage based on memory size, failing immediately if the required
  * memory is not available. The memory will be zeroed.
@@ -93,6 +115,12 @@ void uds_free_memory(void *ptr)
 	free(ptr);
 }
 
+/**********************************************************************/
+int uds_get_memory_node(const void *ptr __attribute__((unused)))
+{
+	return -1;
+}
+
 /**
  * Reallocate dynamically allocated memory. There are no alignment guarantees
  * for the reallocated memory. If the new memory is larger than the old memory,
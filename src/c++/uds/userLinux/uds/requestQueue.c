@@ -307,6 +307,37 @@ void uds_request_queue_enqueue(struct uds_request_queue *queue,
 	}
 }
 
+/**********************************************************************/
+/*
+ * Enqueue requests linked through their next_request fields, waking the worker
+ * at most once for the whole list.
+ */
+void uds_request_queue_enqueue_list(struct uds_request_queue *queue,
+				    struct uds_request *requests)
+{
+	struct uds_request *request = requests;
+	bool unbatched = false;
+
+	while (request != NULL) {
+		struct uds_request *next = request->next_request;
+		struct funnel_queue *sub_queue = (request->requeued ?
+						  queue->retry_queue :
+						  queue->main_queue);
+
+		unbatched |= request->unbatched;
+		funnel_queue_put(sub_queue, &request->queue_link);
+		request = next;
+	}
+
+	/*
+	 * We must wake the worker thread when it is dormant. A read fence
+	 * isn't needed here since we know the queue operation acts as one.
+	 */
+	if (atomic_read(&queue->dormant) || unbatched) {
+		wake_up_worker(queue);
+	}
+}
+
 /**********************************************************************/
 void uds_request_queue_finish(struct uds_request_queue *queue)
 {
@@ -38,6 +38,8 @@ struct atomic_statistics {
 	struct atomic_bio_stats bios_acknowledged;
 	struct atomic_bio_stats bios_acknowledged_partial;
 	struct atomic_bio_stats bios_meta;
+	struct atomic_bio_stats bios_out_merged;
+	struct atomic_bio_stats bios_meta_merged;
 	struct atomic_bio_stats bios_meta_completed;
 	struct atomic_bio_stats bios_journal;
 	struct atomic_bio_stats bios_journal_completed;
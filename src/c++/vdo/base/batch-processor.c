@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright Red Hat
+ */
+
+#include "batch-processor.h"
+
+#include <linux/atomic.h>
+
+#include "funnel-queue.h"
+#include "memory-alloc.h"
+#include "permassert.h"
+
+#include "status-codes.h"
+
+/**
+ * DOC:
+ *
+ * A batch processor gathers completions which arrive from any thread and
+ * hands them, several at a time, to a callback running on a single vdo
+ * thread. This amortizes the cost of a work queue hand-off over many items
+ * and lets the callback work on items together (for instance, hashing several
+ * data blocks at once).
+ *
+ * Items are queued on a funnel queue through the work queue entry link of
+ * their completions, which is unused while they wait in the batch. Whenever an
+ * item is added, the batch's own completion is enqueued on its thread unless
+ * it is already scheduled or running. This mirrors the scheme the data_vio
+ * pool uses to batch data_vio releases.
+ */
+
+struct batch_processor {
+	/* The completion used to schedule processing */
+	struct vdo_completion completion;
+	/* The queue of items waiting to be processed */
+	struct funnel_queue *queue;
+	/* Whether the processor is scheduled or running */
+	atomic_t processing;
+	/* The priority at which to schedule processing */
+	enum vdo_completion_priority priority;
+	/* The function which processes the items */
+	batch_processor_callback *callback;
+	/* The closure for the callback */
+	void *closure;
+};
+
+static inline struct batch_processor *
+as_batch_processor(struct vdo_completion *completion)
+{
+	vdo_assert_completion_type(completion->type,
+				   VDO_BATCH_PROCESSOR_COMPLETION);
+	return container_of(completion, struct batch_processor, completion);
+}
+
+/**
+ * schedule_batch_processing() - Ensure that processing is scheduled.
+ * @batch: The batch processor which has items to process.
+ *
+ * If this call switches the state to processing, enqueue. Otherwise, some
+ * other thread has already done so.
+ */
+static void schedule_batch_processing(struct batch_processor *batch)
+{
+	/* Pairs with the barrier in process_batch_callback(). */
+	smp_mb__before_atomic();
+	if (atomic_cmpxchg(&batch->processing, false, true)) {
+		return;
+	}
+
+	batch->completion.requeue = true;
+	vdo_invoke_completion_callback_with_priority(&batch->completion,
+						     batch->priority);
+}
+
+/**
+ * process_batch_callback() - Run the batch callback and reschedule if items
+ *                            remain.
+ * @completion: The batch processor's completion.
+ */
+static void process_batch_callback(struct vdo_completion *completion)
+{
+	struct batch_processor *batch = as_batch_processor(completion);
+
+	batch->callback(batch, batch->closure);
+
+	atomic_set(&batch->processing, false);
+	/* Pairs with the barrier in schedule_batch_processing(). */
+	smp_mb();
+
+	if (!is_funnel_queue_empty(batch->queue)) {
+		schedule_batch_processing(batch);
+	}
+}
+
+/**
+ * make_batch_processor() - Make a batch processor.
+ * @vdo: The vdo to which the processor belongs.
+ * @thread_id: The thread on which the callback will run.
+ * @priority: The priority at which to run the callback.
+ * @callback: The function which processes batched items.
+ * @closure: The context for the callback.
+ * @batch_ptr: A pointer to hold the new batch processor.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int make_batch_processor(struct vdo *vdo,
+			 thread_id_t thread_id,
+			 enum vdo_completion_priority priority,
+			 batch_processor_callback *callback,
+			 void *closure,
+			 struct batch_processor **batch_ptr)
+{
+	struct batch_processor *batch;
+	int result;
+
+	result = UDS_ALLOCATE(1, struct batch_processor, __func__, &batch);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = make_funnel_queue(&batch->queue);
+	if (result != UDS_SUCCESS) {
+		UDS_FREE(batch);
+		return result;
+	}
+
+	vdo_initialize_completion(&batch->completion,
+				  vdo,
+				  VDO_BATCH_PROCESSOR_COMPLETION);
+	vdo_prepare_completion(&batch->completion,
+			       process_batch_callback,
+			       process_batch_callback,
+			       thread_id,
+			       NULL);
+	atomic_set(&batch->processing, false);
+	batch->priority = priority;
+	batch->callback = callback;
+	batch->closure = closure;
+	*batch_ptr = batch;
+	return VDO_SUCCESS;
+}
+
+/**
+ * free_batch_processor() - Free a batch processor.
+ * @batch: The batch processor to free (may be NULL).
+ *
+ * The processor must be idle and empty.
+ */
+void free_batch_processor(struct batch_processor *batch)
+{
+	if (batch == NULL) {
+		return;
+	}
+
+	ASSERT_LOG_ONLY(!atomic_read(&batch->processing),
+			"batch processor is idle when freed");
+	ASSERT_LOG_ONLY(is_funnel_queue_empty(batch->queue),
+			"batch processor is empty when freed");
+	free_funnel_queue(UDS_FORGET(batch->queue));
+	UDS_FREE(batch);
+}
+
+/**
+ * add_to_batch_processor() - Add an item to a batch processor.
+ * @batch: The batch processor.
+ * @item: The completion to add; it must not be on a work queue.
+ *
+ * May be called from any thread.
+ */
+void add_to_batch_processor(struct batch_processor *batch,
+			    struct vdo_completion *item)
+{
+	funnel_queue_put(batch->queue, &item->work_queue_entry_link);
+	schedule_batch_processing(batch);
+}
+
+/**
+ * next_batch_item() - Take the next item from a batch processor.
+ * @batch: The batch processor.
+ *
+ * Context: Must only be called from the batch callback.
+ *
+ * Return: The next completion in the batch, or NULL if there are none.
+ */
+struct vdo_completion *next_batch_item(struct batch_processor *batch)
+{
+	struct funnel_queue_entry *entry = funnel_queue_poll(batch->queue);
+
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	return container_of(entry, struct vdo_completion, work_queue_entry_link);
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright Red Hat
+ */
+
+#ifndef BATCH_PROCESSOR_H
+#define BATCH_PROCESSOR_H
+
+#include "completion.h"
+#include "kernel-types.h"
+#include "types.h"
+
+struct batch_processor;
+
+/**
+ * typedef batch_processor_callback - The function which processes the items
+ *                                    queued on a batch processor.
+ * @batch: The batch processor whose items are to be processed.
+ * @closure: The closure supplied when the batch processor was made.
+ *
+ * The callback should take items with next_batch_item() until it either runs
+ * out of items or has done as much work as it wishes to do in one go; any
+ * items left behind will cause the callback to be scheduled again.
+ */
+typedef void batch_processor_callback(struct batch_processor *batch,
+				      void *closure);
+
+int __must_check make_batch_processor(struct vdo *vdo,
+				      thread_id_t thread_id,
+				      enum vdo_completion_priority priority,
+				      batch_processor_callback *callback,
+				      void *closure,
+				      struct batch_processor **batch_ptr);
+
+void free_batch_processor(struct batch_processor *batch);
+
+void add_to_batch_processor(struct batch_processor *batch,
+			    struct vdo_completion *item);
+
+struct vdo_completion * __must_check
+next_batch_item(struct batch_processor *batch);
+
+#endif /* BATCH_PROCESSOR_H */
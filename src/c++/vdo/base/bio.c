@@ -5,12 +5,15 @@
 
 #include "bio.h"
 
+#include <linux/murmurhash3.h>
+
 #include "logger.h"
 #include "memory-alloc.h"
 #include "numeric.h"
 #include "permassert.h"
 
 #include "atomic-stats.h"
+#include "data-vio.h"
 #include "kernel-types.h"
 #include "vdo.h"
 #include "vio.h"
@@ -43,6 +46,92 @@ void vdo_bio_copy_data_in(struct bio *bio, char *data_ptr)
 #endif
 }
 
+/*
+ * Copy bio data to a buffer, returning whether the data is all zeros. This
+ * avoids a second pass over the buffer to check for zeros.
+ */
+bool vdo_bio_copy_data_in_and_check_zero(struct bio *bio, char *data_ptr)
+{
+	struct bio_vec biovec;
+	struct bvec_iter iter;
+	bool zero = true;
+
+// XXX workaround for LINUX_VERSION_CODE < KERNEL_VERSION(5,15,0)
+#ifdef __LINUX_BVEC_ITER_H
+	unsigned long flags;
+
+	bio_for_each_segment(biovec, bio, iter) {
+		void *from = bvec_kmap_irq(&biovec, &flags);
+
+		if (!copy_data_and_check_zero(data_ptr, from, biovec.bv_len)) {
+			zero = false;
+		}
+		data_ptr += biovec.bv_len;
+		bvec_kunmap_irq(from, &flags);
+	}
+#else
+
+	bio_for_each_segment(biovec, bio, iter) {
+		void *from = bvec_kmap_local(&biovec);
+
+		if (!copy_data_and_check_zero(data_ptr, from, biovec.bv_len)) {
+			zero = false;
+		}
+		data_ptr += biovec.bv_len;
+		kunmap_local(from);
+	}
+#endif
+
+	return zero;
+}
+
+/*
+ * Copy the data of a bio holding one full block to a buffer, computing its
+ * chunk name and checking it for zeros in the same pass. This can only be
+ * done if the block is in a single segment; if it is not, nothing is copied
+ * and false is returned.
+ */
+bool vdo_bio_copy_block_in_and_hash(struct bio *bio,
+				    char *data_ptr,
+				    uint32_t seed,
+				    struct uds_chunk_name *name,
+				    bool *zero_ptr)
+{
+	struct bio_vec biovec = bio_iovec(bio);
+	void *from;
+
+// XXX workaround for LINUX_VERSION_CODE < KERNEL_VERSION(5,15,0)
+#ifdef __LINUX_BVEC_ITER_H
+	unsigned long flags;
+
+	if (biovec.bv_len != VDO_BLOCK_SIZE) {
+		return false;
+	}
+
+	from = bvec_kmap_irq(&biovec, &flags);
+	*zero_ptr = murmurhash3_128_copy(from,
+					 data_ptr,
+					 VDO_BLOCK_SIZE,
+					 seed,
+					 name);
+	bvec_kunmap_irq(from, &flags);
+#else
+	if (biovec.bv_len != VDO_BLOCK_SIZE) {
+		return false;
+	}
+
+	from = bvec_kmap_local(&biovec);
+	*zero_ptr = murmurhash3_128_copy(from,
+					 data_ptr,
+					 VDO_BLOCK_SIZE,
+					 seed,
+					 name);
+	kunmap_local(from);
+#endif
+
+	return true;
+}
+
 /*
  * Copy a buffer into a bio's data
  */
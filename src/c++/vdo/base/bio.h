@@ -12,6 +12,12 @@
 #include "kernel-types.h"
 
 void vdo_bio_copy_data_in(struct bio *bio, char *data_ptr);
+bool vdo_bio_copy_data_in_and_check_zero(struct bio *bio, char *data_ptr);
+bool vdo_bio_copy_block_in_and_hash(struct bio *bio,
+				    char *data_ptr,
+				    uint32_t seed,
+				    struct uds_chunk_name *name,
+				    bool *zero_ptr);
 void vdo_bio_copy_data_out(struct bio *bio, char *data_ptr);
 
 static inline int vdo_get_bio_result(struct bio *bio)
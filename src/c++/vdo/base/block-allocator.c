@@ -11,6 +11,7 @@
 
 #include "admin-state.h"
 #include "action-manager.h"
+#include "block-discarder.h"
 #include "completion.h"
 #include "constants.h"
 #include "heap.h"
@@ -29,6 +30,16 @@
 #include "vio.h"
 #include "vio-pool.h"
 
+enum {
+	/* The number of blocks set aside at a time for an allocation stream */
+	ALLOCATION_STREAM_EXTENT = 16,
+	/* The shortest free run worth moving an allocation stream to */
+	MINIMUM_STREAM_RUN = 4,
+};
+
+/* This is a module parameter. */
+bool vdo_lazy_ref_count_loading;
+
 struct slab_journal_eraser {
 	struct vdo_completion *parent;
 	struct dm_kcopyd_client *client;
@@ -66,9 +77,11 @@ static unsigned int calculate_slab_priority(struct vdo_slab *slab)
 	 * unless there are very few free blocks that have been previously
 	 * written to.
 	 *
-	 * Since VDO doesn't discard blocks currently, reusing previously
-	 * written blocks makes VDO a better client of any underlying storage
-	 * that is thinly-provisioned (though discarding would be better).
+	 * Unless the block discarder is enabled, VDO doesn't discard freed
+	 * blocks, so reusing previously written blocks makes VDO a better
+	 * client of any underlying storage that is thinly-provisioned. Even
+	 * with discarding, reuse avoids provisioning storage which would only
+	 * be discarded again.
 	 *
 	 * For all other slabs, the priority is derived from the logarithm of
 	 * the number of free blocks. Slabs with the same order of magnitude of
@@ -196,6 +209,12 @@ static int allocate_components(struct block_allocator *allocator,
 		return result;
 	}
 
+	result = vdo_make_block_discarder(vdo, allocator,
+					  &allocator->discarder);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
 	result = make_priority_table(max_priority,
 				     &allocator->prioritized_slabs);
 	if (result != VDO_SUCCESS) {
@@ -278,6 +297,7 @@ void vdo_free_block_allocator(struct block_allocator *allocator)
 	}
 
 	vdo_free_slab_scrubber(UDS_FORGET(allocator->slab_scrubber));
+	vdo_free_block_discarder(UDS_FORGET(allocator->discarder));
 	free_vio_pool(UDS_FORGET(allocator->vio_pool));
 	free_priority_table(UDS_FORGET(allocator->prioritized_slabs));
 	UDS_FREE(allocator);
@@ -414,6 +434,153 @@ int vdo_allocate_block(struct block_allocator *allocator,
 	return allocate_slab_block(allocator->open_slab, block_number_ptr);
 }
 
+/*
+ * Find the stream, if any, whose extent covers a logical block or which the
+ * logical block would extend.
+ */
+static struct allocation_stream *
+find_allocation_stream(struct block_allocator *allocator,
+		       logical_block_number_t lbn)
+{
+	unsigned int i;
+
+	for (i = 0; i < VDO_ALLOCATION_STREAM_COUNT; i++) {
+		struct allocation_stream *stream = &allocator->streams[i];
+
+		if ((stream->length > 0) &&
+		    (lbn >= stream->lbn) &&
+		    (lbn <= stream->lbn + stream->length)) {
+			return stream;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Move a stream which has used up its extent on to the next one, which is
+ * the run of free blocks immediately following it if there is one.
+ */
+static bool extend_allocation_stream(struct ref_counts *ref_counts,
+				     struct allocation_stream *stream)
+{
+	physical_block_number_t pbn = stream->pbn + stream->length;
+	block_count_t length =
+		vdo_set_aside_free_run(ref_counts, pbn,
+				       ALLOCATION_STREAM_EXTENT);
+
+	if (length == 0) {
+		if (!vdo_find_free_run(ref_counts, MINIMUM_STREAM_RUN, &pbn)) {
+			return false;
+		}
+
+		length = vdo_set_aside_free_run(ref_counts, pbn,
+						ALLOCATION_STREAM_EXTENT);
+		stream->run_length = 0;
+	}
+
+	stream->lbn += stream->length;
+	stream->pbn = pbn;
+	stream->length = length;
+	return true;
+}
+
+/*
+ * Allocate the block of a stream's extent corresponding to a logical block,
+ * if it is still free.
+ */
+static bool allocate_from_stream(struct block_allocator *allocator,
+				 struct allocation_stream *stream,
+				 logical_block_number_t lbn,
+				 physical_block_number_t *block_number_ptr)
+{
+	struct vdo_slab *slab = allocator->open_slab;
+	struct block_allocator_statistics *stats = &allocator->statistics;
+	physical_block_number_t pbn;
+
+	if (slab == NULL) {
+		return false;
+	}
+
+	if ((lbn == stream->lbn + stream->length) &&
+	    !extend_allocation_stream(slab->reference_counts, stream)) {
+		return false;
+	}
+
+	pbn = stream->pbn + (lbn - stream->lbn);
+	if (!vdo_reserve_unreferenced_block(slab->reference_counts, pbn)) {
+		return false;
+	}
+
+	vdo_adjust_free_block_count(slab, false);
+	stream->run_length++;
+	if (stream->run_length == 2) {
+		WRITE_ONCE(stats->contiguous_runs_allocated,
+			   stats->contiguous_runs_allocated + 1);
+	}
+
+	if (stream->run_length > 1) {
+		WRITE_ONCE(stats->contiguous_blocks_allocated,
+			   stats->contiguous_blocks_allocated + 1);
+	}
+
+	*block_number_ptr = pbn;
+	return true;
+}
+
+/**
+ * vdo_allocate_adjacent_block() - Allocate a block for a logical block,
+ *                                 adjacent to the blocks allocated to its
+ *                                 logical neighbors if possible.
+ * @allocator: The allocator from which to allocate.
+ * @lbn: The logical block which will map to the allocated block.
+ * @block_number_ptr: A pointer to receive the allocated block number.
+ *
+ * Each allocator tracks a few streams of logically adjacent writes. A stream
+ * which continues past its first block sets aside a small extent of free
+ * blocks in the open slab, and the rest of the stream is allocated from that
+ * extent in logical order, even when the writes arrive out of order. An
+ * allocation which fits no stream starts a new one, replacing the oldest.
+ *
+ * As with vdo_allocate_block(), the allocated block will have a provisional
+ * reference.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int vdo_allocate_adjacent_block(struct block_allocator *allocator,
+				logical_block_number_t lbn,
+				physical_block_number_t *block_number_ptr)
+{
+	struct allocation_stream *stream =
+		find_allocation_stream(allocator, lbn);
+	int result;
+
+	if ((stream != NULL) &&
+	    allocate_from_stream(allocator, stream, lbn, block_number_ptr)) {
+		return VDO_SUCCESS;
+	}
+
+	result = vdo_allocate_block(allocator, block_number_ptr);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	if (stream == NULL) {
+		stream = &allocator->streams[allocator->next_stream];
+		allocator->next_stream =
+			((allocator->next_stream + 1) %
+			 VDO_ALLOCATION_STREAM_COUNT);
+	}
+
+	*stream = (struct allocation_stream) {
+		.lbn = lbn,
+		.pbn = *block_number_ptr,
+		.length = 1,
+		.run_length = 1,
+	};
+	return VDO_SUCCESS;
+}
+
 /*
  * Release an unused provisional reference.
  */
@@ -712,6 +879,15 @@ vdo_prepare_slabs_for_allocation(struct block_allocator *allocator)
 	vdo_get_summarized_slab_statuses(allocator->summary, slab_count,
 					 slab_statuses);
 
+	/*
+	 * In a lazy normal load, the reference counts of clean slabs are
+	 * loaded by the scrubber in the background once the vdo is running,
+	 * rather than all being loaded before it comes online.
+	 */
+	allocator->lazy_load =
+		((depot->load_type == VDO_SLAB_DEPOT_NORMAL_LOAD) &&
+		 READ_ONCE(vdo_lazy_ref_count_loading));
+
 	/* Sort the slabs by cleanliness, then by emptiness hint. */
 	initialize_heap(&heap,
 			compare_slab_statuses,
@@ -739,7 +915,8 @@ vdo_prepare_slabs_for_allocation(struct block_allocator *allocator)
 
 		vdo_mark_slab_unrecovered(slab);
 		high_priority = ((current_slab_status.is_clean &&
-				 (depot->load_type == VDO_SLAB_DEPOT_NORMAL_LOAD)) ||
+				  (depot->load_type == VDO_SLAB_DEPOT_NORMAL_LOAD) &&
+				  !allocator->lazy_load) ||
 				 vdo_slab_journal_requires_scrubbing(slab->journal));
 		vdo_register_slab_for_scrubbing(allocator->slab_scrubber,
 						slab,
@@ -809,6 +986,13 @@ static void do_drain_step(struct vdo_completion *completion)
 		vdo_stop_slab_scrubbing(allocator->slab_scrubber, completion);
 		return;
 
+	case VDO_DRAIN_ALLOCATOR_STEP_DISCARDER:
+		vdo_drain_block_discarder(
+			allocator->discarder,
+			vdo_get_admin_state_code(&allocator->state),
+			completion);
+		return;
+
 	case VDO_DRAIN_ALLOCATOR_STEP_SLABS:
 		apply_to_slabs(allocator, do_drain_step);
 		return;
@@ -882,6 +1066,10 @@ static void do_resume_step(struct vdo_completion *completion)
 		apply_to_slabs(allocator, do_resume_step);
 		return;
 
+	case VDO_DRAIN_ALLOCATOR_STEP_DISCARDER:
+		vdo_resume_block_discarder(allocator->discarder, completion);
+		return;
+
 	case VDO_DRAIN_ALLOCATOR_STEP_SCRUBBER:
 		vdo_resume_slab_scrubbing(allocator->slab_scrubber, completion);
 		return;
@@ -997,6 +1185,14 @@ vdo_get_block_allocator_statistics(const struct block_allocator *allocator)
 		.slab_count = allocator->slab_count,
 		.slabs_opened = READ_ONCE(stats->slabs_opened),
 		.slabs_reopened = READ_ONCE(stats->slabs_reopened),
+		.blocks_discarded = READ_ONCE(stats->blocks_discarded),
+		.discard_bios = READ_ONCE(stats->discard_bios),
+		.discard_blocks_skipped =
+			READ_ONCE(stats->discard_blocks_skipped),
+		.contiguous_runs_allocated =
+			READ_ONCE(stats->contiguous_runs_allocated),
+		.contiguous_blocks_allocated =
+			READ_ONCE(stats->contiguous_blocks_allocated),
 	};
 }
 
@@ -1029,7 +1225,10 @@ void vdo_dump_block_allocator(const struct block_allocator *allocator)
 	unsigned int pause_counter = 0;
 	struct slab_iterator iterator = get_slab_iterator(allocator);
 
-	uds_log_info("block_allocator zone %u", allocator->zone_number);
+	uds_log_info("block_allocator zone %u: %llu contiguous runs allocated",
+		     allocator->zone_number,
+		     (unsigned long long)
+		     READ_ONCE(allocator->statistics.contiguous_runs_allocated));
 	while (vdo_has_next_slab(&iterator)) {
 		vdo_dump_slab(vdo_next_slab(&iterator));
 
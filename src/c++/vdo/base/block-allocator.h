@@ -9,6 +9,7 @@
 #include <linux/dm-kcopyd.h>
 
 #include "admin-state.h"
+#include "block-discarder.h"
 #include "priority-table.h"
 #include "slab-scrubber.h"
 #include "slab-iterator.h"
@@ -23,11 +24,27 @@ enum {
 	 * of the VDO.
 	 */
 	VIO_POOL_SIZE = 128,
+	/*
+	 * The number of streams of logically adjacent writes each allocator
+	 * tracks at once.
+	 */
+	VDO_ALLOCATION_STREAM_COUNT = 8,
 };
 
+/*
+ * Whether a normal load defers loading slab reference counts to the
+ * background. This is a module parameter.
+ *
+ * Until a slab has been loaded, its blocks are counted as allocated, so the
+ * vdo reports itself as loading the way it reports recovery mode, and no new
+ * data is deduplicated against blocks in it.
+ */
+extern bool vdo_lazy_ref_count_loading;
+
 enum block_allocator_drain_step {
 	VDO_DRAIN_ALLOCATOR_START,
 	VDO_DRAIN_ALLOCATOR_STEP_SCRUBBER,
+	VDO_DRAIN_ALLOCATOR_STEP_DISCARDER,
 	VDO_DRAIN_ALLOCATOR_STEP_SLABS,
 	VDO_DRAIN_ALLOCATOR_STEP_SUMMARY,
 	VDO_DRAIN_ALLOCATOR_STEP_FINISHED,
@@ -46,6 +63,21 @@ struct slab_actor {
 	vdo_action *callback;
 };
 
+/*
+ * A stream of logically adjacent writes which is being allocated physically
+ * adjacent blocks from an extent set aside in the open slab.
+ */
+struct allocation_stream {
+	/* The logical block corresponding to the start of the extent */
+	logical_block_number_t lbn;
+	/* The first physical block of the extent */
+	physical_block_number_t pbn;
+	/* The number of blocks in the extent, or 0 if the stream is unused */
+	block_count_t length;
+	/* The number of blocks allocated to the current contiguous run */
+	block_count_t run_length;
+};
+
 struct block_allocator {
 	struct vdo_completion completion;
 	/* The slab depot for this allocator */
@@ -68,6 +100,8 @@ struct block_allocator {
 	unsigned int unopened_slab_priority;
 	/* The state of this allocator */
 	struct admin_state state;
+	/* Whether the last load left reference counts to load lazily */
+	bool lazy_load;
 	/* The actor for applying an action to all slabs */
 	struct slab_actor slab_actor;
 
@@ -77,6 +111,12 @@ struct block_allocator {
 	struct priority_table *prioritized_slabs;
 	/* The slab scrubber */
 	struct slab_scrubber *slab_scrubber;
+	/* The discarder of freed blocks */
+	struct block_discarder *discarder;
+	/* The streams of logically adjacent writes being allocated */
+	struct allocation_stream streams[VDO_ALLOCATION_STREAM_COUNT];
+	/* The stream to replace when a new stream starts */
+	unsigned int next_stream;
 	/* What phase of the close operation the allocator is to perform */
 	enum block_allocator_drain_step drain_step;
 
@@ -135,6 +175,11 @@ void vdo_adjust_free_block_count(struct vdo_slab *slab, bool increment);
 int __must_check vdo_allocate_block(struct block_allocator *allocator,
 				    physical_block_number_t *block_number_ptr);
 
+int __must_check
+vdo_allocate_adjacent_block(struct block_allocator *allocator,
+			    logical_block_number_t lbn,
+			    physical_block_number_t *block_number_ptr);
+
 void vdo_release_block_reference(struct block_allocator *allocator,
 				 physical_block_number_t pbn,
 				 const char *why);
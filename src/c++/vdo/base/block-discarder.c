@@ -0,0 +1,637 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright Red Hat
+ */
+
+#include "block-discarder.h"
+
+#include <linux/bio.h>
+#include <linux/jiffies.h>
+
+#include "logger.h"
+#include "memory-alloc.h"
+#include "permassert.h"
+
+#include "block-allocator.h"
+#include "int-map.h"
+#include "io-submitter.h"
+#include "physical-zone.h"
+#include "ref-counts.h"
+#include "slab.h"
+#include "slab-depot.h"
+#include "vdo.h"
+#include "vio.h"
+
+enum {
+	/* The largest number of blocks to discard with one bio */
+	MAXIMUM_DISCARD_BLOCKS = 512,
+	/* The number of runs which may be waiting to be discarded */
+	MAXIMUM_WAITING_RUNS = 1024,
+};
+
+enum throttle_timer_state {
+	DISCARD_THROTTLE_TIMER_IDLE,
+	DISCARD_THROTTLE_TIMER_RUNNING,
+	DISCARD_THROTTLE_TIMER_FIRED,
+};
+
+/* This is a module parameter. */
+unsigned int vdo_discard_blocks_per_second;
+
+/*
+ * For adjusting allocator statistic fields which are only mutated on the
+ * physical zone thread.
+ */
+#define ADD_ONCE(value, delta) WRITE_ONCE(value, (value) + (delta))
+
+static void launch_discard(struct block_discarder *discarder);
+static void check_for_drain_complete(struct block_discarder *discarder);
+
+static inline bool
+change_timer_state(struct block_discarder *discarder, int old, int new)
+{
+	return (atomic_cmpxchg(&discarder->timer_state, old, new) == old);
+}
+
+/**
+ * throttle_expired() - Hand the expiration of the throttle timer off to the
+ *                      physical zone thread.
+ * @t: The throttle timer.
+ */
+static void throttle_expired(struct timer_list *t)
+{
+	struct block_discarder *discarder =
+		from_timer(discarder, t, throttle_timer);
+
+	if (change_timer_state(discarder,
+			       DISCARD_THROTTLE_TIMER_RUNNING,
+			       DISCARD_THROTTLE_TIMER_FIRED)) {
+		vdo_invoke_completion_callback(&discarder->completion);
+	}
+}
+
+/**
+ * resume_discarding() - Resume discarding once the throttle has expired.
+ * @completion: The discarder's completion.
+ *
+ * This callback is registered in vdo_make_block_discarder().
+ */
+static void resume_discarding(struct vdo_completion *completion)
+{
+	struct block_discarder *discarder =
+		container_of(completion, struct block_discarder, completion);
+
+	atomic_set(&discarder->timer_state, DISCARD_THROTTLE_TIMER_IDLE);
+	if (!vdo_is_state_normal(&discarder->state)) {
+		check_for_drain_complete(discarder);
+		return;
+	}
+
+	launch_discard(discarder);
+}
+
+/**
+ * vdo_make_block_discarder() - Create a block discarder.
+ * @vdo: The vdo.
+ * @allocator: The allocator whose freed blocks are to be discarded.
+ * @discarder_ptr: A pointer to hold the new discarder.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int vdo_make_block_discarder(struct vdo *vdo,
+			     struct block_allocator *allocator,
+			     struct block_discarder **discarder_ptr)
+{
+	struct block_discarder *discarder;
+	int result = UDS_ALLOCATE(1, struct block_discarder, __func__,
+				  &discarder);
+
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	timer_setup(&discarder->throttle_timer, throttle_expired, 0);
+	result = UDS_ALLOCATE(MAXIMUM_WAITING_RUNS, struct discard_run,
+			      __func__, &discarder->runs);
+	if (result != VDO_SUCCESS) {
+		vdo_free_block_discarder(discarder);
+		return result;
+	}
+
+	result = create_metadata_vio(vdo,
+				     VIO_TYPE_BLOCK_ALLOCATOR,
+				     VIO_PRIORITY_LOW,
+				     discarder,
+				     NULL,
+				     &discarder->vio);
+	if (result != VDO_SUCCESS) {
+		vdo_free_block_discarder(discarder);
+		return result;
+	}
+
+	discarder->allocator = allocator;
+	vdo_initialize_pbn_lock(&discarder->lock, VIO_WRITE_LOCK);
+	discarder->lock.holder_count = 1;
+	discarder->budget_jiffies = jiffies;
+	vdo_initialize_completion(&discarder->completion, vdo,
+				  VDO_BLOCK_DISCARDER_COMPLETION);
+	vdo_set_completion_callback(&discarder->completion,
+				    resume_discarding,
+				    allocator->thread_id);
+	vdo_set_admin_state_code(&discarder->state,
+				 VDO_ADMIN_STATE_NORMAL_OPERATION);
+	*discarder_ptr = discarder;
+	return VDO_SUCCESS;
+}
+
+/**
+ * vdo_free_block_discarder() - Free a block discarder.
+ * @discarder: The discarder to free.
+ */
+void vdo_free_block_discarder(struct block_discarder *discarder)
+{
+	if (discarder == NULL) {
+		return;
+	}
+
+	/* Make sure a pending throttle timer can not fire after the free. */
+	del_timer_sync(&discarder->throttle_timer);
+	free_vio(UDS_FORGET(discarder->vio));
+	UDS_FREE(UDS_FORGET(discarder->runs));
+	UDS_FREE(discarder);
+}
+
+/**
+ * vdo_set_discard_blocks_per_second() - Set the rate at which each physical
+ *                                       zone may discard freed blocks.
+ * @value: The new rate, or 0 to stop discarding.
+ */
+void vdo_set_discard_blocks_per_second(unsigned int value)
+{
+	WRITE_ONCE(vdo_discard_blocks_per_second, value);
+}
+
+/**
+ * vdo_enable_discards() - Allow a depot's discarders to discard if the
+ *                         discard rate is set.
+ * @depot: The depot.
+ *
+ * Discarding is only allowed once the super block records that it may have
+ * happened, so this must be called before the super block is saved while
+ * the vdo is loading or resuming. A discard rate set while the vdo is running
+ * takes effect at the next load or resume unless discarding was already
+ * allowed.
+ *
+ * Return: true if discarding was not allowed before.
+ */
+bool vdo_enable_discards(struct slab_depot *depot)
+{
+	if (depot->discards_enabled ||
+	    (READ_ONCE(vdo_discard_blocks_per_second) == 0)) {
+		return false;
+	}
+
+	WRITE_ONCE(depot->discards_enabled, true);
+	return true;
+}
+
+/**
+ * may_discard() - Check whether a discarder may discard blocks.
+ * @discarder: The discarder.
+ *
+ * Return: The rate at which blocks may be discarded, or 0 if they may not.
+ */
+static unsigned int may_discard(struct block_discarder *discarder)
+{
+	if (!READ_ONCE(discarder->allocator->depot->discards_enabled)) {
+		return 0;
+	}
+
+	return READ_ONCE(vdo_discard_blocks_per_second);
+}
+
+/**
+ * get_pbn_operations() - Get the map of PBN locks of a discarder's zone.
+ * @discarder: The discarder.
+ *
+ * The physical zones are made after the slab depot, so the map can not be
+ * found when the discarder is made.
+ */
+static struct int_map *get_pbn_operations(struct block_discarder *discarder)
+{
+	struct vdo *vdo = discarder->completion.vdo;
+
+	return vdo->physical_zones->zones[discarder->allocator->zone_number]
+		.pbn_operations;
+}
+
+static inline struct discard_run *
+get_waiting_run(struct block_discarder *discarder, unsigned int index)
+{
+	return &discarder->runs[(discarder->first_run + index)
+				% MAXIMUM_WAITING_RUNS];
+}
+
+static void skip_blocks(struct block_discarder *discarder,
+			block_count_t count)
+{
+	ADD_ONCE(discarder->allocator->statistics.discard_blocks_skipped,
+		 count);
+}
+
+/**
+ * consume_waiting_blocks() - Remove blocks from the front of the oldest
+ *                            waiting run.
+ * @discarder: The discarder.
+ * @count: The number of blocks to remove.
+ */
+static void consume_waiting_blocks(struct block_discarder *discarder,
+				   block_count_t count)
+{
+	struct discard_run *run = get_waiting_run(discarder, 0);
+
+	run->pbn += count;
+	run->length -= count;
+	if (run->length > 0) {
+		return;
+	}
+
+	discarder->first_run = ((discarder->first_run + 1)
+				% MAXIMUM_WAITING_RUNS);
+	discarder->run_count--;
+}
+
+/**
+ * drop_waiting_runs() - Abandon every run which is waiting to be discarded.
+ * @discarder: The discarder.
+ */
+static void drop_waiting_runs(struct block_discarder *discarder)
+{
+	while (discarder->run_count > 0) {
+		struct discard_run *run = get_waiting_run(discarder, 0);
+
+		skip_blocks(discarder, run->length);
+		consume_waiting_blocks(discarder, run->length);
+	}
+}
+
+/**
+ * start_throttle_timer() - Start the throttle timer if it is not already
+ *                          running.
+ * @discarder: The discarder.
+ * @delay: The number of milliseconds to wait.
+ */
+static void start_throttle_timer(struct block_discarder *discarder,
+				 unsigned int delay)
+{
+	if (!change_timer_state(discarder,
+				DISCARD_THROTTLE_TIMER_IDLE,
+				DISCARD_THROTTLE_TIMER_RUNNING)) {
+		return;
+	}
+
+	mod_timer(&discarder->throttle_timer,
+		  jiffies + max(msecs_to_jiffies(delay), 1UL));
+}
+
+/**
+ * has_budget() - Check whether a number of blocks may be discarded now.
+ * @discarder: The discarder.
+ * @rate: The number of blocks which may be discarded per second.
+ * @needed: The number of blocks to discard.
+ *
+ * The budget accumulates at the configured rate, up to a second's worth or a
+ * full bio's worth, whichever is larger, so that slow rates still discard
+ * runs in large bios. If the budget is too small, the throttle timer is
+ * started to try again once it will have grown enough.
+ *
+ * Return: true if the blocks may be discarded.
+ */
+static bool has_budget(struct block_discarder *discarder,
+		       unsigned int rate,
+		       block_count_t needed)
+{
+	block_count_t burst = max((block_count_t) rate,
+				  (block_count_t) MAXIMUM_DISCARD_BLOCKS);
+	unsigned long now = jiffies;
+	unsigned long elapsed =
+		min(now - discarder->budget_jiffies,
+		    msecs_to_jiffies(MAXIMUM_DISCARD_BLOCKS * 1000));
+	block_count_t earned =
+		((uint64_t) jiffies_to_msecs(elapsed) * rate) / 1000;
+
+	if (earned > 0) {
+		discarder->budget = min(discarder->budget + earned, burst);
+		discarder->budget_jiffies = now;
+	}
+
+	if (discarder->budget >= needed) {
+		return true;
+	}
+
+	start_throttle_timer(discarder,
+			     DIV_ROUND_UP((needed - discarder->budget) * 1000,
+					  rate));
+	return false;
+}
+
+/**
+ * reserve_blocks() - Reserve the blocks at the front of the oldest waiting
+ *                    run for discarding.
+ * @discarder: The discarder.
+ * @limit: The maximum number of blocks to reserve.
+ *
+ * Each block must still be free and unlocked. A reserved block holds a
+ * provisional reference so that it can not be allocated, and the discarder's
+ * write lock so that no write will deduplicate against it.
+ *
+ * Return: The number of blocks reserved.
+ */
+static block_count_t reserve_blocks(struct block_discarder *discarder,
+				    block_count_t limit)
+{
+	struct block_allocator *allocator = discarder->allocator;
+	struct int_map *pbn_operations = get_pbn_operations(discarder);
+	physical_block_number_t start = get_waiting_run(discarder, 0)->pbn;
+	struct vdo_slab *slab = vdo_get_slab(allocator->depot, start);
+	block_count_t count;
+
+	if (slab == NULL) {
+		return 0;
+	}
+
+	for (count = 0; count < limit; count++) {
+		physical_block_number_t pbn = start + count;
+
+		if ((int_map_get(pbn_operations, pbn) != NULL) ||
+		    !vdo_reserve_unreferenced_block(slab->reference_counts,
+						    pbn)) {
+			break;
+		}
+
+		vdo_adjust_free_block_count(slab, false);
+		if (int_map_put(pbn_operations, pbn, &discarder->lock, false,
+				NULL) != VDO_SUCCESS) {
+			vdo_release_block_reference(allocator, pbn,
+						    "discarding");
+			break;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * release_blocks() - Release the blocks of the run which was discarded.
+ * @discarder: The discarder.
+ */
+static void release_blocks(struct block_discarder *discarder)
+{
+	struct int_map *pbn_operations = get_pbn_operations(discarder);
+	physical_block_number_t pbn = discarder->discarding.pbn;
+	physical_block_number_t end = pbn + discarder->discarding.length;
+
+	for (; pbn < end; pbn++) {
+		int_map_remove(pbn_operations, pbn);
+		vdo_release_block_reference(discarder->allocator, pbn,
+					    "discarded");
+	}
+
+	discarder->discarding.length = 0;
+}
+
+/**
+ * check_for_drain_complete() - Check whether a discarder has finished
+ *                              draining.
+ * @discarder: The discarder to check.
+ */
+static void check_for_drain_complete(struct block_discarder *discarder)
+{
+	if (!vdo_is_state_draining(&discarder->state) ||
+	    (discarder->discarding.length > 0)) {
+		return;
+	}
+
+	/*
+	 * If the timer has fired, resume_discarding() will check again once
+	 * it has run.
+	 */
+	if ((atomic_read(&discarder->timer_state) ==
+	     DISCARD_THROTTLE_TIMER_IDLE) ||
+	    change_timer_state(discarder,
+			       DISCARD_THROTTLE_TIMER_RUNNING,
+			       DISCARD_THROTTLE_TIMER_IDLE)) {
+		del_timer_sync(&discarder->throttle_timer);
+		vdo_finish_draining(&discarder->state);
+	}
+}
+
+/**
+ * finish_discard() - Release the blocks of a completed discard and start the
+ *                    next one.
+ * @completion: The discarder's vio completion.
+ */
+static void finish_discard(struct vdo_completion *completion)
+{
+	struct block_discarder *discarder = completion->parent;
+	struct block_allocator_statistics *stats =
+		&discarder->allocator->statistics;
+
+	ADD_ONCE(stats->blocks_discarded, discarder->discarding.length);
+	ADD_ONCE(stats->discard_bios, 1);
+	release_blocks(discarder);
+	if (!vdo_is_state_normal(&discarder->state)) {
+		check_for_drain_complete(discarder);
+		return;
+	}
+
+	launch_discard(discarder);
+}
+
+/**
+ * handle_discard_error() - Stop discarding when the storage refuses a
+ *                          discard.
+ * @completion: The discarder's vio completion.
+ *
+ * The most likely cause is storage which does not support discards, so no
+ * more will be attempted in this zone until the vdo is restarted.
+ */
+static void handle_discard_error(struct vdo_completion *completion)
+{
+	struct block_discarder *discarder = completion->parent;
+
+	uds_log_warning_strerror(completion->result,
+				 "discard failed in physical zone %u; no more blocks will be discarded",
+				 discarder->allocator->zone_number);
+	discarder->unsupported = true;
+	skip_blocks(discarder, discarder->discarding.length);
+	release_blocks(discarder);
+	drop_waiting_runs(discarder);
+	check_for_drain_complete(discarder);
+}
+
+static void discard_endio(struct bio *bio)
+{
+	struct vio *vio = bio->bi_private;
+	struct block_discarder *discarder = vio->completion.parent;
+
+	continue_vio_after_io(vio,
+			      finish_discard,
+			      discarder->allocator->thread_id);
+}
+
+/**
+ * launch_discard() - Discard the oldest waiting run if nothing is being
+ *                    discarded and the rate limit allows.
+ * @discarder: The discarder.
+ *
+ * Blocks at the front of the run which have been reallocated, or which can't
+ * be reserved, are skipped. At most MAXIMUM_DISCARD_BLOCKS are discarded at
+ * once; the rest of the run waits for the next discard.
+ */
+static void launch_discard(struct block_discarder *discarder)
+{
+	unsigned int rate = may_discard(discarder);
+
+	if (rate == 0) {
+		drop_waiting_runs(discarder);
+		return;
+	}
+
+	while ((discarder->run_count > 0) &&
+	       (discarder->discarding.length == 0)) {
+		block_count_t limit =
+			min(get_waiting_run(discarder, 0)->length,
+			    (block_count_t) MAXIMUM_DISCARD_BLOCKS);
+		block_count_t count;
+
+		if (!has_budget(discarder, rate, limit)) {
+			return;
+		}
+
+		count = reserve_blocks(discarder, limit);
+		if (count == 0) {
+			skip_blocks(discarder, 1);
+			consume_waiting_blocks(discarder, 1);
+			continue;
+		}
+
+		discarder->budget -= count;
+		discarder->discarding = *get_waiting_run(discarder, 0);
+		discarder->discarding.length = count;
+		consume_waiting_blocks(discarder, count);
+		vdo_submit_discard(discarder->vio,
+				   discarder->discarding.pbn,
+				   count,
+				   discard_endio,
+				   handle_discard_error);
+	}
+}
+
+/**
+ * vdo_note_freed_block() - Note that a block has become free so that it may
+ *                          be discarded.
+ * @discarder: The discarder of the zone which owns the block.
+ * @pbn: The block which has been freed.
+ *
+ * This must only be called for a decrement which has been made in the slab
+ * journal. Such a decrement has already been committed to the recovery
+ * journal, so the block can never be referenced again by replaying the
+ * journals after a crash.
+ *
+ * The block is added to the newest waiting run if it extends that run.
+ * Otherwise it starts a new run, unless too many runs are waiting already.
+ */
+void vdo_note_freed_block(struct block_discarder *discarder,
+			  physical_block_number_t pbn)
+{
+	struct discard_run *run;
+
+	if ((may_discard(discarder) == 0) ||
+	    discarder->unsupported ||
+	    !vdo_is_state_normal(&discarder->state)) {
+		return;
+	}
+
+	if (discarder->run_count > 0) {
+		run = get_waiting_run(discarder, discarder->run_count - 1);
+		if (pbn == run->pbn + run->length) {
+			run->length++;
+			launch_discard(discarder);
+			return;
+		}
+
+		if (pbn + 1 == run->pbn) {
+			run->pbn--;
+			run->length++;
+			launch_discard(discarder);
+			return;
+		}
+	}
+
+	if (discarder->run_count == MAXIMUM_WAITING_RUNS) {
+		skip_blocks(discarder, 1);
+		return;
+	}
+
+	run = get_waiting_run(discarder, discarder->run_count++);
+	*run = (struct discard_run) {
+		.pbn = pbn,
+		.length = 1,
+	};
+	launch_discard(discarder);
+}
+
+/**
+ * initiate_drain() - Abandon waiting runs and wait for any discard in
+ *                    progress.
+ *
+ * Implements vdo_admin_initiator.
+ */
+static void initiate_drain(struct admin_state *state)
+{
+	struct block_discarder *discarder =
+		container_of(state, struct block_discarder, state);
+
+	drop_waiting_runs(discarder);
+	check_for_drain_complete(discarder);
+}
+
+/**
+ * vdo_drain_block_discarder() - Drain a block discarder.
+ * @discarder: The discarder to drain.
+ * @operation: The type of drain to perform.
+ * @parent: The completion to notify when the discarder has drained.
+ */
+void vdo_drain_block_discarder(struct block_discarder *discarder,
+			       const struct admin_state_code *operation,
+			       struct vdo_completion *parent)
+{
+	vdo_start_draining(&discarder->state, operation, parent,
+			   initiate_drain);
+}
+
+/**
+ * vdo_resume_block_discarder() - Resume a block discarder.
+ * @discarder: The discarder to resume.
+ * @parent: The completion to notify when the discarder has resumed.
+ */
+void vdo_resume_block_discarder(struct block_discarder *discarder,
+				struct vdo_completion *parent)
+{
+	vdo_finish_completion(parent,
+			      vdo_resume_if_quiescent(&discarder->state));
+}
+
+/**
+ * vdo_is_block_discarder_idle() - Check whether a discarder has no blocks
+ *                                 waiting or being discarded.
+ * @discarder: The discarder to check.
+ *
+ * Return: true if the discarder is idle.
+ */
+bool vdo_is_block_discarder_idle(const struct block_discarder *discarder)
+{
+	return ((discarder->run_count == 0) &&
+		(discarder->discarding.length == 0));
+}
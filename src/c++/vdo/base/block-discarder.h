@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright Red Hat
+ */
+
+#ifndef BLOCK_DISCARDER_H
+#define BLOCK_DISCARDER_H
+
+#include <linux/atomic.h>
+#include <linux/timer.h>
+
+#include "admin-state.h"
+#include "completion.h"
+#include "pbn-lock.h"
+#include "types.h"
+
+/*
+ * A block discarder passes the blocks freed in a physical zone down to the
+ * underlying storage as discards, so that thin provisioned storage can
+ * reclaim them and SSDs need not preserve their contents. Freed blocks are
+ * noted as they are freed, coalesced into runs, and discarded in large bios,
+ * one at a time and no faster than vdo_discard_blocks_per_second allows.
+ *
+ * Discards are advisory. Any block which can not be discarded promptly is
+ * simply left alone, and the discarder's state is not preserved across a
+ * suspend.
+ */
+
+/* A run of consecutive freed blocks */
+struct discard_run {
+	/* The first block of the run */
+	physical_block_number_t pbn;
+	/* The number of blocks in the run */
+	block_count_t length;
+};
+
+struct block_discarder {
+	/* The completion for the throttle timer */
+	struct vdo_completion completion;
+	/* The allocator whose freed blocks are being discarded */
+	struct block_allocator *allocator;
+	/* The administrative state of the discarder */
+	struct admin_state state;
+	/* The vio for discarding runs */
+	struct vio *vio;
+	/* The write lock held on each block being discarded */
+	struct pbn_lock lock;
+	/* A ring of runs waiting to be discarded */
+	struct discard_run *runs;
+	/* The index of the oldest waiting run */
+	unsigned int first_run;
+	/* The number of waiting runs */
+	unsigned int run_count;
+	/* The run being discarded, if any */
+	struct discard_run discarding;
+	/* Whether the storage has refused a discard */
+	bool unsupported;
+	/* The number of blocks which may be discarded before throttling */
+	block_count_t budget;
+	/* The time at which the budget was last replenished */
+	unsigned long budget_jiffies;
+	/* The timer which restarts discarding once the budget allows */
+	struct timer_list throttle_timer;
+	/* Whether the throttle timer is idle, running, or has fired */
+	atomic_t timer_state;
+};
+
+/* This is a module parameter; 0 disables discarding. */
+extern unsigned int vdo_discard_blocks_per_second;
+
+void vdo_set_discard_blocks_per_second(unsigned int value);
+
+bool vdo_enable_discards(struct slab_depot *depot);
+
+int __must_check vdo_make_block_discarder(struct vdo *vdo,
+					  struct block_allocator *allocator,
+					  struct block_discarder **discarder_ptr);
+
+void vdo_free_block_discarder(struct block_discarder *discarder);
+
+void vdo_note_freed_block(struct block_discarder *discarder,
+			  physical_block_number_t pbn);
+
+void vdo_drain_block_discarder(struct block_discarder *discarder,
+			       const struct admin_state_code *operation,
+			       struct vdo_completion *parent);
+
+void vdo_resume_block_discarder(struct block_discarder *discarder,
+				struct vdo_completion *parent);
+
+bool __must_check
+vdo_is_block_discarder_idle(const struct block_discarder *discarder);
+
+#endif /* BLOCK_DISCARDER_H */
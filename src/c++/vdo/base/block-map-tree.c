@@ -596,25 +596,31 @@ void vdo_drain_zone_trees(struct block_map_tree_zone *zone)
 /*
  * Release a lock on a page which was being loaded or allocated.
  */
-static void release_page_lock(struct data_vio *data_vio, char *what)
+static void release_tree_page_lock(struct block_map_tree_zone *zone,
+				   struct tree_lock *lock,
+				   char *what)
 {
-	struct block_map_tree_zone *zone;
 	struct tree_lock *lock_holder;
 
-	struct tree_lock *lock = &data_vio->tree_lock;
-
 	ASSERT_LOG_ONLY(lock->locked,
 			"release of unlocked block map page %s for key %llu in tree %u",
 			what, (unsigned long long) lock->key,
 			lock->root_index);
 
-	zone = get_block_map_tree_zone(data_vio);
 	lock_holder = int_map_remove(zone->loading_pages, lock->key);
 	ASSERT_LOG_ONLY((lock_holder == lock),
 			"block map page %s mismatch for key %llu in tree %u",
 			what, (unsigned long long) lock->key,
 			lock->root_index);
 	lock->locked = false;
+	notify_all_waiters(&lock->other_waiters, NULL, NULL);
+}
+
+static void release_page_lock(struct data_vio *data_vio, char *what)
+{
+	release_tree_page_lock(get_block_map_tree_zone(data_vio),
+			       &data_vio->tree_lock,
+			       what);
 }
 
 static void finish_lookup(struct data_vio *data_vio, int result)
@@ -740,28 +746,42 @@ static void continue_load_for_waiter(struct waiter *waiter, void *context)
 	continue_with_loaded_page(data_vio, (struct block_map_page *) context);
 }
 
-static void finish_block_map_page_load(struct vdo_completion *completion)
+/*
+ * Copy a page which has been read for the next level down in a tree lock into
+ * the forest, and move the lock down to that level.
+ */
+static struct block_map_page *
+install_loaded_page(struct block_map_tree_zone *zone,
+		    struct tree_lock *tree_lock,
+		    char *buffer)
 {
 	physical_block_number_t pbn;
 	struct tree_page *tree_page;
 	struct block_map_page *page;
-	nonce_t nonce;
-
-	struct vio_pool_entry *entry = completion->parent;
-	struct data_vio *data_vio = entry->parent;
-	struct block_map_tree_zone *zone =
-		(struct block_map_tree_zone *) entry->context;
-	struct tree_lock *tree_lock = &data_vio->tree_lock;
+	nonce_t nonce = zone->map_zone->block_map->nonce;
 
 	tree_lock->height--;
 	pbn = tree_lock->tree_slots[tree_lock->height].block_map_slot.pbn;
 	tree_page = get_tree_page(zone, tree_lock);
 	page = (struct block_map_page *) tree_page->page_buffer;
-	nonce = zone->map_zone->block_map->nonce;
-
-	if (!vdo_copy_valid_page(entry->buffer, nonce, pbn, page)) {
+	if (!vdo_copy_valid_page(buffer, nonce, pbn, page)) {
 		vdo_format_block_map_page(page, nonce, pbn, false);
 	}
+
+	return page;
+}
+
+static void finish_block_map_page_load(struct vdo_completion *completion)
+{
+	struct block_map_page *page;
+
+	struct vio_pool_entry *entry = completion->parent;
+	struct data_vio *data_vio = entry->parent;
+	struct block_map_tree_zone *zone =
+		(struct block_map_tree_zone *) entry->context;
+	struct tree_lock *tree_lock = &data_vio->tree_lock;
+
+	page = install_loaded_page(zone, tree_lock, entry->buffer);
 	return_vio_to_pool(zone->vio_pool, entry);
 
 	/* Release our claim to the load and wake any waiters */
@@ -811,16 +831,16 @@ static void load_page(struct waiter *waiter, void *context)
 }
 
 /*
- * If the page is already locked, queue up to wait for the lock to be released.
- * If the lock is acquired, @data_vio->tree_lock.locked will be true.
+ * Attempt to lock the page one level below a tree lock's height. If another
+ * tree lock already holds it, that lock is returned and the lock is not
+ * acquired.
  */
-static int attempt_page_lock(struct block_map_tree_zone *zone,
-			     struct data_vio *data_vio)
+static int lock_tree_page(struct block_map_tree_zone *zone,
+			  struct tree_lock *lock,
+			  struct tree_lock **lock_holder_ptr)
 {
 	int result;
-	struct tree_lock *lock_holder;
 
-	struct tree_lock *lock = &data_vio->tree_lock;
 	height_t height = lock->height;
 	struct block_map_tree_slot tree_slot = lock->tree_slots[height];
 	union page_key key;
@@ -834,15 +854,31 @@ static int attempt_page_lock(struct block_map_tree_zone *zone,
 	lock->key = key.key;
 
 	result = int_map_put(zone->loading_pages, lock->key, lock, false,
-				 (void **) &lock_holder);
+				 (void **) lock_holder_ptr);
 	if (result != VDO_SUCCESS) {
 		return result;
 	}
 
-	if (lock_holder == NULL) {
+	if (*lock_holder_ptr == NULL) {
 		/* We got the lock */
-		data_vio->tree_lock.locked = true;
-		return VDO_SUCCESS;
+		lock->locked = true;
+	}
+
+	return VDO_SUCCESS;
+}
+
+/*
+ * If the page is already locked, queue up to wait for the lock to be released.
+ * If the lock is acquired, @data_vio->tree_lock.locked will be true.
+ */
+static int attempt_page_lock(struct block_map_tree_zone *zone,
+			     struct data_vio *data_vio)
+{
+	struct tree_lock *lock_holder;
+	int result = lock_tree_page(zone, &data_vio->tree_lock, &lock_holder);
+
+	if ((result != VDO_SUCCESS) || (lock_holder == NULL)) {
+		return result;
 	}
 
 	/* Someone else is loading or allocating the page we need */
@@ -1176,9 +1212,59 @@ void vdo_lookup_block_map_pbn(struct data_vio *data_vio)
 }
 
 /*
- * Find the PBN of a leaf block map page. This method may only be used after
- * all allocated tree pages have been loaded, otherwise, it may give the wrong
- * answer (0).
+ * Lock the page one level below a tree lock's height so that it can be
+ * loaded by something other than a data_vio. If another lookup is already
+ * loading or allocating the page, the lock is not acquired and the waiter
+ * will be notified, with no context, once that lookup releases it.
+ */
+int vdo_try_lock_tree_page(struct block_map_tree_zone *zone,
+			   struct tree_lock *lock,
+			   struct waiter *waiter)
+{
+	struct tree_lock *lock_holder;
+	int result = lock_tree_page(zone, lock, &lock_holder);
+
+	if ((result != VDO_SUCCESS) || (lock_holder == NULL)) {
+		return result;
+	}
+
+	return enqueue_waiter(&lock_holder->other_waiters, waiter);
+}
+
+/*
+ * Install a page loaded under a lock from vdo_try_lock_tree_page(), release
+ * the lock, and continue any lookups which were waiting for the page.
+ */
+void vdo_finish_tree_page_load(struct block_map_tree_zone *zone,
+			       struct tree_lock *lock,
+			       char *buffer)
+{
+	struct block_map_page *page = install_loaded_page(zone, lock, buffer);
+
+	release_tree_page_lock(zone, lock, "load");
+	notify_all_waiters(&lock->waiters, continue_load_for_waiter, page);
+}
+
+/*
+ * Give up a load under a lock from vdo_try_lock_tree_page(), failing any
+ * lookups which were waiting for the page.
+ */
+void vdo_abort_tree_page_load(struct block_map_tree_zone *zone,
+			      struct tree_lock *lock,
+			      int result)
+{
+	enter_zone_read_only_mode(zone, result);
+	release_tree_page_lock(zone, lock, "load");
+	notify_all_waiters(&lock->waiters, abort_lookup_for_waiter, &result);
+}
+
+/*
+ * Find the PBN of a leaf block map page. If the tree page which holds the
+ * entry for the leaf has not been loaded, the answer is 0 even though the
+ * leaf may exist, so offline callers must load all the allocated tree pages
+ * first. While the VDO is running, this may only be called from the thread of
+ * the zone which owns the leaf's tree, and a 0 must be treated as unknown
+ * rather than unmapped.
  */
 physical_block_number_t vdo_find_block_map_page_pbn(struct block_map *map,
 						    page_number_t page_number)
@@ -87,6 +87,18 @@ void vdo_lookup_block_map_pbn(struct data_vio *data_vio);
 physical_block_number_t vdo_find_block_map_page_pbn(struct block_map *map,
 						    page_number_t page_number);
 
+int __must_check vdo_try_lock_tree_page(struct block_map_tree_zone *zone,
+					struct tree_lock *lock,
+					struct waiter *waiter);
+
+void vdo_finish_tree_page_load(struct block_map_tree_zone *zone,
+			       struct tree_lock *lock,
+			       char *buffer);
+
+void vdo_abort_tree_page_load(struct block_map_tree_zone *zone,
+			      struct tree_lock *lock,
+			      int result);
+
 void vdo_write_tree_page(struct tree_page *page, struct block_map_tree_zone *zone);
 
 #ifdef INTERNAL
@@ -19,7 +19,9 @@
 #include "forest.h"
 #include "num-utils.h"
 #include "recovery-journal.h"
+#include "slab-depot.h"
 #include "status-codes.h"
+#include "sync-completion.h"
 #include "types.h"
 #include "vdo.h"
 #include "vdo-page-cache.h"
@@ -39,8 +41,25 @@
  * cache pressure. In the next oldest era, each time a new journal block is
  * written 1/@maximum_age of the pages in this era are issued for write. In all
  * older eras, pages are issued for write immediately.
+ *
+ * If the vdo_block_map_dirty_target module parameter is set, each zone also
+ * writes its oldest dirty pages early, once more than that percentage of its
+ * cache is dirty or once the oldest era is within a quarter of expiring, and
+ * saves the dirty neighbors of each page it writes so that the io submitter
+ * can merge their writes. This keeps a burst of updates from being written
+ * out all at once when its era expires.
  */
 
+enum {
+	/* The number of forward steps after which access is sequential */
+	SEQUENTIAL_STEPS = 2,
+	/* Arbitrary maximum number of pages to prefetch */
+	MAXIMUM_PREFETCH_PAGES = 256,
+};
+
+/* This is a module parameter. */
+unsigned int vdo_block_map_prefetch_pages;
+
 struct block_map_page_context {
 	/*
 	 * The earliest recovery journal block containing uncommitted updates
@@ -107,6 +126,7 @@ static bool handle_page_write(void *raw_page,
 /*
  * Initialize the per-zone portions of the block map.
  *
+ * @cache_policy: The replacement policy for the zone's page cache
  * @maximum_age: The number of journal blocks before a dirtied page is
  *		 considered old and must be written out
  */
@@ -117,6 +137,7 @@ initialize_block_map_zone(struct block_map *map,
 			  struct vdo *vdo,
 			  struct read_only_notifier *read_only_notifier,
 			  page_count_t cache_size,
+			  enum vdo_page_cache_policy cache_policy,
 			  block_count_t maximum_age)
 {
 	int result;
@@ -138,6 +159,7 @@ initialize_block_map_zone(struct block_map *map,
 
 	return vdo_make_page_cache(vdo,
 				   cache_size / map->zone_count,
+				   cache_policy,
 				   validate_page_on_read,
 				   handle_page_write,
 				   sizeof(struct block_map_page_context),
@@ -238,6 +260,7 @@ int vdo_decode_block_map(struct block_map_state_2_0 state,
 			 struct recovery_journal *journal,
 			 nonce_t nonce,
 			 page_count_t cache_size,
+			 enum vdo_page_cache_policy cache_policy,
 			 block_count_t maximum_age,
 			 struct block_map **map_ptr)
 {
@@ -285,6 +308,7 @@ int vdo_decode_block_map(struct block_map_state_2_0 state,
 						   vdo,
 						   read_only_notifier,
 						   cache_size,
+						   cache_policy,
 						   maximum_age);
 		if (result != VDO_SUCCESS) {
 			vdo_free_block_map(map);
@@ -406,6 +430,7 @@ void vdo_advance_block_map_era(struct block_map *map,
 void vdo_block_map_check_for_drain_complete(struct block_map_zone *zone)
 {
 	if (vdo_is_state_draining(&zone->state) &&
+	    (zone->warmup == NULL) &&
 	    !vdo_is_tree_zone_active(&zone->tree_zone) &&
 	    !vdo_is_page_cache_active(zone->page_cache)) {
 		vdo_finish_draining_with_result(&zone->state,
@@ -522,6 +547,184 @@ void vdo_abandon_block_map_growth(struct block_map *map)
 	vdo_abandon_forest(map);
 }
 
+/*
+ * The state of a resize of one zone's page cache.
+ */
+struct cache_resize {
+	struct block_map_zone *zone;
+	/* The new number of pages for the zone */
+	page_count_t page_count;
+	/* The number of pages the zone had before this resize */
+	page_count_t old_count;
+	/* The number of pages which need new slots */
+	page_count_t shortfall;
+	/* The new slots */
+	struct page_cache_segment segment;
+};
+
+/*
+ * Resize a zone's page cache within the slots it has. This callback is
+ * registered in resize_zone_cache().
+ */
+static void resize_page_cache(struct vdo_completion *completion)
+{
+	struct cache_resize *resize = completion->parent;
+	struct block_map_zone *zone = resize->zone;
+
+	if (!vdo_is_state_normal(&zone->state)) {
+		vdo_finish_completion(completion, VDO_INVALID_ADMIN_STATE);
+		return;
+	}
+
+	resize->old_count = zone->page_cache->page_count;
+	resize->shortfall = vdo_resize_page_cache(zone->page_cache,
+						  resize->page_count);
+	vdo_complete_completion(completion);
+}
+
+/*
+ * Add the new slots to a zone's page cache. This callback is registered in
+ * resize_zone_cache().
+ */
+static void add_page_cache_segment(struct vdo_completion *completion)
+{
+	struct cache_resize *resize = completion->parent;
+	struct vdo_page_cache *cache = resize->zone->page_cache;
+
+	vdo_finish_completion(completion,
+			      vdo_add_page_cache_segment(cache,
+							 &resize->segment));
+}
+
+/*
+ * Resize the page cache of a zone. Any new slots are allocated on the calling
+ * thread so that the zone thread does not wait for them. Once the zone's
+ * size has been changed, the resize records its old size, even if its new
+ * slots could not then be added.
+ */
+static int __must_check
+resize_zone_cache(struct block_map_zone *zone,
+		  page_count_t page_count,
+		  struct cache_resize *resize)
+{
+	struct vdo *vdo = zone->page_cache->vdo;
+	int result;
+
+	*resize = (struct cache_resize) {
+		.zone = zone,
+		.page_count = page_count,
+	};
+	result = vdo_perform_synchronous_action(vdo,
+						resize_page_cache,
+						zone->thread_id,
+						resize);
+	if ((result != VDO_SUCCESS) || (resize->shortfall == 0)) {
+		return result;
+	}
+
+	result = vdo_make_page_cache_segment(zone->page_cache,
+					     resize->shortfall,
+					     &resize->segment);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	result = vdo_perform_synchronous_action(vdo,
+						add_page_cache_segment,
+						zone->thread_id,
+						resize);
+	if (result != VDO_SUCCESS) {
+		vdo_free_page_cache_segment(&resize->segment);
+	}
+
+	return result;
+}
+
+/*
+ * Return the zones which were resized before a failure to their old sizes.
+ * A zone which failed to resize is restored too, since it may have changed
+ * size before failing to get new slots.
+ */
+static void restore_zone_caches(struct block_map *map,
+				struct cache_resize *resizes,
+				zone_count_t failed_zone)
+{
+	zone_count_t zone;
+
+	for (zone = 0; zone <= failed_zone; zone++) {
+		struct cache_resize restore;
+		int result;
+
+		if (resizes[zone].old_count == 0) {
+			/* The zone failed before it changed. */
+			continue;
+		}
+
+		result = resize_zone_cache(&map->zones[zone],
+					   resizes[zone].old_count,
+					   &restore);
+		if (result != VDO_SUCCESS) {
+			uds_log_error_strerror(result,
+					       "failed to restore block map cache of zone %u to %u pages",
+					       zone,
+					       resizes[zone].old_count);
+		}
+	}
+}
+
+/**
+ * vdo_resize_block_map_cache() - Change the size of the block map cache while
+ *                                the vdo is running.
+ * @map: The block map.
+ * @cache_size: The new total number of pages for all logical zones.
+ *
+ * Each zone's share of the cache is resized in turn. A zone which shrinks
+ * evicts the pages beyond its new size as they become idle. If any zone can
+ * not be resized, the zones already resized are returned to their old sizes.
+ * The new size lasts until the vdo is next loaded, which uses the size in the
+ * table.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int vdo_resize_block_map_cache(struct block_map *map, page_count_t cache_size)
+{
+	struct cache_resize *resizes;
+	zone_count_t zone;
+	int result;
+
+	if (cache_size < (2 * MAXIMUM_VDO_USER_VIOS * map->zone_count)) {
+		uds_log_error("block map cache of %u pages is too small for %u logical zones",
+			      cache_size,
+			      map->zone_count);
+		return VDO_OUT_OF_RANGE;
+	}
+
+	result = UDS_ALLOCATE(map->zone_count,
+			      struct cache_resize,
+			      __func__,
+			      &resizes);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	for (zone = 0; zone < map->zone_count; zone++) {
+		result = resize_zone_cache(&map->zones[zone],
+					   cache_size / map->zone_count,
+					   &resizes[zone]);
+		if (result != VDO_SUCCESS) {
+			restore_zone_caches(map, resizes, zone);
+			UDS_FREE(resizes);
+			return uds_log_error_strerror(result,
+						      "failed to resize block map cache of zone %u",
+						      zone);
+		}
+	}
+
+	UDS_FREE(resizes);
+	uds_log_info("block map cache resized to %u pages", cache_size);
+	return VDO_SUCCESS;
+}
+
 /*
  * Release the page completion and then continue the requester.
  */
@@ -539,6 +742,81 @@ static void handle_page_error(struct vdo_completion *completion)
 	finish_processing_page(completion, completion->result);
 }
 
+void vdo_set_block_map_prefetch_pages(unsigned int value)
+{
+	if (value > MAXIMUM_PREFETCH_PAGES) {
+		value = MAXIMUM_PREFETCH_PAGES;
+	}
+
+	WRITE_ONCE(vdo_block_map_prefetch_pages, value);
+}
+
+/*
+ * Prefetch the leaf pages which belong to a zone and follow a given page.
+ * Pages whose parent tree page has not been loaded yet are skipped, since
+ * their locations are not known without reading the tree from storage.
+ */
+static void prefetch_pages(struct block_map_zone *zone,
+			   page_number_t page_number,
+			   page_count_t count)
+{
+	struct block_map *map = zone->block_map;
+	struct slab_depot *depot = zone->page_cache->vdo->depot;
+	page_count_t leaf_pages =
+		vdo_compute_block_map_page_count(map->entry_count);
+	page_number_t next;
+
+	for (next = page_number + 1; (count > 0) && (next < leaf_pages);
+	     next++) {
+		physical_block_number_t pbn;
+
+		if (((next % map->root_count) % map->zone_count) !=
+		    zone->zone_number) {
+			continue;
+		}
+
+		count--;
+		pbn = vdo_find_block_map_page_pbn(map, next);
+		if ((pbn != VDO_ZERO_BLOCK) &&
+		    vdo_is_physical_data_block(depot, pbn)) {
+			vdo_prefetch_page(zone->page_cache, pbn);
+		}
+	}
+}
+
+/*
+ * Watch for a sequential stream of block map accesses, and prefetch the pages
+ * ahead of it. Consecutive leaf pages are in different trees, and usually in
+ * different zones, so each zone looks for its own pages being fetched in
+ * increasing order; no two of them are more than a root count apart.
+ */
+static void detect_sequential_access(struct block_map_zone *zone,
+				     page_number_t page_number)
+{
+	page_count_t count = READ_ONCE(vdo_block_map_prefetch_pages);
+	page_number_t last_page = zone->last_page;
+
+	if ((count == 0) || (page_number == last_page)) {
+		return;
+	}
+
+	zone->last_page = page_number;
+	if ((page_number < last_page) ||
+	    ((page_number - last_page) > zone->block_map->root_count)) {
+		zone->forward_steps = 0;
+		return;
+	}
+
+	if (zone->forward_steps < SEQUENTIAL_STEPS) {
+		zone->forward_steps++;
+		return;
+	}
+
+	/* Don't let prefetched pages crowd out the rest of the cache. */
+	prefetch_pages(zone, page_number,
+		       min(count, zone->page_cache->page_count / 4));
+}
+
 /*
  * Fetch the mapping page for a block map update, and call the
  * provided handler when fetched.
@@ -548,6 +826,7 @@ fetch_mapping_page(struct data_vio *data_vio, bool modifiable,
 		   vdo_action *action)
 {
 	struct block_map_zone *zone = data_vio->logical.zone->block_map_zone;
+	page_number_t page_number = data_vio->tree_lock.tree_slots[0].page_index;
 
 	if (vdo_is_state_draining(&zone->state)) {
 		finish_data_vio(data_vio, VDO_SHUTTING_DOWN);
@@ -562,6 +841,7 @@ fetch_mapping_page(struct data_vio *data_vio, bool modifiable,
 				 action,
 				 handle_page_error);
 	vdo_get_page(&data_vio->page_completion.completion);
+	detect_sequential_access(zone, page_number);
 }
 
 /*
@@ -783,7 +1063,51 @@ struct block_map_statistics vdo_get_block_map_statistics(struct block_map *map)
 		totals.pages_loaded += stats.pages_loaded;
 		totals.pages_saved += stats.pages_saved;
 		totals.flush_count += stats.flush_count;
+		totals.cold_hits += stats.cold_hits;
+		totals.hot_hits += stats.hot_hits;
+		totals.ghost_hits += stats.ghost_hits;
+		totals.pages_prefetched += stats.pages_prefetched;
+		totals.prefetch_hits += stats.prefetch_hits;
+		totals.prefetch_wasted += stats.prefetch_wasted;
+		totals.warmup_pages_scanned += stats.warmup_pages_scanned;
+		totals.warmup_tree_pages_loaded +=
+			stats.warmup_tree_pages_loaded;
+		totals.warmup_leaf_pages_fetched +=
+			stats.warmup_leaf_pages_fetched;
+		totals.pages_written_early += stats.pages_written_early;
+		totals.pages_coalesced += stats.pages_coalesced;
+		totals.max_pages_per_journal_block =
+			max(totals.max_pages_per_journal_block,
+			    stats.max_pages_per_journal_block);
+		totals.writeback_milliseconds += stats.writeback_milliseconds;
+		totals.max_writeback_milliseconds =
+			max(totals.max_writeback_milliseconds,
+			    stats.max_writeback_milliseconds);
 	}
 
 	return totals;
 }
+
+/**
+ * vdo_dump_block_map() - Dump the memory placement of the block map caches
+ *                        to the log for debugging.
+ * @map: The block map to dump.
+ */
+void vdo_dump_block_map(const struct block_map *map)
+{
+	zone_count_t zone;
+
+	if (map == NULL) {
+		return;
+	}
+
+	for (zone = 0; zone < map->zone_count; zone++) {
+		const struct vdo_page_cache *cache = map->zones[zone].page_cache;
+
+		uds_log_info("block map zone %u: %u cache pages, node %d, %u pages off node",
+			     zone,
+			     READ_ONCE(cache->page_count),
+			     cache->node,
+			     READ_ONCE(cache->remote_count));
+	}
+}
@@ -49,6 +49,12 @@ struct block_map_zone {
 	struct vdo_page_cache *page_cache;
 	struct block_map_tree_zone tree_zone;
 	struct admin_state state;
+	/* The last leaf page fetched, for detecting sequential access */
+	page_number_t last_page;
+	/* The number of consecutive forward steps which reached last_page */
+	unsigned int forward_steps;
+	/* The warmup of this zone's trees, if one is running */
+	struct block_map_warmup *warmup;
 };
 
 struct block_map {
@@ -78,6 +84,15 @@ struct block_map {
 	struct block_map_zone zones[];
 };
 
+/*
+ * The number of leaf pages each logical zone prefetches ahead of a
+ * sequential stream of block map accesses, or 0 to disable prefetching. This
+ * is a module parameter.
+ */
+extern unsigned int vdo_block_map_prefetch_pages;
+
+void vdo_set_block_map_prefetch_pages(unsigned int value);
+
 int __must_check
 vdo_decode_block_map(struct block_map_state_2_0 state,
 		     block_count_t logical_blocks,
@@ -87,6 +102,7 @@ vdo_decode_block_map(struct block_map_state_2_0 state,
 		     struct recovery_journal *journal,
 		     nonce_t nonce,
 		     page_count_t cache_size,
+		     enum vdo_page_cache_policy cache_policy,
 		     block_count_t maximum_age,
 		     struct block_map **map_ptr);
 
@@ -104,6 +120,9 @@ void vdo_grow_block_map(struct block_map *map, struct vdo_completion *parent);
 
 void vdo_abandon_block_map_growth(struct block_map *map);
 
+int __must_check
+vdo_resize_block_map_cache(struct block_map *map, page_count_t cache_size);
+
 void vdo_free_block_map(struct block_map *map);
 
 struct block_map_state_2_0 __must_check
@@ -136,4 +155,6 @@ void vdo_put_mapped_block(struct data_vio *data_vio);
 struct block_map_statistics __must_check
 vdo_get_block_map_statistics(struct block_map *map);
 
+void vdo_dump_block_map(const struct block_map *map);
+
 #endif /* BLOCK_MAP_H */
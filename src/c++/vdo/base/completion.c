@@ -30,15 +30,20 @@ static const char *VDO_COMPLETION_TYPE_NAMES[] = {
 	 */
 	"VDO_ACTION_COMPLETION",
 	"VDO_ADMIN_COMPLETION",
+	"VDO_BATCH_PROCESSOR_COMPLETION",
 	"VDO_BLOCK_ALLOCATOR_COMPLETION",
+	"VDO_BLOCK_DISCARDER_COMPLETION",
 	"VDO_BLOCK_MAP_RECOVERY_COMPLETION",
+	"VDO_BLOCK_MAP_WARMUP_COMPLETION",
 	"VDO_DATA_VIO_POOL_COMPLETION",
 	"VDO_FLUSH_COMPLETION",
 	"VDO_FLUSH_NOTIFICATION_COMPLETION",
 	"VDO_GENERATION_FLUSHED_COMPLETION",
 	"VDO_HASH_ZONE_COMPLETION",
 	"VDO_HASH_ZONES_COMPLETION",
+	"VDO_INDEX_SUBMISSION_COMPLETION",
 	"VDO_LOCK_COUNTER_COMPLETION",
+	"VDO_PACKER_DEADLINE_COMPLETION",
 	"VDO_PAGE_COMPLETION",
 	"VDO_PARTITION_COPY_COMPLETION",
 	"VDO_READ_ONLY_MODE_COMPLETION",
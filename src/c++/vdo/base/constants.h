@@ -32,6 +32,12 @@ enum {
 	 **/
 	VDO_BLOCK_MAP_TREE_HEIGHT = 5,
 
+	/** The default LZ4 acceleration factor used when compressing */
+	DEFAULT_VDO_COMPRESSION_ACCELERATION = 1,
+
+	/** The largest LZ4 acceleration factor which makes any difference */
+	VDO_COMPRESSION_ACCELERATION_LIMIT = 65537,
+
 	/** The default number of bio submission queues. */
 	DEFAULT_VDO_BIO_SUBMIT_QUEUE_COUNT = 4,
 
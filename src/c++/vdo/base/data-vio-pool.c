@@ -25,6 +25,7 @@
 #include "dump.h"
 #endif /* __KERNEL__ */
 #include "vdo.h"
+#include "vio-write.h"
 #include "types.h"
 
 /**
@@ -268,8 +269,7 @@ static void launch_bio(struct vdo *vdo,
 		 * Copy the bio data to a char array so that we can continue to
 		 * use the data after we acknowledge the bio.
 		 */
-		vdo_bio_copy_data_in(bio, data_vio->data_block);
-		data_vio->is_zero_block = is_zero_block(data_vio->data_block);
+		ingest_write_data(data_vio, bio);
 	}
 
 	if (data_vio->user_bio->bi_opf & REQ_FUA) {
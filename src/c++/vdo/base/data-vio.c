@@ -30,6 +30,22 @@
 #include "vio-read.h"
 #include "vio-write.h"
 
+enum {
+	/* The number of bytes in each sample taken by the compression check */
+	COMPRESSION_SAMPLE_SIZE = 64,
+	/* The distance between the starts of consecutive samples */
+	COMPRESSION_SAMPLE_STRIDE = 512,
+	COMPRESSION_SAMPLE_COUNT = VDO_BLOCK_SIZE / COMPRESSION_SAMPLE_STRIDE,
+	/*
+	 * Random data would show about 221 distinct byte values in 512 sampled
+	 * bytes; compressible data shows far fewer.
+	 */
+	COMPRESSION_SAMPLE_DISTINCT_LIMIT = 192,
+	/* The number of words the block scans examine at a time */
+	BLOCK_SCAN_WORDS = 8,
+	BLOCK_SCAN_LINE_SIZE = BLOCK_SCAN_WORDS * sizeof(uint64_t),
+};
+
 static const char *ASYNC_OPERATION_NAMES[] = {
 	"launch",
 	"acknowledge_write",
@@ -183,7 +199,11 @@ void launch_data_vio(struct data_vio *data_vio,
 
 	data_vio->is_duplicate = false;
 
-	memset(&data_vio->chunk_name, 0, sizeof(data_vio->chunk_name));
+	/* A name computed as the data was copied in must be kept. */
+	if (!data_vio->hashed_on_ingest) {
+		memset(&data_vio->chunk_name, 0, sizeof(data_vio->chunk_name));
+	}
+
 	memset(&data_vio->duplicate, 0, sizeof(data_vio->duplicate));
 
 	data_vio->io_operation = operation;
@@ -634,25 +654,79 @@ void acknowledge_data_vio(struct data_vio *data_vio)
 	vdo_complete_bio(bio, error);
 }
 
+/**
+ * is_sample_incompressible() - Check whether a sample of a block's data looks
+ *                              too random for LZ4 to compress.
+ * @data: The block data.
+ *
+ * A few cache lines spread across the block are examined. If they contain
+ * nearly as many distinct byte values as random data would, and the block
+ * does not obviously repeat with a period which divides the sample stride,
+ * compressing the block is very unlikely to produce anything small enough to
+ * pack. This is much cheaper than finding that out by running LZ4.
+ *
+ * Return: true if the block should not be compressed.
+ */
+static bool is_sample_incompressible(const char *data)
+{
+	uint64_t seen[256 / 64] = { 0 };
+	unsigned int distinct = 0;
+	unsigned int sample, i;
+
+	for (sample = 0; sample < COMPRESSION_SAMPLE_COUNT; sample++) {
+		const uint8_t *bytes = ((const uint8_t *) data +
+					(sample * COMPRESSION_SAMPLE_STRIDE));
+
+		if ((sample > 0) &&
+		    (memcmp(bytes, data, COMPRESSION_SAMPLE_SIZE) == 0)) {
+			return false;
+		}
+
+		for (i = 0; i < COMPRESSION_SAMPLE_SIZE; i++) {
+			uint64_t bit = 1ULL << (bytes[i] % 64);
+
+			if ((seen[bytes[i] / 64] & bit) == 0) {
+				seen[bytes[i] / 64] |= bit;
+				distinct++;
+			}
+		}
+	}
+
+	return (distinct > COMPRESSION_SAMPLE_DISTINCT_LIMIT);
+}
+
 /**
  * compress_data_vio() - A function to compress the data in a data_vio.
  * @data_vio: The data_vio to compress.
+ * @context: The LZ4 working memory to use, which must not be in use by any
+ *           other thread.
+ * @acceleration: The LZ4 acceleration factor to use.
+ *
+ * Return: true if LZ4 was run, false if a sample of the data showed it to be
+ *         incompressible.
  */
-void compress_data_vio(struct data_vio *data_vio)
+bool compress_data_vio(struct data_vio *data_vio,
+		       char *context,
+		       unsigned int acceleration)
 {
 	int size;
-	char *context = get_work_queue_private_data();
+
+	if (is_sample_incompressible(data_vio->data_block)) {
+		data_vio->compression.size = VDO_BLOCK_SIZE + 1;
+		return false;
+	}
 
 	/*
          * By putting the compressed data at the start of the compressed
          * block data field, we won't need to copy it if this data_vio
          * becomes a compressed write agent.
          */
-	size = LZ4_compress_default(data_vio->data_block,
-				    data_vio->compression.block->data,
-				    VDO_BLOCK_SIZE,
-				    VDO_MAX_COMPRESSED_FRAGMENT_SIZE,
-				    context);
+	size = LZ4_compress_fast(data_vio->data_block,
+				 data_vio->compression.block->data,
+				 VDO_BLOCK_SIZE,
+				 VDO_MAX_COMPRESSED_FRAGMENT_SIZE,
+				 acceleration,
+				 context);
 	if (size > 0) {
 		data_vio->compression.size = size;
 	} else {
@@ -662,6 +736,8 @@ void compress_data_vio(struct data_vio *data_vio)
 		 */
 		data_vio->compression.size = VDO_BLOCK_SIZE + 1;
 	}
+
+	return true;
 }
 
 /**
@@ -702,20 +778,113 @@ int uncompress_data_vio(struct data_vio *data_vio,
 	return VDO_SUCCESS;
 }
 
-/* Return true if a data block contains all zeros. */
+/* OR together the words of one cache line. */
+static inline uint64_t or_line(const uint64_t *words)
+{
+	return (words[0] | words[1] | words[2] | words[3] |
+		words[4] | words[5] | words[6] | words[7]);
+}
+
+/*
+ * Return true if a data block contains all zeros.
+ *
+ * The words of each cache line are ORed together so that there is only one
+ * branch per line, which lets the loads of a line proceed in parallel.
+ */
 bool is_zero_block(char *block)
 {
-	int i;
+	const uint64_t *words = (const uint64_t *) block;
+	const unsigned int word_count = VDO_BLOCK_SIZE / sizeof(uint64_t);
+	unsigned int i;
 
 #ifdef INTERNAL
-	STATIC_ASSERT(VDO_BLOCK_SIZE % sizeof(uint64_t) == 0);
+	STATIC_ASSERT(VDO_BLOCK_SIZE % BLOCK_SCAN_LINE_SIZE == 0);
 	ASSERT_LOG_ONLY((uintptr_t) block % sizeof(uint64_t) == 0,
 			"Data blocks are expected to be aligned");
 #endif  /* INTERNAL */
 
-	for (i = 0; i < VDO_BLOCK_SIZE; i += sizeof(uint64_t)) {
-		if (*((uint64_t *) &block[i]))
+	/* Most blocks which aren't zero are caught by their first word. */
+	if (words[0] != 0)
+		return false;
+
+	for (i = 0; i < word_count; i += BLOCK_SCAN_WORDS) {
+		if (or_line(&words[i]) != 0)
 			return false;
 	}
 	return true;
 }
+
+/* XOR the corresponding words of two cache lines, ORing the results. */
+static inline uint64_t xor_lines(const uint64_t *words1,
+				 const uint64_t *words2)
+{
+	return ((words1[0] ^ words2[0]) | (words1[1] ^ words2[1]) |
+		(words1[2] ^ words2[2]) | (words1[3] ^ words2[3]) |
+		(words1[4] ^ words2[4]) | (words1[5] ^ words2[5]) |
+		(words1[6] ^ words2[6]) | (words1[7] ^ words2[7]));
+}
+
+/*
+ * Return true if two data blocks have the same contents.
+ *
+ * As in is_zero_block(), a whole cache line is compared before branching.
+ */
+bool blocks_equal(const char *block1, const char *block2)
+{
+	const uint64_t *words1 = (const uint64_t *) block1;
+	const uint64_t *words2 = (const uint64_t *) block2;
+	const unsigned int word_count = VDO_BLOCK_SIZE / sizeof(uint64_t);
+	unsigned int i;
+
+#ifdef INTERNAL
+	STATIC_ASSERT(VDO_BLOCK_SIZE % BLOCK_SCAN_LINE_SIZE == 0);
+	ASSERT_LOG_ONLY((uintptr_t) block1 % sizeof(uint64_t) == 0,
+			"Data blocks are expected to be aligned");
+	ASSERT_LOG_ONLY((uintptr_t) block2 % sizeof(uint64_t) == 0,
+			"Data blocks are expected to be aligned");
+#endif  /* INTERNAL */
+
+	/* Stale advice is usually caught by the first word. */
+	if (words1[0] != words2[0])
+		return false;
+
+	for (i = 0; i < word_count; i += BLOCK_SCAN_WORDS) {
+		if (xor_lines(&words1[i], &words2[i]) != 0)
+			return false;
+	}
+	return true;
+}
+
+/**
+ * copy_data_and_check_zero() - Copy data, checking whether it is all zeros
+ *                              along the way.
+ * @to: The destination.
+ * @from: The source.
+ * @length: The number of bytes to copy.
+ *
+ * This touches each byte once, rather than copying and then scanning the copy
+ * with is_zero_block(). Neither buffer needs to be aligned.
+ *
+ * Return: true if all of the copied data was zero.
+ */
+bool copy_data_and_check_zero(char *to, const char *from, unsigned int length)
+{
+	uint64_t bits = 0;
+
+	for (; length >= BLOCK_SCAN_LINE_SIZE; length -= BLOCK_SCAN_LINE_SIZE) {
+		uint64_t line[BLOCK_SCAN_WORDS];
+
+		memcpy(line, from, sizeof(line));
+		memcpy(to, line, sizeof(line));
+		bits |= or_line(line);
+		from += BLOCK_SCAN_LINE_SIZE;
+		to += BLOCK_SCAN_LINE_SIZE;
+	}
+
+	for (; length > 0; length--) {
+		bits |= (uint8_t) *from;
+		*to++ = *from++;
+	}
+
+	return (bits == 0);
+}
@@ -109,6 +109,11 @@ struct tree_lock {
 	 * The queue of waiters for the page this vio is allocating or loading
 	 */
 	struct wait_queue waiters;
+	/*
+	 * Waiters which are not data_vios, such as the block map warmup, to
+	 * notify when this lock is released
+	 */
+	struct wait_queue other_waiters;
 	/* The block map tree slots for this LBN */
 	struct block_map_tree_slot tree_slots[VDO_BLOCK_MAP_TREE_HEIGHT + 1];
 };
@@ -138,6 +143,14 @@ struct compression_state {
 	/* The packer bin to which the enclosing data_vio has been assigned */
 	struct packer_bin *bin;
 
+	/* The packer's count of arrivals when this data_vio was put in a bin */
+	uint64_t arrival;
+#ifdef VDO_INTERNAL
+
+	/* The jiffies when this data_vio was put in a bin */
+	uint64_t arrival_jiffies;
+#endif /* VDO_INTERNAL */
+
 	/* A link in the chain of data_vios which have been packed together */
 	struct data_vio *next_in_batch;
 
@@ -217,6 +230,14 @@ struct data_vio {
 	/* Whether this vio write is a duplicate */
 	bool is_duplicate;
 
+	/* Whether the chunk name was computed as the data was copied in */
+	bool hashed_on_ingest;
+#ifdef VDO_INTERNAL
+
+	/* When the write data was copied in, in ns (0 if it was not) */
+	uint64_t ingest_time;
+#endif /* VDO_INTERNAL */
+
 	/* Data block allocation */
 	struct allocation allocation;
 
@@ -1118,7 +1139,9 @@ void release_data_vio_allocation_lock(struct data_vio *data_vio, bool reset);
 
 void acknowledge_data_vio(struct data_vio *data_vio);
 
-void compress_data_vio(struct data_vio *data_vio);
+bool compress_data_vio(struct data_vio *data_vio,
+		       char *context,
+		       unsigned int acceleration);
 
 int __must_check uncompress_data_vio(struct data_vio *data_vio,
 				     enum block_mapping_state mapping_state,
@@ -1153,4 +1176,10 @@ prepare_data_vio_for_io(struct data_vio *data_vio,
 
 bool is_zero_block(char *block);
 
+bool blocks_equal(const char *block1, const char *block2);
+
+bool copy_data_and_check_zero(char *to,
+			      const char *from,
+			      unsigned int length);
+
 #endif /* DATA_VIO_H */
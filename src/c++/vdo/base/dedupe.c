@@ -135,6 +135,18 @@
  * timed_out list will be searched for any contexts which are timed out and
  * complete. One of these will be used immediately, and the rest will be
  * returned to the available list and marked idle.
+ *
+ * Each hash_zone also has a dedupe_controller which tracks the latency of the
+ * index queries made from that zone. After every CONTROLLER_WINDOW completed
+ * or timed out queries, the controller estimates the 99th percentile latency
+ * of the window and uses it to adapt the zone's timeout to twice that
+ * latency, but never more than the target latency (or the fixed timeout
+ * interval, which serves as an upper bound). If the estimated latency exceeds
+ * the target, the index is not keeping up, so the controller starts skipping
+ * the index for a growing fraction of queries; the fraction shrinks again
+ * once the latency falls well below the target. Timeouts only adapt if
+ * vdo_adaptive_dedupe_timeout is set, and queries are only skipped if
+ * vdo_dedupe_query_shedding is set; both are off by default.
  **/
 
 #include "dedupe.h"
@@ -153,6 +165,7 @@
 #include "memory-alloc.h"
 #include "numeric.h"
 #include "permassert.h"
+#include "time-utils.h"
 #include "uds.h"
 
 #include "action-manager.h"
@@ -163,6 +176,7 @@
 #include "data-vio.h"
 #include "io-submitter.h"
 #include "kernel-types.h"
+#include "num-utils.h"
 #include "packer.h"
 #include "pbn-lock.h"
 #include "physical-zone.h"
@@ -179,6 +193,7 @@
 struct uds_attribute {
 	struct attribute attr;
 	const char *(*show_string)(struct hash_zones *);
+	uint64_t (*show_zone_value)(const struct hash_zone *);
 };
 
 enum timer_state {
@@ -306,6 +321,18 @@ struct hash_lock {
 	 */
 	bool verify_counted;
 
+	/*
+	 * True if the duplicate candidate came from the zone's advice cache
+	 * rather than from the index
+	 */
+	bool cached_advice;
+
+	/*
+	 * True if the agent launched its verification read directly from the
+	 * duplicate's physical zone after acquiring the PBN lock
+	 */
+	bool speculative_verify;
+
 	/* True if this lock is registered in the lock map (cleared on
 	 * rollover)
 	 */
@@ -334,6 +361,28 @@ struct hash_lock {
 
 enum {
 	LOCK_POOL_CAPACITY = MAXIMUM_VDO_USER_VIOS,
+	ADVICE_CACHE_CAPACITY = 1024,
+	/* The number of latency samples between controller adjustments */
+	CONTROLLER_WINDOW = 256,
+	/* Latency buckets are powers of two microseconds, up to 8 seconds */
+	LATENCY_BUCKETS = 24,
+	/* The fraction of queries to skip is measured in 1/SHED_SCALE */
+	SHED_SCALE = 1024,
+	SHED_STEP = SHED_SCALE / 16,
+	SHED_MAXIMUM = SHED_SCALE - (SHED_SCALE / 8),
+};
+
+/*
+ * An entry in a hash zone's cache of recently seen dedupe advice. Entries are
+ * only accessed on the hash zone thread.
+ */
+struct advice_cache_entry {
+	/* The chunk name the advice is for, which is also the map key */
+	struct uds_chunk_name name;
+	/* The advice itself */
+	struct zoned_pbn advice;
+	/* The entry in the zone's LRU list or list of free entries */
+	struct list_head lru_entry;
 };
 
 struct dedupe_context {
@@ -341,10 +390,33 @@ struct dedupe_context {
 	struct uds_request request;
 	struct list_head list_entry;
 	uint64_t submission_jiffies;
+	ktime_t submission_time;
 	struct data_vio *requestor;
 	atomic_t state;
 };
 
+/*
+ * The adaptive timeout state of a hash zone. It is only modified on the hash
+ * zone thread, but the decisions are read by other threads for sysfs.
+ */
+struct dedupe_controller {
+	/*
+	 * The latencies of the queries in the current window; bucket n counts
+	 * latencies below 2^n microseconds but not below 2^(n-1)
+	 */
+	uint32_t latency_buckets[LATENCY_BUCKETS];
+	/* The number of latencies recorded in the current window */
+	uint32_t samples;
+	/* The 99th percentile latency of the last window, in microseconds */
+	uint64_t p99_latency;
+	/* The adapted timeout, in jiffies (0 until the first window ends) */
+	uint64_t timeout_jiffies;
+	/* The fraction of queries to skip, in units of 1/SHED_SCALE */
+	unsigned int shed_fraction;
+	/* The accumulated fraction used to decide which queries to skip */
+	unsigned int shed_credit;
+};
+
 struct hash_zone {
 	/* Which hash zone this is */
 	zone_count_t zone_number;
@@ -370,6 +442,18 @@ struct hash_zone {
 	/* Array of all hash_locks */
 	struct hash_lock *lock_array;
 
+	/* Mapping from chunk names to cached advice_cache_entries */
+	struct pointer_map *advice_map;
+
+	/* Cached advice, least recently used first */
+	struct list_head advice_lru;
+
+	/* Unused advice cache entries */
+	struct list_head advice_free;
+
+	/* Array of all advice_cache_entries */
+	struct advice_cache_entry *advice_entries;
+
 	/* These fields are used to manage the dedupe contexts */
 	struct list_head available;
 	struct list_head pending;
@@ -381,6 +465,20 @@ struct hash_zone {
 
 	/* The dedupe contexts for querying the index from this zone */
 	struct dedupe_context contexts[MAXIMUM_VDO_USER_VIOS];
+
+	/*
+	 * Index requests from this zone which have not yet been launched.
+	 * Each holds a distinct dedupe context, so there can never be more of
+	 * them than there are contexts.
+	 */
+	struct uds_request *submissions[MAXIMUM_VDO_USER_VIOS];
+	vio_count_t submission_count;
+
+	/* The completion for launching the accumulated index requests */
+	struct vdo_completion submission_completion;
+
+	/* The controller which adapts this zone's timeout to the index */
+	struct dedupe_controller controller;
 };
 
 struct hash_zones {
@@ -415,6 +513,14 @@ struct hash_zones {
 	struct hash_zone zones[];
 };
 
+/* This is a module parameter. */
+bool vdo_speculative_verify = true;
+
+/* These are module parameters. */
+bool vdo_adaptive_dedupe_timeout;
+bool vdo_dedupe_query_shedding;
+unsigned int vdo_dedupe_target_latency = 100;
+
 /* These are in milliseconds. */
 unsigned int vdo_dedupe_index_timeout_interval = 5000;
 unsigned int vdo_dedupe_index_min_timer_interval = 100;
@@ -434,6 +540,16 @@ as_hash_zone(struct vdo_completion *completion)
 	return container_of(completion, struct hash_zone, completion);
 }
 
+static inline struct hash_zone *
+as_submitting_hash_zone(struct vdo_completion *completion)
+{
+	vdo_assert_completion_type(completion->type,
+				   VDO_INDEX_SUBMISSION_COMPLETION);
+	return container_of(completion,
+			    struct hash_zone,
+			    submission_completion);
+}
+
 static inline struct hash_zones *
 as_hash_zones(struct vdo_completion *completion)
 {
@@ -479,6 +595,90 @@ static void return_hash_lock_to_pool(struct hash_zone *zone,
 	list_add_tail(&lock->pool_node, &zone->lock_pool);
 }
 
+/**
+ * get_cached_advice() - Look up the cached advice for a chunk name, marking
+ *                       it as recently used if found.
+ * @zone: The hash zone whose cache should be searched.
+ * @name: The chunk name to look up.
+ *
+ * Return: The cache entry for the name, or NULL if there is none.
+ */
+static struct advice_cache_entry *
+get_cached_advice(struct hash_zone *zone, const struct uds_chunk_name *name)
+{
+	struct advice_cache_entry *entry =
+		pointer_map_get(zone->advice_map, name);
+
+	if (entry != NULL) {
+		list_move_tail(&entry->lru_entry, &zone->advice_lru);
+	}
+
+	return entry;
+}
+
+/**
+ * cache_advice() - Record advice for a chunk name in a hash zone's advice
+ *                  cache, evicting the least recently used entry if the
+ *                  cache is full.
+ * @zone: The hash zone whose cache should be updated.
+ * @name: The chunk name the advice is for.
+ * @advice: The advice to record.
+ *
+ * Since the cache is only an optimization, failing to add an entry is not an
+ * error.
+ */
+static void cache_advice(struct hash_zone *zone,
+			 const struct uds_chunk_name *name,
+			 const struct zoned_pbn *advice)
+{
+	struct advice_cache_entry *entry, *old_entry;
+	int result;
+
+	entry = pointer_map_get(zone->advice_map, name);
+	if (entry == NULL) {
+		if (list_empty(&zone->advice_free)) {
+			entry = list_first_entry(&zone->advice_lru,
+						 struct advice_cache_entry,
+						 lru_entry);
+			pointer_map_remove(zone->advice_map, &entry->name);
+		} else {
+			entry = list_first_entry(&zone->advice_free,
+						 struct advice_cache_entry,
+						 lru_entry);
+		}
+
+		entry->name = *name;
+		result = pointer_map_put(zone->advice_map,
+					 &entry->name,
+					 entry,
+					 false,
+					 (void **) &old_entry);
+		if (result != VDO_SUCCESS) {
+			list_move(&entry->lru_entry, &zone->advice_free);
+			return;
+		}
+	}
+
+	entry->advice = *advice;
+	list_move_tail(&entry->lru_entry, &zone->advice_lru);
+}
+
+/**
+ * invalidate_cached_advice() - Remove any cached advice for a chunk name.
+ * @zone: The hash zone whose cache should be updated.
+ * @name: The chunk name whose advice is no longer trustworthy.
+ */
+static void invalidate_cached_advice(struct hash_zone *zone,
+				     const struct uds_chunk_name *name)
+{
+	struct advice_cache_entry *entry =
+		pointer_map_remove(zone->advice_map, name);
+
+	if (entry != NULL) {
+		list_move(&entry->lru_entry, &zone->advice_free);
+	}
+}
+
 /**
  * vdo_get_duplicate_lock() - Get the PBN lock on the duplicate data
  *                            location for a data_vio from the
@@ -1014,10 +1214,114 @@ static void start_unlocking(struct hash_lock *lock, struct data_vio *agent)
 	launch_data_vio_duplicate_zone_callback(agent, unlock_duplicate_pbn);
 }
 
+/**
+ * get_timeout_jiffies() - Get the time after which a query from a hash zone
+ *                         will be timed out.
+ * @zone: The hash zone.
+ *
+ * Return: The timeout, in jiffies.
+ */
+static uint64_t get_timeout_jiffies(const struct hash_zone *zone)
+{
+	uint64_t adapted = READ_ONCE(zone->controller.timeout_jiffies);
+
+	if (!READ_ONCE(vdo_adaptive_dedupe_timeout) || (adapted == 0)) {
+		return vdo_dedupe_index_timeout_jiffies;
+	}
+
+	return min(adapted, vdo_dedupe_index_timeout_jiffies);
+}
+
+/**
+ * estimate_p99_latency() - Estimate the 99th percentile of the latencies in
+ *                          a controller's current window.
+ * @controller: The controller.
+ *
+ * Return: The estimated latency, in microseconds.
+ */
+static uint64_t estimate_p99_latency(const struct dedupe_controller *controller)
+{
+	uint32_t threshold = controller->samples - (controller->samples / 100);
+	uint32_t below = 0;
+	uint32_t in_bucket;
+	uint64_t floor, width;
+	unsigned int bucket;
+
+	for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+		if (below + controller->latency_buckets[bucket] >= threshold) {
+			break;
+		}
+
+		below += controller->latency_buckets[bucket];
+	}
+
+	/* Interpolate within the bucket containing the percentile. */
+	in_bucket = max(controller->latency_buckets[bucket], 1U);
+	floor = (bucket == 0) ? 0 : (1ULL << (bucket - 1));
+	width = (bucket == 0) ? 1 : floor;
+	return floor + DIV_ROUND_UP(width * (threshold - below), in_bucket);
+}
+
+/**
+ * adjust_controller() - Adapt a hash zone's timeout and the fraction of
+ *                       queries it skips to the latencies of the window which
+ *                       just ended.
+ * @zone: The hash zone.
+ */
+static void adjust_controller(struct hash_zone *zone)
+{
+	struct dedupe_controller *controller = &zone->controller;
+	uint64_t p99 = estimate_p99_latency(controller);
+	uint64_t target = (uint64_t) READ_ONCE(vdo_dedupe_target_latency) * 1000;
+	uint64_t timeout = min(2 * p99, target);
+	unsigned int shed = controller->shed_fraction;
+
+	memset(controller->latency_buckets,
+	       0,
+	       sizeof(controller->latency_buckets));
+	controller->samples = 0;
+
+	if (p99 > target) {
+		/* The index is not keeping up, so lighten its load. */
+		shed = min(shed + SHED_STEP, (unsigned int) SHED_MAXIMUM);
+	} else if (p99 < (target / 2)) {
+		shed -= min(shed, (unsigned int) (SHED_STEP / 2));
+	}
+
+	WRITE_ONCE(controller->p99_latency, p99);
+	WRITE_ONCE(controller->timeout_jiffies,
+		   max(msecs_to_jiffies(DIV_ROUND_UP(timeout, 1000)), 2UL));
+	WRITE_ONCE(controller->shed_fraction, shed);
+}
+
+/**
+ * record_query_latency() - Record the latency of an index query which has
+ *                          completed or timed out.
+ * @context: The dedupe context of the query.
+ */
+static void record_query_latency(struct dedupe_context *context)
+{
+	struct dedupe_controller *controller = &context->zone->controller;
+	ktime_t latency = ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+				    context->submission_time);
+	uint64_t microseconds = max(latency, (ktime_t) 0) / NSEC_PER_USEC;
+	unsigned int bucket = 0;
+
+	if (microseconds > 0) {
+		bucket = min(ilog2(microseconds) + 1, LATENCY_BUCKETS - 1);
+	}
+
+	controller->latency_buckets[bucket]++;
+	if (++controller->samples >= CONTROLLER_WINDOW) {
+		adjust_controller(context->zone);
+	}
+}
+
 static void release_context(struct dedupe_context *context)
 {
 	struct hash_zone *zone = context->zone;
 
+	record_query_latency(context);
 	WRITE_ONCE(zone->active, zone->active - 1);
 	list_move(&context->list_entry, &zone->available);
 }
@@ -1026,6 +1330,11 @@ static void process_update_result(struct data_vio *agent)
 {
 	struct dedupe_context *context = agent->dedupe_context;
 
+	/*
+	 * The index is being given new advice for this name, so whatever was
+	 * cached is out of date.
+	 */
+	invalidate_cached_advice(agent->hash_zone, &agent->chunk_name);
 	if (context == NULL) {
 		return;
 	}
@@ -1068,6 +1377,7 @@ static void finish_updating(struct vdo_completion *completion)
 	 * duplicate location changes due to rollover.
 	 */
 	lock->update_advice = false;
+	cache_advice(agent->hash_zone, &agent->chunk_name, &agent->new_mapped);
 
 	if (has_waiters(&lock->waiters)) {
 		/*
@@ -1100,6 +1410,9 @@ static void finish_updating(struct vdo_completion *completion)
 
 static void
 query_index(struct data_vio *data_vio, enum uds_request_type operation);
+static void refresh_cached_name(struct hash_zone *zone,
+				const struct uds_chunk_name *name);
+static void launch_index_requests_callback(struct vdo_completion *completion);
 
 /**
  * start_updating() - Continue deduplication with the last step, updating UDS
@@ -1433,6 +1746,24 @@ static void finish_verifying(struct vdo_completion *completion)
 
 	assert_hash_lock_agent(agent, __func__);
 
+	if (lock->speculative_verify) {
+		struct hash_lock_statistics *stats =
+			&agent->hash_zone->statistics;
+
+		/*
+		 * LOCKING -> VERIFYING transition: The verification read was
+		 * launched by lock_duplicate_pbn(), so the lock never passed
+		 * through start_verifying().
+		 */
+		lock->speculative_verify = false;
+		set_hash_lock_state(lock, VDO_HASH_LOCK_VERIFYING);
+		if (completion->result == VDO_SUCCESS) {
+			increment_stat(agent->is_duplicate ?
+				       &stats->speculative_verify_hits :
+				       &stats->speculative_verify_rollbacks);
+		}
+	}
+
 	if (completion->result != VDO_SUCCESS) {
 		/*
 		 * XXX VDOSTORY-190 should convert verify IO errors to
@@ -1443,6 +1774,9 @@ static void finish_verifying(struct vdo_completion *completion)
 	}
 
 	lock->verified = agent->is_duplicate;
+	if (!lock->verified) {
+		invalidate_cached_advice(agent->hash_zone, &lock->hash);
+	}
 
 	/*
 	 * Only count the result of the initial verification of the advice as
@@ -1450,13 +1784,18 @@ static void finish_verifying(struct vdo_completion *completion)
 	 * releases.
 	 */
 	if (!lock->verify_counted) {
-		struct hash_zone *zone = agent->hash_zone;
+		struct hash_lock_statistics *stats =
+			&agent->hash_zone->statistics;
 
 		lock->verify_counted = true;
 		if (lock->verified) {
-			increment_stat(&zone->statistics.dedupe_advice_valid);
+			increment_stat(&stats->dedupe_advice_valid);
 		} else {
-			increment_stat(&zone->statistics.dedupe_advice_stale);
+			increment_stat(&stats->dedupe_advice_stale);
+			if (lock->cached_advice) {
+				increment_stat(
+					&stats->dedupe_advice_cache_stale);
+			}
 		}
 	}
 
@@ -1492,27 +1831,6 @@ static void finish_verifying(struct vdo_completion *completion)
 	}
 }
 
-static bool blocks_equal(char *block1, char *block2)
-{
-	int i;
-
-#ifdef INTERNAL
-	STATIC_ASSERT(VDO_BLOCK_SIZE % sizeof(uint64_t) == 0);
-	ASSERT_LOG_ONLY((uintptr_t) block1 %sizeof(uint64_t) == 0,
-			"Data blocks are expected to be aligned");
-	ASSERT_LOG_ONLY((uintptr_t) block2 %sizeof(uint64_t) == 0,
-			"Data blocks are expected to be aligned");
-#endif  /* INTERNAL */
-
-	for (i = 0; i < VDO_BLOCK_SIZE; i += sizeof(uint64_t)) {
-		if (*((uint64_t *) &block1[i]) != *((uint64_t *) &block2[i])) {
-			return false;
-		}
-	}
-
-	return true;
-}
-
 static void verify_callback(struct vdo_completion *completion)
 {
 	struct data_vio *agent = as_data_vio(completion);
@@ -1562,28 +1880,20 @@ static void verify_endio(struct bio *bio)
 }
 
 /**
- * start_verifying() - Begin the data verification phase.
- * @lock: The hash lock (must be LOCKING).
+ * launch_verify_read() - Read the candidate duplicate block so it can be
+ *                        compared to the agent's data.
  * @agent: The data_vio to use to read and compare candidate data.
  *
- * Continue the deduplication path for a hash lock by using the agent to read
- * (and possibly decompress) the data at the candidate duplicate location,
- * comparing it to the data in the agent to verify that the candidate is
- * identical to all the data_vios sharing the hash. If so, it can be
- * deduplicated against, otherwise a data_vio allocation will have to be
- * written to and used for dedupe.
+ * The result of the comparison is delivered to finish_verifying() on the hash
+ * zone thread.
  */
-static void start_verifying(struct hash_lock *lock, struct data_vio *agent)
+static void launch_verify_read(struct data_vio *agent)
 {
 	int result;
 	char *buffer = (vdo_is_state_compressed(agent->duplicate.state)
 			? (char *) agent->compression.block
 			: agent->scratch_block);
 
-	set_hash_lock_state(lock, VDO_HASH_LOCK_VERIFYING);
-	ASSERT_LOG_ONLY(!lock->verified,
-			"hash lock only verifies advice once");
-
 	agent->last_async_operation = VIO_ASYNC_OP_VERIFY_DUPLICATION;
 	result = prepare_data_vio_for_io(agent,
 					 buffer,
@@ -1596,9 +1906,27 @@ static void start_verifying(struct hash_lock *lock, struct data_vio *agent)
 		return;
 	}
 
-	set_data_vio_bio_zone_callback(agent, process_vio_io);
-	vdo_invoke_completion_callback_with_priority(data_vio_as_completion(agent),
-						     BIO_Q_VERIFY_PRIORITY);
+	submit_data_vio_io_with_priority(agent, BIO_Q_VERIFY_PRIORITY);
+}
+
+/**
+ * start_verifying() - Begin the data verification phase.
+ * @lock: The hash lock (must be LOCKING).
+ * @agent: The data_vio to use to read and compare candidate data.
+ *
+ * Continue the deduplication path for a hash lock by using the agent to read
+ * (and possibly decompress) the data at the candidate duplicate location,
+ * comparing it to the data in the agent to verify that the candidate is
+ * identical to all the data_vios sharing the hash. If so, it can be
+ * deduplicated against, otherwise a data_vio allocation will have to be
+ * written to and used for dedupe.
+ */
+static void start_verifying(struct hash_lock *lock, struct data_vio *agent)
+{
+	set_hash_lock_state(lock, VDO_HASH_LOCK_VERIFYING);
+	ASSERT_LOG_ONLY(!lock->verified,
+			"hash lock only verifies advice once");
+	launch_verify_read(agent);
 }
 
 /**
@@ -1637,6 +1965,11 @@ static void finish_locking(struct vdo_completion *completion)
 		 * new advice.
 		 */
 		increment_stat(&zone->statistics.dedupe_advice_stale);
+		if (lock->cached_advice) {
+			increment_stat(
+				&zone->statistics.dedupe_advice_cache_stale);
+		}
+
 		lock->update_advice = true;
 		start_writing(lock, agent);
 		return;
@@ -1812,12 +2145,19 @@ static void lock_duplicate_pbn(struct vdo_completion *completion)
 	 */
 	set_duplicate_lock(agent->hash_lock, lock);
 
-	/*
-	 * XXX VDOSTORY-190 Optimization: Same as start_locking() lazily
-	 * changing state to save on having to switch back to the hash zone
-	 * thread. Here we could directly launch the block verify, then switch
-	 * to a hash thread.
-	 */
+	if (READ_ONCE(vdo_speculative_verify) && !agent->hash_lock->verified) {
+		/*
+		 * Since the PBN is now read locked, its contents can't change,
+		 * so launch the block verify directly instead of first
+		 * switching back to the hash zone thread to do it. The lock
+		 * will change state when the comparison result arrives in
+		 * finish_verifying().
+		 */
+		agent->hash_lock->speculative_verify = true;
+		launch_verify_read(agent);
+		return;
+	}
+
 	continue_data_vio(agent, VDO_SUCCESS);
 }
 
@@ -2157,6 +2497,7 @@ static void finish_querying(struct vdo_completion *completion)
 
 	if (agent->is_duplicate) {
 		lock->duplicate = agent->duplicate;
+		cache_advice(agent->hash_zone, &lock->hash, &agent->duplicate);
 		/*
 		 * QUERYING -> LOCKING transition: Valid advice was obtained
 		 * from UDS. Use the QUERYING agent to start the hash lock on
@@ -2190,8 +2531,35 @@ static void finish_querying(struct vdo_completion *completion)
  */
 static void start_querying(struct hash_lock *lock, struct data_vio *data_vio)
 {
+	struct hash_zone *zone = data_vio->hash_zone;
+	struct advice_cache_entry *entry = NULL;
+
 	set_agent(lock, data_vio);
 	set_hash_lock_state(lock, VDO_HASH_LOCK_QUERYING);
+
+	if (READ_ONCE(vdo_from_data_vio(data_vio)->hash_zones->dedupe_flag)) {
+		entry = get_cached_advice(zone, &lock->hash);
+		increment_stat((entry != NULL) ?
+			       &zone->statistics.dedupe_advice_cache_hits :
+			       &zone->statistics.dedupe_advice_cache_misses);
+	}
+
+	if (entry != NULL) {
+		data_vio->is_duplicate = true;
+		data_vio->duplicate = entry->advice;
+		lock->duplicate = entry->advice;
+		lock->cached_advice = true;
+		/*
+		 * QUERYING -> LOCKING transition: Advice for this name was
+		 * recently obtained by another lock, so don't wait for the
+		 * index and verify the cached advice as if UDS had returned
+		 * it.
+		 */
+		refresh_cached_name(zone, &lock->hash);
+		start_locking(lock, data_vio);
+		return;
+	}
+
 	data_vio->last_async_operation = VIO_ASYNC_OP_CHECK_FOR_DUPLICATION;
 	set_data_vio_hash_zone_callback(data_vio, finish_querying);
 	query_index(data_vio,
@@ -2598,11 +2966,27 @@ static ssize_t dedupe_status_show(struct kobject *directory,
 		container_of(attr, struct uds_attribute, attr);
 	struct hash_zones *zones =
 		container_of(directory, struct hash_zones, dedupe_directory);
+	zone_count_t zone;
+	ssize_t length = 0;
+
 	if (ua->show_string != NULL) {
 		return sprintf(buf, "%s\n", ua->show_string(zones));
-	} else {
+	}
+
+	if (ua->show_zone_value == NULL) {
 		return -EINVAL;
 	}
+
+	/* Show the value for each zone, separated by spaces. */
+	for (zone = 0; zone < zones->zone_count; zone++) {
+		length += sprintf(buf + length,
+				  "%s%llu",
+				  (zone == 0) ? "" : " ",
+				  (unsigned long long)
+				  ua->show_zone_value(&zones->zones[zone]));
+	}
+
+	return length + sprintf(buf + length, "\n");
 }
 
 static ssize_t dedupe_status_store(struct kobject *kobj __always_unused,
@@ -2620,13 +3004,52 @@ static struct sysfs_ops dedupe_sysfs_ops = {
 	.store = dedupe_status_store,
 };
 
+static uint64_t get_p99_latency(const struct hash_zone *zone)
+{
+	return READ_ONCE(zone->controller.p99_latency);
+}
+
+static uint64_t get_timeout_interval(const struct hash_zone *zone)
+{
+	return jiffies_to_msecs(get_timeout_jiffies(zone));
+}
+
+static uint64_t get_shed_fraction(const struct hash_zone *zone)
+{
+	if (!READ_ONCE(vdo_dedupe_query_shedding)) {
+		return 0;
+	}
+
+	/* Report the fraction in thousandths. */
+	return DIV_ROUND_UP(READ_ONCE(zone->controller.shed_fraction) * 1000,
+			    SHED_SCALE);
+}
+
 static struct uds_attribute dedupe_status_attribute = {
 	.attr = {.name = "status", .mode = 0444, },
 	.show_string = vdo_get_dedupe_index_state_name,
 };
 
+static struct uds_attribute dedupe_latency_attribute = {
+	.attr = {.name = "query_latency_p99", .mode = 0444, },
+	.show_zone_value = get_p99_latency,
+};
+
+static struct uds_attribute dedupe_timeout_attribute = {
+	.attr = {.name = "timeout_interval", .mode = 0444, },
+	.show_zone_value = get_timeout_interval,
+};
+
+static struct uds_attribute dedupe_shed_attribute = {
+	.attr = {.name = "shed_fraction", .mode = 0444, },
+	.show_zone_value = get_shed_fraction,
+};
+
 static struct attribute *dedupe_attrs[] = {
 	&dedupe_status_attribute.attr,
+	&dedupe_latency_attribute.attr,
+	&dedupe_timeout_attribute.attr,
+	&dedupe_shed_attribute.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(dedupe);
@@ -2772,7 +3195,7 @@ static void start_expiration_timer(struct dedupe_context *context)
 		return;
 	}
 
-	end_time = max(start_time + vdo_dedupe_index_timeout_jiffies,
+	end_time = max(start_time + get_timeout_jiffies(context->zone),
 		       jiffies + vdo_dedupe_index_min_timer_jiffies);
 	mod_timer(&context->zone->timer, end_time);
 }
@@ -2941,9 +3364,7 @@ timeout_index_operations_callback(struct vdo_completion *completion)
 {
 	struct dedupe_context *context, *tmp;
 	struct hash_zone *zone = as_hash_zone(completion);
-	uint64_t timeout_jiffies =
-		msecs_to_jiffies(vdo_dedupe_index_timeout_interval);
-	unsigned long cutoff = jiffies - timeout_jiffies;
+	unsigned long cutoff = jiffies - get_timeout_jiffies(zone);
 	unsigned int timed_out = 0;
 
 	atomic_set(&zone->timer_state, DEDUPE_QUERY_TIMER_IDLE);
@@ -2979,6 +3400,7 @@ timeout_index_operations_callback(struct vdo_completion *completion)
 		 * way.
 		 */
 		list_move(&context->list_entry, &zone->timed_out);
+		record_query_latency(context);
 		continue_data_vio(context->requestor, VDO_SUCCESS);
 		timed_out++;
 	}
@@ -3029,6 +3451,12 @@ static int __must_check initialize_zone(struct vdo *vdo,
 	vdo_set_completion_callback(&zone->completion,
 				    timeout_index_operations_callback,
 				    zone->thread_id);
+	vdo_initialize_completion(&zone->submission_completion,
+				  vdo,
+				  VDO_INDEX_SUBMISSION_COMPLETION);
+	vdo_set_completion_callback(&zone->submission_completion,
+				    launch_index_requests_callback,
+				    zone->thread_id);
 	INIT_LIST_HEAD(&zone->lock_pool);
 	result = UDS_ALLOCATE(LOCK_POOL_CAPACITY,
 			      struct hash_lock,
@@ -3042,6 +3470,30 @@ static int __must_check initialize_zone(struct vdo *vdo,
 		return_hash_lock_to_pool(zone, &zone->lock_array[i]);
 	}
 
+	result = make_pointer_map(ADVICE_CACHE_CAPACITY,
+				  0,
+				  compare_keys,
+				  hash_key,
+				  &zone->advice_map);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	INIT_LIST_HEAD(&zone->advice_lru);
+	INIT_LIST_HEAD(&zone->advice_free);
+	result = UDS_ALLOCATE(ADVICE_CACHE_CAPACITY,
+			      struct advice_cache_entry,
+			      "advice cache entries",
+			      &zone->advice_entries);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	for (i = 0; i < ADVICE_CACHE_CAPACITY; i++) {
+		list_add_tail(&zone->advice_entries[i].lru_entry,
+			      &zone->advice_free);
+	}
+
 	INIT_LIST_HEAD(&zone->available);
 	INIT_LIST_HEAD(&zone->pending);
 	INIT_LIST_HEAD(&zone->timed_out);
@@ -3159,6 +3611,8 @@ void vdo_free_hash_zones(struct hash_zones *zones)
 
 		free_pointer_map(UDS_FORGET(zone->hash_lock_map));
 		UDS_FREE(UDS_FORGET(zone->lock_array));
+		free_pointer_map(UDS_FORGET(zone->advice_map));
+		UDS_FREE(UDS_FORGET(zone->advice_entries));
 	}
 
 	if (zones->index_session != NULL) {
@@ -3375,6 +3829,17 @@ static void get_hash_zone_statistics(const struct hash_zone *zone,
 		READ_ONCE(stats->concurrent_data_matches);
 	tally->concurrent_hash_collisions +=
 		READ_ONCE(stats->concurrent_hash_collisions);
+	tally->dedupe_advice_cache_hits +=
+		READ_ONCE(stats->dedupe_advice_cache_hits);
+	tally->dedupe_advice_cache_misses +=
+		READ_ONCE(stats->dedupe_advice_cache_misses);
+	tally->dedupe_advice_cache_stale +=
+		READ_ONCE(stats->dedupe_advice_cache_stale);
+	tally->speculative_verify_hits +=
+		READ_ONCE(stats->speculative_verify_hits);
+	tally->speculative_verify_rollbacks +=
+		READ_ONCE(stats->speculative_verify_rollbacks);
+	tally->dedupe_requests_shed += READ_ONCE(stats->dedupe_requests_shed);
 	tally->curr_dedupe_queries += READ_ONCE(zone->active);
 }
 
@@ -3611,6 +4076,21 @@ void vdo_set_dedupe_index_min_timer_interval(unsigned int value)
 	vdo_dedupe_index_min_timer_jiffies = min_jiffies;
 }
 
+void vdo_set_dedupe_target_latency(unsigned int value)
+{
+	/* Arbitrary maximum value is two minutes, as for the timeout */
+	if (value > 120000) {
+		value = 120000;
+	}
+
+	/* Arbitrary minimum value is one millisecond */
+	if (value < 1) {
+		value = 1;
+	}
+
+	vdo_dedupe_target_latency = value;
+}
+
 /**
  * acquire_context() - Acquire a dedupe context from a hash_zone if any are
  *                     available.
@@ -3704,24 +4184,74 @@ static int test_launch_request(struct uds_request *request)
 }
 
 #endif /* INTERNAL */
+/**
+ * submit_index_request() - Add a prepared request to the batch of requests a
+ *                          hash zone will launch.
+ * @zone: The hash zone.
+ * @context: The dedupe context of the request.
+ */
+static void submit_index_request(struct hash_zone *zone,
+				 struct dedupe_context *context)
+{
+	zone->submissions[zone->submission_count++] = &context->request;
+	if (zone->submission_count == 1) {
+		vdo_enqueue_completion_with_priority(
+			&zone->submission_completion,
+			VDO_DEFAULT_Q_INDEX_SUBMISSION_PRIORITY);
+	}
+}
+
+/**
+ * shed_query() - Decide whether to skip the index for a query because the
+ *                index is not keeping up with the target latency.
+ * @zone: The hash zone making the query.
+ *
+ * Return: true if the query should not be made.
+ */
+static bool shed_query(struct hash_zone *zone)
+{
+	struct dedupe_controller *controller = &zone->controller;
+
+	if (!READ_ONCE(vdo_dedupe_query_shedding) ||
+	    (controller->shed_fraction == 0)) {
+		return false;
+	}
+
+	/* Spread the skipped queries evenly rather than skipping in bursts. */
+	controller->shed_credit += controller->shed_fraction;
+	if (controller->shed_credit < SHED_SCALE) {
+		return false;
+	}
+
+	controller->shed_credit -= SHED_SCALE;
+	increment_stat(&zone->statistics.dedupe_requests_shed);
+	return true;
+}
+
 /*
  * The index operation will inquire about data_vio.chunk_name, providing (if
  * the operation is appropriate) advice from the data_vio's new_mapped
  * fields. The advice found in the index (or NULL if none) will be returned via
  * receive_data_vio_dedupe_advice(). dedupe_context.status is set to the return
  * status code of any asynchronous index processing.
+ *
+ * The request is not launched immediately. Instead, it is added to the zone's
+ * list of submissions, and all of the requests made while the zone is busy are
+ * launched together by launch_index_requests_callback(). That callback is
+ * queued behind the data_vios already waiting on the zone's thread, at their
+ * priority, so that a steady stream of them can not starve it.
  */
 static void
 query_index(struct data_vio *data_vio, enum uds_request_type operation)
 {
-	int result;
 	struct dedupe_context *context;
 	struct vdo *vdo = vdo_from_data_vio(data_vio);
 	struct hash_zone *zone = data_vio->hash_zone;
 
 	assert_data_vio_in_hash_zone(data_vio);
 
-	if (!READ_ONCE(vdo->hash_zones->dedupe_flag)) {
+	if (!READ_ONCE(vdo->hash_zones->dedupe_flag) ||
+	    ((operation != UDS_UPDATE) && shed_query(zone))) {
 		continue_data_vio(data_vio, VDO_SUCCESS);
 		return;
 	}
@@ -3736,18 +4266,86 @@ query_index(struct data_vio *data_vio, enum uds_request_type operation)
 	data_vio->dedupe_context = context;
 	context->requestor = data_vio;
 	context->submission_jiffies = jiffies;
+	context->submission_time = current_time_ns(CLOCK_MONOTONIC);
 	prepare_uds_request(&context->request, data_vio, operation);
 	atomic_set(&context->state, DEDUPE_CONTEXT_PENDING);
 	list_add_tail(&context->list_entry, &zone->pending);
 	start_expiration_timer(context);
+	submit_index_request(zone, context);
+}
+
+/**
+ * refresh_cached_name() - Query the index for a name whose advice was taken
+ *                         from the advice cache, without waiting for the
+ *                         answer.
+ * @zone: The hash zone which found the cached advice.
+ * @name: The chunk name to refresh.
+ *
+ * The index moves each name it finds into its open chapter. A name which is
+ * only ever served from the cache would otherwise age out of the index, no
+ * matter how often it is written. The context is launched as if it had
+ * already timed out, so no data_vio waits for it, and it is recycled like any
+ * other timed out context once the index has completed it.
+ */
+static void refresh_cached_name(struct hash_zone *zone,
+				const struct uds_chunk_name *name)
+{
+	struct dedupe_context *context = acquire_context(zone);
+
+	if (context == NULL) {
+		/* The name will be refreshed on a later hit. */
+		return;
+	}
+
+	context->requestor = NULL;
+	context->submission_jiffies = jiffies;
+	context->submission_time = current_time_ns(CLOCK_MONOTONIC);
+	context->request.chunk_name = *name;
+	context->request.type = UDS_QUERY;
+	atomic_set(&context->state, DEDUPE_CONTEXT_TIMED_OUT);
+	list_add_tail(&context->list_entry, &zone->timed_out);
+	submit_index_request(zone, context);
+}
+
+/**
+ * launch_index_requests_callback() - Launch all of the index requests which
+ *                                    have accumulated in a hash zone.
+ * @completion: The zone's submission completion.
+ *
+ * The requests are handed to the index as a single batch so that the index
+ * session is only acquired once and each index zone queue is only woken once.
+ * This callback is registered in initialize_zone().
+ */
+static void launch_index_requests_callback(struct vdo_completion *completion)
+{
+	struct hash_zone *zone = as_submitting_hash_zone(completion);
+	vio_count_t count = zone->submission_count;
+	vio_count_t i;
+	int result;
+
+	zone->submission_count = 0;
 #ifdef INTERNAL
-	result = test_launch_request(&context->request);
-#else /* not INTERNAL */
-	result = uds_launch_request(&context->request);
+	if (uds_launch_request_hook != NULL) {
+		for (i = 0; i < count; i++) {
+			result = test_launch_request(zone->submissions[i]);
+			if (result != UDS_SUCCESS) {
+				zone->submissions[i]->status = result;
+				finish_index_operation(zone->submissions[i]);
+			}
+		}
+
+		return;
+	}
+
 #endif /* INTERNAL */
-	if (result != UDS_SUCCESS) {
-		context->request.status = result;
-		finish_index_operation(&context->request);
+	result = uds_launch_requests(zone->submissions, count);
+	if (result == UDS_SUCCESS) {
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		zone->submissions[i]->status = result;
+		finish_index_operation(zone->submissions[i]);
 	}
 }
 
@@ -74,7 +74,7 @@ void vdo_finish_dedupe_index(struct hash_zones *zones);
 
 /*
  * Interval (in milliseconds) from submission until switching to fast path and
- * skipping UDS.
+ * skipping UDS. If the timeout is adaptive, this is its upper bound.
  */
 extern unsigned int vdo_dedupe_index_timeout_interval;
 
@@ -84,8 +84,35 @@ extern unsigned int vdo_dedupe_index_timeout_interval;
  */
 extern unsigned int vdo_dedupe_index_min_timer_interval;
 
+/*
+ * Whether the verification read of a dedupe candidate is launched as soon as
+ * the PBN read lock on it is acquired, rather than after returning to the hash
+ * zone.
+ */
+extern bool vdo_speculative_verify;
+
+/*
+ * Whether each hash zone adapts its timeout to the latency of its index
+ * queries.
+ */
+extern bool vdo_adaptive_dedupe_timeout;
+
+/*
+ * Whether each hash zone skips the index for some queries when the index can
+ * not keep up with the target latency. Skipped posts are not added to the
+ * index.
+ */
+extern bool vdo_dedupe_query_shedding;
+
+/*
+ * The latency (in milliseconds) which the adaptive timeout tries to keep
+ * index queries from exceeding.
+ */
+extern unsigned int vdo_dedupe_target_latency;
+
 void vdo_set_dedupe_index_timeout_interval(unsigned int value);
 void vdo_set_dedupe_index_min_timer_interval(unsigned int value);
+void vdo_set_dedupe_target_latency(unsigned int value);
 
 #ifdef INTERNAL
 typedef int uds_request_hook(struct uds_request *request);
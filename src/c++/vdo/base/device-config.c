@@ -251,6 +251,33 @@ parse_bool(const char *bool_str,
 	return VDO_SUCCESS;
 }
 
+/**
+ * parse_cache_policy() - Parse the name of a block map cache replacement
+ *                        policy.
+ * @policy_str: The policy name.
+ * @policy_ptr: A pointer to return the policy in.
+ *
+ * Return: VDO_SUCCESS or an error if the name is not a known policy.
+ */
+static int __must_check
+parse_cache_policy(const char *policy_str,
+		   enum vdo_page_cache_policy *policy_ptr)
+{
+	if (strcmp(policy_str, "lru") == 0) {
+		*policy_ptr = VDO_PAGE_CACHE_POLICY_LRU;
+		return VDO_SUCCESS;
+	}
+
+	if (strcmp(policy_str, "2q") == 0) {
+		*policy_ptr = VDO_PAGE_CACHE_POLICY_2Q;
+		return VDO_SUCCESS;
+	}
+
+	uds_log_error("optional parameter error: cache policy must be \"lru\" or \"2q\", found \"%s\"",
+		      policy_str);
+	return VDO_BAD_CONFIGURATION;
+}
+
 /**
  * process_one_thread_config_spec() - Process one component of a
  *                                    thread parameter configuration
@@ -459,6 +486,17 @@ static int process_one_key_value_pair(const char *key,
 		config->max_discard_blocks = value;
 		return VDO_SUCCESS;
 	}
+
+	if (strcmp(key, "compressionAcceleration") == 0) {
+		if ((value == 0) ||
+		    (value > VDO_COMPRESSION_ACCELERATION_LIMIT)) {
+			uds_log_error("optional parameter error: compression acceleration must be between 1 and %d",
+				      VDO_COMPRESSION_ACCELERATION_LIMIT);
+			return -EINVAL;
+		}
+		config->compression_acceleration = value;
+		return VDO_SUCCESS;
+	}
 	/* Handles unknown key names */
 	return process_one_thread_config_spec(key, value,
 					      &config->thread_counts);
@@ -488,6 +526,10 @@ static int parse_one_key_value_pair(const char *key,
 		return parse_bool(value, "on", "off", &config->compression);
 	}
 
+	if (strcmp(key, "cachePolicy") == 0) {
+		return parse_cache_policy(value, &config->cache_policy);
+	}
+
 	/* The remaining arguments must have integral values. */
 	result = kstrtouint(value, 10, &count);
 	if (result != UDS_SUCCESS) {
@@ -673,6 +715,8 @@ int vdo_parse_device_config(int argc,
 	config->max_discard_blocks = 1;
 	config->deduplication = true;
 	config->compression = false;
+	config->cache_policy = VDO_PAGE_CACHE_POLICY_LRU;
+	config->compression_acceleration = DEFAULT_VDO_COMPRESSION_ACCELERATION;
 
 	arg_set.argc = argc;
 	arg_set.argv = argv;
@@ -919,6 +963,11 @@ int vdo_validate_new_device_config(struct device_config *to_validate,
 		return VDO_PARAMETER_MISMATCH;
 	}
 
+	if (to_validate->cache_policy != config->cache_policy) {
+		*error_ptr = "Block map cache policy cannot change";
+		return VDO_PARAMETER_MISMATCH;
+	}
+
 	if (to_validate->block_map_maximum_age !=
 	    config->block_map_maximum_age) {
 		*error_ptr = "Block map maximum age cannot change";
@@ -44,9 +44,11 @@ struct device_config {
 	block_count_t logical_blocks;
 	unsigned int logical_block_size;
 	unsigned int cache_size;
+	enum vdo_page_cache_policy cache_policy;
 	unsigned int block_map_maximum_age;
 	bool deduplication;
 	bool compression;
+	unsigned int compression_acceleration;
 	struct thread_count_config thread_counts;
 	block_count_t max_discard_blocks;
 };
@@ -181,6 +181,58 @@ void vdo_advance_dirty_lists_period(struct dirty_lists *dirty_lists,
 	write_expired_elements(dirty_lists);
 }
 
+/**
+ * vdo_get_dirty_lists_headroom() - Get the number of periods which may pass
+ *                                  before the oldest dirty element expires.
+ * @dirty_lists: The dirty_lists to examine.
+ *
+ * Return: The headroom, or the maximum age if there are no dirty elements.
+ */
+block_count_t
+vdo_get_dirty_lists_headroom(const struct dirty_lists *dirty_lists)
+{
+	sequence_number_t period;
+
+	for (period = dirty_lists->oldest_period;
+	     period < dirty_lists->next_period;
+	     period++) {
+		block_count_t offset = period % dirty_lists->maximum_age;
+
+		if (!list_empty(&dirty_lists->lists[offset])) {
+			return (period + dirty_lists->maximum_age
+				- (dirty_lists->next_period - 1));
+		}
+	}
+
+	return dirty_lists->maximum_age;
+}
+
+/**
+ * vdo_expire_oldest_dirty_elements() - Expire some of the oldest elements
+ *                                      without advancing the period.
+ * @dirty_lists: The dirty_lists from which to expire elements.
+ * @count: The maximum number of elements to expire.
+ */
+void vdo_expire_oldest_dirty_elements(struct dirty_lists *dirty_lists,
+				      block_count_t count)
+{
+	sequence_number_t period;
+
+	for (period = dirty_lists->oldest_period;
+	     (count > 0) && (period < dirty_lists->next_period);
+	     period++) {
+		struct list_head *dirty_list =
+			&dirty_lists->lists[period % dirty_lists->maximum_age];
+
+		while ((count > 0) && !list_empty(dirty_list)) {
+			list_move_tail(dirty_list->next, &dirty_lists->expired);
+			count--;
+		}
+	}
+
+	write_expired_elements(dirty_lists);
+}
+
 /**
  * vdo_flush_dirty_lists() - Flush all dirty lists.
  * @dirty_lists: The dirty_lists to flush.
@@ -48,6 +48,12 @@ void vdo_add_to_dirty_lists(struct dirty_lists *dirty_lists,
 void vdo_advance_dirty_lists_period(struct dirty_lists *dirty_lists,
 				    sequence_number_t period);
 
+block_count_t __must_check
+vdo_get_dirty_lists_headroom(const struct dirty_lists *dirty_lists);
+
+void vdo_expire_oldest_dirty_elements(struct dirty_lists *dirty_lists,
+				      block_count_t count);
+
 void vdo_flush_dirty_lists(struct dirty_lists *dirty_lists);
 
 #endif /* DIRTY_LISTS_H */
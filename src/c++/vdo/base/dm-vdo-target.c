@@ -6,12 +6,14 @@
 #include <linux/module.h>
 
 #include "bio.h"
+#include "block-map.h"
 #include "constants.h"
 #include "data-vio-pool.h"
 #include "dedupe.h"
 #include "device-registry.h"
 #include "dump.h"
 #include "flush.h"
+#include "forest.h"
 #include "instance-number.h"
 #include "io-submitter.h"
 #include "logger.h"
@@ -209,6 +211,23 @@ process_vdo_message_locked(struct vdo *vdo,
 					argv[1]);
 			return -EINVAL;
 		}
+
+		if (strcasecmp(argv[0], "cache-size") == 0) {
+			page_count_t cache_size;
+
+			if (kstrtouint(argv[1], 10, &cache_size) != 0) {
+				uds_log_warning("invalid argument '%s' to dmsetup cache-size message",
+						argv[1]);
+				return -EINVAL;
+			}
+
+			return vdo_resize_block_map_cache(vdo->block_map,
+							  cache_size);
+		}
+	}
+
+	if ((argc == 1) && (strcasecmp(argv[0], "warmup") == 0)) {
+		return vdo_warm_block_map(vdo->block_map);
 	}
 
 	uds_log_warning("unrecognized dmsetup message '%s' received", argv[0]);
@@ -348,12 +367,17 @@ static int vdo_initialize(struct dm_target *ti,
 	uds_log_debug("Physical block size    = %llu", (uint64_t) block_size);
 	uds_log_debug("Physical blocks        = %llu", config->physical_blocks);
 	uds_log_debug("Block map cache blocks = %u", config->cache_size);
+	uds_log_debug("Block map cache policy = %s",
+		      ((config->cache_policy == VDO_PAGE_CACHE_POLICY_2Q) ?
+		       "2q" : "lru"));
 	uds_log_debug("Block map maximum age  = %u",
 		      config->block_map_maximum_age);
 	uds_log_debug("Deduplication          = %s",
 		      (config->deduplication ? "on" : "off"));
 	uds_log_debug("Compression            = %s",
 		      (config->compression ? "on" : "off"));
+	uds_log_debug("Compression accel.     = %u",
+		      config->compression_acceleration);
 
 
 	vdo = vdo_find_matching(vdo_uses_device, config);
@@ -10,6 +10,7 @@
 #include "memory-alloc.h"
 #include "type-defs.h"
 
+#include "block-map.h"
 #include "constants.h"
 #include "data-vio.h"
 #include "dedupe.h"
@@ -81,7 +82,9 @@ static void do_dump(struct vdo *vdo,
 		}
 	}
 
+	vdo_dump_block_map(vdo->block_map);
 	vdo_dump_hash_zones(vdo->hash_zones);
+	vdo_dump_io_submitter(vdo->io_submitter);
 	dump_data_vio_pool(vdo->data_vio_pool,
 			   (dump_options_requested & FLAG_SHOW_VIO_POOL) != 0);
 	if ((dump_options_requested & FLAG_SHOW_VDO_STATUS) != 0) {
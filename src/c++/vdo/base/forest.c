@@ -13,21 +13,27 @@
 #include "block-map.h"
 #include "block-map-page.h"
 #include "block-map-tree.h"
+#include "completion.h"
 #include "constants.h"
+#include "data-vio.h"
 #include "dirty-lists.h"
 #include "forest.h"
 #include "io-submitter.h"
 #include "num-utils.h"
+#include "read-only-notifier.h"
 #include "recovery-journal.h"
 #include "slab-depot.h"
 #include "slab-journal.h"
 #include "types.h"
 #include "vdo.h"
+#include "vdo-page-cache.h"
 #include "vio.h"
 #include "vio-pool.h"
 
 enum {
 	BLOCK_MAP_VIO_POOL_SIZE = 64,
+	/* The number of leaf pages each zone's warmup may fetch at once */
+	WARMUP_FETCHES = 32,
 };
 
 struct block_map_tree_segment {
@@ -592,3 +598,560 @@ void vdo_traverse_forest(struct block_map *map,
 		acquire_vio_from_pool(cursors->pool, &cursor->waiter);
 	};
 }
+
+struct block_map_warmup {
+	/* The completion for starting and rescheduling the warmup */
+	struct vdo_completion completion;
+	struct block_map_zone *zone;
+	/* The first error encountered */
+	int result;
+	/* The tree being walked */
+	root_count_t root;
+	struct boundary boundary;
+	height_t height;
+	struct cursor_level levels[VDO_BLOCK_MAP_TREE_HEIGHT];
+	/* The number of leaf pages of the tree which have been scanned */
+	page_count_t leaves_scanned;
+	/*
+	 * The waiter for a tree page lock held by another lookup, or for a vio
+	 * with which to load a tree page
+	 */
+	struct waiter waiter;
+	/* The lock on the tree page being loaded */
+	struct tree_lock lock;
+	/* Whether the walk is waiting for a leaf page fetch to finish */
+	bool waiting_for_fetch;
+	/* The number of leaf pages fetched into the page cache */
+	page_count_t leaves_fetched;
+	page_count_t idle_fetch_count;
+	struct vdo_page_completion *idle_fetches[WARMUP_FETCHES];
+	struct vdo_page_completion fetches[WARMUP_FETCHES];
+};
+
+static void warm_trees(struct block_map_warmup *warmup);
+
+static bool is_warmup_walk_done(struct block_map_warmup *warmup)
+{
+	return (warmup->root >= warmup->zone->block_map->root_count);
+}
+
+/**
+ * stop_warmup_walk() - Stop walking the trees of a zone.
+ * @warmup: The warmup.
+ * @result: The reason for stopping.
+ *
+ * The warmup finishes once its outstanding fetches are done.
+ */
+static void stop_warmup_walk(struct block_map_warmup *warmup, int result)
+{
+	if (warmup->result == VDO_SUCCESS) {
+		warmup->result = result;
+	}
+
+	warmup->root = warmup->zone->block_map->root_count;
+}
+
+/**
+ * finish_warmup_if_done() - Free a warmup if it is done walking and has no
+ *                           fetches outstanding.
+ * @warmup: The warmup.
+ */
+static void finish_warmup_if_done(struct block_map_warmup *warmup)
+{
+	struct block_map_zone *zone = warmup->zone;
+
+	if (!is_warmup_walk_done(warmup) ||
+	    (warmup->idle_fetch_count < WARMUP_FETCHES)) {
+		return;
+	}
+
+	if (warmup->result == VDO_SUCCESS) {
+		uds_log_info("block map zone %u warmup complete, %u leaf pages fetched",
+			     zone->zone_number, warmup->leaves_fetched);
+	} else {
+		uds_log_warning_strerror(warmup->result,
+					 "block map zone %u warmup stopped",
+					 zone->zone_number);
+	}
+
+	zone->warmup = NULL;
+	UDS_FREE(warmup);
+	vdo_block_map_check_for_drain_complete(zone);
+}
+
+/**
+ * start_warming_tree() - Position a warmup at the root of a tree.
+ * @warmup: The warmup.
+ * @root: The index of the tree; the walk is done if it is past the last tree.
+ */
+static void start_warming_tree(struct block_map_warmup *warmup,
+			       root_count_t root)
+{
+	struct block_map *map = warmup->zone->block_map;
+
+	warmup->root = root;
+	if (is_warmup_walk_done(warmup)) {
+		return;
+	}
+
+	warmup->boundary = compute_boundary(map, root);
+	warmup->height = VDO_BLOCK_MAP_TREE_HEIGHT - 1;
+	warmup->levels[warmup->height] = (struct cursor_level) {
+		.page_index = 0,
+		.slot = 0,
+	};
+	warmup->leaves_scanned = 0;
+}
+
+/**
+ * get_leaves_per_entry() - Get the number of leaf pages below each entry of a
+ *                          tree page.
+ * @height: The height of the tree page.
+ */
+static block_count_t get_leaves_per_entry(height_t height)
+{
+	block_count_t leaves = 1;
+
+	for (; height > 0; height--) {
+		leaves *= VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+	}
+
+	return leaves;
+}
+
+/**
+ * scan_leaves() - Count the leaf pages of the current tree before a given
+ *                 leaf page as scanned.
+ * @warmup: The warmup.
+ * @end: The index in the tree of the first leaf page not yet scanned.
+ */
+static void scan_leaves(struct block_map_warmup *warmup, block_count_t end)
+{
+	struct block_map_statistics *stats = &warmup->zone->page_cache->stats;
+
+	end = min(end, (block_count_t) warmup->boundary.levels[0]);
+	if (end <= warmup->leaves_scanned) {
+		return;
+	}
+
+	WRITE_ONCE(stats->warmup_pages_scanned,
+		   stats->warmup_pages_scanned + end - warmup->leaves_scanned);
+	warmup->leaves_scanned = end;
+}
+
+/**
+ * is_warmable_entry() - Check whether an entry in a tree page refers to a
+ *                       page which can be loaded.
+ * @depot: The slab depot.
+ * @mapping: The unpacked entry.
+ * @height: The height of the tree page holding the entry.
+ *
+ * Invalid entries are skipped; the lookup which needs them will report them.
+ */
+static bool is_warmable_entry(struct slab_depot *depot,
+			      const struct data_location *mapping,
+			      height_t height)
+{
+	if (!vdo_is_valid_location(mapping) ||
+	    !vdo_is_mapped_location(mapping) ||
+	    vdo_is_state_compressed(mapping->state) ||
+	    (mapping->pbn == VDO_ZERO_BLOCK)) {
+		return false;
+	}
+
+	/*
+	 * The only entry at the top height is the location of the tree's root,
+	 * which is in the block map partition rather than in the slab depot.
+	 */
+	return ((height == VDO_BLOCK_MAP_TREE_HEIGHT - 1) ||
+		vdo_is_physical_data_block(depot, mapping->pbn));
+}
+
+/**
+ * finish_leaf_fetch() - Release a leaf page once it is in the page cache.
+ * @completion: The vdo_page_completion of the fetch.
+ *
+ * This callback is also the error handler for fetches; a failed fetch puts
+ * the VDO in read-only mode, which will stop the walk.
+ */
+static void finish_leaf_fetch(struct vdo_completion *completion)
+{
+	struct block_map_warmup *warmup = completion->parent;
+
+	vdo_release_page_completion(completion);
+	warmup->idle_fetches[warmup->idle_fetch_count++] =
+		container_of(completion, struct vdo_page_completion, completion);
+	if (warmup->waiting_for_fetch) {
+		warmup->waiting_for_fetch = false;
+		warm_trees(warmup);
+		return;
+	}
+
+	finish_warmup_if_done(warmup);
+}
+
+/**
+ * fetch_leaf() - Fetch a leaf page into the page cache.
+ * @warmup: The warmup, which must have an idle fetch.
+ * @pbn: The location of the leaf page.
+ */
+static void fetch_leaf(struct block_map_warmup *warmup,
+		       physical_block_number_t pbn)
+{
+	struct vdo_page_cache *cache = warmup->zone->page_cache;
+	struct vdo_page_completion *fetch =
+		warmup->idle_fetches[--warmup->idle_fetch_count];
+
+	warmup->leaves_fetched++;
+	WRITE_ONCE(cache->stats.warmup_leaf_pages_fetched,
+		   cache->stats.warmup_leaf_pages_fetched + 1);
+	vdo_init_page_completion(fetch, cache, pbn, false, warmup,
+				 finish_leaf_fetch, finish_leaf_fetch);
+	vdo_get_page(&fetch->completion);
+}
+
+/**
+ * finish_warmup_load() - Install a tree page loaded by a warmup and continue
+ *                        the walk.
+ * @completion: The vio which did the read.
+ */
+static void finish_warmup_load(struct vdo_completion *completion)
+{
+	struct vio_pool_entry *entry = completion->parent;
+	struct block_map_warmup *warmup = entry->parent;
+	struct block_map_tree_zone *zone = &warmup->zone->tree_zone;
+	struct block_map_statistics *stats = &warmup->zone->page_cache->stats;
+
+	vdo_finish_tree_page_load(zone, &warmup->lock, entry->buffer);
+	return_vio_to_pool(zone->vio_pool, entry);
+	WRITE_ONCE(stats->warmup_tree_pages_loaded,
+		   stats->warmup_tree_pages_loaded + 1);
+	warm_trees(warmup);
+}
+
+/**
+ * handle_warmup_load_error() - Abandon a tree page load which failed.
+ * @completion: The vio which did the read.
+ */
+static void handle_warmup_load_error(struct vdo_completion *completion)
+{
+	int result = completion->result;
+	struct vio_pool_entry *entry = completion->parent;
+	struct block_map_warmup *warmup = entry->parent;
+	struct block_map_tree_zone *zone = &warmup->zone->tree_zone;
+
+	record_metadata_io_error(as_vio(completion));
+	return_vio_to_pool(zone->vio_pool, entry);
+	vdo_abort_tree_page_load(zone, &warmup->lock, result);
+	stop_warmup_walk(warmup, result);
+	finish_warmup_if_done(warmup);
+}
+
+static void warmup_load_endio(struct bio *bio)
+{
+	struct vio *vio = bio->bi_private;
+	struct vio_pool_entry *entry = vio->completion.parent;
+	struct block_map_warmup *warmup = entry->parent;
+
+	continue_vio_after_io(vio, finish_warmup_load, warmup->zone->thread_id);
+}
+
+/**
+ * launch_warmup_load() - Read a tree page now that the warmup has a vio.
+ * @waiter: The warmup's waiter.
+ * @context: The vio_pool_entry just acquired.
+ *
+ * Implements waiter_callback.
+ */
+static void launch_warmup_load(struct waiter *waiter, void *context)
+{
+	struct vio_pool_entry *entry = context;
+	struct block_map_warmup *warmup =
+		container_of(waiter, struct block_map_warmup, waiter);
+	struct tree_lock *lock = &warmup->lock;
+	physical_block_number_t pbn =
+		lock->tree_slots[lock->height - 1].block_map_slot.pbn;
+
+	entry->parent = warmup;
+	submit_metadata_vio(entry->vio,
+			    pbn,
+			    warmup_load_endio,
+			    handle_warmup_load_error,
+			    REQ_OP_READ | REQ_PRIO);
+}
+
+/**
+ * retry_warmup_load() - Resume the walk once another lookup has released
+ *                       the lock on a tree page the warmup needs.
+ * @waiter: The warmup's waiter.
+ * @context: Not used.
+ *
+ * Implements waiter_callback.
+ */
+static void retry_warmup_load(struct waiter *waiter,
+			      void *context __always_unused)
+{
+	struct block_map_warmup *warmup =
+		container_of(waiter, struct block_map_warmup, waiter);
+
+	vdo_enqueue_completion(&warmup->completion);
+}
+
+/**
+ * load_tree_page() - Lock and load a tree page which is not in memory.
+ * @warmup: The warmup.
+ * @height: The height of the tree page with the entry for the page.
+ * @level: The position of that entry, which has already been passed.
+ * @pbn: The location of the page.
+ *
+ * If some other lookup is already loading or allocating the page, the
+ * warmup waits for it to release the page lock and then retries the entry.
+ *
+ * Return: true if the walk will continue once the load is done or the lock
+ *         is released, false if the walk has been stopped.
+ */
+static bool load_tree_page(struct block_map_warmup *warmup,
+			   height_t height,
+			   struct cursor_level *level,
+			   physical_block_number_t pbn)
+{
+	int result;
+	struct block_map_tree_zone *zone = &warmup->zone->tree_zone;
+	struct tree_lock *lock = &warmup->lock;
+	slot_number_t slot = level->slot - 1;
+
+	lock->root_index = warmup->root;
+	lock->height = height + 1;
+	lock->tree_slots[height + 1] = (struct block_map_tree_slot) {
+		.page_index = level->page_index,
+		.block_map_slot.slot = slot,
+	};
+	lock->tree_slots[height] = (struct block_map_tree_slot) {
+		.page_index = ((VDO_BLOCK_MAP_ENTRIES_PER_PAGE *
+				level->page_index) + slot),
+		.block_map_slot.pbn = pbn,
+	};
+
+	warmup->waiter.callback = retry_warmup_load;
+	result = vdo_try_lock_tree_page(zone, lock, &warmup->waiter);
+	if (result != VDO_SUCCESS) {
+		stop_warmup_walk(warmup, result);
+		return false;
+	}
+
+	if (!lock->locked) {
+		/* Come back to this entry once the page has been loaded. */
+		warmup->height++;
+		level->slot--;
+		return true;
+	}
+
+	warmup->waiter.callback = launch_warmup_load;
+	result = acquire_vio_from_pool(zone->vio_pool, &warmup->waiter);
+	if (result != VDO_SUCCESS) {
+		vdo_abort_tree_page_load(zone, lock, result);
+		stop_warmup_walk(warmup, result);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * warm_trees() - Walk the trees of a zone from where the warmup left off.
+ * @warmup: The warmup.
+ *
+ * Tree pages which are not in memory are loaded one at a time, under the same
+ * locks as lookups use, while leaf pages are fetched into the page cache up
+ * to WARMUP_FETCHES at a time. Leaf fetching stops once a cache's worth of
+ * pages has been fetched, since more would only evict earlier ones. No data
+ * blocks are read.
+ */
+static void warm_trees(struct block_map_warmup *warmup)
+{
+	struct block_map_zone *zone = warmup->zone;
+	struct block_map *map = zone->block_map;
+	struct slab_depot *depot = zone->page_cache->vdo->depot;
+	slot_number_t budget = VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+
+	while (!is_warmup_walk_done(warmup)) {
+		height_t height = warmup->height;
+		struct cursor_level *level = &warmup->levels[height];
+		struct tree_page *tree_page, *child;
+		struct block_map_page *page;
+		struct data_location mapping;
+		page_number_t entry_index;
+
+		if (!vdo_is_state_normal(&zone->state)) {
+			stop_warmup_walk(warmup, VDO_SHUTTING_DOWN);
+			break;
+		}
+
+		if (vdo_is_read_only(zone->read_only_notifier)) {
+			stop_warmup_walk(warmup, VDO_READ_ONLY);
+			break;
+		}
+
+		if (height == VDO_BLOCK_MAP_TREE_HEIGHT) {
+			scan_leaves(warmup, warmup->boundary.levels[0]);
+			start_warming_tree(warmup,
+					   warmup->root + map->zone_count);
+			continue;
+		}
+
+		tree_page = vdo_get_tree_page_by_index(map->forest,
+						       warmup->root,
+						       height + 1,
+						       level->page_index);
+		page = vdo_as_block_map_page(tree_page);
+		entry_index = ((VDO_BLOCK_MAP_ENTRIES_PER_PAGE *
+				level->page_index) + level->slot);
+		if (!vdo_is_block_map_page_initialized(page) ||
+		    (level->slot == VDO_BLOCK_MAP_ENTRIES_PER_PAGE) ||
+		    (entry_index >= warmup->boundary.levels[height])) {
+			/* This page is done. */
+			scan_leaves(warmup,
+				    ((level->page_index + 1) *
+				     get_leaves_per_entry(height + 1)));
+			warmup->height++;
+			continue;
+		}
+
+		if (budget-- == 0) {
+			/* Let the zone's other work run. */
+			vdo_enqueue_completion(&warmup->completion);
+			return;
+		}
+
+		mapping =
+			vdo_unpack_block_map_entry(&page->entries[level->slot]);
+		if (!is_warmable_entry(depot, &mapping, height)) {
+			level->slot++;
+			scan_leaves(warmup,
+				    ((entry_index + 1) *
+				     get_leaves_per_entry(height)));
+			continue;
+		}
+
+		if (height == 0) {
+			if (warmup->leaves_fetched >=
+			    zone->page_cache->page_count) {
+				level->slot = VDO_BLOCK_MAP_ENTRIES_PER_PAGE;
+				continue;
+			}
+
+			if (warmup->idle_fetch_count == 0) {
+				warmup->waiting_for_fetch = true;
+				return;
+			}
+
+			level->slot++;
+			scan_leaves(warmup, entry_index + 1);
+			fetch_leaf(warmup, mapping.pbn);
+			continue;
+		}
+
+		level->slot++;
+		warmup->height--;
+		warmup->levels[height - 1] = (struct cursor_level) {
+			.page_index = entry_index,
+			.slot = 0,
+		};
+		child = vdo_get_tree_page_by_index(map->forest, warmup->root,
+						   height, entry_index);
+		if (vdo_get_block_map_page_pbn(vdo_as_block_map_page(child)) !=
+		    VDO_ZERO_BLOCK) {
+			continue;
+		}
+
+		if (load_tree_page(warmup, height, level, mapping.pbn)) {
+			/* The walk will continue when the page is loaded. */
+			return;
+		}
+	}
+
+	finish_warmup_if_done(warmup);
+}
+
+static void continue_warming(struct vdo_completion *completion)
+{
+	warm_trees(container_of(completion, struct block_map_warmup,
+				completion));
+}
+
+/**
+ * start_warmup() - Start warming a zone on its own thread.
+ * @completion: The completion of the warmup.
+ */
+static void start_warmup(struct vdo_completion *completion)
+{
+	struct block_map_warmup *warmup =
+		container_of(completion, struct block_map_warmup, completion);
+	struct block_map_zone *zone = warmup->zone;
+	page_count_t i;
+
+	if (zone->warmup != NULL) {
+		uds_log_info("block map zone %u warmup already in progress",
+			     zone->zone_number);
+		UDS_FREE(warmup);
+		return;
+	}
+
+	if (!vdo_is_state_normal(&zone->state) ||
+	    vdo_is_read_only(zone->read_only_notifier)) {
+		uds_log_warning("block map zone %u is not in normal operation, warmup not started",
+				zone->zone_number);
+		UDS_FREE(warmup);
+		return;
+	}
+
+	zone->warmup = warmup;
+	for (i = 0; i < WARMUP_FETCHES; i++) {
+		warmup->idle_fetches[i] = &warmup->fetches[i];
+	}
+
+	warmup->idle_fetch_count = WARMUP_FETCHES;
+	completion->callback = continue_warming;
+	start_warming_tree(warmup, zone->zone_number);
+	warm_trees(warmup);
+}
+
+/**
+ * vdo_warm_block_map() - Start loading the pages of a block map into memory.
+ * @map: The block map to warm.
+ *
+ * Each logical zone walks its own trees on its own thread, loading the tree
+ * pages which are not yet in memory and fetching leaf pages into its page
+ * cache. The warmup runs in the background; its progress is reported in the
+ * block map statistics, and it stops if the block map is suspended.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int vdo_warm_block_map(struct block_map *map)
+{
+	zone_count_t zone_number;
+
+	page_count_t leaf_pages =
+		vdo_compute_block_map_page_count(map->entry_count);
+
+	uds_log_info("starting block map warmup of %u leaf pages", leaf_pages);
+	for (zone_number = 0; zone_number < map->zone_count; zone_number++) {
+		struct block_map_zone *zone = &map->zones[zone_number];
+		struct block_map_warmup *warmup;
+		int result = UDS_ALLOCATE(1, struct block_map_warmup, __func__,
+					  &warmup);
+		if (result != VDO_SUCCESS) {
+			return result;
+		}
+
+		warmup->zone = zone;
+		vdo_initialize_completion(&warmup->completion,
+					  zone->page_cache->vdo,
+					  VDO_BLOCK_MAP_WARMUP_COMPLETION);
+		vdo_launch_completion_callback(&warmup->completion,
+					       start_warmup,
+					       zone->thread_id);
+	}
+
+	return VDO_SUCCESS;
+}
@@ -38,4 +38,6 @@ void vdo_traverse_forest(struct block_map *map,
 			 vdo_entry_callback *callback,
 			 struct vdo_completion *parent);
 
+int __must_check vdo_warm_block_map(struct block_map *map);
+
 #endif /* FOREST_H */
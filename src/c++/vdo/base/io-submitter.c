@@ -10,6 +10,7 @@
 #include <linux/mutex.h>
 #include <linux/version.h>
 
+#include "cpu.h"
 #include "memory-alloc.h"
 #include "permassert.h"
 
@@ -21,6 +22,9 @@
 #include "vdo.h"
 #include "vio.h"
 
+/* This is a module parameter. */
+bool vdo_merge_metadata_bios = true;
+
 /*
  * Submission of bio operations to the underlying storage device will
  * go through a separate work queue thread (or more than one) to
@@ -33,18 +37,40 @@
  * consistently wind up on the same thread. Flush operations are
  * assigned round-robin.
  *
- * The map (protected by the mutex) collects pending I/O operations so
- * that the worker thread can reorder them to try to encourage I/O
- * request merging in the request queue underneath.
+ * The maps (each protected by its own mutex) collect pending I/O
+ * operations so that the worker thread can reorder them to try to
+ * encourage I/O request merging in the request queue underneath. Data I/O
+ * and, unless disabled, metadata I/O other than flushes go through the maps.
+ *
+ * Each bio zone handles runs of bio_rotation_interval consecutive blocks, and
+ * spreads its runs over several maps so that submitters working on different
+ * parts of the zone do not contend for the same lock. Since all of a run is
+ * in the same map, and adjacent runs go to different zones anyway, this
+ * only prevents merges across runs when there is a single bio zone.
  */
+enum {
+	BIO_MAP_SHARDS = 8,
+};
+
+struct __attribute__((aligned(CACHE_LINE_BYTES))) bio_map_shard {
+	struct int_map *map;
+	struct mutex lock;
+	/*
+	 * The number of bios which have gone through the map, and how many of
+	 * those were merged with a pending bio. These are protected by the
+	 * lock.
+	 */
+	uint64_t bios_queued;
+	uint64_t bios_merged;
+};
+
 struct bio_queue_data {
 	struct vdo_work_queue *queue;
 #ifdef __KERNEL__
 	struct blk_plug plug;
 #endif /* __KERNEL__ */
-	struct int_map *map;
-	struct mutex lock;
 	unsigned int queue_number;
+	struct bio_map_shard shards[BIO_MAP_SHARDS];
 };
 
 struct io_submitter {
@@ -158,6 +184,25 @@ void process_vio_io(struct vdo_completion *completion)
 	send_bio_to_device(vio, vio->bio);
 }
 
+/**
+ * get_bio_map_shard() - Get the bio map which holds a vio's pending bio.
+ * @vio: The vio.
+ *
+ * Return: The shard of the vio's bio zone for the run containing the vio's
+ *         physical block.
+ */
+static struct bio_map_shard *get_bio_map_shard(struct vio *vio)
+{
+	struct io_submitter *submitter = vdo_from_vio(vio)->io_submitter;
+	struct bio_queue_data *bio_queue_data
+		= &submitter->bio_queue_data[vio->bio_zone];
+	block_count_t run
+		= vio->physical / submitter->bio_queue_rotation_interval;
+
+	return &bio_queue_data->shards[(run / submitter->num_bio_queues_used)
+				       % BIO_MAP_SHARDS];
+}
+
 /**
  * get_bio_list() - Extract the list of bios to submit from a vio.
  * @vio: The vio submitting I/O.
@@ -171,32 +216,28 @@ void process_vio_io(struct vdo_completion *completion)
 static struct bio *get_bio_list(struct vio *vio)
 {
 	struct bio *bio;
-	struct io_submitter *submitter = vdo_from_vio(vio)->io_submitter;
-	struct bio_queue_data *bio_queue_data
-		= &(submitter->bio_queue_data[vio->bio_zone]);
+	struct bio_map_shard *shard = get_bio_map_shard(vio);
 
 	assert_in_bio_zone(vio);
 
-	mutex_lock(&bio_queue_data->lock);
-	int_map_remove(bio_queue_data->map,
-		       get_bio_sector(vio->bios_merged.head));
-	int_map_remove(bio_queue_data->map,
-		       get_bio_sector(vio->bios_merged.tail));
+	mutex_lock(&shard->lock);
+	int_map_remove(shard->map, get_bio_sector(vio->bios_merged.head));
+	int_map_remove(shard->map, get_bio_sector(vio->bios_merged.tail));
 	bio = vio->bios_merged.head;
 	bio_list_init(&vio->bios_merged);
-	mutex_unlock(&bio_queue_data->lock);
+	mutex_unlock(&shard->lock);
 
 	return bio;
 }
 
 /**
- * process_data_vio_io() - Submit a data_vio's bio to the storage below
- *                         along with any bios that have been merged with it.
+ * process_merged_vio_io() - Submit a vio's bio to the storage below along
+ *                           with any bios that have been merged with it.
  *
  * Context: This call may block and so should only be called from a
  *          bio thread.
  */
-static void process_data_vio_io(struct vdo_completion *completion)
+static void process_merged_vio_io(struct vdo_completion *completion)
 {
 	struct bio *bio, *next;
 	struct vio *vio = as_vio(completion);
@@ -306,29 +347,31 @@ static int merge_to_next_head(struct int_map *bio_map,
 /**
  * try_bio_map_merge() - Attempt to merge a vio's bio with other pending I/Os.
  * @vio: The vio to merge.
+ * @priority: The priority at which the vio's I/O will be submitted.
  *
- * Currently this is only used for data_vios, but is broken out for
- * future use with metadata vios.
+ * Only bios which will be submitted at the same priority are merged, so the
+ * priority is recorded in the vio's completion before it enters the map.
  *
  * Return: whether or not the vio was merged.
  */
-static bool try_bio_map_merge(struct vio *vio)
+static bool try_bio_map_merge(struct vio *vio,
+			      enum vdo_completion_priority priority)
 {
 	int result;
 	bool merged = true;
 	struct bio *bio = vio->bio;
 	struct vio *prev_vio, *next_vio;
 	struct vdo *vdo = vdo_from_vio(vio);
-	struct bio_queue_data *bio_queue_data
-		= &vdo->io_submitter->bio_queue_data[vio->bio_zone];
+	struct bio_map_shard *shard = get_bio_map_shard(vio);
 
 	bio->bi_next = NULL;
 	bio_list_init(&vio->bios_merged);
 	bio_list_add(&vio->bios_merged, bio);
+	vio_as_completion(vio)->priority = priority;
 
-	mutex_lock(&bio_queue_data->lock);
-	prev_vio = get_mergeable_locked(bio_queue_data->map, vio, true);
-	next_vio = get_mergeable_locked(bio_queue_data->map, vio, false);
+	mutex_lock(&shard->lock);
+	prev_vio = get_mergeable_locked(shard->map, vio, true);
+	next_vio = get_mergeable_locked(shard->map, vio, false);
 	if (prev_vio == next_vio) {
 		next_vio = NULL;
 	}
@@ -336,60 +379,79 @@ static bool try_bio_map_merge(struct vio *vio)
 	if ((prev_vio == NULL) && (next_vio == NULL)) {
 		/* no merge. just add to bio_queue */
 		merged = false;
-		result = int_map_put(bio_queue_data->map, get_bio_sector(bio),
+		result = int_map_put(shard->map, get_bio_sector(bio),
 				     vio, true, NULL);
 	} else if (next_vio == NULL) {
 		/* Only prev. merge to prev's tail */
-		result = merge_to_prev_tail(bio_queue_data->map,
-					    vio,
-					    prev_vio);
+		result = merge_to_prev_tail(shard->map, vio, prev_vio);
 	} else {
 		/* Only next. merge to next's head */
-		result = merge_to_next_head(bio_queue_data->map,
-					    vio,
-					    next_vio);
+		result = merge_to_next_head(shard->map, vio, next_vio);
+	}
+
+	WRITE_ONCE(shard->bios_queued, shard->bios_queued + 1);
+	if (merged) {
+		WRITE_ONCE(shard->bios_merged, shard->bios_merged + 1);
 	}
 
-	mutex_unlock(&bio_queue_data->lock);
+	mutex_unlock(&shard->lock);
 
 	/* We don't care about failure of int_map_put in this case. */
 	ASSERT_LOG_ONLY(result == UDS_SUCCESS, "bio map insertion succeeds");
+	if (merged) {
+		vdo_count_bios((is_data_vio(vio)
+				? &vdo->stats.bios_out_merged
+				: &vdo->stats.bios_meta_merged),
+			       bio);
+	}
+
 	return merged;
 }
 
 /**
- * submit_data_vio_io() - Submit I/O for a data_vio.
+ * submit_vio_with_merging() - Submit a vio's I/O, merging it with other
+ *                             pending I/Os if possible.
+ * @vio: The vio for which to issue I/O.
+ * @priority: The priority at which to submit the I/O.
+ *
+ * A vio which is merged will be submitted along with the vio it was merged
+ * with. Otherwise, the vio will be sent to the appropriate bio zone directly.
+ */
+static void submit_vio_with_merging(struct vio *vio,
+				    enum vdo_completion_priority priority)
+{
+	struct vdo_completion *completion = vio_as_completion(vio);
+
+	if (try_bio_map_merge(vio, priority)) {
+		return;
+	}
+
+	vdo_set_completion_callback(completion,
+				    process_merged_vio_io,
+				    get_vio_bio_zone_thread_id(vio));
+	vdo_invoke_completion_callback_with_priority(completion, priority);
+}
+
+/**
+ * submit_data_vio_io_with_priority() - Submit I/O for a data_vio at a given
+ *                                      priority.
  * @data_vio: the data_vio for which to issue I/O.
+ * @priority: the priority at which to submit the I/O.
  *
  * If possible, this I/O will be merged other pending I/Os. Otherwise,
  * the data_vio will be sent to the appropriate bio zone directly.
  */
-void submit_data_vio_io(struct data_vio *data_vio)
+void submit_data_vio_io_with_priority(struct data_vio *data_vio,
+				      enum vdo_completion_priority priority)
 {
 #ifdef VDO_INTERNAL
 	data_vio_as_vio(data_vio)->bio_submission_jiffies = jiffies;
 #endif
-	if (try_bio_map_merge(data_vio_as_vio(data_vio))) {
-		return;
-	}
-
-	launch_data_vio_bio_zone_callback(data_vio,
-					  process_data_vio_io);
-
+	submit_vio_with_merging(data_vio_as_vio(data_vio), priority);
 }
 
 /**
- * vdo_submit_metadata_io() - Submit I/O for a metadata vio.
- *
- * The vio is enqueued on a vdo bio queue so that bio submission (which may
- * block) does not block other vdo threads.
- *
- * That the error handler will run on the correct thread is only true so long
- * as the thread calling this function, and the thread set in the endio
- * callback are the same, as well as the fact that no error can occur on the
- * bio queue. Currently this is true for all callers, but additional care will
- * be needed if this ever changes.
-
+ * prepare_metadata_io() - Reset a metadata vio and its bio for I/O.
  * @vio: the vio for which to issue I/O
  * @physical: the physical block number to read or write
  * @callback: the bio endio function which will be called after the I/O
@@ -397,13 +459,16 @@ void submit_data_vio_io(struct data_vio *data_vio)
  * @error_handler: the handler for submission or I/O errors (may be NULL)
  * @operation: the type of I/O to perform
  * @data: the buffer to read or write (may be NULL)
+ *
+ * Return: true if the vio is ready for submission; if not, the vio has been
+ *         continued with the error.
  **/
-void vdo_submit_metadata_io(struct vio *vio,
-			    physical_block_number_t physical,
-			    bio_end_io_t callback,
-			    vdo_action *error_handler,
-			    unsigned int operation,
-			    char *data)
+static bool prepare_metadata_io(struct vio *vio,
+				physical_block_number_t physical,
+				bio_end_io_t callback,
+				vdo_action *error_handler,
+				unsigned int operation,
+				char *data)
 {
 	struct vdo_completion *completion = vio_as_completion(vio);
 	int result;
@@ -440,9 +505,20 @@ void vdo_submit_metadata_io(struct vio *vio,
 					   vio->physical);
 	if (result != VDO_SUCCESS) {
 		continue_vio(vio, result);
-		return;
+		return false;
 	}
 
+	return true;
+}
+
+/**
+ * launch_metadata_io() - Enqueue a prepared metadata vio on its bio queue.
+ * @vio: the vio to submit
+ **/
+static void launch_metadata_io(struct vio *vio)
+{
+	struct vdo_completion *completion = vio_as_completion(vio);
+
 	vdo_set_completion_callback(completion,
 				    process_vio_io,
 				    get_vio_bio_zone_thread_id(vio));
@@ -450,6 +526,163 @@ void vdo_submit_metadata_io(struct vio *vio,
 						     get_metadata_priority(vio));
 }
 
+/**
+ * vdo_submit_metadata_io() - Submit I/O for a metadata vio.
+ *
+ * The vio is enqueued on a vdo bio queue so that bio submission (which may
+ * block) does not block other vdo threads.
+ *
+ * That the error handler will run on the correct thread is only true so long
+ * as the thread calling this function, and the thread set in the endio
+ * callback are the same, as well as the fact that no error can occur on the
+ * bio queue. Currently this is true for all callers, but additional care will
+ * be needed if this ever changes.
+
+ * @vio: the vio for which to issue I/O
+ * @physical: the physical block number to read or write
+ * @callback: the bio endio function which will be called after the I/O
+ *            completes
+ * @error_handler: the handler for submission or I/O errors (may be NULL)
+ * @operation: the type of I/O to perform
+ * @data: the buffer to read or write (may be NULL)
+ *
+ * Unless metadata merging has been disabled, I/O other than flushes may be
+ * merged with other pending I/O to adjacent blocks.
+ **/
+void vdo_submit_metadata_io(struct vio *vio,
+			    physical_block_number_t physical,
+			    bio_end_io_t callback,
+			    vdo_action *error_handler,
+			    unsigned int operation,
+			    char *data)
+{
+	if (!prepare_metadata_io(vio,
+				 physical,
+				 callback,
+				 error_handler,
+				 operation,
+				 data)) {
+		return;
+	}
+
+	if ((data != NULL) &&
+	    ((operation & REQ_PREFLUSH) == 0) &&
+	    READ_ONCE(vdo_merge_metadata_bios)) {
+		submit_vio_with_merging(vio, get_metadata_priority(vio));
+		return;
+	}
+
+	launch_metadata_io(vio);
+}
+
+/**
+ * vdo_submit_discard() - Submit a discard of a run of blocks.
+ * @vio: the vio for which to issue the discard
+ * @physical: the first physical block to discard
+ * @block_count: the number of blocks to discard, which is not limited by the
+ *               size of the vio
+ * @callback: the bio endio function which will be called after the discard
+ *            completes
+ * @error_handler: the handler for submission or I/O errors
+ *
+ * A discard carries no data, so it is never merged with other I/O.
+ **/
+void vdo_submit_discard(struct vio *vio,
+			physical_block_number_t physical,
+			block_count_t block_count,
+			bio_end_io_t callback,
+			vdo_action *error_handler)
+{
+	if (!prepare_metadata_io(vio,
+				 physical,
+				 callback,
+				 error_handler,
+				 REQ_OP_DISCARD,
+				 NULL)) {
+		return;
+	}
+
+	vio->bio->bi_iter.bi_size = block_count * VDO_BLOCK_SIZE;
+	launch_metadata_io(vio);
+}
+
+/**
+ * vdo_dump_io_submitter() - Dump the merging statistics of each bio zone.
+ * @io_submitter: The io_submitter to dump (may be NULL).
+ *
+ * Context: dumps in a thread-unsafe fashion.
+ */
+void vdo_dump_io_submitter(const struct io_submitter *io_submitter)
+{
+	unsigned int i;
+
+	if (io_submitter == NULL) {
+		return;
+	}
+
+	for (i = 0; i < io_submitter->num_bio_queues_used; i++) {
+		const struct bio_queue_data *bio_queue_data =
+			&io_submitter->bio_queue_data[i];
+		uint64_t queued = 0;
+		uint64_t merged = 0;
+		unsigned int s;
+
+		for (s = 0; s < BIO_MAP_SHARDS; s++) {
+			const struct bio_map_shard *shard =
+				&bio_queue_data->shards[s];
+
+			queued += READ_ONCE(shard->bios_queued);
+			merged += READ_ONCE(shard->bios_merged);
+		}
+
+		uds_log_info("bio zone %u: bios queued=%llu merged=%llu",
+			     bio_queue_data->queue_number,
+			     (unsigned long long) queued,
+			     (unsigned long long) merged);
+	}
+}
+
+/**
+ * make_bio_maps() - Make the bio maps for a bio zone.
+ * @bio_queue_data: The bio zone.
+ * @capacity: The initial capacity of the zone, which is divided among its
+ *            maps. A map grows if its share of the bios is larger.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+static int make_bio_maps(struct bio_queue_data *bio_queue_data,
+			 size_t capacity)
+{
+	size_t shard_capacity = DIV_ROUND_UP(capacity, BIO_MAP_SHARDS);
+	unsigned int s;
+
+	for (s = 0; s < BIO_MAP_SHARDS; s++) {
+		struct bio_map_shard *shard = &bio_queue_data->shards[s];
+		int result;
+
+		mutex_init(&shard->lock);
+		result = make_int_map(shard_capacity, 0, &shard->map);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
+	return VDO_SUCCESS;
+}
+
+/**
+ * free_bio_maps() - Free the bio maps of a bio zone.
+ * @bio_queue_data: The bio zone.
+ */
+static void free_bio_maps(struct bio_queue_data *bio_queue_data)
+{
+	unsigned int s;
+
+	for (s = 0; s < BIO_MAP_SHARDS; s++) {
+		free_int_map(UDS_FORGET(bio_queue_data->shards[s].map));
+	}
+}
+
 /**
  * vdo_make_io_submitter() - Create an io_submitter structure.
  *
@@ -487,7 +720,6 @@ int vdo_make_io_submitter(unsigned int thread_count,
 		struct bio_queue_data *bio_queue_data =
 			&io_submitter->bio_queue_data[i];
 
-		mutex_init(&bio_queue_data->lock);
 		/*
 		 * One I/O operation per request, but both first &
 		 * last sector numbers.
@@ -499,13 +731,14 @@ int vdo_make_io_submitter(unsigned int thread_count,
 		 * requests *may* wind up on one thread, and thus all
 		 * in the same map.
 		 */
-		result = make_int_map(max_requests_active * 2, 0,
-				      &bio_queue_data->map);
+		result = make_bio_maps(bio_queue_data,
+				       max_requests_active * 2);
 		if (result != 0) {
 			/*
 			 * Clean up the partially initialized bio-queue
 			 * entirely and indicate that initialization failed.
 			 */
+			free_bio_maps(bio_queue_data);
 			uds_log_error("bio map initialization failed %d",
 				      result);
 			vdo_cleanup_io_submitter(io_submitter);
@@ -524,7 +757,7 @@ int vdo_make_io_submitter(unsigned int thread_count,
 			 * Clean up the partially initialized bio-queue
 			 * entirely and indicate that initialization failed.
 			 */
-			free_int_map(UDS_FORGET(bio_queue_data->map));
+			free_bio_maps(bio_queue_data);
 			uds_log_error("bio queue initialization failed %d",
 				      result);
 			vdo_cleanup_io_submitter(io_submitter);
@@ -584,7 +817,7 @@ void vdo_free_io_submitter(struct io_submitter *io_submitter)
 		 * reference to it.
 		 */
 		UDS_FORGET(io_submitter->bio_queue_data[i].queue);
-		free_int_map(UDS_FORGET(io_submitter->bio_queue_data[i].map));
+		free_bio_maps(&io_submitter->bio_queue_data[i]);
 	}
 	UDS_FREE(io_submitter);
 }
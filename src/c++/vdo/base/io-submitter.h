@@ -12,6 +12,12 @@
 #include "kernel-types.h"
 #include "vio.h"
 
+/*
+ * Whether metadata I/O may be merged with pending I/O to adjacent blocks.
+ * This is a module parameter.
+ */
+extern bool vdo_merge_metadata_bios;
+
 int vdo_make_io_submitter(unsigned int thread_count,
 			  unsigned int rotation_interval,
 			  unsigned int max_requests_active,
@@ -22,9 +28,17 @@ void vdo_cleanup_io_submitter(struct io_submitter *io_submitter);
 
 void vdo_free_io_submitter(struct io_submitter *io_submitter);
 
+void vdo_dump_io_submitter(const struct io_submitter *io_submitter);
+
 void process_vio_io(struct vdo_completion *completion);
 
-void submit_data_vio_io(struct data_vio *data_vio);
+void submit_data_vio_io_with_priority(struct data_vio *data_vio,
+				      enum vdo_completion_priority priority);
+
+static inline void submit_data_vio_io(struct data_vio *data_vio)
+{
+	submit_data_vio_io_with_priority(data_vio, BIO_Q_DATA_PRIORITY);
+}
 
 void vdo_submit_metadata_io(struct vio *vio,
 			    physical_block_number_t physical,
@@ -33,6 +47,12 @@ void vdo_submit_metadata_io(struct vio *vio,
 			    unsigned int operation,
 			    char *data);
 
+void vdo_submit_discard(struct vio *vio,
+			physical_block_number_t physical,
+			block_count_t block_count,
+			bio_end_io_t callback,
+			vdo_action *error_handler);
+
 static inline void submit_metadata_vio(struct vio *vio,
 				       physical_block_number_t physical,
 				       bio_end_io_t callback,
@@ -126,6 +126,7 @@ enum vdo_completion_priority {
 	UDS_Q_MAX_PRIORITY = 0,
 	VDO_DEFAULT_Q_COMPLETION_PRIORITY = 1,
 	VDO_DEFAULT_Q_FLUSH_PRIORITY = 2,
+	VDO_DEFAULT_Q_INDEX_SUBMISSION_PRIORITY = 1,
 	VDO_DEFAULT_Q_MAP_BIO_PRIORITY = 0,
 	VDO_DEFAULT_Q_SYNC_PRIORITY = 2,
 	VDO_DEFAULT_Q_VIO_CALLBACK_PRIORITY = 1,
@@ -160,6 +161,7 @@ enum vdo_zone_type {
 struct action_manager;
 struct allocation_selector;
 struct atomic_bio_stats;
+struct batch_processor;
 #ifdef INTERNAL
 struct bio;
 #endif /* INTERNAL */
@@ -169,6 +171,7 @@ struct block_device;
 #endif /* INTERNAL */
 struct block_map;
 struct block_map_tree_zone;
+struct block_map_warmup;
 struct block_map_zone;
 struct data_vio;
 struct data_vio_pool;
@@ -197,6 +200,7 @@ struct slab_summary;
 struct slab_summary_zone;
 struct thread_config;
 struct thread_count_config;
+struct tree_lock;
 struct vdo;
 struct vdo_completion;
 struct vdo_flush;
@@ -6,6 +6,8 @@
 #include "packer.h"
 
 #include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/timer.h>
 
 #include "logger.h"
 #include "memory-alloc.h"
@@ -29,6 +31,25 @@
 #include "vio.h"
 #include "vio-write.h"
 
+enum {
+	/* The fit_item of a compressed size no fragments can reach */
+	FIT_UNREACHED = 0xff,
+	/* The fit_item of the size of the fragments which must be written */
+	FIT_REQUIRED = 0xfe,
+};
+
+enum deadline_timer_state {
+	PACKER_DEADLINE_TIMER_IDLE,
+	PACKER_DEADLINE_TIMER_RUNNING,
+	PACKER_DEADLINE_TIMER_FIRED,
+};
+
+/* These are module parameters. */
+bool vdo_best_fit_packing;
+unsigned int vdo_packer_deadline_interval;
+
+static uint64_t vdo_packer_deadline_jiffies;
+
 /**
  * assert_on_packer_thread() - Check that we are on the packer thread.
  * @packer: The packer.
@@ -41,6 +62,69 @@ static inline void assert_on_packer_thread(struct packer *packer,
 			"%s() called from packer thread", caller);
 }
 
+/**
+ * vdo_set_packer_deadline_interval() - Set the packer deadline.
+ * @value: The deadline in milliseconds, or 0 to disable the deadline.
+ */
+void vdo_set_packer_deadline_interval(unsigned int value)
+{
+	/* Arbitrary maximum value is two minutes */
+	if (value > 120000) {
+		value = 120000;
+	}
+
+	vdo_packer_deadline_interval = value;
+	WRITE_ONCE(vdo_packer_deadline_jiffies,
+		   ((value == 0) ? 0 : msecs_to_jiffies(value)));
+}
+
+static inline bool
+change_timer_state(struct packer *packer, int old, int new)
+{
+	return (atomic_cmpxchg(&packer->timer_state, old, new) == old);
+}
+
+/**
+ * start_deadline_timer() - Start the deadline timer if it is not already
+ *                          running.
+ * @packer: The packer.
+ * @arrival: The arrival time of the oldest bin which is not yet expired.
+ *
+ * Bins are only added after the timer has been started for an earlier bin, so
+ * a running timer never needs to be moved earlier.
+ */
+static void start_deadline_timer(struct packer *packer, uint64_t arrival)
+{
+	uint64_t deadline = READ_ONCE(vdo_packer_deadline_jiffies);
+
+	if ((deadline == 0) ||
+	    !change_timer_state(packer,
+				PACKER_DEADLINE_TIMER_IDLE,
+				PACKER_DEADLINE_TIMER_RUNNING)) {
+		return;
+	}
+
+	mod_timer(&packer->deadline_timer, arrival + deadline);
+}
+
+/**
+ * deadline_expired() - Hand the expiration of the deadline timer off to the
+ *                      packer thread.
+ * @t: The deadline timer.
+ */
+static void deadline_expired(struct timer_list *t)
+{
+	struct packer *packer = from_timer(packer, t, deadline_timer);
+
+	if (change_timer_state(packer,
+			       PACKER_DEADLINE_TIMER_RUNNING,
+			       PACKER_DEADLINE_TIMER_FIRED)) {
+		vdo_invoke_completion_callback(&packer->deadline_completion);
+	}
+}
+
+static void write_expired_bins(struct vdo_completion *completion);
+
 /**
  * vdo_next_packer_bin() - Return the next bin in the free_space-sorted list.
  */
@@ -141,6 +225,13 @@ int vdo_make_packer(struct vdo *vdo,
 	INIT_LIST_HEAD(&packer->bins);
 	vdo_set_admin_state_code(&packer->state,
 				 VDO_ADMIN_STATE_NORMAL_OPERATION);
+	timer_setup(&packer->deadline_timer, deadline_expired, 0);
+	vdo_initialize_completion(&packer->deadline_completion,
+				  vdo,
+				  VDO_PACKER_DEADLINE_COMPLETION);
+	vdo_set_completion_callback(&packer->deadline_completion,
+				    write_expired_bins,
+				    packer->thread_id);
 
 	for (i = 0; i < bin_count; i++) {
 		int result = make_bin(packer);
@@ -165,6 +256,16 @@ int vdo_make_packer(struct vdo *vdo,
 		return result;
 	}
 
+	result = UDS_ALLOCATE_EXTENDED(struct packer_bin,
+				       VDO_MAX_COMPRESSION_SLOTS,
+				       struct vio *, __func__,
+				       &packer->staging_bin);
+	if (result != VDO_SUCCESS) {
+		vdo_free_packer(packer);
+		return result;
+	}
+
+	packer->staging_bin->free_space = packer->bin_data_size;
 	result = vdo_make_default_thread(vdo, packer->thread_id);
 	if (result != VDO_SUCCESS) {
 		vdo_free_packer(packer);
@@ -187,12 +288,15 @@ void vdo_free_packer(struct packer *packer)
 		return;
 	}
 
+	/* The timer callback must not run once the packer is gone. */
+	del_timer_sync(&packer->deadline_timer);
 	while ((bin = vdo_get_packer_fullest_bin(packer)) != NULL) {
 		list_del_init(&bin->list);
 		UDS_FREE(bin);
 	}
 
 	UDS_FREE(UDS_FORGET(packer->canceled_bin));
+	UDS_FREE(UDS_FORGET(packer->staging_bin));
 	UDS_FREE(packer);
 }
 
@@ -240,9 +344,45 @@ struct packer_statistics vdo_get_packer_statistics(const struct packer *packer)
 			READ_ONCE(stats->compressed_blocks_written),
 		.compressed_fragments_in_packer =
 			READ_ONCE(stats->compressed_fragments_in_packer),
+		.compressed_fragment_bytes =
+			READ_ONCE(stats->compressed_fragment_bytes),
+		.deadline_bins_written =
+			READ_ONCE(stats->deadline_bins_written),
+		.compression_batches =
+			atomic64_read(&packer->compression_batches),
+		.compression_batch_blocks =
+			atomic64_read(&packer->compression_batch_blocks),
+		.compression_batch_nanoseconds =
+			atomic64_read(&packer->compression_batch_nanoseconds),
+		.compression_attempts =
+			atomic64_read(&packer->compression_attempts),
+		.compression_skips = atomic64_read(&packer->compression_skips),
 	};
 }
 
+/**
+ * vdo_record_compression_batch() - Record the statistics for a batch of
+ *                                  blocks compressed on a CPU thread.
+ * @packer: The packer.
+ * @blocks: The number of blocks in the batch.
+ * @skipped: The number of those blocks which were not given to LZ4 because
+ *           they appeared to be incompressible.
+ * @nanoseconds: The time taken to compress the batch.
+ *
+ * Context: May be called from any thread.
+ */
+void vdo_record_compression_batch(struct packer *packer,
+				  block_count_t blocks,
+				  block_count_t skipped,
+				  uint64_t nanoseconds)
+{
+	atomic64_inc(&packer->compression_batches);
+	atomic64_add(blocks, &packer->compression_batch_blocks);
+	atomic64_add(blocks - skipped, &packer->compression_attempts);
+	atomic64_add(skipped, &packer->compression_skips);
+	atomic64_add(nanoseconds, &packer->compression_batch_nanoseconds);
+}
+
 /**
  * abort_packing() - Abort packing a data_vio.
  * @data_vio: The data_vio to abort.
@@ -353,6 +493,47 @@ static void add_to_bin(struct packer_bin *bin, struct data_vio *data_vio)
 	bin->incoming[bin->slots_used++] = data_vio;
 }
 
+/**
+ * take_from_bin() - Remove a data_vio from the bin which holds it.
+ * @packer: The packer.
+ * @data_vio: The data_vio to remove.
+ *
+ * The bin is moved to its new position in the sorted list.
+ */
+static void take_from_bin(struct packer *packer, struct data_vio *data_vio)
+{
+	struct packer_bin *bin = data_vio->compression.bin;
+	slot_number_t slot = data_vio->compression.slot;
+
+	bin->slots_used--;
+	if (slot < bin->slots_used) {
+		bin->incoming[slot] = bin->incoming[bin->slots_used];
+		bin->incoming[slot]->compression.slot = slot;
+	}
+
+	data_vio->compression.bin = NULL;
+	data_vio->compression.slot = 0;
+
+	if (bin != packer->canceled_bin) {
+		bin->free_space += data_vio->compression.size;
+		insert_in_sorted_list(packer, bin);
+	}
+}
+
+#ifdef VDO_INTERNAL
+/**
+ * record_time_in_packer() - Record how long a data_vio waited in a bin.
+ * @data_vio: The data_vio leaving the packer.
+ */
+static void record_time_in_packer(struct data_vio *data_vio)
+{
+	struct vdo *vdo = vdo_from_data_vio(data_vio);
+
+	enter_histogram_sample(vdo->histograms.packer_time_histogram,
+			       jiffies - data_vio->compression.arrival_jiffies);
+}
+
+#endif /* VDO_INTERNAL */
 /**
  * remove_from_bin() - Get the next data_vio whose compression has not been
  *                     canceled from a bin.
@@ -370,6 +551,9 @@ static struct data_vio *remove_from_bin(struct packer *packer,
 
 		if (may_write_compressed_data_vio(data_vio)) {
 			data_vio->compression.bin = NULL;
+#ifdef VDO_INTERNAL
+			record_time_in_packer(data_vio);
+#endif /* VDO_INTERNAL */
 			return data_vio;
 		}
 
@@ -501,10 +685,185 @@ static void write_bin(struct packer *packer, struct packer_bin *bin)
 		   (stats->compressed_fragments_written + slot));
 	WRITE_ONCE(stats->compressed_blocks_written,
 		   stats->compressed_blocks_written + 1);
+	WRITE_ONCE(stats->compressed_fragment_bytes,
+		   stats->compressed_fragment_bytes + offset);
+#ifdef VDO_INTERNAL
+	enter_histogram_sample(vdo->histograms.packer_fragments_histogram,
+			       slot);
+	enter_histogram_sample(vdo->histograms.packer_fill_histogram,
+			       (offset * 100) / packer->bin_data_size);
+#endif /* VDO_INTERNAL */
 
 	submit_data_vio_io(agent);
 }
 
+/**
+ * insert_candidate() - Add a fragment to the best-fit candidates, keeping
+ *                      them sorted from largest to smallest.
+ * @packer: The packer.
+ * @count: The number of candidates already gathered.
+ * @data_vio: The data_vio holding the fragment.
+ */
+static void insert_candidate(struct packer *packer,
+			     unsigned int count,
+			     struct data_vio *data_vio)
+{
+	unsigned int i;
+
+	for (i = count;
+	     ((i > 0) &&
+	      (packer->candidates[i - 1]->compression.size <
+	       data_vio->compression.size));
+	     i--) {
+		packer->candidates[i] = packer->candidates[i - 1];
+	}
+
+	packer->candidates[i] = data_vio;
+}
+
+/**
+ * select_best_fit() - Move the combination of fragments which most fully
+ *                     fills a compressed block to the staging bin.
+ * @packer: The packer.
+ *
+ * The combination is found with a subset sum over the compressed sizes of the
+ * candidates, taking the larger fragments first so that each size is reached
+ * with few fragments. If the oldest fragment has waited too long, only the
+ * combinations which include it are considered.
+ *
+ * Return: true if any fragments were moved.
+ */
+static bool select_best_fit(struct packer *packer)
+{
+	struct packer_bin *bin;
+	struct data_vio *oldest = NULL;
+	struct data_vio *required = NULL;
+	unsigned int count = 0;
+	unsigned int i;
+	block_size_t capacity = packer->bin_data_size;
+	block_size_t start = 0;
+	block_size_t reached;
+	block_size_t size;
+	block_size_t fill;
+
+	for (bin = vdo_get_packer_fullest_bin(packer);
+	     bin != NULL;
+	     bin = vdo_next_packer_bin(packer, bin)) {
+		slot_number_t slot;
+
+		for (slot = 0; slot < bin->slots_used; slot++) {
+			struct data_vio *data_vio = bin->incoming[slot];
+			struct vio_compression_state state =
+				get_vio_compression_state(data_vio);
+
+			if (state.may_not_compress) {
+				continue;
+			}
+
+			if ((oldest == NULL) ||
+			    (data_vio->compression.arrival <
+			     oldest->compression.arrival)) {
+				oldest = data_vio;
+			}
+
+			if (count < BEST_FIT_WINDOW) {
+				insert_candidate(packer, count++, data_vio);
+			}
+		}
+	}
+
+	if (oldest == NULL) {
+		return false;
+	}
+
+	memset(packer->fit_item, FIT_UNREACHED, capacity + 1);
+	if ((packer->arrivals - oldest->compression.arrival) >
+	    BEST_FIT_WINDOW) {
+		required = oldest;
+		start = required->compression.size;
+	}
+
+	packer->fit_item[start] = FIT_REQUIRED;
+	packer->fit_count[start] = ((required == NULL) ? 0 : 1);
+	reached = start;
+	for (i = 0; (i < count) && (reached < capacity); i++) {
+		block_size_t top;
+
+		if (packer->candidates[i] == required) {
+			continue;
+		}
+
+		size = packer->candidates[i]->compression.size;
+		top = min((block_size_t) (reached + size), capacity);
+		for (fill = top; fill >= start + size; fill--) {
+			block_size_t rest = fill - size;
+
+			if ((packer->fit_item[fill] != FIT_UNREACHED) ||
+			    (packer->fit_item[rest] == FIT_UNREACHED) ||
+			    (packer->fit_count[rest] >= packer->max_slots)) {
+				continue;
+			}
+
+			packer->fit_item[fill] = i;
+			packer->fit_count[fill] = packer->fit_count[rest] + 1;
+			reached = max(reached, fill);
+		}
+	}
+
+	for (fill = reached;
+	     packer->fit_item[fill] != FIT_REQUIRED;
+	     fill -= size) {
+		struct data_vio *chosen =
+			packer->candidates[packer->fit_item[fill]];
+
+		size = chosen->compression.size;
+		take_from_bin(packer, chosen);
+		add_to_bin(packer->staging_bin, chosen);
+	}
+
+	if (required != NULL) {
+		take_from_bin(packer, required);
+		add_to_bin(packer->staging_bin, required);
+	}
+
+	return true;
+}
+
+/**
+ * make_room() - Write out fragments so that some bin has room for a data_vio.
+ * @packer: The packer.
+ * @bin: The bin selected for the data_vio, which does not have room for it.
+ * @data_vio: The data_vio which needs room.
+ *
+ * Return: The bin which now has room for the data_vio.
+ */
+static struct packer_bin *make_room(struct packer *packer,
+				    struct packer_bin *bin,
+				    struct data_vio *data_vio)
+{
+	if (!READ_ONCE(vdo_best_fit_packing)) {
+		write_bin(packer, bin);
+		return bin;
+	}
+
+	while (select_best_fit(packer)) {
+		struct packer_bin *roomy;
+
+		write_bin(packer, packer->staging_bin);
+		for (roomy = vdo_get_packer_fullest_bin(packer);
+		     roomy != NULL;
+		     roomy = vdo_next_packer_bin(packer, roomy)) {
+			if (roomy->free_space >= data_vio->compression.size) {
+				return roomy;
+			}
+		}
+	}
+
+	/* Only canceled data_vios are left, so clear them out of the bin. */
+	write_bin(packer, bin);
+	return bin;
+}
+
 /**
  * add_data_vio_to_packer_bin() - Add a data_vio to a bin's incoming queue
  * @packer: The packer.
@@ -519,15 +878,23 @@ static void add_data_vio_to_packer_bin(struct packer *packer,
 				       struct data_vio *data_vio)
 {
 	/*
-	 * If the selected bin doesn't have room, start a new batch to make
-	 * room.
+	 * If the selected bin doesn't have room, write out some fragments to
+	 * make room.
 	 */
 	if (bin->free_space < data_vio->compression.size) {
-		write_bin(packer, bin);
+		bin = make_room(packer, bin, data_vio);
 	}
 
+	data_vio->compression.arrival = packer->arrivals++;
+#ifdef VDO_INTERNAL
+	data_vio->compression.arrival_jiffies = jiffies;
+#endif /* VDO_INTERNAL */
 	add_to_bin(bin, data_vio);
 	bin->free_space -= data_vio->compression.size;
+	if (bin->slots_used == 1) {
+		bin->arrival_jiffies = jiffies;
+		start_deadline_timer(packer, bin->arrival_jiffies);
+	}
 
 	/* If we happen to exactly fill the bin, start a new batch. */
 	if ((bin->slots_used == packer->max_slots) || (bin->free_space == 0)) {
@@ -655,12 +1022,85 @@ void vdo_attempt_packing(struct data_vio *data_vio)
  */
 static void check_for_drain_complete(struct packer *packer)
 {
-	if (vdo_is_state_draining(&packer->state) &&
-	    (packer->canceled_bin->slots_used == 0)) {
+	if (!vdo_is_state_draining(&packer->state) ||
+	    (packer->canceled_bin->slots_used != 0)) {
+		return;
+	}
+
+	/*
+	 * If the timer has fired, write_expired_bins() will check again once
+	 * it has run.
+	 */
+	if ((atomic_read(&packer->timer_state) ==
+	     PACKER_DEADLINE_TIMER_IDLE) ||
+	    change_timer_state(packer,
+			       PACKER_DEADLINE_TIMER_RUNNING,
+			       PACKER_DEADLINE_TIMER_IDLE)) {
+		del_timer_sync(&packer->deadline_timer);
 		vdo_finish_draining(&packer->state);
 	}
 }
 
+/**
+ * write_expired_bins() - Write out every bin which has been waiting longer
+ *                        than the deadline.
+ * @completion: The packer's deadline completion.
+ *
+ * This callback is registered in vdo_make_packer() and is invoked when the
+ * deadline timer fires. The timer is restarted for the oldest remaining bin.
+ */
+static void write_expired_bins(struct vdo_completion *completion)
+{
+	struct packer *packer = container_of(completion,
+					     struct packer,
+					     deadline_completion);
+	uint64_t deadline = READ_ONCE(vdo_packer_deadline_jiffies);
+	struct packer_bin *bin, *tmp;
+	struct packer_bin *oldest = NULL;
+	uint64_t now = jiffies;
+	block_count_t written = 0;
+
+	assert_on_packer_thread(packer, __func__);
+	atomic_set(&packer->timer_state, PACKER_DEADLINE_TIMER_IDLE);
+	if (!vdo_is_state_normal(&packer->state) || (deadline == 0)) {
+		check_for_drain_complete(packer);
+		return;
+	}
+
+	list_for_each_entry_safe(bin, tmp, &packer->bins, list) {
+		if (bin->slots_used == 0) {
+			continue;
+		}
+
+		if (time_before64(now, bin->arrival_jiffies + deadline)) {
+			if ((oldest == NULL) ||
+			    time_before64(bin->arrival_jiffies,
+					  oldest->arrival_jiffies)) {
+				oldest = bin;
+			}
+
+			continue;
+		}
+
+		/*
+		 * Writing the bin empties it, which moves it to the end of the
+		 * list where it will be skipped.
+		 */
+		write_bin(packer, bin);
+		insert_in_sorted_list(packer, bin);
+		written++;
+	}
+
+	if (written > 0) {
+		WRITE_ONCE(packer->statistics.deadline_bins_written,
+			   packer->statistics.deadline_bins_written + written);
+	}
+
+	if (oldest != NULL) {
+		start_deadline_timer(packer, oldest->arrival_jiffies);
+	}
+}
+
 /**
  * write_all_non_empty_bins() - Write out all non-empty bins on behalf of a
  *                              flush or suspend.
@@ -712,30 +1152,17 @@ void vdo_remove_lock_holder_from_packer(struct vdo_completion *completion)
 	struct data_vio *data_vio = as_data_vio(completion);
 	struct packer *packer = get_packer_from_data_vio(data_vio);
 	struct data_vio *lock_holder;
-	struct packer_bin *bin;
-	slot_number_t slot;
 
 	assert_data_vio_in_packer_zone(data_vio);
 
 	lock_holder = UDS_FORGET(data_vio->compression.lock_holder);
-	bin = lock_holder->compression.bin;
-	ASSERT_LOG_ONLY((bin != NULL), "data_vio in packer has a bin");
-
-	slot = lock_holder->compression.slot;
-	bin->slots_used--;
-	if (slot < bin->slots_used) {
-		bin->incoming[slot] = bin->incoming[bin->slots_used];
-		bin->incoming[slot]->compression.slot = slot;
-	}
-
-	lock_holder->compression.bin = NULL;
-	lock_holder->compression.slot = 0;
-
-	if (bin != packer->canceled_bin) {
-		bin->free_space += lock_holder->compression.size;
-		insert_in_sorted_list(packer, bin);
-	}
+	ASSERT_LOG_ONLY((lock_holder->compression.bin != NULL),
+			"data_vio in packer has a bin");
 
+	take_from_bin(packer, lock_holder);
+#ifdef VDO_INTERNAL
+	record_time_in_packer(lock_holder);
+#endif /* VDO_INTERNAL */
 	abort_packing(lock_holder);
 	check_for_drain_complete(packer);
 }
@@ -6,18 +6,27 @@
 #ifndef PACKER_H
 #define PACKER_H
 
+#include <linux/atomic.h>
 #include <linux/list.h>
+#include <linux/timer.h>
 
 #include "compiler.h"
 
 #include "admin-state.h"
 #include "block-mapping-state.h"
+#include "completion.h"
+#include "constants.h"
 #include "statistics.h"
 #include "types.h"
 #include "wait-queue.h"
 
 enum {
 	DEFAULT_PACKER_BINS = 16,
+	/*
+	 * The most fragments considered at once when choosing the best
+	 * combination to write, which bounds the time spent choosing.
+	 */
+	BEST_FIT_WINDOW = 64,
 };
 
 /*
@@ -39,12 +48,26 @@ enum {
  * canceled and removed from their bin by the packer. These data_vios need to
  * wait for the canceller to rendezvous with them (VDO-2809) and so they sit in
  * this special bin.
+ *
+ * If best-fit packing is enabled, a bin which overflows is not simply written
+ * out. Instead, the fragments in all of the bins are treated as a window of
+ * candidates, and the combination of them which most fully fills a compressed
+ * block is moved to the staging bin and written from there. To bound the time
+ * a fragment can wait in the packer, once the oldest fragment has seen more
+ * than BEST_FIT_WINDOW later arrivals, it must be part of the combination.
+ *
+ * If a packer deadline is set, each bin records when its oldest fragment
+ * arrived, and a timer on the packer writes out any bin which has been
+ * waiting longer than the deadline, so that a lightly loaded vdo does not hold
+ * compressible writes indefinitely waiting for a bin to fill.
  */
 struct packer_bin {
 	/* List links for packer.packer_bins */
 	struct list_head list;
 	/* The number of items in the bin */
 	slot_number_t slots_used;
+	/* The jiffies when the first item was added to the empty bin */
+	uint64_t arrival_jiffies;
 	/*
 	 * The number of compressed block bytes remaining in the current batch
 	 */
@@ -69,10 +92,30 @@ struct packer {
 	 * are waiting to rendezvous with the canceling data_vio.
 	 */
 	struct packer_bin *canceled_bin;
+	/* A bin to hold the fragments chosen by best-fit packing */
+	struct packer_bin *staging_bin;
+
+	/* The number of data_vios which have been put in bins */
+	uint64_t arrivals;
+	/*
+	 * The fragments considered by best-fit packing, and for each
+	 * compressed size, the index of the fragment which first made that
+	 * size reachable and the number of fragments needed to reach it.
+	 */
+	struct data_vio *candidates[BEST_FIT_WINDOW];
+	byte fit_item[VDO_BLOCK_SIZE];
+	byte fit_count[VDO_BLOCK_SIZE];
 
 	/* The current flush generation */
 	sequence_number_t flush_generation;
 
+	/* The timer which writes out bins older than the deadline */
+	struct timer_list deadline_timer;
+	/* Whether the deadline timer is idle, running, or has fired */
+	atomic_t timer_state;
+	/* The completion which handles the deadline on the packer thread */
+	struct vdo_completion deadline_completion;
+
 	/* The administrative state of the packer */
 	struct admin_state state;
 
@@ -81,8 +124,34 @@ struct packer {
 	 * accessed from other threads.
 	 */
 	struct packer_statistics statistics;
+
+	/*
+	 * Compression batch statistics, which are updated from the CPU
+	 * threads.
+	 */
+	atomic64_t compression_batches;
+	atomic64_t compression_batch_blocks;
+	atomic64_t compression_batch_nanoseconds;
+	atomic64_t compression_attempts;
+	atomic64_t compression_skips;
 };
 
+/*
+ * Whether the packer chooses the best combination of fragments to write when
+ * a bin overflows, rather than writing the overflowing bin. This is a module
+ * parameter.
+ */
+extern bool vdo_best_fit_packing;
+
+/*
+ * The longest time, in milliseconds, that a fragment may wait in a packer bin
+ * before the bin is written out, or 0 if bins wait until they are full or
+ * flushed. This is a module parameter.
+ */
+extern unsigned int vdo_packer_deadline_interval;
+
+void vdo_set_packer_deadline_interval(unsigned int value);
+
 int __must_check vdo_make_packer(struct vdo *vdo,
 				 block_count_t bin_count,
 				 struct packer **packer_ptr);
@@ -97,6 +166,11 @@ vdo_get_packer_statistics(const struct packer *packer);
 
 void vdo_attempt_packing(struct data_vio *data_vio);
 
+void vdo_record_compression_batch(struct packer *packer,
+				  block_count_t blocks,
+				  block_count_t skipped,
+				  uint64_t nanoseconds);
+
 void vdo_flush_packer(struct packer *packer);
 
 void vdo_remove_lock_holder_from_packer(struct vdo_completion *completion);
@@ -9,6 +9,7 @@
 
 #include "data-vio-pool.h"
 #include "dedupe.h"
+#include "slab-depot.h"
 #include "vdo.h"
 
 struct pool_attribute {
@@ -125,6 +126,14 @@ static ssize_t pool_requests_maximum_show(struct vdo *vdo, char *buf)
 		       get_data_vio_pool_maximum_requests(vdo->data_vio_pool));
 }
 
+static ssize_t pool_slab_scrub_rate_show(struct vdo *vdo, char *buf)
+{
+	return sprintf(buf,
+		       "%llu\n",
+		       (unsigned long long)
+		       vdo_get_slab_depot_scrub_rate(vdo->depot));
+}
+
 static void vdo_pool_release(struct kobject *directory)
 {
 	UDS_FREE(container_of(directory, struct vdo, vdo_directory));
@@ -195,6 +204,14 @@ static struct pool_attribute vdo_pool_requests_maximum_attr = {
 	.show = pool_requests_maximum_show,
 };
 
+static struct pool_attribute vdo_pool_slab_scrub_rate_attr = {
+	.attr = {
+			.name = "slab_scrub_rate",
+			.mode = 0444,
+		},
+	.show = pool_slab_scrub_rate_show,
+};
+
 static struct attribute *pool_attrs[] = {
 	&vdo_pool_compressing_attr.attr,
 	&vdo_pool_discards_active_attr.attr,
@@ -204,6 +221,7 @@ static struct attribute *pool_attrs[] = {
 	&vdo_pool_requests_active_attr.attr,
 	&vdo_pool_requests_limit_attr.attr,
 	&vdo_pool_requests_maximum_attr.attr,
+	&vdo_pool_slab_scrub_rate_attr.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(pool);
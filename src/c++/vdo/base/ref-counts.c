@@ -6,6 +6,7 @@
 #include "ref-counts.h"
 
 #include <linux/bio.h>
+#include <linux/bitops.h>
 
 #include "logger.h"
 #include "memory-alloc.h"
@@ -37,6 +38,12 @@
 static const uint64_t BYTES_PER_WORD = sizeof(uint64_t);
 static const bool NORMAL_OPERATION = true;
 
+enum {
+	/* The number of counters summarized by each bit of full_chunks */
+	COUNTS_PER_CHUNK = 64,
+	CHUNKS_PER_BLOCK = COUNTS_PER_BLOCK / COUNTS_PER_CHUNK,
+};
+
 /**
  * ref_counts_from_waiter() - Return the ref_counts from the ref_counts
  *                            waiter.
@@ -174,6 +181,18 @@ static bool advance_search_cursor(struct ref_counts *ref_counts)
 	return true;
 }
 
+/**
+ * get_full_chunks_size() - Get the number of words in the bitmap of full
+ *                          chunks for a given number of reference blocks.
+ * @ref_block_count: The number of reference blocks.
+ *
+ * Return: The size of the bitmap in words.
+ */
+static size_t get_full_chunks_size(block_count_t ref_block_count)
+{
+	return DIV_ROUND_UP(ref_block_count * CHUNKS_PER_BLOCK, BITS_PER_LONG);
+}
+
 /**
  * vdo_make_ref_counts() - Create a reference counting object.
  * @block_count: The number of physical blocks that can be referenced.
@@ -222,6 +241,15 @@ int vdo_make_ref_counts(block_count_t block_count,
 		return result;
 	}
 
+	result = UDS_ALLOCATE(get_full_chunks_size(ref_block_count),
+			      unsigned long,
+			      "ref counts summary",
+			      &ref_counts->full_chunks);
+	if (result != UDS_SUCCESS) {
+		vdo_free_ref_counts(ref_counts);
+		return result;
+	}
+
 	ref_counts->slab = slab;
 	ref_counts->block_count = block_count;
 	ref_counts->free_blocks = block_count;
@@ -254,6 +282,7 @@ void vdo_free_ref_counts(struct ref_counts *ref_counts)
 		return;
 	}
 
+	UDS_FREE(UDS_FORGET(ref_counts->full_chunks));
 	UDS_FREE(UDS_FORGET(ref_counts->counters));
 	UDS_FREE(ref_counts);
 }
@@ -360,6 +389,34 @@ vdo_get_reference_block(struct ref_counts *ref_counts,
 	return &ref_counts->blocks[index / COUNTS_PER_BLOCK];
 }
 
+/**
+ * mark_chunk_not_full() - Note that the chunk containing a counter may have a
+ *                         free counter.
+ * @ref_counts: The refcounts object.
+ * @index: The index of the counter which has become free.
+ */
+static inline void mark_chunk_not_full(struct ref_counts *ref_counts,
+				       slab_block_number index)
+{
+	__clear_bit(index / COUNTS_PER_CHUNK, ref_counts->full_chunks);
+}
+
+/**
+ * mark_block_not_full() - Note that every chunk of a reference block may have
+ *                         a free counter.
+ * @block: The reference block whose counters have changed.
+ */
+static void mark_block_not_full(struct reference_block *block)
+{
+	unsigned long chunk =
+		(block - block->ref_counts->blocks) * CHUNKS_PER_BLOCK;
+	unsigned long end_chunk = chunk + CHUNKS_PER_BLOCK;
+
+	for (; chunk < end_chunk; chunk++) {
+		__clear_bit(chunk, block->ref_counts->full_chunks);
+	}
+}
+
 /**
  * get_reference_counter() - Get the reference counter that covers the given
  *                           physical block number.
@@ -503,6 +560,7 @@ static int decrement_for_data(struct ref_counts *ref_counts,
 			*counter_ptr = EMPTY_REFERENCE_COUNT;
 			block->allocated_count--;
 			ref_counts->free_blocks++;
+			mark_chunk_not_full(ref_counts, block_number);
 			*free_status_changed = true;
 		}
 		break;
@@ -924,22 +982,19 @@ find_zero_byte_in_word(const byte *word_ptr,
 		       slab_block_number fail_index)
 {
 	uint64_t word = get_unaligned_le64(word_ptr);
-
 	/*
-	 * This looks like a loop, but GCC will unroll the eight iterations for
-	 * us.
+	 * Set the high bit of every zero byte, testing all eight bytes at
+	 * once. A borrow may also flag a byte above a zero byte, but never
+	 * one below it, so the lowest flagged byte is the first zero byte.
 	 */
-	unsigned int offset;
+	uint64_t zeros = ((word - 0x0101010101010101ULL) & ~word &
+			  0x8080808080808080ULL);
 
-	for (offset = 0; offset < BYTES_PER_WORD; offset++) {
-		/* Assumes little-endian byte order, which we have on X86. */
-		if ((word & 0xFF) == 0) {
-			return (start_index + offset);
-		}
-		word >>= 8;
+	if (zeros == 0) {
+		return fail_index;
 	}
 
-	return fail_index;
+	return (start_index + (__ffs64(zeros) / 8));
 }
 
 /**
@@ -1011,6 +1066,54 @@ bool vdo_find_free_block(const struct ref_counts *ref_counts,
 	return false;
 }
 
+/**
+ * find_free_block_in_chunks() - Find the first block with a reference count
+ *                               of zero in a range of reference counter
+ *                               indexes, skipping chunks known to be full.
+ * @ref_counts: The reference counters to scan.
+ * @start_index: The array index at which to start scanning (included in the
+ *               scan).
+ * @end_index: The array index at which to stop scanning (excluded from the
+ *             scan).
+ * @index_ptr: A pointer to hold the array index of the free block.
+ *
+ * Any chunk which is searched in its entirety without finding a free block is
+ * marked full so that later searches will skip it.
+ *
+ * Return: true if a free block was found in the specified range.
+ */
+static bool find_free_block_in_chunks(struct ref_counts *ref_counts,
+				      slab_block_number start_index,
+				      slab_block_number end_index,
+				      slab_block_number *index_ptr)
+{
+	unsigned long end_chunk = DIV_ROUND_UP(end_index, COUNTS_PER_CHUNK);
+	unsigned long chunk = find_next_zero_bit(ref_counts->full_chunks,
+						 end_chunk,
+						 start_index / COUNTS_PER_CHUNK);
+
+	while (chunk < end_chunk) {
+		slab_block_number chunk_start = chunk * COUNTS_PER_CHUNK;
+		slab_block_number chunk_end = chunk_start + COUNTS_PER_CHUNK;
+		slab_block_number start = max(start_index, chunk_start);
+		slab_block_number end = min(end_index, chunk_end);
+
+		if (vdo_find_free_block(ref_counts, start, end, index_ptr)) {
+			return true;
+		}
+
+		if ((start == chunk_start) && (end == chunk_end)) {
+			__set_bit(chunk, ref_counts->full_chunks);
+		}
+
+		chunk = find_next_zero_bit(ref_counts->full_chunks,
+					   end_chunk,
+					   chunk + 1);
+	}
+
+	return false;
+}
+
 /**
  * search_current_reference_block() - Search the reference block currently
  *                                    saved in the search cursor for a
@@ -1022,16 +1125,16 @@ bool vdo_find_free_block(const struct ref_counts *ref_counts,
  *
  * Return: true if an unreferenced counter was found.
  */
-static bool search_current_reference_block(const struct ref_counts *ref_counts,
+static bool search_current_reference_block(struct ref_counts *ref_counts,
 					   slab_block_number *free_index_ptr)
 {
 	/* Don't bother searching if the current block is known to be full. */
 	return ((ref_counts->search_cursor.block->allocated_count <
 		 COUNTS_PER_BLOCK) &&
-		vdo_find_free_block(ref_counts,
-				    ref_counts->search_cursor.index,
-				    ref_counts->search_cursor.end_index,
-				    free_index_ptr));
+		find_free_block_in_chunks(ref_counts,
+					  ref_counts->search_cursor.index,
+					  ref_counts->search_cursor.end_index,
+					  free_index_ptr));
 }
 
 /**
@@ -1167,6 +1270,114 @@ int vdo_provisionally_reference_block(struct ref_counts *ref_counts,
 	return VDO_SUCCESS;
 }
 
+/**
+ * vdo_reserve_unreferenced_block() - Provisionally reference a block only if
+ *                                    it is unreferenced.
+ * @ref_counts: The reference counters.
+ * @pbn: The PBN to reserve.
+ *
+ * Return: true if the block was unreferenced and is now provisionally
+ *         referenced.
+ */
+bool vdo_reserve_unreferenced_block(struct ref_counts *ref_counts,
+				    physical_block_number_t pbn)
+{
+	slab_block_number block_number;
+
+	if (!vdo_is_slab_open(ref_counts->slab) ||
+	    (vdo_slab_block_number_from_pbn(ref_counts->slab, pbn,
+					    &block_number) != VDO_SUCCESS) ||
+	    (ref_counts->counters[block_number] != EMPTY_REFERENCE_COUNT)) {
+		return false;
+	}
+
+	make_provisional_reference(ref_counts, block_number);
+	return true;
+}
+
+/**
+ * vdo_set_aside_free_run() - Measure a run of unreferenced blocks and keep
+ *                            the free block search from allocating them.
+ * @ref_counts: The reference counters.
+ * @pbn: The first block of the run.
+ * @limit: The maximum length of the run.
+ *
+ * If the search cursor is within the run, it is moved past the run so that
+ * the blocks are left for the caller to allocate with
+ * vdo_reserve_unreferenced_block(). Any the caller does not allocate will be
+ * found again once the slab is reopened.
+ *
+ * Return: The number of consecutive unreferenced blocks starting at @pbn.
+ */
+block_count_t vdo_set_aside_free_run(struct ref_counts *ref_counts,
+				     physical_block_number_t pbn,
+				     block_count_t limit)
+{
+	struct search_cursor *cursor = &ref_counts->search_cursor;
+	slab_block_number start, end, index;
+
+	if (vdo_slab_block_number_from_pbn(ref_counts->slab, pbn,
+					   &start) != VDO_SUCCESS) {
+		return 0;
+	}
+
+	end = min((uint64_t) start + limit, (uint64_t) ref_counts->block_count);
+	for (index = start; index < end; index++) {
+		if (ref_counts->counters[index] != EMPTY_REFERENCE_COUNT) {
+			break;
+		}
+	}
+
+	if ((cursor->index >= start) && (cursor->index < index)) {
+		cursor->index = min(index, cursor->end_index);
+	}
+
+	return index - start;
+}
+
+/**
+ * vdo_find_free_run() - Find a run of unreferenced blocks near the search
+ *                       cursor.
+ * @ref_counts: The reference counters to scan.
+ * @length: The length of the run to find.
+ * @pbn_ptr: A pointer to hold the first block of the run.
+ *
+ * Only a reference block's worth of counters following the search cursor are
+ * scanned, so that a fragmented slab is not searched end to end. The blocks
+ * found are not allocated.
+ *
+ * Return: true if a run was found.
+ */
+bool vdo_find_free_run(struct ref_counts *ref_counts,
+		       block_count_t length,
+		       physical_block_number_t *pbn_ptr)
+{
+	slab_block_number index = ref_counts->search_cursor.index;
+	slab_block_number end = min(index + COUNTS_PER_BLOCK,
+				    ref_counts->block_count);
+
+	while ((index < end) &&
+	       find_free_block_in_chunks(ref_counts, index, end, &index)) {
+		slab_block_number run_end = index;
+
+		while ((run_end < ref_counts->block_count) &&
+		       (run_end - index < length) &&
+		       (ref_counts->counters[run_end] ==
+			EMPTY_REFERENCE_COUNT)) {
+			run_end++;
+		}
+
+		if (run_end - index == length) {
+			*pbn_ptr = index_to_pbn(ref_counts, index);
+			return true;
+		}
+
+		index = run_end;
+	}
+
+	return false;
+}
+
 #ifdef INTERNAL
 /**
  * vdo_count_unreferenced_blocks() - Count all unreferenced blocks in a range
@@ -1235,6 +1446,9 @@ void vdo_reset_reference_counts(struct ref_counts *ref_counts)
 
 	memset(ref_counts->counters, 0,
 	       ref_counts->block_count * sizeof(vdo_refcount_t));
+	memset(ref_counts->full_chunks, 0,
+	       (get_full_chunks_size(ref_counts->reference_block_count) *
+		sizeof(unsigned long)));
 	ref_counts->free_blocks = ref_counts->block_count;
 	ref_counts->slab_journal_point = (struct journal_point) {
 		.sequence_number = 0,
@@ -1588,6 +1802,8 @@ static void clear_provisional_references(struct reference_block *block)
 			block->allocated_count--;
 		}
 	}
+
+	mark_block_not_full(block);
 }
 
 /**
@@ -1640,6 +1856,8 @@ static void unpack_reference_block(struct packed_reference_block *packed,
 			block->allocated_count++;
 		}
 	}
+
+	mark_block_not_full(block);
 }
 
 /**
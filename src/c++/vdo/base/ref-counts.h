@@ -90,6 +90,12 @@ struct ref_counts {
 	uint32_t free_blocks;
 	/* The array of reference counts */
 	vdo_refcount_t *counters; /* use UDS_ALLOCATE to align data ptr */
+	/*
+	 * One bit for each chunk of 64 counters, set when a search has found
+	 * the chunk to have no free counters, and cleared when any counter in
+	 * it becomes free
+	 */
+	unsigned long *full_chunks;
 
 	/*
 	 * The saved block pointer and array indexes for the free block search
@@ -171,6 +177,19 @@ vdo_provisionally_reference_block(struct ref_counts *ref_counts,
 				  physical_block_number_t pbn,
 				  struct pbn_lock *lock);
 
+bool __must_check
+vdo_reserve_unreferenced_block(struct ref_counts *ref_counts,
+			       physical_block_number_t pbn);
+
+block_count_t __must_check
+vdo_set_aside_free_run(struct ref_counts *ref_counts,
+		       physical_block_number_t pbn,
+		       block_count_t limit);
+
+bool __must_check vdo_find_free_run(struct ref_counts *ref_counts,
+				    block_count_t length,
+				    physical_block_number_t *pbn_ptr);
+
 block_count_t __must_check
 vdo_count_unreferenced_blocks(struct ref_counts *ref_counts,
 			      physical_block_number_t start_pbn,
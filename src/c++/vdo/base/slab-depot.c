@@ -532,12 +532,27 @@ uint8_t vdo_get_increment_limit(struct slab_depot *depot,
 				physical_block_number_t pbn)
 {
 	struct vdo_slab *slab = vdo_get_slab(depot, pbn);
+	uint8_t limit;
 
 	if ((slab == NULL) || vdo_is_unrecovered_slab(slab)) {
 		return 0;
 	}
 
-	return vdo_get_available_references(slab->reference_counts, pbn);
+	limit = vdo_get_available_references(slab->reference_counts, pbn);
+
+	/*
+	 * Once discarding has been enabled, an unreferenced block may have
+	 * been discarded, and not all storage reads back discarded blocks
+	 * consistently, so never resurrect one from stale advice. Which blocks
+	 * were discarded is not recorded, but whether discarding was ever
+	 * enabled is saved in the super block.
+	 */
+	if ((limit == MAXIMUM_REFERENCE_COUNT) &&
+	    READ_ONCE(depot->discards_enabled)) {
+		return 0;
+	}
+
+	return limit;
 }
 
 /**
@@ -618,7 +633,6 @@ block_count_t vdo_get_slab_depot_data_blocks(const struct slab_depot *depot)
  *
  * Return: The total number of slabs that are unrecovered.
  */
-EXTERNAL_STATIC
 slab_count_t vdo_get_slab_depot_unrecovered_slab_count(const struct slab_depot *depot)
 {
 	slab_count_t total = 0;
@@ -632,6 +646,31 @@ slab_count_t vdo_get_slab_depot_unrecovered_slab_count(const struct slab_depot *
 	return total;
 }
 
+/**
+ * vdo_get_slab_depot_scrub_rate() - Get the rate at which the depot has
+ *                                   scrubbed slabs.
+ * @depot: The slab depot.
+ *
+ * The zones scrub concurrently, so their rates are added.
+ *
+ * Context: This may be called from any thread.
+ *
+ * Return: The number of slabs scrubbed per second spent scrubbing.
+ */
+uint64_t vdo_get_slab_depot_scrub_rate(const struct slab_depot *depot)
+{
+	uint64_t rate = 0;
+	zone_count_t zone;
+
+	for (zone = 0; zone < depot->zone_count; zone++) {
+		struct block_allocator *allocator = depot->allocators[zone];
+
+		rate += vdo_get_slab_scrub_rate(allocator->slab_scrubber);
+	}
+
+	return rate;
+}
+
 /**
  * start_depot_load() - The preamble of a load operation which loads the slab
  *                      summary.
@@ -1020,6 +1059,13 @@ get_depot_block_allocator_statistics(const struct slab_depot *depot)
 		totals.slab_count += stats.slab_count;
 		totals.slabs_opened += stats.slabs_opened;
 		totals.slabs_reopened += stats.slabs_reopened;
+		totals.blocks_discarded += stats.blocks_discarded;
+		totals.discard_bios += stats.discard_bios;
+		totals.discard_blocks_skipped += stats.discard_blocks_skipped;
+		totals.contiguous_runs_allocated +=
+			stats.contiguous_runs_allocated;
+		totals.contiguous_blocks_allocated +=
+			stats.contiguous_blocks_allocated;
 	}
 
 	return totals;
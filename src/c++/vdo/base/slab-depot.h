@@ -51,6 +51,9 @@ struct slab_depot {
 	/* Determines how slabs should be queued during load */
 	enum slab_depot_load_type load_type;
 
+	/* Whether freed blocks may have been discarded, ever */
+	bool discards_enabled;
+
 	/* The state for notifying slab journals to release recovery journal */
 	sequence_number_t active_release_request;
 	sequence_number_t new_release_request;
@@ -115,6 +118,12 @@ vdo_get_slab_depot_allocated_blocks(const struct slab_depot *depot);
 block_count_t __must_check
 vdo_get_slab_depot_data_blocks(const struct slab_depot *depot);
 
+slab_count_t __must_check
+vdo_get_slab_depot_unrecovered_slab_count(const struct slab_depot *depot);
+
+uint64_t __must_check
+vdo_get_slab_depot_scrub_rate(const struct slab_depot *depot);
+
 void vdo_get_slab_depot_statistics(const struct slab_depot *depot,
 				   struct vdo_statistics *stats);
 
@@ -168,9 +177,6 @@ int __must_check vdo_get_slab_number(const struct slab_depot *depot,
 				     physical_block_number_t pbn,
 				     slab_count_t *slab_number_ptr);
 
-slab_count_t __must_check
-vdo_get_slab_depot_unrecovered_slab_count(const struct slab_depot *depot);
-
 bool __must_check
 vdo_are_equivalent_slab_depots(struct slab_depot *depot_a, struct slab_depot *depot_b);
 #endif /* INTERNAL */
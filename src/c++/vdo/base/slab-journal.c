@@ -1240,6 +1240,8 @@ void vdo_add_slab_journal_entry(struct slab_journal *journal,
 				struct data_vio *data_vio)
 {
 	struct vdo_slab *slab = journal->slab;
+	bool decrement =
+		!vdo_is_journal_increment_operation(data_vio->operation.type);
 	int result;
 
 	if (!vdo_is_slab_open(slab)) {
@@ -1258,7 +1260,13 @@ void vdo_add_slab_journal_entry(struct slab_journal *journal,
 		return;
 	}
 
-	if (vdo_is_unrecovered_slab(slab) && requires_reaping(journal)) {
+	/*
+	 * A slab whose reference counts are being loaded lazily is loaded as
+	 * soon as it frees space, so that the space can be reused.
+	 */
+	if (vdo_is_unrecovered_slab(slab) &&
+	    (requires_reaping(journal) ||
+	     (decrement && slab->allocator->lazy_load))) {
 		struct slab_scrubber *scrubber
 			= slab->allocator->slab_scrubber;
 		vdo_register_slab_for_scrubbing(scrubber, slab, true);
@@ -6,6 +6,7 @@
 #include "slab-scrubber.h"
 
 #include <linux/bio.h>
+#include <linux/jiffies.h>
 
 #include "logger.h"
 #include "memory-alloc.h"
@@ -20,12 +21,36 @@
 #include "ref-counts.h"
 #include "slab.h"
 #include "slab-journal.h"
+#include "slab-summary.h"
 #include "vdo.h"
 #include "vio.h"
 
+enum {
+	MAXIMUM_SLAB_SCRUB_DEPTH = 16,
+	/* The number of queued slabs to consider when allocations are waiting */
+	MAXIMUM_SLABS_TO_CONSIDER = 64,
+};
+
+/*
+ * The number of slabs each physical zone may scrub at once, each with its own
+ * slab journal read outstanding.
+ */
+unsigned int vdo_slab_scrub_depth = 1;
+
+/**
+ * vdo_set_slab_scrub_depth() - Set the number of slabs each physical zone may
+ *                              scrub concurrently.
+ * @value: The new depth, which will be clamped to between 1 and 16.
+ */
+void vdo_set_slab_scrub_depth(unsigned int value)
+{
+	WRITE_ONCE(vdo_slab_scrub_depth,
+		   max(1U, min(value, (unsigned int) MAXIMUM_SLAB_SCRUB_DEPTH)));
+}
+
 /**
- * allocate_vio_and_buffer() - Allocate the buffer and vio used for reading the
- *                             slab journal when scrubbing a slab.
+ * allocate_scrub_contexts() - Allocate the buffers and vios used for reading
+ *                             slab journals when scrubbing slabs.
  * @scrubber: The slab scrubber for which to allocate.
  * @vdo: The VDO in which the scrubber resides.
  * @slab_journal_size: The size of a slab journal.
@@ -33,24 +58,46 @@
  * Return: VDO_SUCCESS or an error.
  */
 static int __must_check
-allocate_vio_and_buffer(struct slab_scrubber *scrubber,
+allocate_scrub_contexts(struct slab_scrubber *scrubber,
 			struct vdo *vdo,
 			block_count_t slab_journal_size)
 {
 	size_t buffer_size = VDO_BLOCK_SIZE * slab_journal_size;
-	int result = UDS_ALLOCATE(buffer_size, char, __func__,
-				  &scrubber->journal_data);
+	unsigned int depth = READ_ONCE(vdo_slab_scrub_depth);
+	unsigned int i;
+	int result;
+
+	depth = max(1U, min(depth, (unsigned int) MAXIMUM_SLAB_SCRUB_DEPTH));
+	result = UDS_ALLOCATE(depth, struct scrub_context, __func__,
+			      &scrubber->contexts);
 	if (result != VDO_SUCCESS) {
 		return result;
 	}
 
-	return create_multi_block_metadata_vio(vdo,
-					       VIO_TYPE_SLAB_JOURNAL,
-					       VIO_PRIORITY_METADATA,
-					       scrubber,
-					       slab_journal_size,
-					       scrubber->journal_data,
-					       &scrubber->vio);
+	scrubber->context_count = depth;
+	for (i = 0; i < depth; i++) {
+		struct scrub_context *context = &scrubber->contexts[i];
+
+		context->scrubber = scrubber;
+		result = UDS_ALLOCATE(buffer_size, char, __func__,
+				      &context->journal_data);
+		if (result != VDO_SUCCESS) {
+			return result;
+		}
+
+		result = create_multi_block_metadata_vio(vdo,
+							 VIO_TYPE_SLAB_JOURNAL,
+							 VIO_PRIORITY_METADATA,
+							 context,
+							 slab_journal_size,
+							 context->journal_data,
+							 &context->vio);
+		if (result != VDO_SUCCESS) {
+			return result;
+		}
+	}
+
+	return VDO_SUCCESS;
 }
 
 /**
@@ -74,7 +121,7 @@ int vdo_make_slab_scrubber(struct vdo *vdo,
 		return result;
 	}
 
-	result = allocate_vio_and_buffer(scrubber, vdo, slab_journal_size);
+	result = allocate_scrub_contexts(scrubber, vdo, slab_journal_size);
 	if (result != VDO_SUCCESS) {
 		vdo_free_slab_scrubber(scrubber);
 		return result;
@@ -85,6 +132,8 @@ int vdo_make_slab_scrubber(struct vdo *vdo,
 	INIT_LIST_HEAD(&scrubber->high_priority_slabs);
 	INIT_LIST_HEAD(&scrubber->slabs);
 	scrubber->read_only_notifier = read_only_notifier;
+	scrubber->epoch = jiffies;
+	atomic64_set(&scrubber->scrub_clock, 0);
 	vdo_set_admin_state_code(&scrubber->admin_state,
 				 VDO_ADMIN_STATE_SUSPENDED);
 	*scrubber_ptr = scrubber;
@@ -92,14 +141,27 @@ int vdo_make_slab_scrubber(struct vdo *vdo,
 }
 
 /**
- * free_vio_and_buffer() - Free the vio and buffer used for reading slab
+ * free_scrub_contexts() - Free the vios and buffers used for reading slab
  *                         journals.
  * @scrubber: The scrubber.
  **/
-static void free_vio_and_buffer(struct slab_scrubber *scrubber)
+static void free_scrub_contexts(struct slab_scrubber *scrubber)
 {
-	free_vio(UDS_FORGET(scrubber->vio));
-	UDS_FREE(UDS_FORGET(scrubber->journal_data));
+	unsigned int i;
+
+	if (scrubber->contexts == NULL) {
+		return;
+	}
+
+	for (i = 0; i < scrubber->context_count; i++) {
+		struct scrub_context *context = &scrubber->contexts[i];
+
+		free_vio(UDS_FORGET(context->vio));
+		UDS_FREE(UDS_FORGET(context->journal_data));
+	}
+
+	UDS_FREE(UDS_FORGET(scrubber->contexts));
+	scrubber->context_count = 0;
 }
 
 /**
@@ -112,7 +174,7 @@ void vdo_free_slab_scrubber(struct slab_scrubber *scrubber)
 		return;
 	}
 
-	free_vio_and_buffer(scrubber);
+	free_scrub_contexts(scrubber);
 	UDS_FREE(scrubber);
 }
 
@@ -120,19 +182,46 @@ void vdo_free_slab_scrubber(struct slab_scrubber *scrubber)
  * get_next_slab() - Get the next slab to scrub.
  * @scrubber: The slab scrubber.
  *
+ * If allocations are waiting for a clean slab and there are no high-priority
+ * slabs, whichever of the next few slabs the slab summary says has the most
+ * free blocks is chosen, since it is the most likely to satisfy them.
+ *
  * Return: The next slab to scrub or NULL if there are none.
  */
 static struct vdo_slab *get_next_slab(struct slab_scrubber *scrubber)
 {
+	struct vdo_slab *slab, *best = NULL;
+	block_count_t best_free_blocks = 0;
+	unsigned int considered = 0;
+
 	if (!list_empty(&scrubber->high_priority_slabs)) {
 		return vdo_slab_from_list_entry(scrubber->high_priority_slabs.next);
 	}
 
-	if (!list_empty(&scrubber->slabs)) {
+	if (list_empty(&scrubber->slabs)) {
+		return NULL;
+	}
+
+	if (!has_waiters(&scrubber->waiters)) {
 		return vdo_slab_from_list_entry(scrubber->slabs.next);
 	}
 
-	return NULL;
+	list_for_each_entry(slab, &scrubber->slabs, allocq_entry) {
+		block_count_t free_blocks =
+			vdo_get_summarized_free_block_count(slab->allocator->summary,
+							    slab->slab_number);
+
+		if ((best == NULL) || (free_blocks > best_free_blocks)) {
+			best = slab;
+			best_free_blocks = free_blocks;
+		}
+
+		if (++considered == MAXIMUM_SLABS_TO_CONSIDER) {
+			break;
+		}
+	}
+
+	return best;
 }
 
 /**
@@ -143,7 +232,8 @@ static struct vdo_slab *get_next_slab(struct slab_scrubber *scrubber)
  */
 static bool __must_check has_slabs_to_scrub(struct slab_scrubber *scrubber)
 {
-	return (get_next_slab(scrubber) != NULL);
+	return (!list_empty(&scrubber->high_priority_slabs) ||
+		!list_empty(&scrubber->slabs));
 }
 
 /**
@@ -158,6 +248,36 @@ slab_count_t vdo_get_scrubber_slab_count(const struct slab_scrubber *scrubber)
 	return READ_ONCE(scrubber->slab_count);
 }
 
+/**
+ * vdo_get_slab_scrub_rate() - Get the rate at which a scrubber has scrubbed
+ *                             slabs.
+ * @scrubber: The scrubber to query.
+ *
+ * Context: This may be called from any thread.
+ *
+ * Return: The number of slabs scrubbed per second spent scrubbing.
+ */
+uint64_t vdo_get_slab_scrub_rate(const struct slab_scrubber *scrubber)
+{
+	uint64_t clock = atomic64_read(&scrubber->scrub_clock);
+	unsigned long elapsed = clock >> 1;
+	unsigned int milliseconds;
+
+	if ((clock & 1) == 1) {
+		/* This thread may not have seen jiffies reach the run start. */
+		unsigned long since_epoch = jiffies - scrubber->epoch;
+
+		elapsed = ((since_epoch > elapsed) ? since_epoch - elapsed : 0);
+	}
+
+	milliseconds = jiffies_to_msecs(elapsed);
+	if (milliseconds == 0) {
+		return 0;
+	}
+
+	return READ_ONCE(scrubber->slabs_scrubbed) * 1000 / milliseconds;
+}
+
 /**
  * vdo_register_slab_for_scrubbing() - Register a slab with a scrubber.
  * @scrubber: The scrubber.
@@ -191,6 +311,46 @@ void vdo_register_slab_for_scrubbing(struct slab_scrubber *scrubber,
 	list_add_tail(&slab->allocq_entry, &scrubber->slabs);
 }
 
+/**
+ * start_scrub_timer() - Start timing a run of scrubbing.
+ * @scrubber: The scrubber.
+ */
+static void start_scrub_timer(struct slab_scrubber *scrubber)
+{
+	unsigned long offset;
+
+	if (scrubber->running) {
+		return;
+	}
+
+	scrubber->run_start = jiffies;
+	scrubber->running = true;
+
+	/*
+	 * No more time can have been spent scrubbing than has passed since
+	 * the epoch, so the offset is never negative.
+	 */
+	offset = ((scrubber->run_start - scrubber->epoch) -
+		  scrubber->scrub_jiffies);
+	atomic64_set(&scrubber->scrub_clock, ((uint64_t) offset << 1) | 1);
+}
+
+/**
+ * stop_scrub_timer() - Add the time spent in a run of scrubbing to the total.
+ * @scrubber: The scrubber.
+ */
+static void stop_scrub_timer(struct slab_scrubber *scrubber)
+{
+	if (!scrubber->running) {
+		return;
+	}
+
+	scrubber->scrub_jiffies += jiffies - scrubber->run_start;
+	scrubber->running = false;
+	atomic64_set(&scrubber->scrub_clock,
+		     (uint64_t) scrubber->scrub_jiffies << 1);
+}
+
 /**
  * finish_scrubbing() - Stop scrubbing, either because there are no more slabs
  *                      to scrub or because there's been an error.
@@ -201,9 +361,11 @@ static void finish_scrubbing(struct slab_scrubber *scrubber)
 	bool notify;
 
 	if (!has_slabs_to_scrub(scrubber)) {
-		free_vio_and_buffer(scrubber);
+		free_scrub_contexts(scrubber);
 	}
 
+	stop_scrub_timer(scrubber);
+
 	/* Inform whoever is waiting that scrubbing has completed. */
 	vdo_complete_completion(&scrubber->completion);
 
@@ -230,6 +392,16 @@ static void finish_scrubbing(struct slab_scrubber *scrubber)
 
 static void scrub_next_slab(struct slab_scrubber *scrubber);
 
+/**
+ * release_scrub_context() - Make a scrub context available for another slab.
+ * @context: The context.
+ */
+static void release_scrub_context(struct scrub_context *context)
+{
+	context->slab = NULL;
+	context->scrubber->active_count--;
+}
+
 /**
  * slab_scrubbed() - Notify the scrubber that a slab has been scrubbed.
  * @completion: The slab rebuild completion.
@@ -238,22 +410,28 @@ static void scrub_next_slab(struct slab_scrubber *scrubber);
  */
 static void slab_scrubbed(struct vdo_completion *completion)
 {
-	struct slab_scrubber *scrubber = completion->parent;
+	struct scrub_context *context = completion->parent;
+	struct slab_scrubber *scrubber = context->scrubber;
 
-	vdo_finish_scrubbing_slab(scrubber->slab);
+	vdo_finish_scrubbing_slab(context->slab);
+	release_scrub_context(context);
 	WRITE_ONCE(scrubber->slab_count, scrubber->slab_count - 1);
+	WRITE_ONCE(scrubber->slabs_scrubbed, scrubber->slabs_scrubbed + 1);
 	scrub_next_slab(scrubber);
 }
 
 /**
  * abort_scrubbing() - Abort scrubbing due to an error.
- * @scrubber: The slab scrubber.
+ * @context: The context of the slab which could not be scrubbed.
  * @result: The error.
  */
-static void abort_scrubbing(struct slab_scrubber *scrubber, int result)
+static void abort_scrubbing(struct scrub_context *context, int result)
 {
+	struct slab_scrubber *scrubber = context->scrubber;
+
 	vdo_enter_read_only_mode(scrubber->read_only_notifier, result);
 	vdo_set_completion_result(&scrubber->completion, result);
+	release_scrub_context(context);
 	scrub_next_slab(scrubber);
 }
 
@@ -332,8 +510,8 @@ static int apply_block_entries(struct packed_slab_journal_block *block,
 static void apply_journal_entries(struct vdo_completion *completion)
 {
 	int result;
-	struct slab_scrubber *scrubber = completion->parent;
-	struct vdo_slab *slab = scrubber->slab;
+	struct scrub_context *context = completion->parent;
+	struct vdo_slab *slab = context->slab;
 	struct slab_journal *journal = slab->journal;
 	struct ref_counts *reference_counts = slab->reference_counts;
 
@@ -341,7 +519,7 @@ static void apply_journal_entries(struct vdo_completion *completion)
 	sequence_number_t tail = journal->tail;
 	tail_block_offset_t end_index =
 		vdo_get_slab_journal_block_offset(journal, tail - 1);
-	char *end_data = scrubber->journal_data + (end_index * VDO_BLOCK_SIZE);
+	char *end_data = context->journal_data + (end_index * VDO_BLOCK_SIZE);
 	struct packed_slab_journal_block *end_block =
 		(struct packed_slab_journal_block *) end_data;
 
@@ -357,7 +535,7 @@ static void apply_journal_entries(struct vdo_completion *completion)
 
 	for (sequence = head; sequence < tail; sequence++) {
 		char *block_data =
-			scrubber->journal_data + (index * VDO_BLOCK_SIZE);
+			context->journal_data + (index * VDO_BLOCK_SIZE);
 		struct packed_slab_journal_block *block =
 			(struct packed_slab_journal_block *) block_data;
 		struct slab_journal_block_header header;
@@ -373,14 +551,14 @@ static void apply_journal_entries(struct vdo_completion *completion)
 			/* The block is not what we expect it to be. */
 			uds_log_error("vdo_slab journal block for slab %u was invalid",
 				      slab->slab_number);
-			abort_scrubbing(scrubber, VDO_CORRUPT_JOURNAL);
+			abort_scrubbing(context, VDO_CORRUPT_JOURNAL);
 			return;
 		}
 
 		result = apply_block_entries(block, header.entry_count,
 					     sequence, slab);
 		if (result != VDO_SUCCESS) {
-			abort_scrubbing(scrubber, result);
+			abort_scrubbing(context, result);
 			return;
 		}
 
@@ -400,7 +578,7 @@ static void apply_journal_entries(struct vdo_completion *completion)
 						  &ref_counts_point),
 			"Refcounts are not more accurate than the slab journal");
 	if (result != VDO_SUCCESS) {
-		abort_scrubbing(scrubber, result);
+		abort_scrubbing(context, result);
 		return;
 	}
 
@@ -409,7 +587,7 @@ static void apply_journal_entries(struct vdo_completion *completion)
 			       slab_scrubbed,
 			       handle_scrubber_error,
 			       completion->callback_thread_id,
-			       scrubber);
+			       context);
 	vdo_start_slab_action(slab, VDO_ADMIN_STATE_SAVE_FOR_SCRUBBING,
 			      completion);
 }
@@ -417,24 +595,24 @@ static void apply_journal_entries(struct vdo_completion *completion)
 static void read_slab_journal_endio(struct bio *bio)
 {
 	struct vio *vio = bio->bi_private;
-	struct slab_scrubber *scrubber = vio->completion.parent;
+	struct scrub_context *context = vio->completion.parent;
 
 	continue_vio_after_io(bio->bi_private,
 			      apply_journal_entries,
-			      scrubber->completion.callback_thread_id);
+			      context->scrubber->completion.callback_thread_id);
 }
 
 /**
- * start_scrubbing() - Read the current slab's journal from disk now that it
- *                     has been flushed.
- * @completion: The scrubber's vio completion.
+ * start_scrubbing() - Read a slab's journal from disk now that it has been
+ *                     flushed.
+ * @completion: The scrub context's vio completion.
  *
- * This callback is registered in scrub_next_slab().
+ * This callback is registered in launch_next_slab().
  */
 static void start_scrubbing(struct vdo_completion *completion)
 {
-	struct slab_scrubber *scrubber = completion->parent;
-	struct vdo_slab *slab = scrubber->slab;
+	struct scrub_context *context = completion->parent;
+	struct vdo_slab *slab = context->slab;
 
 	if (vdo_get_summarized_cleanliness(slab->allocator->summary,
 					   slab->slab_number)) {
@@ -442,7 +620,7 @@ static void start_scrubbing(struct vdo_completion *completion)
 		return;
 	}
 
-	submit_metadata_vio(scrubber->vio,
+	submit_metadata_vio(context->vio,
 			    slab->journal_origin,
 			    read_slab_journal_endio,
 			    handle_scrubber_error,
@@ -450,46 +628,93 @@ static void start_scrubbing(struct vdo_completion *completion)
 }
 
 /**
- * scrub_next_slab() - Scrub the next slab if there is one.
+ * can_launch_slab() - Check whether a scrubber should start scrubbing another
+ *                     slab now.
  * @scrubber: The scrubber.
+ *
+ * Return: true if there is a slab to scrub and an idle context to scrub it.
  */
-static void scrub_next_slab(struct slab_scrubber *scrubber)
+static bool can_launch_slab(struct slab_scrubber *scrubber)
 {
+	return ((scrubber->active_count < scrubber->context_count) &&
+		!vdo_is_read_only(scrubber->read_only_notifier) &&
+		!vdo_is_state_draining(&scrubber->admin_state) &&
+		has_slabs_to_scrub(scrubber) &&
+		!(scrubber->high_priority_only &&
+		  list_empty(&scrubber->high_priority_slabs)));
+}
+
+/**
+ * launch_next_slab() - Start scrubbing the next slab with an idle context.
+ * @scrubber: The scrubber.
+ */
+static void launch_next_slab(struct slab_scrubber *scrubber)
+{
+	struct vdo_slab *slab = get_next_slab(scrubber);
+	struct scrub_context *context = scrubber->contexts;
 	struct vdo_completion *completion;
-	struct vdo_slab *slab;
+
+	while (context->slab != NULL) {
+		context++;
+	}
+
+	list_del_init(&slab->allocq_entry);
+	context->slab = slab;
+	scrubber->active_count++;
+	completion = vio_as_completion(context->vio);
+	vdo_prepare_completion(completion,
+			       start_scrubbing,
+			       handle_scrubber_error,
+			       scrubber->completion.callback_thread_id,
+			       context);
+	vdo_start_slab_action(slab, VDO_ADMIN_STATE_SCRUBBING, completion);
+}
+
+/**
+ * scrub_next_slab() - Scrub as many of the remaining slabs at once as the
+ *                     scrubber has contexts for, and finish once none are
+ *                     being scrubbed and no more should be.
+ * @scrubber: The scrubber.
+ */
+static void scrub_next_slab(struct slab_scrubber *scrubber)
+{
+	if (scrubber->launching) {
+		/* A slab finished synchronously; the loop below continues. */
+		return;
+	}
+
+	scrubber->launching = true;
+	while (can_launch_slab(scrubber)) {
+		launch_next_slab(scrubber);
+	}
+	scrubber->launching = false;
 
 	/*
-	 * Note: this notify call is always safe only because scrubbing can
-	 * only be started when the VDO is quiescent.
+	 * Waiters are notified only after choosing slabs, so that the choice
+	 * can favor them. Note: this notify call is always safe only because
+	 * scrubbing can only be started when the VDO is quiescent.
 	 */
 	notify_all_waiters(&scrubber->waiters, NULL, NULL);
+	if (scrubber->active_count > 0) {
+		return;
+	}
+
 	if (vdo_is_read_only(scrubber->read_only_notifier)) {
 		vdo_set_completion_result(&scrubber->completion, VDO_READ_ONLY);
 		finish_scrubbing(scrubber);
 		return;
 	}
 
-	slab = get_next_slab(scrubber);
-	if ((slab == NULL) || (scrubber->high_priority_only &&
-			       list_empty(&scrubber->high_priority_slabs))) {
+	if (!has_slabs_to_scrub(scrubber) ||
+	    (scrubber->high_priority_only &&
+	     list_empty(&scrubber->high_priority_slabs))) {
 		scrubber->high_priority_only = false;
 		finish_scrubbing(scrubber);
 		return;
 	}
 
-	if (vdo_finish_draining(&scrubber->admin_state)) {
-		return;
-	}
-
-	list_del_init(&slab->allocq_entry);
-	scrubber->slab = slab;
-	completion = vio_as_completion(scrubber->vio);
-	vdo_prepare_completion(completion,
-			       start_scrubbing,
-			       handle_scrubber_error,
-			       scrubber->completion.callback_thread_id,
-			       scrubber);
-	vdo_start_slab_action(slab, VDO_ADMIN_STATE_SCRUBBING, completion);
+	stop_scrub_timer(scrubber);
+	vdo_finish_draining(&scrubber->admin_state);
 }
 
 /**
@@ -518,6 +743,7 @@ void vdo_scrub_slabs(struct slab_scrubber *scrubber,
 		return;
 	}
 
+	start_scrub_timer(scrubber);
 	scrub_next_slab(scrubber);
 }
 
@@ -591,6 +817,7 @@ void vdo_resume_slab_scrubbing(struct slab_scrubber *scrubber,
 		return;
 	}
 
+	start_scrub_timer(scrubber);
 	scrub_next_slab(scrubber);
 	vdo_complete_completion(parent);
 }
@@ -624,8 +851,9 @@ int vdo_enqueue_clean_slab_waiter(struct slab_scrubber *scrubber,
  */
 void vdo_dump_slab_scrubber(const struct slab_scrubber *scrubber)
 {
-	uds_log_info("slab_scrubber slab_count %u waiters %zu %s%s",
+	uds_log_info("slab_scrubber slab_count %u active %u waiters %zu %s%s",
 		     vdo_get_scrubber_slab_count(scrubber),
+		     scrubber->active_count,
 		     count_waiters(&scrubber->waiters),
 		     vdo_get_admin_state_code(&scrubber->admin_state)->name,
 		     scrubber->high_priority_only ? ", high_priority_only " : "");
@@ -6,6 +6,7 @@
 #ifndef SLAB_SCRUBBER_H
 #define SLAB_SCRUBBER_H
 
+#include <linux/atomic.h>
 #include <linux/list.h>
 
 #include "admin-state.h"
@@ -13,6 +14,18 @@
 #include "types.h"
 #include "wait-queue.h"
 
+/* The state for scrubbing one of the slabs a scrubber scrubs concurrently */
+struct scrub_context {
+	/* The scrubber to which this context belongs */
+	struct slab_scrubber *scrubber;
+	/* The slab being scrubbed, or NULL if the context is idle */
+	struct vdo_slab *slab;
+	/* The vio for loading slab journal blocks */
+	struct vio *vio;
+	/* A buffer to store the slab journal blocks */
+	char *journal_data;
+};
+
 struct slab_scrubber {
 	struct vdo_completion completion;
 	/* The queue of slabs to scrub first */
@@ -35,14 +48,44 @@ struct slab_scrubber {
 	bool high_priority_only;
 	/* The context for entering read-only mode */
 	struct read_only_notifier *read_only_notifier;
-	/* The slab currently being scrubbed */
-	struct vdo_slab *slab;
-	/* The vio for loading slab journal blocks */
-	struct vio *vio;
-	/* A buffer to store the slab journal blocks */
-	char *journal_data;
+	/* The contexts for the slabs which may be scrubbed concurrently */
+	struct scrub_context *contexts;
+	/* The number of scrub contexts */
+	unsigned int context_count;
+	/* The number of slabs currently being scrubbed */
+	unsigned int active_count;
+	/* Whether more slabs are being launched, to prevent recursion */
+	bool launching;
+
+	/* The time spent scrubbing, not including the current run */
+	unsigned long scrub_jiffies;
+	/* The time at which the current run of scrubbing started */
+	unsigned long run_start;
+	/* Whether the scrubber is in a run of scrubbing */
+	bool running;
+	/* The time at which the scrubber was made */
+	unsigned long epoch;
+
+	/*
+	 * These fields are modified by the physical zone thread, but are
+	 * queried by other threads to compute the scrub rate.
+	 */
+	/* The number of slabs scrubbed since the scrubber was made */
+	uint64_t slabs_scrubbed;
+	/*
+	 * The time spent scrubbing, in one value so that it can be read
+	 * consistently. Between runs, this is twice scrub_jiffies. During a
+	 * run, it is one more than twice the amount by which the start of
+	 * the run, measured from the epoch, exceeds scrub_jiffies.
+	 */
+	atomic64_t scrub_clock;
 };
 
+/* This is a module parameter; it takes effect when a VDO is started. */
+extern unsigned int vdo_slab_scrub_depth;
+
+void vdo_set_slab_scrub_depth(unsigned int value);
+
 int __must_check
 vdo_make_slab_scrubber(struct vdo *vdo,
 		       block_count_t slab_journal_size,
@@ -78,6 +121,9 @@ int vdo_enqueue_clean_slab_waiter(struct slab_scrubber *scrubber,
 slab_count_t __must_check
 vdo_get_scrubber_slab_count(const struct slab_scrubber *scrubber);
 
+uint64_t __must_check
+vdo_get_slab_scrub_rate(const struct slab_scrubber *scrubber);
+
 void vdo_dump_slab_scrubber(const struct slab_scrubber *scrubber);
 
 #endif /* SLAB_SCRUBBER_H */
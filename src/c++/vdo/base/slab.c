@@ -11,6 +11,7 @@
 
 #include "admin-state.h"
 #include "block-allocator.h"
+#include "block-discarder.h"
 #include "completion.h"
 #include "constants.h"
 #include "num-utils.h"
@@ -219,9 +220,22 @@ int vdo_modify_slab_reference_count(struct vdo_slab *slab,
 		return result;
 	}
 
-	if (free_status_changed) {
-		vdo_adjust_free_block_count(slab,
-					    !vdo_is_journal_increment_operation(operation.type));
+	if (!free_status_changed) {
+		return VDO_SUCCESS;
+	}
+
+	vdo_adjust_free_block_count(slab,
+				    !vdo_is_journal_increment_operation(operation.type));
+
+	/*
+	 * A decrement without a journal point releases a provisional
+	 * reference, such as one held by the discarder itself, so it frees
+	 * no data which needs discarding.
+	 */
+	if ((journal_point != NULL) &&
+	    !vdo_is_journal_increment_operation(operation.type)) {
+		vdo_note_freed_block(slab->allocator->discarder,
+				     operation.pbn);
 	}
 
 	return VDO_SUCCESS;
@@ -7,9 +7,16 @@
 
 #include "logger.h"
 
+#include "block-allocator.h"
+#include "block-discarder.h"
+#include "block-map.h"
 #include "constants.h"
 #include "dedupe.h"
+#include "io-submitter.h"
+#include "packer.h"
+#include "slab-scrubber.h"
 #include "vdo.h"
+#include "vio-write.h"
 
 static int vdo_log_level_show(char *buf,
 			      const struct kernel_param *kp)
@@ -84,6 +91,78 @@ static int vdo_min_dedupe_timer_interval_store(const char *buf,
 	return 0;
 }
 
+static int vdo_dedupe_target_latency_store(const char *buf,
+					   const struct kernel_param *kp)
+{
+	int result = param_set_uint(buf, kp);
+
+	if (result != 0) {
+		return result;
+	}
+	vdo_set_dedupe_target_latency(*(uint *)kp->arg);
+	return 0;
+}
+
+static int vdo_packer_deadline_interval_store(const char *buf,
+					      const struct kernel_param *kp)
+{
+	int result = param_set_uint(buf, kp);
+
+	if (result != 0) {
+		return result;
+	}
+	vdo_set_packer_deadline_interval(*(uint *)kp->arg);
+	return 0;
+}
+
+static int vdo_block_map_prefetch_pages_store(const char *buf,
+					      const struct kernel_param *kp)
+{
+	int result = param_set_uint(buf, kp);
+
+	if (result != 0) {
+		return result;
+	}
+	vdo_set_block_map_prefetch_pages(*(uint *)kp->arg);
+	return 0;
+}
+
+static int vdo_block_map_dirty_target_store(const char *buf,
+					    const struct kernel_param *kp)
+{
+	int result = param_set_uint(buf, kp);
+
+	if (result != 0) {
+		return result;
+	}
+	vdo_set_block_map_dirty_target(*(uint *)kp->arg);
+	return 0;
+}
+
+static int vdo_discard_blocks_per_second_store(const char *buf,
+					       const struct kernel_param *kp)
+{
+	int result = param_set_uint(buf, kp);
+
+	if (result != 0) {
+		return result;
+	}
+	vdo_set_discard_blocks_per_second(*(uint *)kp->arg);
+	return 0;
+}
+
+static int vdo_slab_scrub_depth_store(const char *buf,
+				      const struct kernel_param *kp)
+{
+	int result = param_set_uint(buf, kp);
+
+	if (result != 0) {
+		return result;
+	}
+	vdo_set_slab_scrub_depth(*(uint *)kp->arg);
+	return 0;
+}
+
 static const struct kernel_param_ops log_level_ops = {
 	.set = vdo_log_level_store,
 	.get = vdo_log_level_show,
@@ -106,6 +185,71 @@ static const struct kernel_param_ops dedupe_timer_ops = {
 	.get = param_get_uint,
 };
 
+static const struct kernel_param_ops dedupe_target_latency_ops = {
+	.set = vdo_dedupe_target_latency_store,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops adaptive_dedupe_timeout_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops dedupe_query_shedding_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops fused_write_ingest_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops speculative_verify_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops best_fit_packing_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops packer_deadline_ops = {
+	.set = vdo_packer_deadline_interval_store,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops merge_metadata_bios_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
+static const struct kernel_param_ops block_map_prefetch_ops = {
+	.set = vdo_block_map_prefetch_pages_store,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops block_map_dirty_target_ops = {
+	.set = vdo_block_map_dirty_target_store,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops discard_blocks_per_second_ops = {
+	.set = vdo_discard_blocks_per_second_store,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops slab_scrub_depth_ops = {
+	.set = vdo_slab_scrub_depth_store,
+	.get = param_get_uint,
+};
+
+static const struct kernel_param_ops lazy_ref_count_loading_ops = {
+	.set = param_set_bool,
+	.get = param_get_bool,
+};
+
 module_param_cb(log_level, &log_level_ops, NULL, 0644);
 
 #ifdef VDO_INTERNAL
@@ -118,3 +262,42 @@ module_param_cb(deduplication_timeout_interval, &dedupe_timeout_ops,
 
 module_param_cb(min_deduplication_timer_interval, &dedupe_timer_ops,
 		&vdo_dedupe_index_min_timer_interval, 0644);
+
+module_param_cb(deduplication_target_latency, &dedupe_target_latency_ops,
+		&vdo_dedupe_target_latency, 0644);
+
+module_param_cb(adaptive_deduplication_timeout, &adaptive_dedupe_timeout_ops,
+		&vdo_adaptive_dedupe_timeout, 0644);
+
+module_param_cb(deduplication_query_shedding, &dedupe_query_shedding_ops,
+		&vdo_dedupe_query_shedding, 0644);
+
+module_param_cb(fused_write_ingest, &fused_write_ingest_ops,
+		&vdo_fused_write_ingest, 0644);
+
+module_param_cb(speculative_verify, &speculative_verify_ops,
+		&vdo_speculative_verify, 0644);
+
+module_param_cb(best_fit_packing, &best_fit_packing_ops,
+		&vdo_best_fit_packing, 0644);
+
+module_param_cb(packer_deadline_interval, &packer_deadline_ops,
+		&vdo_packer_deadline_interval, 0644);
+
+module_param_cb(merge_metadata_bios, &merge_metadata_bios_ops,
+		&vdo_merge_metadata_bios, 0644);
+
+module_param_cb(block_map_prefetch_pages, &block_map_prefetch_ops,
+		&vdo_block_map_prefetch_pages, 0644);
+
+module_param_cb(block_map_dirty_target, &block_map_dirty_target_ops,
+		&vdo_block_map_dirty_target, 0644);
+
+module_param_cb(discard_blocks_per_second, &discard_blocks_per_second_ops,
+		&vdo_discard_blocks_per_second, 0644);
+
+module_param_cb(slab_scrub_depth, &slab_scrub_depth_ops,
+		&vdo_slab_scrub_depth, 0644);
+
+module_param_cb(lazy_ref_count_loading, &lazy_ref_count_loading_ops,
+		&vdo_lazy_ref_count_loading, 0644);
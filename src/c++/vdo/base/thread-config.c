@@ -41,6 +41,15 @@ static int allocate_thread_config(zone_count_t logical_zone_count,
 		return result;
 	}
 
+	result = UDS_ALLOCATE(logical_zone_count,
+			      int,
+			      "logical node array",
+			      &config->logical_nodes);
+	if (result != VDO_SUCCESS) {
+		vdo_free_thread_config(config);
+		return result;
+	}
+
 	result = UDS_ALLOCATE(physical_zone_count,
 			      thread_id_t,
 			      "physical thread array",
@@ -88,6 +97,37 @@ static void assign_thread_ids(struct thread_config *config,
 	}
 }
 
+/**
+ * assign_logical_zone_nodes() - Spread the logical zones across the memory
+ *                               nodes which also have CPUs.
+ * @config: The thread configuration.
+ * @shared: Whether the logical zone thread is shared with other zones.
+ *
+ * A zone thread is bound to the CPUs of its node, so a node without CPUs or
+ * without memory can not be used. A machine with a single usable node, or a
+ * single thread doing all of the zone work, gains nothing from binding
+ * threads to nodes, so nothing is bound.
+ */
+static void assign_logical_zone_nodes(struct thread_config *config,
+				      bool shared)
+{
+	nodemask_t nodes;
+	zone_count_t zone;
+	int node;
+
+	nodes_and(nodes, node_states[N_CPU], node_states[N_MEMORY]);
+	node = first_node(nodes);
+	for (zone = 0; zone < config->logical_zone_count; zone++) {
+		if (shared || (nodes_weight(nodes) < 2)) {
+			config->logical_nodes[zone] = NUMA_NO_NODE;
+			continue;
+		}
+
+		config->logical_nodes[zone] = node;
+		node = next_node_in(node, nodes);
+	}
+}
+
 /**
  * vdo_make_thread_config() - Make a thread configuration.
  * @counts: The counts of each type of thread.
@@ -122,6 +162,7 @@ int vdo_make_thread_config(struct thread_count_config counts,
 		config->logical_threads[0] = config->thread_count;
 		config->physical_threads[0] = config->thread_count;
 		config->hash_zone_threads[0] = config->thread_count++;
+		assign_logical_zone_nodes(config, true);
 	} else {
 		result = allocate_thread_config(counts.logical_zones,
 						counts.physical_zones,
@@ -144,6 +185,7 @@ int vdo_make_thread_config(struct thread_count_config counts,
 		assign_thread_ids(config,
 				  config->hash_zone_threads,
 				  counts.hash_zones);
+		assign_logical_zone_nodes(config, false);
 	}
 
 	config->dedupe_thread = config->thread_count++;
@@ -168,12 +210,36 @@ void vdo_free_thread_config(struct thread_config *config)
 	}
 
 	UDS_FREE(UDS_FORGET(config->logical_threads));
+	UDS_FREE(UDS_FORGET(config->logical_nodes));
 	UDS_FREE(UDS_FORGET(config->physical_threads));
 	UDS_FREE(UDS_FORGET(config->hash_zone_threads));
 	UDS_FREE(UDS_FORGET(config->bio_threads));
 	UDS_FREE(config);
 }
 
+/**
+ * vdo_get_thread_node() - Get the memory node to which a thread should be
+ *                         bound.
+ * @thread_config: The thread configuration.
+ * @thread_id: The thread id.
+ *
+ * Return: The node of the thread, or NUMA_NO_NODE if the thread should not
+ *         be bound.
+ */
+int vdo_get_thread_node(const struct thread_config *thread_config,
+			thread_id_t thread_id)
+{
+	zone_count_t zone;
+
+	for (zone = 0; zone < thread_config->logical_zone_count; zone++) {
+		if (thread_config->logical_threads[zone] == thread_id) {
+			return thread_config->logical_nodes[zone];
+		}
+	}
+
+	return NUMA_NO_NODE;
+}
+
 static bool get_zone_thread_name(const thread_id_t thread_ids[],
 				 zone_count_t count,
 				 thread_id_t id,
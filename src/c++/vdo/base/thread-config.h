@@ -6,6 +6,8 @@
 #ifndef THREAD_CONFIG_H
 #define THREAD_CONFIG_H
 
+#include <linux/nodemask.h>
+
 #include "permassert.h"
 
 #include "kernel-types.h"
@@ -24,6 +26,8 @@ struct thread_config {
 	thread_id_t bio_ack_thread;
 	thread_id_t cpu_thread;
 	thread_id_t *logical_threads;
+	/* The memory node of each logical zone, or NUMA_NO_NODE */
+	int *logical_nodes;
 	thread_id_t *physical_threads;
 	thread_id_t *hash_zone_threads;
 	thread_id_t *bio_threads;
@@ -51,6 +55,26 @@ vdo_get_logical_zone_thread(const struct thread_config *thread_config,
 	return thread_config->logical_threads[logical_zone];
 }
 
+/**
+ * vdo_get_logical_zone_node() - Get the memory node for a given logical zone.
+ * @thread_config: The thread config.
+ * @logical_zone: The number of the logical zone.
+ *
+ * The zone's thread runs on the CPUs of this node, so the zone's memory
+ * should be allocated from it.
+ *
+ * Return: The node for the given zone, or NUMA_NO_NODE if the zone is not
+ *         bound to a node.
+ */
+static inline int __must_check
+vdo_get_logical_zone_node(const struct thread_config *thread_config,
+			  zone_count_t logical_zone)
+{
+	ASSERT_LOG_ONLY((logical_zone <= thread_config->logical_zone_count),
+			"logical zone valid");
+	return thread_config->logical_nodes[logical_zone];
+}
+
 /**
  * vdo_get_physical_zone_thread() - Get the thread id for a given physical
  *                                  zone.
@@ -84,6 +108,9 @@ vdo_get_hash_zone_thread(const struct thread_config *thread_config,
 	return thread_config->hash_zone_threads[hash_zone];
 }
 
+int __must_check vdo_get_thread_node(const struct thread_config *thread_config,
+				     thread_id_t thread_id);
+
 void vdo_get_thread_name(const struct thread_config *thread_config,
 			 thread_id_t thread_id,
 			 char *buffer,
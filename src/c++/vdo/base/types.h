@@ -121,6 +121,12 @@ enum vdo_metadata_type {
 	VDO_METADATA_SLAB_JOURNAL,
 } __packed;
 
+/* Replacement policies for the block map page cache. */
+enum vdo_page_cache_policy {
+	VDO_PAGE_CACHE_POLICY_LRU,
+	VDO_PAGE_CACHE_POLICY_2Q,
+};
+
 /* A position in the block map where a block map entry is stored. */
 struct block_map_slot {
 	physical_block_number_t pbn;
@@ -76,6 +76,14 @@ decode_components(struct buffer *buffer, struct vdo_component_states *states)
 		return result;
 	}
 
+	states->discards_enabled = false;
+	if (content_length(buffer) > 0) {
+		result = get_boolean(buffer, &states->discards_enabled);
+		if (result != UDS_SUCCESS) {
+			return result;
+		}
+	}
+
 	ASSERT_LOG_ONLY((content_length(buffer) == 0),
 			"All decoded component data was used");
 	return VDO_SUCCESS;
@@ -171,7 +179,8 @@ static size_t __must_check get_component_data_size(struct fixed_layout *layout)
 		vdo_get_fixed_layout_encoded_size(layout) +
 		vdo_get_recovery_journal_encoded_size() +
 		vdo_get_slab_depot_encoded_size() +
-		vdo_get_block_map_encoded_size());
+		vdo_get_block_map_encoded_size() +
+		sizeof(bool));
 }
 
 /**
@@ -226,6 +235,11 @@ int vdo_encode_component_states(struct buffer *buffer,
 		return result;
 	}
 
+	result = put_boolean(buffer, states->discards_enabled);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
 	expected_size = get_component_data_size(states->layout);
 	ASSERT_LOG_ONLY((content_length(buffer) == expected_size),
 			"All super block component data was encoded");
@@ -39,6 +39,12 @@ struct vdo_component_states {
 	struct recovery_journal_state_7_0 recovery_journal;
 	struct slab_depot_state_2_0 slab_depot;
 
+	/*
+	 * Whether freed blocks may ever have been discarded. Super blocks
+	 * written before this was recorded do not have it.
+	 */
+	bool discards_enabled;
+
 	/* Our partitioning of the underlying storage */
 	struct fixed_layout *layout;
 };
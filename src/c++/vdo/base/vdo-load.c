@@ -9,6 +9,7 @@
 #include "memory-alloc.h"
 
 #include "admin-completion.h"
+#include "block-discarder.h"
 #include "block-map.h"
 #include "completion.h"
 #include "constants.h"
@@ -286,6 +287,7 @@ static void load_callback(struct vdo_completion *completion)
 		return;
 
 	case LOAD_PHASE_MAKE_DIRTY:
+		vdo_enable_discards(vdo->depot);
 		vdo_set_state(vdo, VDO_DIRTY);
 		vdo_save_components(vdo, vdo_reset_admin_sub_task(completion));
 		return;
@@ -309,6 +311,8 @@ static void load_callback(struct vdo_completion *completion)
 
 	case LOAD_PHASE_DATA_REDUCTION:
 		WRITE_ONCE(vdo->compressing, vdo->device_config->compression);
+		WRITE_ONCE(vdo->compression_acceleration,
+			   vdo->device_config->compression_acceleration);
 		if (vdo->device_config->deduplication) {
 			/*
 			 * Don't try to load or rebuild the index first (and
@@ -540,6 +544,8 @@ static int __must_check decode_vdo(struct vdo *vdo)
 		return result;
 	}
 
+	vdo->depot->discards_enabled = vdo->states.discards_enabled;
+
 	result = vdo_decode_block_map(vdo->states.block_map,
 				      vdo->states.vdo.config.logical_blocks,
 				      thread_config,
@@ -548,6 +554,7 @@ static int __must_check decode_vdo(struct vdo *vdo)
 				      vdo->recovery_journal,
 				      vdo->states.vdo.nonce,
 				      vdo->device_config->cache_size,
+				      vdo->device_config->cache_policy,
 				      maximum_age,
 				      &vdo->block_map);
 	if (result != VDO_SUCCESS) {
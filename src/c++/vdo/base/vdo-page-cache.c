@@ -6,6 +6,7 @@
 #include "vdo-page-cache.h"
 
 #include <linux/bio.h>
+#include <linux/jiffies.h>
 #include <linux/ratelimit.h>
 
 #include "errors.h"
@@ -27,8 +28,27 @@
 enum {
 	LOG_INTERVAL = 4000,
 	DISPLAY_INTERVAL = 100000,
+	/*
+	 * Under the 2Q policy, pages used only once are evicted first while
+	 * they fill more than a quarter of the cache, and the pbns of the
+	 * last half a cache's worth of them are remembered.
+	 */
+	COLD_FRACTION = 4,
+	GHOST_FRACTION = 2,
+	/*
+	 * Early writeback writes at most a quarter of the cache per period,
+	 * and paces the oldest dirty pages once they are within a quarter of
+	 * the maximum age of expiring.
+	 */
+	WRITEBACK_FRACTION = 4,
+	HEADROOM_FRACTION = 4,
+	/* The most dirty pages on each side of a page to save along with it */
+	MAXIMUM_COALESCED_PAGES = 8,
 };
 
+/* This is a module parameter. */
+unsigned int vdo_block_map_dirty_target;
+
 /*
  * For adjusting VDO page cache statistic fields which are only mutated on the
  * logical zone thread. Prevents any compiler shenanigans from affecting other
@@ -66,11 +86,14 @@ static inline bool is_valid(const struct page_info *info)
 	return is_present(info) || is_outgoing(info);
 }
 
-static char *get_page_buffer(struct page_info *info)
+static inline bool is_unused(const struct page_info *info)
 {
-	struct vdo_page_cache *cache = info->cache;
+	return (info->state == PS_FREE) || (info->state == PS_FAILED);
+}
 
-	return &cache->pages[(info - cache->infos) * VDO_BLOCK_SIZE];
+static char *get_page_buffer(struct page_info *info)
+{
+	return info->vio->data;
 }
 
 static inline struct page_info *
@@ -124,40 +147,82 @@ page_completion_from_waiter(struct waiter *waiter)
  */
 static int __must_check allocate_cache_components(struct vdo_page_cache *cache)
 {
-	uint64_t size = cache->page_count * (uint64_t) VDO_BLOCK_SIZE;
+	page_count_t slot;
+	int result;
 
-	int result = UDS_ALLOCATE(cache->page_count,
-				  struct page_info,
-				  "page infos",
-				  &cache->infos);
-	if (result != UDS_SUCCESS) {
-		return result;
+	if (cache->ghost_capacity == 0) {
+		return VDO_SUCCESS;
 	}
 
-	result = uds_allocate_memory(size, VDO_BLOCK_SIZE, "cache pages",
-				     &cache->pages);
+	result = UDS_ALLOCATE(cache->ghost_capacity,
+			      physical_block_number_t,
+			      "page cache ghosts",
+			      &cache->ghosts);
 	if (result != UDS_SUCCESS) {
 		return result;
 	}
 
-	return make_int_map(cache->page_count, 0, &cache->page_map);
+	for (slot = 0; slot < cache->ghost_capacity; slot++) {
+		cache->ghosts[slot] = NO_PAGE;
+	}
+
+	return make_int_map(cache->ghost_capacity, 0, &cache->ghost_map);
 }
 
 /**
- * initialize_info() - Initialize all page info structures and put them on the
- *                     free list.
- * @cache: The cache to initialize.
+ * vdo_make_page_cache_segment() - Allocate and initialize page slots for a
+ *                                 cache.
+ * @cache: The cache which will own the slots.
+ * @page_count: The number of slots to allocate.
+ * @segment: The segment to initialize.
+ *
+ * This does not touch the state of the cache, so it may be called from any
+ * thread. The slots are not used until the segment is passed to
+ * vdo_add_page_cache_segment().
  *
  * Return: VDO_SUCCESS or an error.
  */
-static int initialize_info(struct vdo_page_cache *cache)
+int vdo_make_page_cache_segment(struct vdo_page_cache *cache,
+				page_count_t page_count,
+				struct page_cache_segment *segment)
 {
-	struct page_info *info;
+	uint64_t size = page_count * (uint64_t) VDO_BLOCK_SIZE;
+	page_count_t slot;
+	int result;
 
-	INIT_LIST_HEAD(&cache->free_list);
-	for (info = cache->infos; info < cache->infos + cache->page_count;
-	     ++info) {
-		int result;
+	*segment = (struct page_cache_segment) {
+		.page_count = page_count,
+	};
+
+	/*
+	 * Both the infos and the pages are only touched by the zone's thread,
+	 * so put them on that thread's node.
+	 */
+	result = uds_allocate_memory_on_node(page_count *
+					     sizeof(struct page_info),
+					     __alignof__(struct page_info),
+					     cache->node,
+					     "page infos",
+					     &segment->infos);
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	result = uds_allocate_memory_on_node(size, VDO_BLOCK_SIZE, cache->node,
+					     "cache pages", &segment->pages);
+	if (result != UDS_SUCCESS) {
+		vdo_free_page_cache_segment(segment);
+		return result;
+	}
+
+	for (slot = 0; slot < page_count; slot++) {
+		struct page_info *info = &segment->infos[slot];
+		char *page = segment->pages + ((size_t) slot * VDO_BLOCK_SIZE);
+
+		if ((cache->node != NUMA_NO_NODE) &&
+		    (uds_get_memory_node(page) != cache->node)) {
+			segment->remote_count++;
+		}
 
 		info->cache = cache;
 		info->state = PS_FREE;
@@ -165,10 +230,10 @@ static int initialize_info(struct vdo_page_cache *cache)
 
 		result = create_metadata_vio(cache->vdo,
 					     VIO_TYPE_BLOCK_MAP,
-					     VIO_PRIORITY_METADATA, info,
-					     get_page_buffer(info),
+					     VIO_PRIORITY_METADATA, info, page,
 					     &info->vio);
 		if (result != VDO_SUCCESS) {
+			vdo_free_page_cache_segment(segment);
 			return result;
 		}
 
@@ -177,19 +242,159 @@ static int initialize_info(struct vdo_page_cache *cache)
 			cache->zone->thread_id;
 
 		INIT_LIST_HEAD(&info->state_entry);
-		list_add_tail(&info->state_entry, &cache->free_list);
 		INIT_LIST_HEAD(&info->lru_entry);
 	}
 
 	return VDO_SUCCESS;
 }
 
+/**
+ * vdo_free_page_cache_segment() - Free the page slots of a segment.
+ * @segment: The segment to free.
+ */
+void vdo_free_page_cache_segment(struct page_cache_segment *segment)
+{
+	if (segment->infos != NULL) {
+		struct page_info *info;
+
+		for (info = segment->infos;
+		     info < segment->infos + segment->page_count;
+		     ++info) {
+			free_vio(UDS_FORGET(info->vio));
+		}
+	}
+
+	UDS_FREE(UDS_FORGET(segment->infos));
+	UDS_FREE(UDS_FORGET(segment->pages));
+}
+
+/**
+ * make_page_map() - Make a map of page number to info for every page in a
+ *                   cache.
+ * @cache: The cache.
+ * @capacity: The number of pages the map should be sized for.
+ * @map_ptr: A pointer to hold the new map.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+static int __must_check make_page_map(struct vdo_page_cache *cache,
+				      page_count_t capacity,
+				      struct int_map **map_ptr)
+{
+	struct int_map *map;
+	unsigned int s;
+	int result = make_int_map(capacity, 0, &map);
+
+	if (result != UDS_SUCCESS) {
+		return result;
+	}
+
+	for (s = 0; s < cache->segment_count; s++) {
+		struct page_cache_segment *segment = &cache->segments[s];
+		struct page_info *info;
+
+		for (info = segment->infos;
+		     info < segment->infos + segment->page_count;
+		     info++) {
+			if (info->pbn == NO_PAGE) {
+				continue;
+			}
+
+			result = int_map_put(map, info->pbn, info, true, NULL);
+			if (result != UDS_SUCCESS) {
+				free_int_map(map);
+				return result;
+			}
+		}
+	}
+
+	*map_ptr = map;
+	return VDO_SUCCESS;
+}
+
+static void allocate_free_pages(struct vdo_page_cache *cache);
+
+/**
+ * vdo_add_page_cache_segment() - Add the slots of a segment to the end of a
+ *                                cache, and put them on the free list.
+ * @cache: The cache.
+ * @segment: The segment made by vdo_make_page_cache_segment(); the cache
+ *           takes ownership of its slots on success.
+ *
+ * Unless the cache is being constructed, this must be called on the cache's
+ * thread, and the cache must have no slots being retired.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int vdo_add_page_cache_segment(struct vdo_page_cache *cache,
+			       struct page_cache_segment *segment)
+{
+	struct page_cache_segment *segments;
+	struct int_map *page_map;
+	struct page_info *info;
+	int result = ASSERT(cache->page_count == cache->slot_count,
+			    "page cache has no slots being retired");
+
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	/*
+	 * Size the map for the grown cache now rather than letting it rehash
+	 * while pages are being fetched.
+	 */
+	result = make_page_map(cache, cache->slot_count + segment->page_count,
+			       &page_map);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	result = uds_reallocate_memory(cache->segments,
+				       (cache->segment_count *
+					sizeof(struct page_cache_segment)),
+				       ((cache->segment_count + 1) *
+					sizeof(struct page_cache_segment)),
+				       "page cache segments",
+				       &segments);
+	if (result != UDS_SUCCESS) {
+		free_int_map(page_map);
+		return result;
+	}
+
+	cache->segments = segments;
+	cache->segments[cache->segment_count++] = *segment;
+	*segment = (struct page_cache_segment) { 0 };
+	segment = &cache->segments[cache->segment_count - 1];
+
+	free_int_map(UDS_FORGET(cache->page_map));
+	cache->page_map = page_map;
+
+	for (info = segment->infos;
+	     info < segment->infos + segment->page_count;
+	     info++) {
+		list_add_tail(&info->state_entry, &cache->free_list);
+	}
+
+	cache->slot_count += segment->page_count;
+	WRITE_ONCE(cache->remote_count,
+		   cache->remote_count + segment->remote_count);
+	WRITE_ONCE(cache->page_count, cache->slot_count);
+	ADD_ONCE(cache->stats.free_pages, segment->page_count);
+	if (cache->policy == VDO_PAGE_CACHE_POLICY_2Q) {
+		cache->cold_target = cache->page_count / COLD_FRACTION;
+	}
+
+	allocate_free_pages(cache);
+	return VDO_SUCCESS;
+}
+
 static void write_dirty_pages_callback(struct list_head *entry, void *context);
 
 /**
  * vdo_make_page_cache() - Construct a page cache.
  * @vdo: The vdo.
  * @page_count: The number of cache pages to hold.
+ * @policy: The replacement policy for the cache.
  * @read_hook: The function to be called when a page is read into the cache.
  * @write_hook: The function to be called after a page is written from the
  *              cache.
@@ -204,6 +409,7 @@ static void write_dirty_pages_callback(struct list_head *entry, void *context);
  */
 int vdo_make_page_cache(struct vdo *vdo,
 			page_count_t page_count,
+			enum vdo_page_cache_policy policy,
 			vdo_page_read_function *read_hook,
 			vdo_page_write_function *write_hook,
 			size_t page_context_size,
@@ -212,6 +418,7 @@ int vdo_make_page_cache(struct vdo *vdo,
 			struct vdo_page_cache **cache_ptr)
 {
 	struct vdo_page_cache *cache;
+	struct page_cache_segment segment;
 	int result = ASSERT(page_context_size <= MAX_PAGE_CONTEXT_SIZE,
 			    "page context size %zu cannot exceed %u bytes",
 			    page_context_size,
@@ -226,11 +433,19 @@ int vdo_make_page_cache(struct vdo *vdo,
 	}
 
 	cache->vdo = vdo;
-	cache->page_count = page_count;
+	cache->policy = policy;
+	if (policy == VDO_PAGE_CACHE_POLICY_2Q) {
+		/* The ghost ring keeps this size if the cache is resized. */
+		cache->ghost_capacity = page_count / GHOST_FRACTION;
+	}
+
 	cache->read_hook = read_hook;
 	cache->write_hook = write_hook;
 	cache->zone = zone;
-	cache->stats.free_pages = page_count;
+	cache->node = vdo_get_logical_zone_node(vdo->thread_config,
+						zone->zone_number);
+	INIT_LIST_HEAD(&cache->free_list);
+	INIT_LIST_HEAD(&cache->retired_list);
 
 	result = allocate_cache_components(cache);
 	if (result != VDO_SUCCESS) {
@@ -238,12 +453,20 @@ int vdo_make_page_cache(struct vdo *vdo,
 		return result;
 	}
 
-	result = initialize_info(cache);
+	result = vdo_make_page_cache_segment(cache, page_count, &segment);
 	if (result != VDO_SUCCESS) {
 		vdo_free_page_cache(cache);
 		return result;
 	}
 
+	result = vdo_add_page_cache_segment(cache, &segment);
+	if (result != VDO_SUCCESS) {
+		vdo_free_page_cache_segment(&segment);
+		vdo_free_page_cache(cache);
+		return result;
+	}
+
+	cache->maximum_age = maximum_age;
 	result = vdo_make_dirty_lists(maximum_age, write_dirty_pages_callback,
 				      cache, &cache->dirty_lists);
 	if (result != VDO_SUCCESS) {
@@ -253,6 +476,7 @@ int vdo_make_page_cache(struct vdo *vdo,
 
 	/* initialize empty circular queues */
 	INIT_LIST_HEAD(&cache->lru_list);
+	INIT_LIST_HEAD(&cache->cold_list);
 	INIT_LIST_HEAD(&cache->outgoing_list);
 
 	*cache_ptr = cache;
@@ -265,24 +489,21 @@ int vdo_make_page_cache(struct vdo *vdo,
  */
 void vdo_free_page_cache(struct vdo_page_cache *cache)
 {
+	unsigned int s;
+
 	if (cache == NULL) {
 		return;
 	}
 
-	if (cache->infos != NULL) {
-		struct page_info *info;
-
-		for (info = cache->infos;
-		     info < cache->infos + cache->page_count;
-		     ++info) {
-			free_vio(UDS_FORGET(info->vio));
-		}
+	for (s = 0; s < cache->segment_count; s++) {
+		vdo_free_page_cache_segment(&cache->segments[s]);
 	}
 
 	UDS_FREE(UDS_FORGET(cache->dirty_lists));
 	free_int_map(UDS_FORGET(cache->page_map));
-	UDS_FREE(UDS_FORGET(cache->infos));
-	UDS_FREE(UDS_FORGET(cache->pages));
+	free_int_map(UDS_FORGET(cache->ghost_map));
+	UDS_FREE(UDS_FORGET(cache->ghosts));
+	UDS_FREE(UDS_FORGET(cache->segments));
 	UDS_FREE(cache);
 }
 
@@ -397,7 +618,10 @@ static void update_counter(struct page_info *info, int32_t delta)
 
 	switch (info->state) {
 	case PS_FREE:
-		ADD_ONCE(stats->free_pages, delta);
+		/* A retired slot is not a free page. */
+		if (!info->retiring) {
+			ADD_ONCE(stats->free_pages, delta);
+		}
 		return;
 
 	case PS_INCOMING:
@@ -425,13 +649,84 @@ static void update_counter(struct page_info *info, int32_t delta)
 	}
 }
 
+/**
+ * remember_ghost() - Remember the pbn of a page evicted from the cold list.
+ * @cache: The page cache.
+ * @pbn: The pbn of the evicted page.
+ *
+ * The ghost ring is a FIFO; the oldest ghost is forgotten to make room,
+ * unless its pbn has since been evicted again into a newer slot.
+ */
+static void remember_ghost(struct vdo_page_cache *cache,
+			   physical_block_number_t pbn)
+{
+	physical_block_number_t *slot;
+	int result;
+
+	if (cache->ghost_capacity == 0) {
+		return;
+	}
+
+	slot = &cache->ghosts[cache->next_ghost];
+	cache->next_ghost = (cache->next_ghost + 1) % cache->ghost_capacity;
+	if ((*slot != NO_PAGE) &&
+	    (int_map_get(cache->ghost_map, *slot) == slot)) {
+		int_map_remove(cache->ghost_map, *slot);
+	}
+
+	*slot = pbn;
+	result = int_map_put(cache->ghost_map, pbn, slot, true, NULL);
+	if (result != UDS_SUCCESS) {
+		/* A lost ghost only costs the page a promotion. */
+		*slot = NO_PAGE;
+	}
+}
+
+/**
+ * forget_ghost() - Check whether a page was recently evicted from the cold
+ *                  list, and forget it if so.
+ * @cache: The page cache.
+ * @pbn: The pbn of the page.
+ *
+ * Return: true if the page had a ghost.
+ */
+static bool forget_ghost(struct vdo_page_cache *cache,
+			 physical_block_number_t pbn)
+{
+	return ((cache->ghost_map != NULL) &&
+		(int_map_remove(cache->ghost_map, pbn) != NULL));
+}
+
 /**
  * update_lru() - Update the lru information for an active page.
+ *
+ * Under the 2Q policy, a page which is not yet on either list goes to the
+ * tail of the cold FIFO, where further uses do not move it, so that a
+ * sequential scan (which uses each page many times in quick succession)
+ * cycles through the cold list without disturbing the reused pages. A page
+ * which is fetched again soon after being evicted from the cold list is
+ * genuinely reused, and goes to the LRU list instead.
  */
 static void update_lru(struct page_info *info)
 {
 	struct vdo_page_cache *cache = info->cache;
 
+	if ((cache->policy == VDO_PAGE_CACHE_POLICY_2Q) &&
+	    list_empty(&info->lru_entry)) {
+		if (!forget_ghost(cache, info->pbn)) {
+			info->cold = true;
+			cache->cold_count++;
+			list_add_tail(&info->lru_entry, &cache->cold_list);
+			return;
+		}
+
+		ADD_ONCE(cache->stats.ghost_hits, 1);
+	}
+
+	if (info->cold) {
+		return;
+	}
+
 	if (cache->lru_list.prev != &info->lru_entry) {
 		list_move_tail(&info->lru_entry, &cache->lru_list);
 	}
@@ -446,6 +741,9 @@ static void update_lru(struct page_info *info)
 static void set_info_state(struct page_info *info,
 			   enum vdo_page_buffer_state new_state)
 {
+	struct vdo_page_cache *cache = info->cache;
+	bool was_unused = is_unused(info);
+
 	if (new_state == info->state) {
 		return;
 	}
@@ -457,11 +755,21 @@ static void set_info_state(struct page_info *info,
 	switch (info->state) {
 	case PS_FREE:
 	case PS_FAILED:
-		list_move_tail(&info->state_entry, &info->cache->free_list);
+		if (info->retiring) {
+			if (!was_unused) {
+				cache->retired_count++;
+			}
+
+			list_move_tail(&info->state_entry,
+				       &cache->retired_list);
+			return;
+		}
+
+		list_move_tail(&info->state_entry, &cache->free_list);
 		return;
 
 	case PS_OUTGOING:
-		list_move_tail(&info->state_entry, &info->cache->outgoing_list);
+		list_move_tail(&info->state_entry, &cache->outgoing_list);
 		return;
 
 	case PS_DIRTY:
@@ -521,6 +829,20 @@ static int reset_page_info(struct page_info *info)
 		return result;
 	}
 
+	if (info->cold) {
+		if (is_present(info)) {
+			remember_ghost(info->cache, info->pbn);
+		}
+
+		info->cold = false;
+		info->cache->cold_count--;
+	}
+
+	if (info->prefetched) {
+		info->prefetched = false;
+		ADD_ONCE(info->cache->stats.prefetch_wasted, 1);
+	}
+
 	result = set_info_pbn(info, NO_PAGE);
 	set_info_state(info, PS_FREE);
 	list_del_init(&info->lru_entry);
@@ -563,32 +885,65 @@ find_page(struct vdo_page_cache *cache, physical_block_number_t pbn)
 	return cache->last_found;
 }
 
+/**
+ * select_from_list() - Find the first page in a list which may be evicted.
+ * @list: The LRU or cold list to search.
+ * @clean_only: Whether dirty pages should be passed over.
+ *
+ * Return: A pointer to the info structure for an evictable page, or NULL if
+ *         the list has none.
+ */
+static struct page_info * __must_check
+select_from_list(struct list_head *list, bool clean_only)
+{
+	struct list_head *lru;
+
+	list_for_each(lru, list) {
+		struct page_info *info = page_info_from_lru_entry(lru);
+
+		if ((info->busy == 0) && !is_in_flight(info) &&
+		    !info->retiring && !(clean_only && is_dirty(info))) {
+			return info;
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * select_lru_page() - Determine which page is least recently used.
  * @cache: The page cache structure.
+ * @clean_only: Whether to select only pages which need not be written.
  *
  * Picks the least recently used from among the non-busy entries at the front
  * of each of the lru ring. Since whenever we mark a page busy we also put it
  * to the end of the ring it is unlikely that the entries at the front are
- * busy unless the queue is very short, but not impossible.
+ * busy unless the queue is very short, but not impossible. Under the 2Q
+ * policy, the oldest cold page is taken instead while the cold list is over
+ * its target size.
  *
  * Return: A pointer to the info structure for a relevant page, or NULL if no
- * such page can be found. The page can be dirty or resident.
+ * such page can be found. The page can be dirty or resident unless
+ * @clean_only is set.
  */
 static struct page_info * __must_check
-select_lru_page(struct vdo_page_cache *cache)
+select_lru_page(struct vdo_page_cache *cache, bool clean_only)
 {
-	struct list_head *lru;
-
-	list_for_each(lru, &cache->lru_list) {
-		struct page_info *info = page_info_from_lru_entry(lru);
+	struct page_info *info;
 
-		if ((info->busy == 0) && !is_in_flight(info)) {
+	if (cache->cold_count > cache->cold_target) {
+		info = select_from_list(&cache->cold_list, clean_only);
+		if (info != NULL) {
 			return info;
 		}
 	}
 
-	return NULL;
+	info = select_from_list(&cache->lru_list, clean_only);
+	if (info != NULL) {
+		return info;
+	}
+
+	return select_from_list(&cache->cold_list, clean_only);
 }
 
 /**
@@ -624,6 +979,25 @@ vdo_get_page_cache_statistics(const struct vdo_page_cache *cache)
 		.pages_loaded = READ_ONCE(stats->pages_loaded),
 		.pages_saved = READ_ONCE(stats->pages_saved),
 		.flush_count = READ_ONCE(stats->flush_count),
+		.cold_hits = READ_ONCE(stats->cold_hits),
+		.hot_hits = READ_ONCE(stats->hot_hits),
+		.ghost_hits = READ_ONCE(stats->ghost_hits),
+		.pages_prefetched = READ_ONCE(stats->pages_prefetched),
+		.prefetch_hits = READ_ONCE(stats->prefetch_hits),
+		.prefetch_wasted = READ_ONCE(stats->prefetch_wasted),
+		.warmup_pages_scanned = READ_ONCE(stats->warmup_pages_scanned),
+		.warmup_tree_pages_loaded =
+			READ_ONCE(stats->warmup_tree_pages_loaded),
+		.warmup_leaf_pages_fetched =
+			READ_ONCE(stats->warmup_leaf_pages_fetched),
+		.pages_written_early = READ_ONCE(stats->pages_written_early),
+		.pages_coalesced = READ_ONCE(stats->pages_coalesced),
+		.max_pages_per_journal_block =
+			READ_ONCE(stats->max_pages_per_journal_block),
+		.writeback_milliseconds =
+			READ_ONCE(stats->writeback_milliseconds),
+		.max_writeback_milliseconds =
+			READ_ONCE(stats->max_writeback_milliseconds),
 	};
 }
 
@@ -743,7 +1117,7 @@ static void set_persistent_error(struct vdo_page_cache *cache,
 				 const char *context,
 				 int result)
 {
-	struct page_info *info;
+	unsigned int s;
 	/* If we're already read-only, there's no need to log. */
 	struct read_only_notifier *notifier = cache->zone->read_only_notifier;
 
@@ -759,9 +1133,15 @@ static void set_persistent_error(struct vdo_page_cache *cache,
 	distribute_error_over_queue(result, &cache->free_waiters);
 	cache->waiter_count = 0;
 
-	for (info = cache->infos; info < cache->infos + cache->page_count;
-	     ++info) {
-		distribute_error_over_queue(result, &info->waiting);
+	for (s = 0; s < cache->segment_count; s++) {
+		struct page_cache_segment *segment = &cache->segments[s];
+		struct page_info *info;
+
+		for (info = segment->infos;
+		     info < segment->infos + segment->page_count;
+		     ++info) {
+			distribute_error_over_queue(result, &info->waiting);
+		}
 	}
 }
 
@@ -870,6 +1250,213 @@ bool vdo_is_page_cache_active(struct vdo_page_cache *cache)
 		(cache->outstanding_writes != 0));
 }
 
+static void launch_page_save(struct page_info *info);
+
+/**
+ * get_slot() - Get the page info for a slot of the cache.
+ * @cache: The page cache.
+ * @slot: The index of the slot across all segments.
+ *
+ * Return: The page info for the slot.
+ */
+static struct page_info *get_slot(struct vdo_page_cache *cache,
+				  page_count_t slot)
+{
+	struct page_cache_segment *segment = cache->segments;
+
+	while (slot >= segment->page_count) {
+		slot -= segment->page_count;
+		segment++;
+	}
+
+	return &segment->infos[slot];
+}
+
+/**
+ * retire_page_if_idle() - Stop using a page whose slot is beyond the cache
+ *                         size, if nothing is using it.
+ * @info: The page info.
+ *
+ * A dirty page is written out first, and retired once it is clean.
+ */
+static void retire_page_if_idle(struct page_info *info)
+{
+	struct vdo_page_cache *cache = info->cache;
+
+	if (!info->retiring || is_unused(info) || (info->busy > 0) ||
+	    is_in_flight(info) || has_waiters(&info->waiting)) {
+		return;
+	}
+
+	if (is_dirty(info)) {
+		if (vdo_is_state_normal(&cache->zone->state) &&
+		    !vdo_is_read_only(cache->zone->read_only_notifier)) {
+			launch_page_save(info);
+		}
+
+		return;
+	}
+
+	reset_page_info(info);
+}
+
+/**
+ * release_retired_segments() - Free the segments at the end of the cache
+ *                              once every slot beyond the cache size has been
+ *                              retired.
+ * @cache: The page cache.
+ *
+ * A segment which still holds slots within the cache size is kept, with its
+ * retired slots, until the cache is resized again.
+ */
+static void release_retired_segments(struct vdo_page_cache *cache)
+{
+	if (cache->retired_count < (cache->slot_count - cache->page_count)) {
+		return;
+	}
+
+	while (cache->segment_count > 0) {
+		struct page_cache_segment *segment =
+			&cache->segments[cache->segment_count - 1];
+		struct page_info *info;
+
+		if ((cache->slot_count - segment->page_count) <
+		    cache->page_count) {
+			return;
+		}
+
+		for (info = segment->infos;
+		     info < segment->infos + segment->page_count;
+		     info++) {
+			list_del_init(&info->state_entry);
+		}
+
+		cache->last_found = NULL;
+		cache->slot_count -= segment->page_count;
+		cache->retired_count -= segment->page_count;
+		WRITE_ONCE(cache->remote_count,
+			   cache->remote_count - segment->remote_count);
+		cache->segment_count--;
+		vdo_free_page_cache_segment(segment);
+	}
+}
+
+/**
+ * check_for_retirement() - Retire a page which has just become idle if its
+ *                          slot is beyond the cache size.
+ * @info: The page info, which may be freed.
+ */
+static void check_for_retirement(struct page_info *info)
+{
+	struct vdo_page_cache *cache = info->cache;
+
+	if (!info->retiring) {
+		return;
+	}
+
+	retire_page_if_idle(info);
+	release_retired_segments(cache);
+}
+
+/**
+ * retire_slot() - Mark a slot as beyond the cache size.
+ * @info: The page info for the slot.
+ */
+static void retire_slot(struct page_info *info)
+{
+	struct vdo_page_cache *cache = info->cache;
+
+	if (info->retiring) {
+		return;
+	}
+
+	if (info->state == PS_FREE) {
+		ADD_ONCE(cache->stats.free_pages, -1);
+	}
+
+	info->retiring = true;
+	if (is_unused(info)) {
+		cache->retired_count++;
+		list_move_tail(&info->state_entry, &cache->retired_list);
+	}
+}
+
+/**
+ * restore_slot() - Return a slot which was beyond the cache size to use.
+ * @info: The page info for the slot.
+ */
+static void restore_slot(struct page_info *info)
+{
+	struct vdo_page_cache *cache = info->cache;
+
+	if (!info->retiring) {
+		return;
+	}
+
+	info->retiring = false;
+	if (info->state == PS_FREE) {
+		ADD_ONCE(cache->stats.free_pages, 1);
+	}
+
+	if (is_unused(info)) {
+		cache->retired_count--;
+		list_move_tail(&info->state_entry, &cache->free_list);
+	}
+}
+
+/**
+ * vdo_resize_page_cache() - Change the number of pages a cache holds, using
+ *                           the slots it already has.
+ * @cache: The page cache.
+ * @page_count: The new number of pages.
+ *
+ * Shrinking takes effect at once for new fetches, which only use the slots
+ * within the new size. Pages in the slots beyond it are evicted as they
+ * become idle, dirty pages being written out first, and the memory for those
+ * slots is freed once they are all empty. Growing first reclaims slots which
+ * are still being retired; if those are not enough, the caller must make a
+ * segment for the rest and add it with vdo_add_page_cache_segment().
+ *
+ * Return: The number of pages by which the cache's slots fall short of the
+ *         new size.
+ */
+page_count_t vdo_resize_page_cache(struct vdo_page_cache *cache,
+				   page_count_t page_count)
+{
+	page_count_t old_count = cache->page_count;
+	page_count_t slot;
+
+	assert_on_cache_thread(cache, __func__);
+
+	if (page_count >= old_count) {
+		page_count_t available = min(page_count, cache->slot_count);
+
+		for (slot = old_count; slot < available; slot++) {
+			restore_slot(get_slot(cache, slot));
+		}
+
+		WRITE_ONCE(cache->page_count, available);
+	} else {
+		WRITE_ONCE(cache->page_count, page_count);
+		for (slot = page_count; slot < old_count; slot++) {
+			retire_slot(get_slot(cache, slot));
+		}
+
+		for (slot = page_count; slot < old_count; slot++) {
+			retire_page_if_idle(get_slot(cache, slot));
+		}
+
+		release_retired_segments(cache);
+	}
+
+	if (cache->policy == VDO_PAGE_CACHE_POLICY_2Q) {
+		cache->cold_target = cache->page_count / COLD_FRACTION;
+	}
+
+	allocate_free_pages(cache);
+	return page_count - cache->page_count;
+}
+
 /**
  * page_is_loaded() - Vio callback used when a page has been loaded.
  * @completion: A completion for the vio, the parent of which is a page_info.
@@ -883,6 +1470,7 @@ static void page_is_loaded(struct vdo_completion *completion)
 
 	set_info_state(info, PS_RESIDENT);
 	distribute_page_over_queue(info, &info->waiting);
+	check_for_retirement(info);
 
 	/*
 	 * Don't decrement until right before calling
@@ -910,6 +1498,7 @@ static void handle_load_error(struct vdo_completion *completion)
 	set_info_state(info, PS_FAILED);
 	distribute_error_over_queue(result, &info->waiting);
 	reset_page_info(info);
+	check_for_retirement(info);
 
 	/*
 	 * Don't decrement until right before
@@ -1092,17 +1681,74 @@ static void schedule_page_save(struct page_info *info)
 
 	info->cache->pages_to_flush++;
 	info->cache->outstanding_writes++;
+	info->save_jiffies = jiffies;
 	set_info_state(info, PS_OUTGOING);
 }
 
+/**
+ * schedule_adjacent_page_save() - Schedule a save of the page at a given pbn
+ *                                 if it is dirty and not in use.
+ * @cache: The page cache.
+ * @pbn: The pbn of the page.
+ *
+ * Return: true if the page was scheduled to be saved.
+ */
+static bool schedule_adjacent_page_save(struct vdo_page_cache *cache,
+					physical_block_number_t pbn)
+{
+	struct page_info *info = find_page(cache, pbn);
+
+	if ((info == NULL) || !is_dirty(info) || (info->busy > 0)) {
+		return false;
+	}
+
+	schedule_page_save(info);
+	ADD_ONCE(cache->stats.pages_coalesced, 1);
+	return true;
+}
+
+/**
+ * schedule_adjacent_page_saves() - Schedule saves of the run of dirty pages on
+ *                                  either side of a page being saved.
+ * @info: The page being saved.
+ *
+ * The writes of adjacent pages will be merged by the io submitter, so saving
+ * a dirty neighbor along with a page is cheaper than saving it later on its
+ * own.
+ */
+static void schedule_adjacent_page_saves(struct page_info *info)
+{
+	struct vdo_page_cache *cache = info->cache;
+	physical_block_number_t pbn = info->pbn;
+	page_count_t i;
+
+	for (i = 1; i <= MAXIMUM_COALESCED_PAGES; i++) {
+		if (!schedule_adjacent_page_save(cache, pbn + i)) {
+			break;
+		}
+	}
+
+	for (i = 1; (i <= MAXIMUM_COALESCED_PAGES) && (i <= pbn); i++) {
+		if (!schedule_adjacent_page_save(cache, pbn - i)) {
+			break;
+		}
+	}
+}
+
 static void write_dirty_pages_callback(struct list_head *expired,
 				       void *context)
 {
+	bool coalesce = (READ_ONCE(vdo_block_map_dirty_target) > 0);
+
 	while (!list_empty(expired)) {
 		struct list_head *entry = expired->next;
+		struct page_info *info = page_info_from_state_entry(entry);
 
 		list_del_init(entry);
-		schedule_page_save(page_info_from_state_entry(entry));
+		schedule_page_save(info);
+		if (coalesce && (info->state == PS_OUTGOING)) {
+			schedule_adjacent_page_saves(info);
+		}
 	}
 
 	save_pages((struct vdo_page_cache *) context);
@@ -1182,6 +1828,27 @@ static void allocate_free_page(struct page_info *info)
 	}
 }
 
+/**
+ * allocate_free_pages() - Allocate pages from the free list to the
+ *                         completions waiting for free pages.
+ * @cache: The page cache.
+ *
+ * This is needed when slots are added to the free list by growing the cache
+ * rather than by a page becoming free.
+ */
+static void allocate_free_pages(struct vdo_page_cache *cache)
+{
+	while (has_waiters(&cache->free_waiters)) {
+		struct page_info *info = find_free_page(cache);
+
+		if (info == NULL) {
+			return;
+		}
+
+		allocate_free_page(info);
+	}
+}
+
 /**
  * discard_a_page() - Begin the process of discarding a page.
  * @cache: The page cache.
@@ -1195,7 +1862,7 @@ static void allocate_free_page(struct page_info *info)
  */
 static void discard_a_page(struct vdo_page_cache *cache)
 {
-	struct page_info *info = select_lru_page(cache);
+	struct page_info *info = select_lru_page(cache, false);
 
 	if (info == NULL) {
 		report_cache_pressure(cache);
@@ -1248,6 +1915,62 @@ static void discard_page_if_needed(struct vdo_page_cache *cache)
 	}
 }
 
+/**
+ * vdo_set_block_map_dirty_target() - Set the percentage of each zone's cache
+ *                                    which may be dirty before pages are
+ *                                    written early.
+ * @value: The new target, which will be limited to 100.
+ */
+void vdo_set_block_map_dirty_target(unsigned int value)
+{
+	WRITE_ONCE(vdo_block_map_dirty_target, min(value, 100U));
+}
+
+/**
+ * write_early() - Save some of the oldest dirty pages before their era
+ *                 expires.
+ * @cache: The cache.
+ *
+ * Pages beyond the dirty target are written out, and once the oldest dirty
+ * page is close to expiring, pages are written at the average rate needed to
+ * clean the cache within the maximum age. This spreads out the writes which
+ * would otherwise all be issued in the period a busy era expires. No more
+ * than a fraction of the cache is scheduled in any one period.
+ */
+static void write_early(struct vdo_page_cache *cache)
+{
+	unsigned int target = READ_ONCE(vdo_block_map_dirty_target);
+	block_count_t dirty = cache->stats.dirty_pages;
+	block_count_t allowed, headroom, limit;
+	block_count_t budget = 0;
+
+	if ((target == 0) || (dirty == 0)) {
+		return;
+	}
+
+	allowed = ((block_count_t) cache->page_count * target) / 100;
+	if (dirty > allowed) {
+		budget = dirty - allowed;
+	}
+
+	headroom = vdo_get_dirty_lists_headroom(cache->dirty_lists);
+	if (headroom <= (cache->maximum_age / HEADROOM_FRACTION)) {
+		budget = max(budget, DIV_ROUND_UP(dirty, cache->maximum_age));
+	}
+
+	limit = max((block_count_t) 1,
+		    (block_count_t) (cache->page_count / WRITEBACK_FRACTION));
+	budget = min(budget, limit);
+	if (budget <= cache->outstanding_writes) {
+		return;
+	}
+
+	vdo_expire_oldest_dirty_elements(cache->dirty_lists,
+					 budget - cache->outstanding_writes);
+	ADD_ONCE(cache->stats.pages_written_early,
+		 dirty - cache->stats.dirty_pages);
+}
+
 /**
  * vdo_advance_page_cache_period() - Advance the dirty period for a page
  *                                   cache.
@@ -1258,7 +1981,9 @@ void vdo_advance_page_cache_period(struct vdo_page_cache *cache,
 				   sequence_number_t period)
 {
 	assert_on_cache_thread(cache, __func__);
+	cache->pages_since_period = 0;
 	vdo_advance_dirty_lists_period(cache->dirty_lists, period);
+	write_early(cache);
 }
 
 /**
@@ -1330,6 +2055,23 @@ static void write_page_endio(struct bio *bio)
 	continue_vio_after_io(vio, page_is_written_out, cache->zone->thread_id);
 }
 
+/**
+ * record_writeback_latency() - Record how long a page took to be written
+ *                              out after it was scheduled to be saved.
+ * @info: The page which has been written.
+ */
+static void record_writeback_latency(struct page_info *info)
+{
+	struct block_map_statistics *stats = &info->cache->stats;
+	uint64_t milliseconds =
+		jiffies_to_msecs(jiffies - info->save_jiffies);
+
+	ADD_ONCE(stats->writeback_milliseconds, milliseconds);
+	if (milliseconds > stats->max_writeback_milliseconds) {
+		WRITE_ONCE(stats->max_writeback_milliseconds, milliseconds);
+	}
+}
+
 /**
  * page_is_written_out() - Vio callback used when a page has been written out.
  * @completion: A completion for the vio, the parent of which is embedded in
@@ -1359,6 +2101,7 @@ static void page_is_written_out(struct vdo_completion *completion)
 		}
 	}
 
+	record_writeback_latency(info);
 	was_discard = write_has_finished(info);
 	reclaimed = (!was_discard || (info->busy > 0) ||
 		     has_waiters(&info->waiting));
@@ -1372,8 +2115,9 @@ static void page_is_written_out(struct vdo_completion *completion)
 		cache->discard_count--;
 	}
 
-	if (reclaimed) {
+	if (reclaimed || info->retiring) {
 		discard_page_if_needed(cache);
+		check_for_retirement(info);
 	} else {
 		allocate_free_page(info);
 	}
@@ -1381,6 +2125,20 @@ static void page_is_written_out(struct vdo_completion *completion)
 	vdo_block_map_check_for_drain_complete(cache->zone);
 }
 
+/**
+ * count_page_write() - Count a page write against the current period.
+ * @cache: The cache writing the page.
+ */
+static void count_page_write(struct vdo_page_cache *cache)
+{
+	cache->pages_since_period++;
+	if (cache->pages_since_period >
+	    cache->stats.max_pages_per_journal_block) {
+		WRITE_ONCE(cache->stats.max_pages_per_journal_block,
+			   cache->pages_since_period);
+	}
+}
+
 /**
  * write_pages() - Write the batch of pages which were covered by the layer
  *                 flush which just completed.
@@ -1418,6 +2176,7 @@ static void write_pages(struct vdo_completion *flush_completion)
 			continue;
 		}
 		ADD_ONCE(info->cache->stats.pages_saved, 1);
+		count_page_write(info->cache);
 		submit_metadata_vio(info->vio,
 				    info->pbn,
 				    write_page_endio,
@@ -1473,6 +2232,8 @@ void vdo_release_page_completion(struct vdo_completion *completion)
 			discard_info->write_status = WRITE_STATUS_NORMAL;
 			launch_page_save(discard_info);
 		}
+
+		check_for_retirement(discard_info);
 		/*
 		 * if there are excess requests for pages (that have not already
 		 * started discards) we need to discard some page (which may be
@@ -1540,6 +2301,11 @@ void vdo_get_page(struct vdo_completion *completion)
 	info = find_page(cache, vdo_page_comp->pbn);
 	if (info != NULL) {
 		/* The page is in the cache already. */
+		if (info->prefetched) {
+			info->prefetched = false;
+			ADD_ONCE(cache->stats.prefetch_hits, 1);
+		}
+
 		if ((info->write_status == WRITE_STATUS_DEFERRED) ||
 		    is_incoming(info) ||
 		    (is_outgoing(info) && vdo_page_comp->writable)) {
@@ -1559,6 +2325,12 @@ void vdo_get_page(struct vdo_completion *completion)
 		if (is_valid(info)) {
 			/* The page is usable. */
 			ADD_ONCE(cache->stats.found_in_cache, 1);
+			if (info->cold) {
+				ADD_ONCE(cache->stats.cold_hits, 1);
+			} else {
+				ADD_ONCE(cache->stats.hot_hits, 1);
+			}
+
 			if (!is_present(info)) {
 				ADD_ONCE(cache->stats.read_outgoing, 1);
 			}
@@ -1584,6 +2356,47 @@ void vdo_get_page(struct vdo_completion *completion)
 	discard_page_for_completion(vdo_page_comp);
 }
 
+/**
+ * vdo_prefetch_page() - Start loading a page which is expected to be needed
+ *                       soon.
+ * @cache: The page cache.
+ * @pbn: The absolute physical block number of the page.
+ *
+ * Nothing is done if the page is already cached, or if making room for it
+ * would mean waiting for a page or writing out a dirty one. A prefetched page
+ * which is evicted before it is used is counted as wasted.
+ */
+void vdo_prefetch_page(struct vdo_page_cache *cache,
+		       physical_block_number_t pbn)
+{
+	struct page_info *info;
+
+	assert_on_cache_thread(cache, __func__);
+
+	if ((find_page(cache, pbn) != NULL) ||
+	    has_waiters(&cache->free_waiters) ||
+	    vdo_is_read_only(cache->zone->read_only_notifier)) {
+		return;
+	}
+
+	info = find_free_page(cache);
+	if (info == NULL) {
+		info = select_lru_page(cache, true);
+		if ((info == NULL) || (reset_page_info(info) != VDO_SUCCESS)) {
+			return;
+		}
+	}
+
+	if (launch_page_load(info, pbn) != VDO_SUCCESS) {
+		/* Put the page back on the free list. */
+		reset_page_info(info);
+		return;
+	}
+
+	info->prefetched = true;
+	ADD_ONCE(cache->stats.pages_prefetched, 1);
+}
+
 /**
  * vdo_mark_completed_page_dirty() - Mark a VDO page referenced by a completed
  *                                   vdo_page_completion as dirty.
@@ -1712,17 +2525,23 @@ void vdo_drain_page_cache(struct vdo_page_cache *cache)
  */
 int vdo_invalidate_page_cache(struct vdo_page_cache *cache)
 {
-	struct page_info *info;
+	unsigned int s;
 
 	assert_on_cache_thread(cache, __func__);
 
 	/* Make sure we don't throw away any dirty pages. */
-	for (info = cache->infos; info < cache->infos + cache->page_count;
-	     info++) {
-		int result = ASSERT(!is_dirty(info),
-				    "cache must have no dirty pages");
-		if (result != VDO_SUCCESS) {
-			return result;
+	for (s = 0; s < cache->segment_count; s++) {
+		struct page_cache_segment *segment = &cache->segments[s];
+		struct page_info *info;
+
+		for (info = segment->infos;
+		     info < segment->infos + segment->page_count;
+		     info++) {
+			int result = ASSERT(!is_dirty(info),
+					    "cache must have no dirty pages");
+			if (result != VDO_SUCCESS) {
+				return result;
+			}
 		}
 	}
 
@@ -64,14 +64,32 @@ enum {
 
 static const physical_block_number_t NO_PAGE = 0xFFFFFFFFFFFFFFFF;
 
+/*
+ * A separately allocated run of page slots. A cache starts with a single
+ * segment, and gains another each time it is resized beyond the slots it
+ * already has.
+ */
+struct page_cache_segment {
+	/* number of page slots in the segment */
+	page_count_t page_count;
+	/* array of page information entries */
+	struct page_info *infos;
+	/* raw memory for pages */
+	char *pages;
+	/* number of pages not on the cache's memory node */
+	page_count_t remote_count;
+};
+
 /*
  * The VDO Page Cache abstraction.
  */
 struct vdo_page_cache {
 	/* the VDO which owns this cache */
 	struct vdo *vdo;
-	/* number of pages in cache */
+	/* number of pages in cache; later slots are being retired */
 	page_count_t page_count;
+	/* the replacement policy */
+	enum vdo_page_cache_policy policy;
 	/* function to call on page read */
 	vdo_page_read_function *read_hook;
 	/* function to call on page write */
@@ -81,20 +99,48 @@ struct vdo_page_cache {
 	/* Whether the VDO is doing a read-only rebuild */
 	bool rebuilding;
 
-	/* array of page information entries */
-	struct page_info *infos;
-	/* raw memory for pages */
-	char *pages;
+	/* the segments holding the page slots, in slot order */
+	struct page_cache_segment *segments;
+	/* number of segments */
+	unsigned int segment_count;
+	/* number of page slots in all segments */
+	page_count_t slot_count;
+	/* number of slots beyond page_count which are no longer in use */
+	page_count_t retired_count;
+	/* the memory node for the slots, or NUMA_NO_NODE */
+	int node;
+	/* number of slot pages not on the memory node */
+	page_count_t remote_count;
 	/* cache last found page info */
 	struct page_info *last_found;
 	/* map of page number to info */
 	struct int_map *page_map;
-	/* main LRU list (all infos) */
+	/* LRU list of reused pages (all infos under the LRU policy) */
 	struct list_head lru_list;
+	/* FIFO list of pages which have only been used once (2Q only) */
+	struct list_head cold_list;
+	/* number of pages on the cold list */
+	page_count_t cold_count;
+	/* number of cold pages to keep before evicting reused pages */
+	page_count_t cold_target;
+	/* ring of pbns recently evicted from the cold list (2Q only) */
+	physical_block_number_t *ghosts;
+	/* number of slots in the ghost ring */
+	page_count_t ghost_capacity;
+	/* the next ghost slot to fill */
+	page_count_t next_ghost;
+	/* map of evicted pbn to its ghost slot */
+	struct int_map *ghost_map;
 	/* dirty pages by period */
 	struct dirty_lists *dirty_lists;
+	/* the number of periods after which a dirty page must be written */
+	block_count_t maximum_age;
+	/* number of pages written since the period last advanced */
+	page_count_t pages_since_period;
 	/* free page list (oldest first) */
 	struct list_head free_list;
+	/* unused slots beyond page_count */
+	struct list_head retired_list;
 	/* outgoing page list */
 	struct list_head outgoing_list;
 	/* number of read I/O operations pending */
@@ -178,14 +224,32 @@ struct page_info {
 	struct wait_queue waiting;
 	/* state linked list entry */
 	struct list_head state_entry;
-	/* LRU entry */
+	/* LRU or cold list entry */
 	struct list_head lru_entry;
+	/* whether the page is on the cold list */
+	bool cold;
+	/* whether the page was prefetched and has not yet been used */
+	bool prefetched;
+	/* whether the page's slot is beyond the cache size */
+	bool retiring;
+	/* when the page was last scheduled to be saved, in jiffies */
+	uint64_t save_jiffies;
 	/* Space for per-page client data */
 	byte context[MAX_PAGE_CONTEXT_SIZE];
 };
 
+/*
+ * The percentage of each zone's cache which may be dirty before the oldest
+ * dirty pages are written out ahead of their era, or 0 to only write pages
+ * when their era expires. This is a module parameter.
+ */
+extern unsigned int vdo_block_map_dirty_target;
+
+void vdo_set_block_map_dirty_target(unsigned int value);
+
 int __must_check vdo_make_page_cache(struct vdo *vdo,
 				     page_count_t page_count,
+				     enum vdo_page_cache_policy policy,
 				     vdo_page_read_function *read_hook,
 				     vdo_page_write_function *write_hook,
 				     size_t page_context_size,
@@ -206,6 +270,20 @@ bool __must_check vdo_is_page_cache_active(struct vdo_page_cache *cache);
 void vdo_advance_page_cache_period(struct vdo_page_cache *cache,
 				   sequence_number_t period);
 
+int __must_check
+vdo_make_page_cache_segment(struct vdo_page_cache *cache,
+			    page_count_t page_count,
+			    struct page_cache_segment *segment);
+
+void vdo_free_page_cache_segment(struct page_cache_segment *segment);
+
+int __must_check
+vdo_add_page_cache_segment(struct vdo_page_cache *cache,
+			   struct page_cache_segment *segment);
+
+page_count_t __must_check
+vdo_resize_page_cache(struct vdo_page_cache *cache, page_count_t page_count);
+
 /* ASYNC */
 
 /*
@@ -241,6 +319,9 @@ void vdo_release_page_completion(struct vdo_completion *completion);
 
 void vdo_get_page(struct vdo_completion *completion);
 
+void vdo_prefetch_page(struct vdo_page_cache *cache,
+		       physical_block_number_t pbn);
+
 void vdo_mark_completed_page_dirty(struct vdo_completion *completion,
 				   sequence_number_t old_dirty_period,
 				   sequence_number_t new_dirty_period);
@@ -216,8 +216,13 @@ static void check_may_grow_physical(struct vdo_completion *completion)
 		return;
 	}
 
-	/* This check should only be done from a base code thread. */
-	if (vdo_in_recovery_mode(vdo)) {
+	/*
+	 * This check should only be done from a base code thread. Slabs whose
+	 * reference counts are still being loaded lazily must be treated as
+	 * they are in recovery mode.
+	 */
+	if (vdo_in_recovery_mode(vdo) ||
+	    (vdo_get_slab_depot_unrecovered_slab_count(vdo->depot) > 0)) {
 		vdo_finish_completion(completion->parent, VDO_RETRY_AFTER_REBUILD);
 		return;
 	}
@@ -10,6 +10,7 @@
 #include "logger.h"
 
 #include "admin-completion.h"
+#include "block-discarder.h"
 #include "block-map.h"
 #include "completion.h"
 #include "data-vio-pool.h"
@@ -87,11 +88,20 @@ static void write_super_block(struct vdo *vdo,
 	switch (vdo_get_state(vdo)) {
 	case VDO_CLEAN:
 	case VDO_NEW:
+		vdo_enable_discards(vdo->depot);
 		vdo_set_state(vdo, VDO_DIRTY);
 		vdo_save_components(vdo, completion);
 		return;
 
 	case VDO_DIRTY:
+		if (vdo_enable_discards(vdo->depot)) {
+			vdo_save_components(vdo, completion);
+			return;
+		}
+
+		vdo_complete_completion(completion);
+		return;
+
 	case VDO_READ_ONLY_MODE:
 	case VDO_FORCE_REBUILD:
 	case VDO_RECOVERING:
@@ -170,6 +180,8 @@ static void resume_callback(struct vdo_completion *completion)
 		}
 		uds_log_info("compression is %s",
 			     (enable ? "enabled" : "disabled"));
+		WRITE_ONCE(vdo->compression_acceleration,
+			   vdo->device_config->compression_acceleration);
 
 		vdo_resume_packer(vdo->packer,
 				  vdo_reset_admin_sub_task(completion));
@@ -48,6 +48,7 @@
 #include "vdo-layout.h"
 #include "vdo-resize.h"
 #include "vdo-resize-logical.h"
+#include "vio-write.h"
 #include "work-queue.h"
 
 #ifdef __KERNEL__
@@ -134,6 +135,8 @@ int vdo_make_thread(struct vdo *vdo,
 {
 	struct vdo_thread *thread = &vdo->threads[thread_id];
 	char queue_name[MAX_VDO_WORK_QUEUE_NAME_LEN];
+	int node;
+	int result;
 
 	if (type == NULL) {
 		type = &default_queue_type;
@@ -151,13 +154,24 @@ int vdo_make_thread(struct vdo *vdo,
 			    thread_id,
 			    queue_name,
 			    sizeof(queue_name));
-	return make_work_queue(vdo->thread_name_prefix,
-			       queue_name,
-			       thread,
-			       type,
-			       queue_count,
-			       contexts,
-			       &thread->queue);
+	result = make_work_queue(vdo->thread_name_prefix,
+				 queue_name,
+				 thread,
+				 type,
+				 queue_count,
+				 contexts,
+				 &thread->queue);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	/* Keep the thread near the memory of the zone it serves. */
+	node = vdo_get_thread_node(vdo->thread_config, thread_id);
+	if (node != NUMA_NO_NODE) {
+		bind_work_queue_to_node(thread->queue, node);
+	}
+
+	return VDO_SUCCESS;
 }
 
 /**
@@ -359,6 +373,12 @@ int vdo_make(unsigned int instance,
 		return result;
 	}
 
+	result = make_data_vio_batch_processors(vdo);
+	if (result != VDO_SUCCESS) {
+		*reason = "Cannot allocate data_vio batch processors";
+		return result;
+	}
+
 	return VDO_SUCCESS;
 }
 
@@ -428,6 +448,7 @@ void vdo_destroy(struct vdo *vdo)
 		UDS_FREE(UDS_FORGET(vdo->threads));
 	}
 
+	free_data_vio_batch_processors(vdo);
 	vdo_free_thread_config(UDS_FORGET(vdo->thread_config));
 
 	if (vdo->compression_context != NULL) {
@@ -681,6 +702,7 @@ static void record_vdo(struct vdo *vdo)
 	vdo->states.recovery_journal =
 		vdo_record_recovery_journal(vdo->recovery_journal);
 	vdo->states.slab_depot = vdo_record_slab_depot(vdo->depot);
+	vdo->states.discards_enabled = READ_ONCE(vdo->depot->discards_enabled);
 	vdo->states.layout = vdo_get_fixed_layout(vdo->layout);
 }
 
@@ -841,7 +863,16 @@ bool vdo_get_compressing(struct vdo *vdo)
 
 static size_t get_block_map_cache_size(const struct vdo *vdo)
 {
-	return ((size_t) vdo->device_config->cache_size) * VDO_BLOCK_SIZE;
+	const struct block_map *map = vdo->block_map;
+	size_t pages = 0;
+	zone_count_t zone;
+
+	/* The cache may have been resized since the vdo was loaded. */
+	for (zone = 0; zone < map->zone_count; zone++) {
+		pages += READ_ONCE(map->zones[zone].page_cache->page_count);
+	}
+
+	return pages * VDO_BLOCK_SIZE;
 }
 
 static struct error_statistics __must_check
@@ -923,7 +954,7 @@ vdo_get_physical_blocks_overhead(const struct vdo *vdo)
 		vdo_get_journal_block_map_data_blocks_used(vdo->recovery_journal));
 }
 
-static const char *vdo_describe_state(enum vdo_state state)
+static const char *vdo_describe_state(enum vdo_state state, bool loading)
 {
 	/* These strings should all fit in the 15 chars of VDOStatistics.mode. */
 	switch (state) {
@@ -934,7 +965,7 @@ static const char *vdo_describe_state(enum vdo_state state)
 		return "read-only";
 
 	default:
-		return "normal";
+		return (loading ? "loading" : "normal");
 	}
 }
 
@@ -949,6 +980,7 @@ static void get_vdo_statistics(const struct vdo *vdo,
 {
 	struct recovery_journal *journal = vdo->recovery_journal;
 	enum vdo_state state = vdo_get_state(vdo);
+	bool loading;
 
 	vdo_assert_on_admin_thread(vdo, __func__);
 
@@ -984,11 +1016,19 @@ static void get_vdo_statistics(const struct vdo *vdo,
 	stats->block_map = vdo_get_block_map_statistics(vdo->block_map);
 	vdo_get_dedupe_statistics(vdo->hash_zones, stats);
 	stats->errors = get_vdo_error_statistics(vdo);
-	stats->in_recovery_mode = (state == VDO_RECOVERING);
+
+	/*
+	 * Until every slab's reference counts have been loaded, the unloaded
+	 * slabs are counted as full, just as unrecovered slabs are in recovery
+	 * mode, so report it the same way.
+	 */
+	loading = ((state == VDO_DIRTY) &&
+		   (vdo_get_slab_depot_unrecovered_slab_count(vdo->depot) > 0));
+	stats->in_recovery_mode = ((state == VDO_RECOVERING) || loading);
 	snprintf(stats->mode,
 		 sizeof(stats->mode),
 		 "%s",
-		 vdo_describe_state(state));
+		 vdo_describe_state(state, loading));
 
 	stats->instance = vdo->instance;
 	stats->current_vios_in_progress =
@@ -1003,6 +1043,8 @@ static void get_vdo_statistics(const struct vdo *vdo,
 	copy_bio_stat(&stats->bios_in_partial, &vdo->stats.bios_in_partial);
 	copy_bio_stat(&stats->bios_out, &vdo->stats.bios_out);
 	copy_bio_stat(&stats->bios_meta, &vdo->stats.bios_meta);
+	copy_bio_stat(&stats->bios_out_merged, &vdo->stats.bios_out_merged);
+	copy_bio_stat(&stats->bios_meta_merged, &vdo->stats.bios_meta_merged);
 	copy_bio_stat(&stats->bios_journal, &vdo->stats.bios_journal);
 	copy_bio_stat(&stats->bios_page_cache, &vdo->stats.bios_page_cache);
 	copy_bio_stat(&stats->bios_out_completed,
@@ -91,6 +91,8 @@ struct vdo {
 	struct packer *packer;
 	/* Whether incoming data should be compressed */
 	bool compressing;
+	/* The LZ4 acceleration factor to compress with */
+	unsigned int compression_acceleration;
 
 	/* The handler for flush requests */
 	struct flusher *flusher;
@@ -162,6 +164,15 @@ struct vdo {
 
 	/* N blobs of context data for LZ4 code, one per CPU thread. */
 	char **compression_context;
+
+	/* N batch processors for hashing data_vios, one per CPU thread. */
+	struct batch_processor **hashers;
+	/* The rotor for selecting a hasher */
+	atomic_t hasher_rotor;
+	/* N batch processors for compressing data_vios, one per CPU thread. */
+	struct batch_processor **compressors;
+	/* The rotor for selecting a compressor */
+	atomic_t compressor_rotor;
 };
 
 #if defined(VDO_INTERNAL) || defined(INTERNAL)
@@ -9,6 +9,7 @@
 
 #include "vdoHistograms.h"
 
+#include "block-mapping-state.h"
 #include "histogram.h"
 
 /**
@@ -106,6 +107,26 @@ void vdo_initialize_histograms(struct kobject *parent,
 						   "writes",
 						   "queue time",
 						   5);
+	/*
+	 * These two are in nanoseconds, so a log_size of 6 reaches 1 msec. and
+	 * 7 reaches 10 msec.
+	 */
+	histograms->write_ingest_histogram =
+		make_logarithmic_histogram(parent,
+					   "write_ingest",
+					   "Copy In Write Data",
+					   "writes",
+					   "copy time",
+					   "nanoseconds",
+					   6);
+	histograms->write_hashed_histogram =
+		make_logarithmic_histogram(parent,
+					   "write_hashed",
+					   "Write Data Hashed",
+					   "writes",
+					   "time from copy to hash",
+					   "nanoseconds",
+					   7);
 	histograms->start_request_histogram =
 		make_logarithmic_jiffies_histogram(parent,
 						   "bio_start",
@@ -113,6 +134,29 @@ void vdo_initialize_histograms(struct kobject *parent,
 						   "requests",
 						   "delay time",
 						   5);
+	histograms->packer_fragments_histogram =
+		make_linear_histogram(parent,
+				      "packer_fragments",
+				      "Fragments Per Compressed Block",
+				      "blocks",
+				      "fragments",
+				      NULL,
+				      VDO_MAX_COMPRESSION_SLOTS + 1);
+	histograms->packer_fill_histogram =
+		make_linear_histogram(parent,
+				      "packer_fill",
+				      "Compressed Block Fill",
+				      "blocks",
+				      "fill",
+				      "percent",
+				      101);
+	histograms->packer_time_histogram =
+		make_logarithmic_jiffies_histogram(parent,
+						   "packer_time",
+						   "Time In Packer",
+						   "fragments",
+						   "wait time",
+						   5);
 }
 
 /**
@@ -124,6 +168,9 @@ void vdo_destroy_histograms(struct vdo_histograms *histograms)
 {
 	free_histogram(UDS_FORGET(histograms->discard_ack_histogram));
 	free_histogram(UDS_FORGET(histograms->flush_histogram));
+	free_histogram(UDS_FORGET(histograms->packer_fill_histogram));
+	free_histogram(UDS_FORGET(histograms->packer_fragments_histogram));
+	free_histogram(UDS_FORGET(histograms->packer_time_histogram));
 	free_histogram(UDS_FORGET(histograms->post_histogram));
 	free_histogram(UDS_FORGET(histograms->query_histogram));
 	free_histogram(UDS_FORGET(histograms->read_ack_histogram));
@@ -133,5 +180,7 @@ void vdo_destroy_histograms(struct vdo_histograms *histograms)
 	free_histogram(UDS_FORGET(histograms->update_histogram));
 	free_histogram(UDS_FORGET(histograms->write_ack_histogram));
 	free_histogram(UDS_FORGET(histograms->write_bios_histogram));
+	free_histogram(UDS_FORGET(histograms->write_hashed_histogram));
+	free_histogram(UDS_FORGET(histograms->write_ingest_histogram));
 	free_histogram(UDS_FORGET(histograms->write_queue_histogram));
 }
@@ -21,6 +21,11 @@ struct vdo_histograms {
 	struct histogram *write_ack_histogram;
 	struct histogram *write_bios_histogram;
 	struct histogram *write_queue_histogram;
+	struct histogram *write_ingest_histogram;
+	struct histogram *write_hashed_histogram;
+	struct histogram *packer_fragments_histogram;
+	struct histogram *packer_fill_histogram;
+	struct histogram *packer_time_histogram;
 };
 
 void vdo_initialize_histograms(struct kobject *parent,
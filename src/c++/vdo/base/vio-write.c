@@ -98,8 +98,11 @@
 #include <linux/murmurhash3.h>
 
 #include "logger.h"
+#include "memory-alloc.h"
 #include "permassert.h"
+#include "time-utils.h"
 
+#include "batch-processor.h"
 #include "bio.h"
 #include "block-map.h"
 #include "compression-state.h"
@@ -107,6 +110,7 @@
 #include "dedupe.h"
 #include "io-submitter.h"
 #include "kernel-types.h"
+#include "packer.h"
 #include "recovery-journal.h"
 #include "reference-operation.h"
 #include "slab.h"
@@ -116,6 +120,27 @@
 #include "vdo.h"
 #include "vio-read.h"
 
+enum {
+	/* The seed from which all chunk names are computed */
+	CHUNK_NAME_SEED = 0x62ea60be,
+	/*
+	 * The number of sets of MURMURHASH3_LANES blocks a hasher will hash
+	 * before yielding the CPU thread to other work.
+	 */
+	DATA_VIO_HASH_BATCH_ROUNDS = 4,
+	/*
+	 * The number of blocks a compressor will compress before yielding the
+	 * CPU thread to other work.
+	 */
+	DATA_VIO_COMPRESS_BATCH_SIZE = 16,
+};
+
+/*
+ * Whether full-block writes are hashed as their data is copied in, rather than
+ * later on a CPU thread. This is a module parameter.
+ */
+bool vdo_fused_write_ingest = true;
+
 /*
  * The steps taken cleaning up a VIO, in the order they are performed.
  */
@@ -637,20 +662,77 @@ static void pack_compressed_data(struct vdo_completion *completion)
 }
 
 /**
- * compress_data_vio_callback() - Do the actual work of compressing the data
- *                                on a CPU queue.
- * @completion: The completion of the write in progress.
+ * compress_data_vio_batch() - Do the actual work of compressing the data of
+ *                             the data_vios waiting in a compressor.
+ * @batch: The compressor.
+ * @closure: The LZ4 working memory which belongs to this compressor.
  *
- * This callback is registered in launch_compress_data_vio().
+ * This is the batch_processor_callback of the data_vio compressors, and so
+ * runs on a CPU thread. Since a batch processor only runs on one thread at a
+ * time, its working memory is never shared, and it stays warm in the cache
+ * across the blocks of a batch.
  */
-static void compress_data_vio_callback(struct vdo_completion *completion)
+static void compress_data_vio_batch(struct batch_processor *batch,
+				    void *closure)
 {
-	struct data_vio *data_vio = as_data_vio(completion);
+	struct vdo_completion *item;
+	struct vdo *vdo = NULL;
+	block_count_t count = 0;
+	block_count_t skipped = 0;
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+
+	while ((count < DATA_VIO_COMPRESS_BATCH_SIZE) &&
+	       ((item = next_batch_item(batch)) != NULL)) {
+		struct data_vio *data_vio = as_data_vio(item);
+
+		assert_data_vio_on_cpu_thread(data_vio);
+		vdo = vdo_from_data_vio(data_vio);
+		if (!compress_data_vio(data_vio,
+				       closure,
+				       READ_ONCE(vdo->compression_acceleration))) {
+			skipped++;
+		}
+
+		launch_data_vio_packer_callback(data_vio,
+						pack_compressed_data);
+		count++;
+	}
+
+	if (count == 0) {
+		return;
+	}
 
-	assert_data_vio_on_cpu_thread(data_vio);
-	compress_data_vio(data_vio);
-	launch_data_vio_packer_callback(data_vio,
-					pack_compressed_data);
+	vdo_record_compression_batch(vdo->packer,
+				     count,
+				     skipped,
+				     ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+					       start));
+}
+
+/**
+ * select_batch_processor() - Choose the per-CPU-thread batch processor to
+ *                            which a data_vio will be sent.
+ * @vdo: The vdo.
+ * @processors: The batch processors to choose from, one per CPU thread.
+ * @rotor: The rotor for choosing among them.
+ *
+ * The processors are used in turn so that every CPU thread does some of the
+ * work.
+ *
+ * Return: The selected batch processor.
+ */
+static struct batch_processor *
+select_batch_processor(struct vdo *vdo,
+		       struct batch_processor **processors,
+		       atomic_t *rotor)
+{
+	unsigned int count = vdo->device_config->thread_counts.cpu_threads;
+
+	if (count == 1) {
+		return processors[0];
+	}
+
+	return processors[((unsigned int) atomic_inc_return(rotor) % count)];
 }
 
 /**
@@ -662,6 +744,8 @@ static void compress_data_vio_callback(struct vdo_completion *completion)
  */
 void launch_compress_data_vio(struct data_vio *data_vio)
 {
+	struct vdo *vdo;
+
 	ASSERT_LOG_ONLY(!data_vio->is_duplicate,
 			"compressing a non-duplicate block");
 	if (!may_compress_data_vio(data_vio)) {
@@ -670,9 +754,11 @@ void launch_compress_data_vio(struct data_vio *data_vio)
 	}
 
 	data_vio->last_async_operation = VIO_ASYNC_OP_COMPRESS_DATA_VIO;
-	launch_data_vio_cpu_callback(data_vio,
-				     compress_data_vio_callback,
-				     CPU_Q_COMPRESS_BLOCK_PRIORITY);
+	vdo = vdo_from_data_vio(data_vio);
+	add_to_batch_processor(select_batch_processor(vdo,
+						      vdo->compressors,
+						      &vdo->compressor_rotor),
+			       data_vio_as_completion(data_vio));
 }
 
 /**
@@ -744,7 +830,7 @@ void launch_deduplicate_data_vio(struct data_vio *data_vio)
  *                       dedupe for that name.
  * @completion: The data_vio to lock.
  *
- * This is the callback registered in hash_data_vio().
+ * This is the callback registered in finish_hashing().
  */
 static void lock_hash_in_zone(struct vdo_completion *completion)
 {
@@ -776,25 +862,22 @@ static void lock_hash_in_zone(struct vdo_completion *completion)
 }
 
 /**
- * hash_data_vio() - Hash the data in a data_vio and set the hash zone (which
- *                   also flags the chunk name as set).
- * @completion: The data_vio to hash.
-
- * This callback is registered in prepare_for_dedupe().
+ * finish_hashing() - Set the hash zone of a data_vio whose chunk name has
+ *                    been computed (which also flags the chunk name as set)
+ *                    and send it to that zone.
+ * @data_vio: The data_vio which has been hashed.
  */
-static void hash_data_vio(struct vdo_completion *completion)
+static void finish_hashing(struct data_vio *data_vio)
 {
-	struct data_vio *data_vio = as_data_vio(completion);
-
-	assert_data_vio_on_cpu_thread(data_vio);
-	ASSERT_LOG_ONLY(!data_vio->is_zero_block,
-			"zero blocks should not be hashed");
-
-	murmurhash3_128(data_vio->data_block,
-			VDO_BLOCK_SIZE,
-			0x62ea60be,
-			&data_vio->chunk_name);
+#ifdef VDO_INTERNAL
+	if (data_vio->ingest_time != 0) {
+		struct vdo *vdo = vdo_from_data_vio(data_vio);
 
+		enter_histogram_sample(vdo->histograms.write_hashed_histogram,
+				       ktime_sub(current_time_ns(CLOCK_MONOTONIC),
+						 data_vio->ingest_time));
+	}
+#endif /* VDO_INTERNAL */
 	data_vio->hash_zone =
 		vdo_select_hash_zone(vdo_from_data_vio(data_vio)->hash_zones,
 				     &data_vio->chunk_name);
@@ -803,6 +886,94 @@ static void hash_data_vio(struct vdo_completion *completion)
 					   lock_hash_in_zone);
 }
 
+/**
+ * hash_data_vio_batch() - Hash the data of the data_vios waiting in a
+ *                         hasher, several blocks at a time.
+ * @batch: The hasher.
+ * @closure: Unused.
+ *
+ * This is the batch_processor_callback of the data_vio hashers, and so runs
+ * on a CPU thread. Up to MURMURHASH3_LANES blocks are hashed together, which
+ * produces exactly the same chunk names as hashing each one separately.
+ */
+static void hash_data_vio_batch(struct batch_processor *batch,
+				void *closure __always_unused)
+{
+	struct data_vio *data_vios[MURMURHASH3_LANES];
+	const void *blocks[MURMURHASH3_LANES];
+	void *names[MURMURHASH3_LANES];
+	unsigned int rounds;
+
+	for (rounds = 0; rounds < DATA_VIO_HASH_BATCH_ROUNDS; rounds++) {
+		struct vdo_completion *item;
+		unsigned int count = 0;
+		unsigned int i;
+
+		while ((count < MURMURHASH3_LANES) &&
+		       ((item = next_batch_item(batch)) != NULL)) {
+			struct data_vio *data_vio = as_data_vio(item);
+
+			assert_data_vio_on_cpu_thread(data_vio);
+			ASSERT_LOG_ONLY(!data_vio->is_zero_block,
+					"zero blocks should not be hashed");
+			data_vios[count] = data_vio;
+			blocks[count] = data_vio->data_block;
+			names[count] = &data_vio->chunk_name;
+			count++;
+		}
+
+		if (count == 0) {
+			return;
+		}
+
+		murmurhash3_128_multiple(blocks,
+					 count,
+					 VDO_BLOCK_SIZE,
+					 CHUNK_NAME_SEED,
+					 names);
+		for (i = 0; i < count; i++) {
+			finish_hashing(data_vios[i]);
+		}
+	}
+}
+
+/**
+ * ingest_write_data() - Copy the data of a full-block write out of its bio.
+ * @data_vio: The data_vio doing the write.
+ * @bio: The bio being written.
+ *
+ * The data is checked for zeros as it is copied. If fused ingest is enabled
+ * and the block is in a single bio segment, its chunk name is computed in the
+ * same pass too, so that the data_vio can skip the hashing stage and the
+ * compressor later finds the data already in the cache.
+ */
+void ingest_write_data(struct data_vio *data_vio, struct bio *bio)
+{
+#ifdef VDO_INTERNAL
+	struct vdo *vdo = vdo_from_data_vio(data_vio);
+	ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+
+#endif /* VDO_INTERNAL */
+	if (READ_ONCE(vdo_fused_write_ingest) &&
+	    vdo_bio_copy_block_in_and_hash(bio,
+					   data_vio->data_block,
+					   CHUNK_NAME_SEED,
+					   &data_vio->chunk_name,
+					   &data_vio->is_zero_block)) {
+		data_vio->hashed_on_ingest = true;
+	} else {
+		data_vio->is_zero_block =
+			vdo_bio_copy_data_in_and_check_zero(bio,
+							    data_vio->data_block);
+	}
+
+#ifdef VDO_INTERNAL
+	data_vio->ingest_time = current_time_ns(CLOCK_MONOTONIC);
+	enter_histogram_sample(vdo->histograms.write_ingest_histogram,
+			       ktime_sub(data_vio->ingest_time, start));
+#endif /* VDO_INTERNAL */
+}
+
 /**
  * prepare_for_dedupe() - Prepare for the dedupe path after attempting to get
  *                        an allocation.
@@ -810,6 +981,8 @@ static void hash_data_vio(struct vdo_completion *completion)
  */
 static void prepare_for_dedupe(struct data_vio *data_vio)
 {
+	struct vdo *vdo;
+
 	/* We don't care what thread we are on */
 	if (abort_on_error(data_vio_as_completion(data_vio)->result,
 			   data_vio,
@@ -820,14 +993,22 @@ static void prepare_for_dedupe(struct data_vio *data_vio)
 	ASSERT_LOG_ONLY(!data_vio->is_zero_block,
 			"must not prepare to dedupe zero blocks");
 
+	if (data_vio->hashed_on_ingest) {
+		finish_hashing(data_vio);
+		return;
+	}
+
 	/*
 	 * Before we can dedupe, we need to know the chunk name, so the first
-	 * step is to hash the block data.
+	 * step is to hash the block data. Hashing is batched on the CPU
+	 * threads so that several blocks can be hashed together.
 	 */
 	data_vio->last_async_operation = VIO_ASYNC_OP_HASH_DATA_VIO;
-	launch_data_vio_cpu_callback(data_vio,
-				     hash_data_vio,
-				     CPU_Q_HASH_BLOCK_PRIORITY);
+	vdo = vdo_from_data_vio(data_vio);
+	add_to_batch_processor(select_batch_processor(vdo,
+						      vdo->hashers,
+						      &vdo->hasher_rotor),
+			       data_vio_as_completion(data_vio));
 }
 
 /**
@@ -1220,3 +1401,120 @@ void cleanup_write_data_vio(struct data_vio *data_vio)
 {
 	perform_cleanup_stage(data_vio, VIO_CLEANUP_START);
 }
+
+/**
+ * make_cpu_batch_processors() - Make a set of batch processors, one for each
+ *                               CPU thread.
+ * @vdo: The vdo which will own the processors.
+ * @priority: The priority at which the processors will run.
+ * @callback: The callback of each processor.
+ * @closures: The closure for each processor (may be NULL).
+ * @what: What the processors are for, for error messages.
+ * @processors_ptr: A pointer to hold the array of processors.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+static int make_cpu_batch_processors(struct vdo *vdo,
+				     enum vdo_completion_priority priority,
+				     batch_processor_callback *callback,
+				     char **closures,
+				     const char *what,
+				     struct batch_processor ***processors_ptr)
+{
+	int count = vdo->device_config->thread_counts.cpu_threads;
+	struct batch_processor **processors;
+	int i;
+	int result;
+
+	result = UDS_ALLOCATE(count,
+			      struct batch_processor *,
+			      what,
+			      &processors);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	*processors_ptr = processors;
+	for (i = 0; i < count; i++) {
+		result = make_batch_processor(vdo,
+					      vdo->thread_config->cpu_thread,
+					      priority,
+					      callback,
+					      ((closures == NULL) ?
+					       NULL :
+					       closures[i]),
+					      &processors[i]);
+		if (result != VDO_SUCCESS) {
+			return result;
+		}
+	}
+
+	return VDO_SUCCESS;
+}
+
+/**
+ * free_cpu_batch_processors() - Free a set of per-CPU-thread batch
+ *                               processors.
+ * @vdo: The vdo which owns the processors.
+ * @processors: The processors to free (may be NULL).
+ */
+static void free_cpu_batch_processors(struct vdo *vdo,
+				      struct batch_processor **processors)
+{
+	int i;
+
+	if (processors == NULL) {
+		return;
+	}
+
+	for (i = 0; i < vdo->device_config->thread_counts.cpu_threads; i++) {
+		free_batch_processor(UDS_FORGET(processors[i]));
+	}
+
+	UDS_FREE(processors);
+}
+
+/**
+ * make_data_vio_batch_processors() - Make the batch processors which hash and
+ *                                    compress data_vios on the CPU threads.
+ * @vdo: The vdo which will own the processors.
+ *
+ * Each compressor is given the LZ4 working memory of one CPU thread as its
+ * own.
+ *
+ * Return: VDO_SUCCESS or an error.
+ */
+int make_data_vio_batch_processors(struct vdo *vdo)
+{
+	int result;
+
+	atomic_set(&vdo->hasher_rotor, 0);
+	atomic_set(&vdo->compressor_rotor, 0);
+	result = make_cpu_batch_processors(vdo,
+					   CPU_Q_HASH_BLOCK_PRIORITY,
+					   hash_data_vio_batch,
+					   NULL,
+					   "data_vio hashers",
+					   &vdo->hashers);
+	if (result != VDO_SUCCESS) {
+		return result;
+	}
+
+	return make_cpu_batch_processors(vdo,
+					 CPU_Q_COMPRESS_BLOCK_PRIORITY,
+					 compress_data_vio_batch,
+					 vdo->compression_context,
+					 "data_vio compressors",
+					 &vdo->compressors);
+}
+
+/**
+ * free_data_vio_batch_processors() - Free the data_vio hashers and
+ *                                    compressors of a vdo.
+ * @vdo: The vdo whose batch processors are to be freed.
+ */
+void free_data_vio_batch_processors(struct vdo *vdo)
+{
+	free_cpu_batch_processors(vdo, UDS_FORGET(vdo->compressors));
+	free_cpu_batch_processors(vdo, UDS_FORGET(vdo->hashers));
+}
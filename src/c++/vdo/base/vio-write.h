@@ -18,4 +18,12 @@ void launch_compress_data_vio(struct data_vio *data_vio);
 
 void launch_deduplicate_data_vio(struct data_vio *data_vio);
 
+extern bool vdo_fused_write_ingest;
+
+void ingest_write_data(struct data_vio *data_vio, struct bio *bio);
+
+int __must_check make_data_vio_batch_processors(struct vdo *vdo);
+
+void free_data_vio_batch_processors(struct vdo *vdo);
+
 #endif /* VIO_WRITE_H */
@@ -8,6 +8,7 @@
 #include <linux/atomic.h>
 #include <linux/kthread.h>
 #include <linux/percpu.h>
+#include <linux/topology.h>
 
 #include "logger.h"
 #include "memory-alloc.h"
@@ -616,6 +617,45 @@ static void finish_round_robin_work_queue(struct round_robin_work_queue *queue)
 	}
 }
 
+/**
+ * bind_work_queue_to_node() - Restrict the threads of a work queue to the
+ *                             CPUs of a memory node.
+ * @queue: The work queue.
+ * @node: The node to bind to.
+ *
+ * Failure to bind is logged but otherwise ignored, since the queue works
+ * correctly wherever its threads run.
+ */
+void bind_work_queue_to_node(struct vdo_work_queue *queue, int node)
+{
+	struct simple_work_queue *simple_queue;
+	struct simple_work_queue **queue_table = &simple_queue;
+	unsigned int count = 1;
+	unsigned int i;
+
+	if (queue->round_robin_mode) {
+		struct round_robin_work_queue *round_robin_queue =
+			as_round_robin_work_queue(queue);
+
+		queue_table = round_robin_queue->service_queues;
+		count = round_robin_queue->num_service_queues;
+	} else {
+		simple_queue = as_simple_work_queue(queue);
+	}
+
+	for (i = 0; i < count; i++) {
+		int result = set_cpus_allowed_ptr(queue_table[i]->thread,
+						  cpumask_of_node(node));
+
+		if (result != 0) {
+			uds_log_warning_strerror(result,
+						 "could not bind %s to node %d",
+						 queue->name,
+						 node);
+		}
+	}
+}
+
 /*
  * No enqueueing of completions should be done once this function is called.
  */
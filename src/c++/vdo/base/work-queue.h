@@ -32,6 +32,8 @@ int make_work_queue(const char *thread_name_prefix,
 		    void *thread_privates[],
 		    struct vdo_work_queue **queue_ptr);
 
+void bind_work_queue_to_node(struct vdo_work_queue *queue, int node);
+
 void enqueue_work_queue(struct vdo_work_queue *queue,
 			struct vdo_completion *completion);
 
@@ -60,6 +60,18 @@ static inline int test_bit(int nr, const volatile unsigned long *addr)
 	return 1UL & (addr[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG-1)));
 }
 
+/**
+ * __ffs64 - find first set bit in a 64 bit word
+ * @word: The 64 bit word
+ *
+ * The result is not defined if no bits are set, so check that @word
+ * is non-zero before calling this.
+ **/
+static inline unsigned int __ffs64(uint64_t word)
+{
+	return __builtin_ctzll(word);
+}
+
 /**********************************************************************/
 unsigned long __must_check
 find_next_zero_bit(const unsigned long *addr,
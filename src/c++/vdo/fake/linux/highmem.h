@@ -42,6 +42,17 @@ static inline void memcpy_to_page(struct page *page,
   memcpy(page->page_data + offset, from, len);
 }
 
+/**********************************************************************/
+static inline void *kmap_local_page(struct page *page)
+{
+  return page->page_data;
+}
+
+/**********************************************************************/
+static inline void kunmap_local(const void *addr __attribute__((unused)))
+{
+}
+
 static inline void memcpy_from_page(char *to,
                                     struct page *page,
 				    size_t offset,
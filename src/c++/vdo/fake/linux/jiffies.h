@@ -18,6 +18,9 @@ unsigned long getUnitTestJiffies(void);
 
 #define jiffies (getUnitTestJiffies() / 1)
 
+#define time_after64(a, b) ((int64_t) ((b) - (a)) < 0)
+#define time_before64(a, b) time_after64(b, a)
+
 static inline unsigned long msecs_to_jiffies(const unsigned int m)
 {
 	return m / MS_PER_JIFFY;
@@ -13,11 +13,12 @@
 #define LZ4_MEM_COMPRESS LZ4_context_size()
 
 /**********************************************************************/
-int LZ4_compress_default(const char *source,
-                         char *dest,
-                         int isize,
-                         int maxOutputSize,
-                         void *context);
+int LZ4_compress_fast(const char *source,
+                      char *dest,
+                      int isize,
+                      int maxOutputSize,
+                      int acceleration,
+                      void *context);
 
 /**********************************************************************/
 int LZ4_decompress_safe(const char *source,
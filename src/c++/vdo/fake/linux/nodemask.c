@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Implementation of fake memory node state for user space.
+ *
+ * Copyright Red Hat
+ *
+ */
+
+#include <linux/nodemask.h>
+
+nodemask_t node_states[NR_NODE_STATES] = {
+	[N_MEMORY] = { .bits = 1 },
+	[N_CPU] = { .bits = 1 },
+};
+
+/**********************************************************************/
+void set_fake_node_count(unsigned int count)
+{
+	unsigned long bits = ((count < MAX_NUMNODES)
+			      ? ((1UL << count) - 1)
+			      : ~0UL);
+
+	node_states[N_MEMORY].bits = bits;
+	node_states[N_CPU].bits = bits;
+}
@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Unit test requirements from linux/nodemask.h and linux/numa.h. User space
+ * is treated as a machine with a single memory node unless a test sets up
+ * more with set_fake_node_count().
+ *
+ * Copyright Red Hat
+ *
+ */
+
+#ifndef LINUX_NODEMASK_H
+#define LINUX_NODEMASK_H
+
+#define NUMA_NO_NODE (-1)
+#define MAX_NUMNODES 64
+
+typedef struct {
+	unsigned long bits;
+} nodemask_t;
+
+enum node_states {
+	N_MEMORY,
+	N_CPU,
+	NR_NODE_STATES,
+};
+
+extern nodemask_t node_states[NR_NODE_STATES];
+
+#define nodes_and(dst, src1, src2) ((dst).bits = (src1).bits & (src2).bits)
+#define nodes_weight(nodemask) __builtin_popcountl((nodemask).bits)
+
+#define first_node(src) __first_node(&(src))
+static inline int __first_node(const nodemask_t *srcp)
+{
+	return ((srcp->bits == 0) ? MAX_NUMNODES : __builtin_ctzl(srcp->bits));
+}
+
+#define next_node_in(n, src) __next_node_in((n), &(src))
+static inline int __next_node_in(int node, const nodemask_t *srcp)
+{
+	unsigned long later = ((node + 1 < MAX_NUMNODES)
+			       ? (srcp->bits & (~0UL << (node + 1)))
+			       : 0);
+
+	return ((later == 0) ? __first_node(srcp) : __builtin_ctzl(later));
+}
+
+static inline void node_clear_state(int node, enum node_states state)
+{
+	node_states[state].bits &= ~(1UL << node);
+}
+
+/**
+ * set_fake_node_count() - Make every node below a count have both CPUs and
+ *                         memory, and no other node have either.
+ * @count: The number of nodes.
+ */
+void set_fake_node_count(unsigned int count);
+
+#endif // LINUX_NODEMASK_H
@@ -0,0 +1,172 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include <unistd.h>
+
+#include "uds.h"
+
+#include "dedupe.h"
+#include "statistics.h"
+#include "vdo.h"
+
+#include "ioRequest.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  // The number of query latencies the controller measures before adapting
+  WINDOW_SIZE = 256,
+  // The fraction of queries skipped after one slow window is 1/16
+  SHED_INTERVAL = 16,
+  WRITE_SIZE = 16,
+};
+
+static bool         savedAdaptiveTimeout;
+static bool         savedQueryShedding;
+static unsigned int savedTargetLatency;
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .mappableBlocks      = 1024,
+    .hashZoneThreadCount = 1,
+    .dataFormatter       = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+  savedAdaptiveTimeout = vdo_adaptive_dedupe_timeout;
+  savedQueryShedding = vdo_dedupe_query_shedding;
+  savedTargetLatency = vdo_dedupe_target_latency;
+}
+
+/**
+ * Test-specific tear down.
+ **/
+static void tearDown(void)
+{
+  uds_launch_request_hook = NULL;
+  vdo_adaptive_dedupe_timeout = savedAdaptiveTimeout;
+  vdo_dedupe_query_shedding = savedQueryShedding;
+  vdo_dedupe_target_latency = savedTargetLatency;
+  tearDownVDOTest();
+}
+
+/**
+ * A uds_request_hook which makes every index request slower than the target
+ * latency.
+ **/
+static int delayRequest(struct uds_request *request __attribute__((unused)))
+{
+  usleep(2000);
+  return UDS_SUCCESS;
+}
+
+/**
+ * Write unique data in groups of WRITE_SIZE blocks.
+ *
+ * @param start  The first logical block to write
+ * @param count  The number of blocks to write
+ **/
+static void writeUniqueBlocks(logical_block_number_t start,
+                              block_count_t          count)
+{
+  for (block_count_t i = 0; i < count; i += WRITE_SIZE) {
+    writeData(start + i, start + i, WRITE_SIZE, VDO_SUCCESS);
+  }
+}
+
+/**
+ * Get the number of dedupe queries which have been skipped.
+ **/
+static uint64_t getShedCount(void)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  return stats.hash_lock.dedupe_requests_shed;
+}
+
+/**
+ * Test that queries are skipped once the index is measured to be slower than
+ * the target latency, and that nothing is skipped when shedding is disabled.
+ **/
+static void testShedding(void)
+{
+  vdo_dedupe_query_shedding = true;
+  vdo_set_dedupe_target_latency(1);
+  uds_launch_request_hook = delayRequest;
+
+  // Nothing is skipped until a full window of latencies has been measured.
+  writeUniqueBlocks(0, WINDOW_SIZE);
+  CU_ASSERT_EQUAL(getShedCount(), 0);
+
+  // Now the skipped queries are spread evenly.
+  writeUniqueBlocks(WINDOW_SIZE, 4 * SHED_INTERVAL);
+  CU_ASSERT_EQUAL(getShedCount(), 4);
+  verifyData(WINDOW_SIZE, WINDOW_SIZE, 4 * SHED_INTERVAL);
+
+  vdo_dedupe_query_shedding = false;
+  writeUniqueBlocks(WINDOW_SIZE + (4 * SHED_INTERVAL), 2 * SHED_INTERVAL);
+  CU_ASSERT_EQUAL(getShedCount(), 4);
+}
+
+/**
+ * Test that adapting the timeout does not skip queries unless shedding has
+ * also been enabled, and that both are off by default.
+ **/
+static void testAdaptiveTimeoutDoesNotShed(void)
+{
+  CU_ASSERT_FALSE(vdo_adaptive_dedupe_timeout);
+  CU_ASSERT_FALSE(vdo_dedupe_query_shedding);
+  CU_ASSERT_EQUAL(vdo_dedupe_index_timeout_interval, 5000);
+
+  vdo_adaptive_dedupe_timeout = true;
+  vdo_set_dedupe_target_latency(1);
+  uds_launch_request_hook = delayRequest;
+  writeUniqueBlocks(0, WINDOW_SIZE + (4 * SHED_INTERVAL));
+  CU_ASSERT_EQUAL(getShedCount(), 0);
+  verifyData(0, 0, WINDOW_SIZE + (4 * SHED_INTERVAL));
+}
+
+/**
+ * Test that the controller does not skip queries when the index is faster
+ * than the target latency.
+ **/
+static void testNoShedding(void)
+{
+  vdo_dedupe_query_shedding = true;
+  vdo_set_dedupe_target_latency(60000);
+  uds_launch_request_hook = delayRequest;
+  writeUniqueBlocks(0, WINDOW_SIZE + (4 * SHED_INTERVAL));
+  CU_ASSERT_EQUAL(getShedCount(), 0);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "slow index queries are shed",          testShedding                   },
+  { "fast index queries are kept",          testNoShedding                 },
+  { "adaptive timeouts alone keep queries", testAdaptiveTimeoutDoesNotShed },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "adaptive dedupe timeout tests (AdaptiveDedupeTimeout_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDown,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
@@ -0,0 +1,148 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "block-allocator.h"
+#include "slab-depot.h"
+#include "statistics.h"
+#include "vdo.h"
+
+#include "blockMapUtils.h"
+#include "ioRequest.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  STREAM_LENGTH = 12,
+  // A logical block in a different block map page from the first stream
+  OTHER_STREAM  = 2048,
+};
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .logicalBlocks  = 4096,
+    .mappableBlocks = 1024,
+    .dataFormatter  = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+}
+
+/**
+ * Get the block allocator statistics.
+ **/
+static struct block_allocator_statistics getAllocatorStatistics(void)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  return stats.allocator;
+}
+
+/**
+ * Write one block with unique data.
+ *
+ * @param lbn  The logical block to write
+ **/
+static void writeBlock(logical_block_number_t lbn)
+{
+  writeData(lbn, lbn + 1, 1, VDO_SUCCESS);
+}
+
+/**
+ * Test that two interleaved sequential writers are each given a run of
+ * physically adjacent blocks.
+ **/
+static void testInterleavedStreams(void)
+{
+  for (logical_block_number_t i = 0; i < STREAM_LENGTH; i++) {
+    writeBlock(i);
+    writeBlock(OTHER_STREAM + i);
+  }
+
+  // The second block of each stream is where its run begins.
+  for (logical_block_number_t i = 1; i < STREAM_LENGTH - 1; i++) {
+    CU_ASSERT_EQUAL(lookupLBN(i).pbn + 1, lookupLBN(i + 1).pbn);
+    CU_ASSERT_EQUAL(lookupLBN(OTHER_STREAM + i).pbn + 1,
+                    lookupLBN(OTHER_STREAM + i + 1).pbn);
+  }
+
+  struct block_allocator_statistics stats = getAllocatorStatistics();
+  CU_ASSERT_EQUAL(stats.contiguous_runs_allocated, 2);
+  CU_ASSERT_EQUAL(stats.contiguous_blocks_allocated,
+                  2 * (STREAM_LENGTH - 2));
+  verifyData(0, 1, STREAM_LENGTH);
+  verifyData(OTHER_STREAM, OTHER_STREAM + 1, STREAM_LENGTH);
+}
+
+/**
+ * Test that writes arriving out of order within a stream's extent are still
+ * allocated in logical order.
+ **/
+static void testOutOfOrderWrites(void)
+{
+  writeBlock(0);
+  writeBlock(1);
+  writeBlock(5);
+  writeBlock(3);
+
+  physical_block_number_t start = lookupLBN(0).pbn;
+  CU_ASSERT_EQUAL(lookupLBN(1).pbn, start + 1);
+  CU_ASSERT_EQUAL(lookupLBN(3).pbn, start + 3);
+  CU_ASSERT_EQUAL(lookupLBN(5).pbn, start + 5);
+
+  // The gaps left for logical blocks 2 and 4 are filled when they arrive.
+  writeBlock(4);
+  writeBlock(2);
+  CU_ASSERT_EQUAL(lookupLBN(2).pbn, start + 2);
+  CU_ASSERT_EQUAL(lookupLBN(4).pbn, start + 4);
+
+  struct block_allocator_statistics stats = getAllocatorStatistics();
+  CU_ASSERT_EQUAL(stats.contiguous_runs_allocated, 1);
+  CU_ASSERT_EQUAL(stats.contiguous_blocks_allocated, 5);
+  verifyData(0, 1, 6);
+}
+
+/**
+ * Test that a block map page allocated in the middle of a stream does not
+ * break the stream's run.
+ **/
+static void testBlockMapPageDoesNotBreakStream(void)
+{
+  writeBlock(0);
+  writeBlock(1);
+  // This allocates a new block map leaf page.
+  writeBlock(OTHER_STREAM);
+  writeBlock(2);
+  CU_ASSERT_EQUAL(lookupLBN(2).pbn, lookupLBN(1).pbn + 1);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "interleaved streams",             testInterleavedStreams             },
+  { "out of order writes",             testOutOfOrderWrites               },
+  { "block map pages between blocks",  testBlockMapPageDoesNotBreakStream },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "adjacent allocation (AdjacentAllocation_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDownVDOTest,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
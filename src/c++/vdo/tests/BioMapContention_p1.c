@@ -0,0 +1,158 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * Performance testing of contention on the io submitter's maps of pending
+ * bios, comparing a single locked map per bio zone with the sharded maps.
+ *
+ * $Id$
+ */
+
+#include "assertions.h"
+
+#include <linux/mutex.h>
+#include <stdio.h>
+
+#include "cpu.h"
+#include "int-map.h"
+#include "memory-alloc.h"
+#include "time-utils.h"
+#include "uds-threads.h"
+
+#include "constants.h"
+#include "num-utils.h"
+
+enum {
+  // The default bio rotation interval
+  RUN_BLOCKS = DEFAULT_VDO_BIO_SUBMIT_QUEUE_ROTATE_INTERVAL,
+  // The number of runs each submitter writes
+  RUNS_PER_SUBMITTER = 4096,
+  MAX_SHARDS = 8,
+  MAX_SUBMITTERS = 32,
+};
+
+struct shard {
+  struct int_map *map;
+  struct mutex    lock;
+} __attribute__((aligned(CACHE_LINE_BYTES)));
+
+static struct shard  shards[MAX_SHARDS];
+static unsigned int  shardCount;
+static unsigned int  submitterCount;
+
+/**
+ * Get the shard for a block, as the io submitter does for a single bio zone.
+ *
+ * @param block  The block number
+ *
+ * @return The shard holding the block's pending bio
+ **/
+static struct shard *getShard(uint64_t block)
+{
+  return &shards[(block / RUN_BLOCKS) % shardCount];
+}
+
+/**
+ * Submit runs of blocks, looking for neighbors to merge with and adding each
+ * block to its map as try_bio_map_merge() does, then removing each run as
+ * get_bio_list() does.
+ *
+ * @param arg  The index of the submitter
+ **/
+static void submitRuns(void *arg)
+{
+  uint64_t submitter = (uintptr_t) arg;
+  unsigned int merges = 0;
+
+  for (uint64_t r = 0; r < RUNS_PER_SUBMITTER; r++) {
+    uint64_t start = ((r * submitterCount) + submitter) * RUN_BLOCKS;
+    struct shard *shard = getShard(start);
+
+    for (uint64_t block = start; block < start + RUN_BLOCKS; block++) {
+      uint64_t sector = block * VDO_SECTORS_PER_BLOCK;
+
+      mutex_lock(&shard->lock);
+      if ((int_map_get(shard->map, sector - VDO_SECTORS_PER_BLOCK) != NULL)
+          || (int_map_get(shard->map, sector + VDO_SECTORS_PER_BLOCK)
+              != NULL)) {
+        merges++;
+      }
+      CU_ASSERT_EQUAL(UDS_SUCCESS,
+                      int_map_put(shard->map, sector, shard, true, NULL));
+      mutex_unlock(&shard->lock);
+    }
+
+    mutex_lock(&shard->lock);
+    for (uint64_t block = start; block < start + RUN_BLOCKS; block++) {
+      int_map_remove(shard->map, block * VDO_SECTORS_PER_BLOCK);
+    }
+    mutex_unlock(&shard->lock);
+  }
+
+  // Every block but the first of each run finds its predecessor.
+  unsigned int runMerges = RUNS_PER_SUBMITTER * (RUN_BLOCKS - 1);
+  if ((shardCount > 1) || (submitterCount == 1)) {
+    // Adjacent runs are never in the same map at once.
+    CU_ASSERT_EQUAL(merges, runMerges);
+  } else {
+    // The first block of a run may also find the end of another run.
+    CU_ASSERT(merges >= runMerges);
+    CU_ASSERT(merges <= runMerges + RUNS_PER_SUBMITTER);
+  }
+}
+
+/**
+ * Time a number of submitters sharing a given number of maps.
+ *
+ * @param submitters  The number of submitting threads
+ * @param count       The number of maps
+ **/
+static void testContention(unsigned int submitters, unsigned int count)
+{
+  struct thread *threads[MAX_SUBMITTERS];
+
+  submitterCount = submitters;
+  shardCount = count;
+  for (unsigned int s = 0; s < shardCount; s++) {
+    mutex_init(&shards[s].lock);
+    CU_ASSERT_EQUAL(UDS_SUCCESS,
+                    make_int_map(DIV_ROUND_UP(2 * MAXIMUM_VDO_USER_VIOS,
+                                              shardCount),
+                                 0, &shards[s].map));
+  }
+
+  ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+  for (uint64_t t = 0; t < submitters; t++) {
+    CU_ASSERT_EQUAL(UDS_SUCCESS,
+                    uds_create_thread(submitRuns, (void *) (uintptr_t) t,
+                                      "submitter", &threads[t]));
+  }
+
+  for (unsigned int t = 0; t < submitters; t++) {
+    uds_join_threads(threads[t]);
+  }
+
+  ktime_t duration = current_time_ns(CLOCK_MONOTONIC) - start;
+  uint64_t bios = (uint64_t) submitters * RUNS_PER_SUBMITTER * RUN_BLOCKS;
+  printf("%2u submitters, %u map%s: %6.3fs (%6.1f ns/bio)\n",
+         submitters, count, ((count == 1) ? " " : "s"),
+         duration * 1.0e-9, (double) duration / bios);
+
+  for (unsigned int s = 0; s < shardCount; s++) {
+    free_int_map(UDS_FORGET(shards[s].map));
+    mutex_destroy(&shards[s].lock);
+  }
+}
+
+int main(void)
+{
+  for (unsigned int submitters = 1;
+       submitters <= MAX_SUBMITTERS;
+       submitters *= 2) {
+    testContention(submitters, 1);
+    testContention(submitters, MAX_SHARDS);
+  }
+
+  return 0;
+}
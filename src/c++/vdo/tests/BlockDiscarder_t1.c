@@ -0,0 +1,330 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "memory-alloc.h"
+
+#include "block-allocator.h"
+#include "block-discarder.h"
+#include "slab-depot.h"
+#include "statistics.h"
+#include "vdo.h"
+
+#include "asyncLayer.h"
+#include "blockMapUtils.h"
+#include "ioRequest.h"
+#include "mutexUtils.h"
+#include "testTimer.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  BLOCK_COUNT = 64,
+  // Fast enough that a discard never waits for its budget
+  FAST_RATE   = 1 << 20,
+};
+
+static unsigned int            savedRate;
+static physical_block_number_t pbns[BLOCK_COUNT];
+static struct bio             *trappedDiscard;
+static bool                    blocked;
+static bool                    discarderIdle;
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .logicalBlocks  = 1024,
+    .mappableBlocks = 1024,
+    .dataFormatter  = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+  savedRate = vdo_discard_blocks_per_second;
+  trappedDiscard = NULL;
+}
+
+/**
+ * Test-specific tear down.
+ **/
+static void tearDown(void)
+{
+  vdo_set_discard_blocks_per_second(savedRate);
+  tearDownVDOTest();
+}
+
+/**
+ * Set the discard rate. A nonzero rate only takes effect once the vdo has
+ * recorded that discarding is enabled, which happens when it resumes.
+ **/
+static void setDiscardRate(unsigned int rate)
+{
+  vdo_set_discard_blocks_per_second(rate);
+  if (rate > 0) {
+    performSuccessfulSuspendAndResume(false);
+    CU_ASSERT_TRUE(vdo->depot->discards_enabled);
+  }
+}
+
+/**
+ * Get the discarder of the only physical zone.
+ **/
+static struct block_discarder *getDiscarder(void)
+{
+  return vdo->depot->allocators[0]->discarder;
+}
+
+/**
+ * Write the test blocks and record where they were written.
+ **/
+static void writeBlocks(void)
+{
+  writeData(0, 1, BLOCK_COUNT, VDO_SUCCESS);
+  for (logical_block_number_t lbn = 0; lbn < BLOCK_COUNT; lbn++) {
+    pbns[lbn] = lookupLBN(lbn).pbn;
+  }
+}
+
+/**
+ * Action to check whether the discarder is idle.
+ **/
+static void checkDiscarderIdle(struct vdo_completion *completion)
+{
+  discarderIdle = vdo_is_block_discarder_idle(getDiscarder());
+  vdo_finish_completion(completion, VDO_SUCCESS);
+}
+
+/**
+ * Wait for every noted block to be discarded, firing the throttle timer
+ * whenever it is running.
+ **/
+static void waitForDiscards(void)
+{
+  thread_id_t threadID = vdo->depot->allocators[0]->thread_id;
+  for (;;) {
+    performSuccessfulActionOnThread(checkDiscarderIdle, threadID);
+    if (discarderIdle) {
+      return;
+    }
+
+    unsigned long timeout = getNextTimeout();
+    if (timeout != ULONG_MAX) {
+      fireTimers(timeout);
+    }
+  }
+}
+
+/**
+ * Get the block allocator statistics.
+ **/
+static struct block_allocator_statistics getAllocatorStatistics(void)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  return stats.allocator;
+}
+
+/**
+ * Check that each of the freed blocks reads back as zeros from the storage.
+ **/
+static void assertBlocksDiscarded(void)
+{
+  char *buffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(VDO_BLOCK_SIZE, char, __func__, &buffer));
+  PhysicalLayer *ramLayer = getSynchronousLayer();
+  for (block_count_t i = 0; i < BLOCK_COUNT; i++) {
+    VDO_ASSERT_SUCCESS(ramLayer->reader(ramLayer, pbns[i], 1, buffer));
+    for (size_t j = 0; j < VDO_BLOCK_SIZE; j++) {
+      CU_ASSERT_EQUAL(buffer[j], 0);
+    }
+  }
+
+  UDS_FREE(buffer);
+}
+
+/**
+ * Trap the first discard.
+ *
+ * Implements BIOSubmitHook.
+ **/
+static bool trapFirstDiscard(struct bio *bio)
+{
+  if ((bio_op(bio) != REQ_OP_DISCARD) || (trappedDiscard != NULL)) {
+    return true;
+  }
+
+  trappedDiscard = bio;
+  clearBIOSubmitHook();
+  signalState(&blocked);
+  return false;
+}
+
+/**
+ * Test that nothing is discarded unless discarding has been enabled.
+ **/
+static void testDisabled(void)
+{
+  vdo_set_discard_blocks_per_second(0);
+  writeBlocks();
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+
+  struct block_allocator_statistics stats = getAllocatorStatistics();
+  CU_ASSERT_EQUAL(stats.blocks_discarded, 0);
+  CU_ASSERT_EQUAL(stats.discard_bios, 0);
+  CU_ASSERT_EQUAL(stats.discard_blocks_skipped, 0);
+}
+
+/**
+ * Test that a rate set while the vdo is running does not discard anything
+ * until the vdo resumes.
+ **/
+static void testRateTakesEffectOnResume(void)
+{
+  vdo_set_discard_blocks_per_second(FAST_RATE);
+  writeBlocks();
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  CU_ASSERT_FALSE(vdo->depot->discards_enabled);
+  CU_ASSERT_EQUAL(getAllocatorStatistics().blocks_discarded, 0);
+
+  performSuccessfulSuspendAndResume(false);
+  CU_ASSERT_TRUE(vdo->depot->discards_enabled);
+  writeData(0, 1, BLOCK_COUNT, VDO_SUCCESS);
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  waitForDiscards();
+  CU_ASSERT_EQUAL(getAllocatorStatistics().blocks_discarded, BLOCK_COUNT);
+}
+
+/**
+ * Test that blocks freed while a discard is in progress are discarded
+ * together once it completes, and that discarded blocks can be reused.
+ **/
+static void testBatchedDiscards(void)
+{
+  setDiscardRate(FAST_RATE);
+  writeBlocks();
+
+  clearState(&blocked);
+  setBIOSubmitHook(trapFirstDiscard);
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  waitForState(&blocked);
+
+  // The rest of the blocks were freed while the first discard was trapped.
+  reallyEnqueueBIO(trappedDiscard);
+  waitForDiscards();
+
+  struct block_allocator_statistics stats = getAllocatorStatistics();
+  CU_ASSERT_EQUAL(stats.blocks_discarded, BLOCK_COUNT);
+  CU_ASSERT(stats.discard_bios < BLOCK_COUNT);
+  CU_ASSERT_EQUAL(stats.discard_blocks_skipped, 0);
+  assertBlocksDiscarded();
+
+  writeData(0, 1, BLOCK_COUNT, VDO_SUCCESS);
+  verifyData(0, 1, BLOCK_COUNT);
+}
+
+/**
+ * Test that a slow rate holds discards back until the throttle allows them.
+ **/
+static void testThrottledDiscards(void)
+{
+  setDiscardRate(1);
+  writeBlocks();
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  CU_ASSERT(getAllocatorStatistics().blocks_discarded < BLOCK_COUNT);
+
+  waitForDiscards();
+  struct block_allocator_statistics stats = getAllocatorStatistics();
+  CU_ASSERT_EQUAL(stats.blocks_discarded, BLOCK_COUNT);
+  CU_ASSERT_EQUAL(stats.discard_blocks_skipped, 0);
+  assertBlocksDiscarded();
+}
+
+/**
+ * Test that a suspend abandons blocks waiting to be discarded.
+ **/
+static void testSuspendSkipsWaitingBlocks(void)
+{
+  setDiscardRate(1);
+  writeBlocks();
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  performSuccessfulSuspendAndResume(false);
+
+  struct block_allocator_statistics stats = getAllocatorStatistics();
+  CU_ASSERT(stats.discard_blocks_skipped > 0);
+  CU_ASSERT_EQUAL(stats.blocks_discarded + stats.discard_blocks_skipped,
+                  BLOCK_COUNT);
+  CU_ASSERT_TRUE(vdo_is_block_discarder_idle(getDiscarder()));
+}
+
+/**
+ * Test that advice naming a freed block is still used if discarding has
+ * never been enabled.
+ **/
+static void testDedupeAgainstFreedBlocks(void)
+{
+  vdo_set_discard_blocks_per_second(0);
+  writeBlocks();
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  writeData(BLOCK_COUNT, 1, BLOCK_COUNT, VDO_SUCCESS);
+
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT(stats.hash_lock.dedupe_advice_valid > 0);
+  verifyData(BLOCK_COUNT, 1, BLOCK_COUNT);
+}
+
+/**
+ * Test that stale advice naming a discarded block is refused even after
+ * discarding has been disabled and the vdo has been restarted.
+ **/
+static void testNoDedupeAgainstDiscardedBlocks(void)
+{
+  setDiscardRate(FAST_RATE);
+  writeBlocks();
+  discardData(0, BLOCK_COUNT, VDO_SUCCESS);
+  waitForDiscards();
+
+  vdo_set_discard_blocks_per_second(0);
+  restartVDO(false);
+  CU_ASSERT_TRUE(vdo->depot->discards_enabled);
+  writeData(BLOCK_COUNT, 1, BLOCK_COUNT, VDO_SUCCESS);
+
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_valid, 0);
+  CU_ASSERT(stats.hash_lock.dedupe_advice_stale > 0);
+  verifyData(BLOCK_COUNT, 1, BLOCK_COUNT);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "discarding is disabled by default",     testDisabled                       },
+  { "a new rate takes effect on resume",     testRateTakesEffectOnResume        },
+  { "freed blocks are discarded in batches", testBatchedDiscards                },
+  { "discards are throttled",                testThrottledDiscards              },
+  { "suspend skips waiting blocks",          testSuspendSkipsWaitingBlocks      },
+  { "freed blocks are deduped",              testDedupeAgainstFreedBlocks       },
+  { "discarded blocks are not deduped",      testNoDedupeAgainstDiscardedBlocks },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "block discarder tests (BlockDiscarder_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDown,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
@@ -0,0 +1,164 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "block-map.h"
+#include "statistics.h"
+#include "vdo.h"
+
+#include "dataBlocks.h"
+#include "ioRequest.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  LEAF_PAGES     = 64,
+  CACHE_SIZE     = 16,
+  // The prefetch window is limited to a quarter of the cache
+  PREFETCH_PAGES = CACHE_SIZE / 4,
+  // The number of reads needed to detect a forward scan
+  DETECT_PAGES   = 4,
+};
+
+static unsigned int savedPrefetchPages;
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .logicalBlocks      = LEAF_PAGES * VDO_BLOCK_MAP_ENTRIES_PER_PAGE,
+    .mappableBlocks     = 512,
+    .cacheSize          = CACHE_SIZE,
+    .logicalThreadCount = 1,
+    .dataFormatter      = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+  savedPrefetchPages = vdo_block_map_prefetch_pages;
+
+  // Write one block in each leaf page, then write out the dirty pages so
+  // that the cache holds only clean pages from the end of the map.
+  for (page_number_t page = 0; page < LEAF_PAGES; page++) {
+    writeData(page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE, page, 1, VDO_SUCCESS);
+  }
+
+  performSuccessfulSuspendAndResume(true);
+  vdo_set_block_map_prefetch_pages(2 * PREFETCH_PAGES);
+}
+
+/**
+ * Test-specific tear down.
+ **/
+static void tearDown(void)
+{
+  vdo_set_block_map_prefetch_pages(savedPrefetchPages);
+  tearDownVDOTest();
+}
+
+/**
+ * Read back the block written in a leaf page.
+ *
+ * @param page  The leaf page to read from
+ **/
+static void readPage(page_number_t page)
+{
+  verifyData(page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE, page, 1);
+}
+
+/**
+ * Check the prefetch statistics.
+ *
+ * @param prefetched  The expected number of prefetched pages
+ * @param hits        The expected number of prefetched pages which were used
+ **/
+static void assertPrefetchStatistics(uint64_t prefetched, uint64_t hits)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.block_map.pages_prefetched, prefetched);
+  CU_ASSERT_EQUAL(stats.block_map.prefetch_hits, hits);
+  CU_ASSERT_EQUAL(stats.block_map.prefetch_wasted, 0);
+}
+
+/**
+ * Test that a forward scan prefetches the leaf pages ahead of it once it has
+ * been detected.
+ **/
+static void testSequentialPrefetch(void)
+{
+  for (page_number_t page = 0; page < DETECT_PAGES; page++) {
+    readPage(page);
+  }
+
+  // The last detecting read prefetched the pages after it.
+  assertPrefetchStatistics(PREFETCH_PAGES, 0);
+
+  // Every later page has already been prefetched when it is read.
+  for (page_number_t page = DETECT_PAGES; page < LEAF_PAGES; page++) {
+    readPage(page);
+  }
+
+  assertPrefetchStatistics(LEAF_PAGES - DETECT_PAGES,
+                           LEAF_PAGES - DETECT_PAGES);
+}
+
+/**
+ * Test that a backward scan does not prefetch.
+ **/
+static void testNoPrefetchBackward(void)
+{
+  for (page_number_t page = LEAF_PAGES; page > 0; page--) {
+    readPage(page - 1);
+  }
+
+  assertPrefetchStatistics(0, 0);
+}
+
+/**
+ * Test that a forward scan after a restart skips the pages whose tree pages
+ * have not been loaded yet, rather than prefetching the wrong pages.
+ **/
+static void testNoPrefetchBeforeTreeLoad(void)
+{
+  restartVDO(false);
+  for (page_number_t page = 0; page < LEAF_PAGES; page++) {
+    readPage(page);
+  }
+
+  // Only the pages in trees which earlier reads loaded can be prefetched.
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT(stats.block_map.pages_prefetched < LEAF_PAGES - DETECT_PAGES);
+  CU_ASSERT_EQUAL(stats.block_map.prefetch_hits,
+                  stats.block_map.pages_prefetched);
+  CU_ASSERT_EQUAL(stats.block_map.prefetch_wasted, 0);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "forward scans are prefetched",      testSequentialPrefetch       },
+  { "backward scans are not prefetched", testNoPrefetchBackward       },
+  { "unloaded tree pages are skipped",   testNoPrefetchBeforeTreeLoad },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "block map prefetch tests (BlockMapPrefetch_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDown,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
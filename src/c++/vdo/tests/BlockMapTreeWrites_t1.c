@@ -57,6 +57,7 @@ static void initialize(block_count_t journalBlocks)
   writeCount      = 0;
   writeGeneration = 0;
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
 
   vdo->recovery_journal->entries_per_block = ENTRIES_PER_BLOCK;
   zone = &vdo->block_map->zones[0].tree_zone;
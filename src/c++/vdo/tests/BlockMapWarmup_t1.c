@@ -0,0 +1,233 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "memory-alloc.h"
+
+#include "block-map.h"
+#include "forest.h"
+#include "statistics.h"
+#include "vdo.h"
+#include "vio.h"
+
+#include "asyncLayer.h"
+#include "dataBlocks.h"
+#include "ioRequest.h"
+#include "mutexUtils.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  LEAF_PAGES = 64,
+  // Every tree has a leaf page, so each needs its four tree pages loaded.
+  TREE_PAGES = DEFAULT_VDO_BLOCK_MAP_TREE_ROOT_COUNT * 4,
+};
+
+static bool        warmupRunning;
+static struct bio *trappedLoad;
+static bool        blocked;
+
+/**
+ * Initialize a VDO with one block written in each leaf page, and then
+ * restart it so that nothing from the block map is in memory.
+ *
+ * @param cacheSize  The size of the block map cache
+ **/
+static void initializeWarmupTest(page_count_t cacheSize)
+{
+  const TestParameters parameters = {
+    .logicalBlocks      = LEAF_PAGES * VDO_BLOCK_MAP_ENTRIES_PER_PAGE,
+    .mappableBlocks     = 512,
+    .cacheSize          = cacheSize,
+    .logicalThreadCount = 1,
+    .dataFormatter      = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+
+  for (page_number_t page = 0; page < LEAF_PAGES; page++) {
+    writeData(page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE, page, 1, VDO_SUCCESS);
+  }
+
+  restartVDO(false);
+}
+
+/**
+ * Action to check whether the block map zone is still warming up.
+ **/
+static void checkWarmup(struct vdo_completion *completion)
+{
+  warmupRunning = (vdo->block_map->zones[0].warmup != NULL);
+  vdo_finish_completion(completion, VDO_SUCCESS);
+}
+
+/**
+ * Check whether the block map zone is still warming up.
+ **/
+static bool isWarmupRunning(void)
+{
+  performSuccessfulActionOnThread(checkWarmup,
+                                  vdo->block_map->zones[0].thread_id);
+  return warmupRunning;
+}
+
+/**
+ * Wait for a warmup to finish.
+ **/
+static void waitForWarmup(void)
+{
+  while (isWarmupRunning()) {
+    // Keep checking.
+  }
+}
+
+/**
+ * Warm up the block map and wait for the warmup to finish.
+ **/
+static void warmBlockMap(void)
+{
+  VDO_ASSERT_SUCCESS(vdo_warm_block_map(vdo->block_map));
+  waitForWarmup();
+}
+
+/**
+ * Trap the first read of a block map tree page.
+ *
+ * Implements BIOSubmitHook.
+ **/
+static bool trapFirstTreePageLoad(struct bio *bio)
+{
+  struct vio *vio = bio->bi_private;
+  if ((bio_op(bio) != REQ_OP_READ)
+      || (vio->type != VIO_TYPE_BLOCK_MAP_INTERIOR)) {
+    return true;
+  }
+
+  trappedLoad = bio;
+  clearBIOSubmitHook();
+  signalState(&blocked);
+  return false;
+}
+
+/**
+ * Check the block map statistics.
+ *
+ * @param warmups    The number of warmups which have run
+ * @param treePages  The expected number of tree pages loaded by the warmup
+ * @param leafPages  The expected number of leaf pages fetched by the warmup
+ * @param loaded     The expected number of pages loaded into the cache
+ **/
+static void assertWarmupStatistics(uint64_t warmups,
+                                   uint64_t treePages,
+                                   uint64_t leafPages,
+                                   uint64_t loaded)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.block_map.warmup_pages_scanned,
+                  warmups * LEAF_PAGES);
+  CU_ASSERT_EQUAL(stats.block_map.warmup_tree_pages_loaded, treePages);
+  CU_ASSERT_EQUAL(stats.block_map.warmup_leaf_pages_fetched, leafPages);
+  CU_ASSERT_EQUAL(stats.block_map.pages_loaded, loaded);
+}
+
+/**
+ * Test that a warmup loads the whole block map when the cache can hold it,
+ * so that reads need no block map I/O.
+ **/
+static void testWarmup(void)
+{
+  initializeWarmupTest(2 * LEAF_PAGES);
+  warmBlockMap();
+  assertWarmupStatistics(1, TREE_PAGES, LEAF_PAGES, LEAF_PAGES);
+
+  for (page_number_t page = 0; page < LEAF_PAGES; page++) {
+    verifyData(page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE, page, 1);
+  }
+  assertWarmupStatistics(1, TREE_PAGES, LEAF_PAGES, LEAF_PAGES);
+
+  // A second warmup finds everything already in memory.
+  warmBlockMap();
+  assertWarmupStatistics(2, TREE_PAGES, 2 * LEAF_PAGES, LEAF_PAGES);
+}
+
+/**
+ * Test that a warmup stops fetching leaf pages once the cache is full, but
+ * still loads every tree page.
+ **/
+static void testSmallCache(void)
+{
+  const page_count_t cacheSize = LEAF_PAGES / 4;
+  initializeWarmupTest(cacheSize);
+  warmBlockMap();
+  assertWarmupStatistics(1, TREE_PAGES, cacheSize, cacheSize);
+
+  for (page_number_t page = 0; page < LEAF_PAGES; page++) {
+    verifyData(page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE, page, 1);
+  }
+}
+
+/**
+ * Test that a warmup which needs a tree page another lookup is loading waits
+ * for that load and then carries on.
+ **/
+static void testWaitForLookup(void)
+{
+  initializeWarmupTest(2 * LEAF_PAGES);
+
+  char *buffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(VDO_BLOCK_SIZE, char, __func__, &buffer));
+  trappedLoad = NULL;
+  clearState(&blocked);
+  setBIOSubmitHook(trapFirstTreePageLoad);
+  IORequest *request = launchBufferBackedRequest(0, 1, buffer, REQ_OP_READ);
+  waitForState(&blocked);
+
+  // The read holds the lock on the first tree page the warmup needs.
+  VDO_ASSERT_SUCCESS(vdo_warm_block_map(vdo->block_map));
+  CU_ASSERT_TRUE(isWarmupRunning());
+  assertWarmupStatistics(0, 0, 0, 0);
+
+  reallyEnqueueBIO(trappedLoad);
+  awaitAndFreeSuccessfulRequest(UDS_FORGET(request));
+  UDS_FREE(buffer);
+  waitForWarmup();
+
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.block_map.warmup_pages_scanned, LEAF_PAGES);
+  CU_ASSERT(stats.block_map.warmup_tree_pages_loaded < TREE_PAGES);
+  CU_ASSERT_EQUAL(stats.block_map.warmup_leaf_pages_fetched, LEAF_PAGES);
+  CU_ASSERT_EQUAL(stats.block_map.pages_loaded, LEAF_PAGES);
+
+  for (page_number_t page = 0; page < LEAF_PAGES; page++) {
+    verifyData(page * VDO_BLOCK_MAP_ENTRIES_PER_PAGE, page, 1);
+  }
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "warmup loads the block map",      testWarmup        },
+  { "warmup is limited by cache size", testSmallCache    },
+  { "warmup waits for a lookup",       testWaitForLookup },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "block map warmup tests (BlockMapWarmup_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = NULL,
+  .cleaner                  = tearDownVDOTest,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
@@ -0,0 +1,138 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * Performance testing of data block comparison, as used to verify dedupe
+ * advice.
+ *
+ * $Id$
+ */
+
+#include "assertions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "constants.h"
+#include "data-vio.h"
+
+enum {
+  // Should be larger than CPU cache size.
+  TESTSIZE = 40 * 1024 * 1024,
+  PREFETCH_AVOIDANCE_GAP = 2048,
+  STRIDE = VDO_BLOCK_SIZE + PREFETCH_AVOIDANCE_GAP,
+  BLOCKS = TESTSIZE / STRIDE,
+};
+
+static char buffer[TESTSIZE] __attribute__ ((__aligned__(64)));
+static char copy[TESTSIZE] __attribute__ ((__aligned__(64)));
+
+typedef bool Comparator(const char *block1, const char *block2);
+
+static uint64_t cpuTime(void)
+{
+  /* user cpu time */
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) < 0) {
+    perror("getrusage");
+    exit(1);
+  }
+  return ((uint64_t) ru.ru_utime.tv_sec * 1000000) + ru.ru_utime.tv_usec;
+}
+
+/**
+ * The word at a time comparison blocks_equal() used to do.
+ *
+ * Implements Comparator.
+ **/
+static bool compareWords(const char *block1, const char *block2)
+{
+  for (unsigned int i = 0; i < VDO_BLOCK_SIZE; i += sizeof(uint64_t)) {
+    if (*((const uint64_t *) &block1[i]) != *((const uint64_t *) &block2[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Implements Comparator.
+ **/
+static bool compareMemcmp(const char *block1, const char *block2)
+{
+  return (memcmp(block1, block2, VDO_BLOCK_SIZE) == 0);
+}
+
+/**
+ * Time a comparator over blocks scattered through the buffers.
+ *
+ * @param label       What is being timed
+ * @param comparator  The comparison to time
+ * @param iterations  The number of blocks to compare
+ *
+ * @return The number of equal blocks found
+ **/
+static unsigned int testCompare(const char   *label,
+                                Comparator   *comparator,
+                                unsigned int  iterations)
+{
+  unsigned int equal = 0;
+  uint64_t startTime = cpuTime();
+  for (unsigned int i = 0; i < iterations; i++) {
+    size_t offset = (size_t) (i % BLOCKS) * STRIDE;
+    if (comparator(buffer + offset, copy + offset)) {
+      equal++;
+    }
+  }
+
+  uint64_t duration = cpuTime() - startTime;
+  double perBlock = (double) duration / iterations;
+  printf("%8u %-14s: %5.2fs (%.3fus/block, %7.1fMB/s)\n",
+         iterations, label, duration * 1.0e-6, perBlock,
+         (1.0e6 * VDO_BLOCK_SIZE / (1024 * 1024)) / perBlock);
+  return equal;
+}
+
+/**
+ * Time all the comparators on the current contents of the buffers.
+ *
+ * @param iterations  The number of blocks to compare with each
+ **/
+static void testAll(unsigned int iterations)
+{
+  unsigned int equal = testCompare("blocks_equal", blocks_equal, iterations);
+  CU_ASSERT_EQUAL(equal, testCompare("word loop", compareWords, iterations));
+  CU_ASSERT_EQUAL(equal, testCompare("memcmp", compareMemcmp, iterations));
+}
+
+int main(void)
+{
+  unsigned int iterations = 1000000;
+
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = random() & 0xff;
+  }
+  memcpy(copy, buffer, sizeof(copy));
+
+  printf("Equal blocks:\n");
+  testAll(iterations);
+
+  printf("Blocks differing in the last byte:\n");
+  for (unsigned int i = 0; i < BLOCKS; i++) {
+    copy[((size_t) i * STRIDE) + VDO_BLOCK_SIZE - 1] ^= 1;
+  }
+  testAll(iterations);
+
+  printf("Blocks differing in the first byte:\n");
+  memcpy(copy, buffer, sizeof(copy));
+  for (unsigned int i = 0; i < BLOCKS; i++) {
+    copy[(size_t) i * STRIDE] ^= 1;
+  }
+  testAll(iterations);
+  return 0;
+}
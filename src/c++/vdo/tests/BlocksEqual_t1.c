@@ -0,0 +1,62 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include <linux/prandom.h>
+#include <string.h>
+
+#include "albtest.h"
+#include "assertions.h"
+#include "data-vio.h"
+
+static char block1[VDO_BLOCK_SIZE] __attribute__((aligned(64)));
+static char block2[VDO_BLOCK_SIZE] __attribute__((aligned(64)));
+
+/**********************************************************************/
+static void blocksEqualTest(void)
+{
+  prandom_bytes(block1, sizeof(block1));
+  memcpy(block2, block1, sizeof(block2));
+  CU_ASSERT_TRUE(blocks_equal(block1, block2));
+  CU_ASSERT_TRUE(blocks_equal(block1, block1));
+
+  // A single differing bit anywhere in the block
+  for (unsigned int i = 0; i < VDO_BLOCK_SIZE; i++) {
+    for (unsigned int bit = 0; bit < 8; bit += 3) {
+      block2[i] ^= (1 << bit);
+      CU_ASSERT_FALSE(blocks_equal(block1, block2));
+      CU_ASSERT_FALSE(blocks_equal(block2, block1));
+      block2[i] ^= (1 << bit);
+    }
+  }
+
+  CU_ASSERT_TRUE(blocks_equal(block1, block2));
+
+  // Blocks which are both zero
+  memset(block1, 0, sizeof(block1));
+  memset(block2, 0, sizeof(block2));
+  CU_ASSERT_TRUE(blocks_equal(block1, block2));
+}
+
+/**********************************************************************/
+static CU_TestInfo theTestInfo[] = {
+  { "blocks equal", blocksEqualTest },
+  CU_TEST_INFO_NULL
+};
+
+static CU_SuiteInfo theSuiteInfo = {
+  .name                     = "Test blocks_equal (BlocksEqual_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = NULL,
+  .cleaner                  = NULL,
+  .tests                    = theTestInfo
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &theSuiteInfo;
+}
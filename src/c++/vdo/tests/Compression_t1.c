@@ -6,6 +6,9 @@
  * $Id$
  */
 
+#include <linux/murmurhash3.h>
+#include <stdlib.h>
+
 #include "albtest.h"
 
 #include "memory-alloc.h"
@@ -14,6 +17,7 @@
 #include "block-allocator.h"
 #include "packer.h"
 #include "vdo.h"
+#include "vio-write.h"
 
 #include "asyncLayer.h"
 #include "blockMapUtils.h"
@@ -25,9 +29,11 @@
 #include "vdoAsserts.h"
 #include "vdoTestBase.h"
 
-static IORequest     *requests[VDO_MAX_COMPRESSION_SLOTS];
-static block_count_t  blocksFree;
-static bool           finishedCompressedWrite;
+static IORequest             *requests[VDO_MAX_COMPRESSION_SLOTS];
+static block_count_t          blocksFree;
+static bool                   finishedCompressedWrite;
+static struct uds_chunk_name  hashedName;
+static bool                   hashedOnIngest;
 
 /**
  * Test-specific initialization.
@@ -81,6 +87,124 @@ static void testCompressedDataReadWrite(void)
   }
 
   CU_ASSERT_EQUAL(blocksFree, getPhysicalBlocksFree());
+
+  // None of the compressible data should have skipped compression.
+  struct packer_statistics stats = vdo_get_packer_statistics(vdo->packer);
+  CU_ASSERT_EQUAL(0, stats.compression_skips);
+  CU_ASSERT_EQUAL(stats.compression_batch_blocks, stats.compression_attempts);
+}
+
+/**
+ * Test that random data is written without being given to LZ4.
+ **/
+static void testIncompressibleData(void)
+{
+  enum { BLOCK_COUNT = 4 };
+  char *buffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(BLOCK_COUNT * VDO_BLOCK_SIZE, char, __func__,
+                                  &buffer));
+  for (size_t i = 0; i < BLOCK_COUNT * VDO_BLOCK_SIZE; i++) {
+    buffer[i] = random() & 0xff;
+  }
+
+  VDO_ASSERT_SUCCESS(performWrite(0, BLOCK_COUNT, buffer));
+  CU_ASSERT_EQUAL(blocksFree - BLOCK_COUNT, getPhysicalBlocksFree());
+
+  struct packer_statistics stats = vdo_get_packer_statistics(vdo->packer);
+  CU_ASSERT_EQUAL(BLOCK_COUNT, stats.compression_skips);
+  CU_ASSERT_EQUAL(0, stats.compression_attempts);
+  CU_ASSERT_EQUAL(0, stats.compressed_fragments_in_packer);
+
+  char *readBuffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(BLOCK_COUNT * VDO_BLOCK_SIZE, char,
+                                  __func__, &readBuffer));
+  VDO_ASSERT_SUCCESS(performRead(0, BLOCK_COUNT, readBuffer));
+  UDS_ASSERT_EQUAL_BYTES(buffer, readBuffer, BLOCK_COUNT * VDO_BLOCK_SIZE);
+  UDS_FREE(readBuffer);
+  UDS_FREE(buffer);
+}
+
+/**
+ * Test that blocks hashed as they are copied in and blocks hashed later on a
+ * CPU thread get the same chunk names, and so deduplicate against each other.
+ **/
+static void testFusedIngestToggle(void)
+{
+  enum { BLOCK_COUNT = 4 };
+  char *buffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(BLOCK_COUNT * VDO_BLOCK_SIZE, char, __func__,
+                                  &buffer));
+  // Random data is not compressed, so it will not wait in the packer.
+  for (size_t i = 0; i < BLOCK_COUNT * VDO_BLOCK_SIZE; i++) {
+    buffer[i] = random() & 0xff;
+  }
+
+  bool fused = vdo_fused_write_ingest;
+  for (logical_block_number_t lbn = 0;
+       lbn < 4 * BLOCK_COUNT;
+       lbn += BLOCK_COUNT) {
+    WRITE_ONCE(vdo_fused_write_ingest, !vdo_fused_write_ingest);
+    VDO_ASSERT_SUCCESS(performWrite(lbn, BLOCK_COUNT, buffer));
+    CU_ASSERT_EQUAL(blocksFree - BLOCK_COUNT, getPhysicalBlocksFree());
+  }
+  WRITE_ONCE(vdo_fused_write_ingest, fused);
+
+  char *readBuffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(BLOCK_COUNT * VDO_BLOCK_SIZE, char,
+                                  __func__, &readBuffer));
+  for (logical_block_number_t lbn = 0;
+       lbn < 4 * BLOCK_COUNT;
+       lbn += BLOCK_COUNT) {
+    VDO_ASSERT_SUCCESS(performRead(lbn, BLOCK_COUNT, readBuffer));
+    UDS_ASSERT_EQUAL_BYTES(buffer, readBuffer, BLOCK_COUNT * VDO_BLOCK_SIZE);
+  }
+  UDS_FREE(readBuffer);
+  UDS_FREE(buffer);
+}
+
+/**
+ * Record the chunk name of a data_vio as it goes to get its hash lock.
+ *
+ * Implements CompletionHook.
+ **/
+static bool recordChunkName(struct vdo_completion *completion)
+{
+  if (lastAsyncOperationIs(completion, VIO_ASYNC_OP_ACQUIRE_VDO_HASH_LOCK)) {
+    struct data_vio *dataVIO = as_data_vio(completion);
+    hashedName               = dataVIO->chunk_name;
+    hashedOnIngest           = dataVIO->hashed_on_ingest;
+  }
+
+  return true;
+}
+
+/**
+ * Test that a block gets the chunk name of its data whether it is hashed as
+ * it is copied in or later on a CPU thread.
+ **/
+static void testChunkName(void)
+{
+  char *buffer;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE(VDO_BLOCK_SIZE, char, __func__, &buffer));
+  for (size_t i = 0; i < VDO_BLOCK_SIZE; i++) {
+    buffer[i] = random() & 0xff;
+  }
+
+  struct uds_chunk_name expected;
+  murmurhash3_128(buffer, VDO_BLOCK_SIZE, 0x62ea60be, &expected);
+
+  bool fused = vdo_fused_write_ingest;
+  setCompletionEnqueueHook(recordChunkName);
+  for (logical_block_number_t lbn = 0; lbn < 2; lbn++) {
+    WRITE_ONCE(vdo_fused_write_ingest, (lbn == 0));
+    memset(&hashedName, 0, sizeof(hashedName));
+    VDO_ASSERT_SUCCESS(performWrite(lbn, 1, buffer));
+    CU_ASSERT_EQUAL(hashedOnIngest, (lbn == 0));
+    UDS_ASSERT_BLOCKNAME_EQUAL(expected.name, hashedName.name);
+  }
+  clearCompletionEnqueueHooks();
+  WRITE_ONCE(vdo_fused_write_ingest, fused);
+  UDS_FREE(buffer);
 }
 
 /**
@@ -341,6 +465,9 @@ static void testInvalidFragment(void)
 
 static CU_TestInfo tests[] = {
   { "compressed data read write",        testCompressedDataReadWrite         },
+  { "incompressible data skips LZ4",      testIncompressibleData              },
+  { "fused and unfused hashing dedupe",   testFusedIngestToggle               },
+  { "fused and unfused chunk names",      testChunkName                       },
   { "dedupe block in packer",            testDedupeBlocksInPacker            },
   { "dedupe block in compressor",        testDedupeBlocksInCompressor        },
   { "compressed block reference",        testCompressedBlockReference        },
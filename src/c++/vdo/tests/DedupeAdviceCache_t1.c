@@ -0,0 +1,177 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "statistics.h"
+#include "vdo.h"
+
+#include "blockMapUtils.h"
+#include "dataBlocks.h"
+#include "ioRequest.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  // The test index holds four chapters of 4096 records each.
+  INDEX_RECORDS  = 4 * 4096,
+  UNIQUE_WRITE   = 16,
+  ROUND_BLOCKS   = 1024,
+  HOT_LBN        = UNIQUE_WRITE,
+};
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .mappableBlocks      = 64,
+    .hashZoneThreadCount = 1,
+    .dataFormatter       = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+}
+
+/**
+ * Check the advice cache statistics.
+ *
+ * @param hits    The expected number of cache hits
+ * @param misses  The expected number of cache misses
+ * @param stale   The expected number of stale cache hits
+ **/
+static void assertCacheStatistics(uint64_t hits,
+                                  uint64_t misses,
+                                  uint64_t stale)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_cache_hits, hits);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_cache_misses, misses);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_cache_stale, stale);
+}
+
+/**
+ * Test that advice returned by the index is reused by later hash locks
+ * without querying the index again.
+ **/
+static void testCacheHits(void)
+{
+  // The first copy posts to the index, which has no advice to return.
+  writeData(0, 0, 1, VDO_SUCCESS);
+  assertCacheStatistics(0, 1, 0);
+
+  // The second copy gets advice from the index, which is then cached.
+  writeData(1, 0, 1, VDO_SUCCESS);
+  assertCacheStatistics(0, 2, 0);
+
+  // Subsequent copies get their advice from the cache.
+  writeData(2, 0, 1, VDO_SUCCESS);
+  writeData(3, 0, 1, VDO_SUCCESS);
+  assertCacheStatistics(2, 2, 0);
+
+  physical_block_number_t pbn = lookupLBN(0).pbn;
+  for (logical_block_number_t lbn = 1; lbn < 4; lbn++) {
+    CU_ASSERT_EQUAL(lookupLBN(lbn).pbn, pbn);
+  }
+
+  verifyData(0, 0, 1);
+  verifyData(3, 0, 1);
+}
+
+/**
+ * Test that cached advice which fails verification is invalidated and
+ * replaced by the location of the newly written copy.
+ **/
+static void testStaleCachedAdvice(void)
+{
+  writeData(0, 0, 1, VDO_SUCCESS);
+  writeData(1, 0, 1, VDO_SUCCESS);
+  assertCacheStatistics(0, 2, 0);
+
+  // Change the contents of the cached duplicate behind VDO's back.
+  physical_block_number_t stalePBN = lookupLBN(0).pbn;
+  char buffer[VDO_BLOCK_SIZE];
+  fillWithOffsetPlusOne(buffer, 47);
+  VDO_ASSERT_SUCCESS(layer->writer(layer, stalePBN, 1, buffer));
+
+  // The cached advice fails to verify, so the data must be written.
+  writeData(2, 0, 1, VDO_SUCCESS);
+  assertCacheStatistics(1, 2, 1);
+  physical_block_number_t newPBN = lookupLBN(2).pbn;
+  CU_ASSERT_NOT_EQUAL(newPBN, stalePBN);
+
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_stale, 1);
+
+  // The index update replaced the stale cache entry with the new copy.
+  writeData(3, 0, 1, VDO_SUCCESS);
+  assertCacheStatistics(2, 2, 1);
+  CU_ASSERT_EQUAL(lookupLBN(3).pbn, newPBN);
+  verifyData(3, 0, 1);
+}
+
+/**
+ * Test that a name whose advice is always found in the cache is still
+ * refreshed in the index, so that it does not age out while it is hot.
+ **/
+static void testHotNameStaysIndexed(void)
+{
+  // Get the hot block's advice from the index, and hence into the cache.
+  writeData(HOT_LBN, 0, 1, VDO_SUCCESS);
+  writeData(HOT_LBN + 1, 0, 1, VDO_SUCCESS);
+  physical_block_number_t hotPBN = lookupLBN(HOT_LBN).pbn;
+
+  // Write more unique blocks than the index can hold, hitting the hot name
+  // in the cache once per round.
+  block_count_t index = 1;
+  uint64_t hits = 0;
+  while (index < INDEX_RECORDS + ROUND_BLOCKS) {
+    for (block_count_t i = 0; i < ROUND_BLOCKS; i += UNIQUE_WRITE) {
+      writeData(0, index, UNIQUE_WRITE, VDO_SUCCESS);
+      index += UNIQUE_WRITE;
+    }
+
+    writeData(HOT_LBN + 2, 0, 1, VDO_SUCCESS);
+    CU_ASSERT_EQUAL(lookupLBN(HOT_LBN + 2).pbn, hotPBN);
+    hits++;
+  }
+
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_cache_hits, hits);
+
+  // Restarting empties the cache, so the index must supply the advice.
+  restartVDO(false);
+  writeData(HOT_LBN + 3, 0, 1, VDO_SUCCESS);
+  CU_ASSERT_EQUAL(lookupLBN(HOT_LBN + 3).pbn, hotPBN);
+  verifyData(HOT_LBN + 3, 0, 1);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "cached advice is reused",           testCacheHits           },
+  { "stale cached advice is invalidated", testStaleCachedAdvice   },
+  { "hot names stay in the index",       testHotNameStaysIndexed },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "dedupe advice cache tests (DedupeAdviceCache_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDownVDOTest,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
@@ -0,0 +1,145 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * Performance testing of zero block detection.
+ *
+ * $Id$
+ */
+
+#include "assertions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "constants.h"
+#include "data-vio.h"
+
+enum {
+  // Should be larger than CPU cache size.
+  TESTSIZE = 40 * 1024 * 1024,
+  PREFETCH_AVOIDANCE_GAP = 2048,
+  STRIDE = VDO_BLOCK_SIZE + PREFETCH_AVOIDANCE_GAP,
+  BLOCKS = TESTSIZE / STRIDE,
+};
+
+static char buffer[TESTSIZE] __attribute__ ((__aligned__(64)));
+static char dataBlock[VDO_BLOCK_SIZE] __attribute__ ((__aligned__(64)));
+
+static uint64_t cpuTime(void)
+{
+  /* user cpu time */
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) < 0) {
+    perror("getrusage");
+    exit(1);
+  }
+  return ((uint64_t) ru.ru_utime.tv_sec * 1000000) + ru.ru_utime.tv_usec;
+}
+
+/**
+ * Report the time taken for a number of blocks.
+ *
+ * @param label       What was timed
+ * @param iterations  The number of blocks processed
+ * @param duration    The time taken in microseconds
+ **/
+static void report(const char   *label,
+                   unsigned int  iterations,
+                   uint64_t      duration)
+{
+  double perBlock = (double) duration / iterations;
+  printf("%8u %-28s: %5.2fs (%.3fus/block, %7.1fMB/s)\n",
+         iterations, label, duration * 1.0e-6, perBlock,
+         (1.0e6 * VDO_BLOCK_SIZE / (1024 * 1024)) / perBlock);
+}
+
+/**
+ * Check blocks scattered through the buffer for zeros.
+ *
+ * @param iterations  The number of blocks to check
+ *
+ * @return The number of zero blocks found
+ **/
+static unsigned int testCheck(unsigned int iterations)
+{
+  unsigned int zeros = 0;
+  uint64_t startTime = cpuTime();
+  for (unsigned int i = 0; i < iterations; i++) {
+    if (is_zero_block(buffer + ((size_t) (i % BLOCKS) * STRIDE))) {
+      zeros++;
+    }
+  }
+  report("checked", iterations, cpuTime() - startTime);
+  return zeros;
+}
+
+/**
+ * Copy blocks scattered through the buffer into a data block and check each
+ * for zeros, either in two passes or in one.
+ *
+ * @param fused       Whether to check while copying
+ * @param iterations  The number of blocks to copy
+ *
+ * @return The number of zero blocks found
+ **/
+static unsigned int testCopy(bool fused, unsigned int iterations)
+{
+  unsigned int zeros = 0;
+  uint64_t startTime = cpuTime();
+  for (unsigned int i = 0; i < iterations; i++) {
+    char *block = buffer + ((size_t) (i % BLOCKS) * STRIDE);
+    bool zero;
+    if (fused) {
+      zero = copy_data_and_check_zero(dataBlock, block, VDO_BLOCK_SIZE);
+    } else {
+      memcpy(dataBlock, block, VDO_BLOCK_SIZE);
+      zero = is_zero_block(dataBlock);
+    }
+
+    if (zero) {
+      zeros++;
+    }
+  }
+  report((fused ? "copied and checked together" : "copied, then checked"),
+         iterations, cpuTime() - startTime);
+  return zeros;
+}
+
+/**
+ * Time all the variants on the current contents of the buffer.
+ *
+ * @param iterations  The number of blocks to process in each variant
+ **/
+static void testAll(unsigned int iterations)
+{
+  unsigned int zeros = testCheck(iterations);
+  CU_ASSERT_EQUAL(zeros, testCopy(false, iterations));
+  CU_ASSERT_EQUAL(zeros, testCopy(true, iterations));
+}
+
+int main(void)
+{
+  unsigned int iterations = 1000000;
+
+  printf("Zero blocks:\n");
+  memset(buffer, 0, sizeof(buffer));
+  testAll(iterations);
+
+  printf("Blocks which are zero until the last byte:\n");
+  for (unsigned int i = 0; i < BLOCKS; i++) {
+    buffer[((size_t) i * STRIDE) + VDO_BLOCK_SIZE - 1] = 1;
+  }
+  testAll(iterations);
+
+  printf("Random blocks:\n");
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = random() & 0xff;
+  }
+  testAll(iterations);
+  return 0;
+}
@@ -44,9 +44,43 @@ static void isZeroTest(void)
   }
 }
 
+/**********************************************************************/
+static void copyAndCheckZeroTest(void)
+{
+  static char source[VDO_BLOCK_SIZE + 1];
+  static char dest[VDO_BLOCK_SIZE + 1];
+
+  // Copy at every alignment and with lengths which aren't whole cache lines.
+  for (unsigned int offset = 0; offset < 8; offset++) {
+    for (unsigned int length = VDO_BLOCK_SIZE - 71;
+         length <= VDO_BLOCK_SIZE - offset;
+         length += 7) {
+      memset(source, 0, sizeof(source));
+      memset(dest, 0xff, sizeof(dest));
+      CU_ASSERT_TRUE(copy_data_and_check_zero(dest + offset, source + offset,
+                                              length));
+      UDS_ASSERT_EQUAL_BYTES(dest + offset, source + offset, length);
+
+      // A single nonzero byte anywhere, including the unaligned tail.
+      for (unsigned int i = 0; i < length; i += 61) {
+        source[offset + i] = 1;
+        CU_ASSERT_FALSE(copy_data_and_check_zero(dest + offset,
+                                                 source + offset, length));
+        UDS_ASSERT_EQUAL_BYTES(dest + offset, source + offset, length);
+        source[offset + i] = 0;
+      }
+
+      source[offset + length - 1] = 1;
+      CU_ASSERT_FALSE(copy_data_and_check_zero(dest + offset, source + offset,
+                                               length));
+    }
+  }
+}
+
 /**********************************************************************/
 static CU_TestInfo theTestInfo[] = {
-  { "zero block", isZeroTest },
+  { "zero block",          isZeroTest           },
+  { "copy and check zero", copyAndCheckZeroTest },
   CU_TEST_INFO_NULL
 };
 
@@ -22,9 +22,12 @@
 
 #include "albtest.h"
 
+#include <stdio.h>
+
 #include "memory-alloc.h"
 #include "syscalls.h"
 #include "testUtils.h"
+#include "time-utils.h"
 
 #include "block-allocator.h"
 #include "slab-depot.h"
@@ -40,6 +43,8 @@
 // Configure a very large VDO.
 static const block_count_t  DATA_BLOCKS = 16;
 static const char          *testFile    = "/mnt/raid0/large_vdo_temp";
+// Seconds to allow for loading the reference counts of every slab
+static const unsigned int   LOAD_TIMEOUT = 3600;
 
 // Configure a very large VDO.
 // Blocks: 1 super, 4 journal, 84318377 block map, 16777216 refcount
@@ -100,6 +105,29 @@ static void initializeLargeVDOX1(void)
   vdo_allocate_from_last_slab(vdo->depot);
 }
 
+/**
+ * Restart the VDO and report how long it took to come online and to finish
+ * loading its reference counts.
+ *
+ * @param lazy  Whether to load reference counts lazily
+ **/
+static void timeRestart(bool lazy)
+{
+  bool savedLazy = vdo_lazy_ref_count_loading;
+  vdo_lazy_ref_count_loading = lazy;
+  stopVDO();
+
+  ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+  startVDO(VDO_CLEAN);
+  ktime_t online = current_time_ns(CLOCK_MONOTONIC) - start;
+  waitForSlabsRecovered(LOAD_TIMEOUT);
+  ktime_t loaded = current_time_ns(CLOCK_MONOTONIC) - start;
+
+  printf("%s reference count load: online in %6.3fs, loaded in %6.3fs\n",
+         (lazy ? "lazy " : "eager"), online * 1.0e-9, loaded * 1.0e-9);
+  vdo_lazy_ref_count_loading = savedLazy;
+}
+
 /**
  * Write the given data, verify it can be read, and check block usage.
  *
@@ -147,8 +175,10 @@ static void testBasic(void)
   writeAndVerify(DATA_BLOCKS, 1, DATA_BLOCKS, DATA_BLOCKS);
   writeAndVerify(2 * DATA_BLOCKS, 1, DATA_BLOCKS, DATA_BLOCKS);
 
-  // Restart to test save/load
-  restartVDO(false);
+  // Restart to test save/load, timing startup with each kind of load
+  timeRestart(false);
+  timeRestart(true);
+  verifyData(0, 1, DATA_BLOCKS);
 
   // Crash and restart the VDO
   block_count_t  blockCount = layer->getBlockCount(layer);
@@ -0,0 +1,217 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "block-allocator.h"
+#include "slab.h"
+#include "slab-depot.h"
+#include "statistics.h"
+#include "vdo.h"
+
+#include "blockMapUtils.h"
+#include "ioRequest.h"
+#include "recoveryModeUtils.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  BLOCK_COUNT     = 48,
+  OVERWRITE_COUNT = 16,
+  DISCARD_COUNT   = 8,
+  NEW_DATA        = 1000,
+  // Seconds to allow for loading the reference counts of every slab
+  LOAD_TIMEOUT    = 60,
+};
+
+static bool                     savedLazy;
+static struct vdo_slab         *slabToCheck;
+static enum slab_rebuild_status slabStatus;
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .logicalBlocks     = 1024,
+    .mappableBlocks    = 64,
+    .journalBlocks     = 32,
+    .slabSize          = 32,
+    .slabJournalBlocks = 8,
+    .dataFormatter     = fillWithOffsetPlusOne,
+  };
+  initializeRecoveryModeTest(&parameters);
+  savedLazy = vdo_lazy_ref_count_loading;
+}
+
+/**
+ * Test-specific tear down.
+ **/
+static void tearDown(void)
+{
+  vdo_lazy_ref_count_loading = savedLazy;
+  tearDownRecoveryModeTest();
+}
+
+/**
+ * Get the number of data blocks in use.
+ **/
+static block_count_t getDataBlocksUsed(void)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  return stats.data_blocks_used;
+}
+
+/**
+ * Get the number of the slab to which a logical block is mapped.
+ **/
+static slab_count_t getSlabNumber(logical_block_number_t lbn)
+{
+  return vdo_get_slab(vdo->depot, lookupLBN(lbn).pbn)->slab_number;
+}
+
+/**
+ * Check whether the VDO reports that it is loading reference counts.
+ **/
+static void assertLoading(bool loading)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.in_recovery_mode, loading);
+  CU_ASSERT_STRING_EQUAL(stats.mode, (loading ? "loading" : "normal"));
+}
+
+/**
+ * Write the test data and restart the VDO with lazy reference count loading,
+ * checking that the slab holding the first block was not loaded before the
+ * VDO came online.
+ **/
+static void writeAndRestartLazily(void)
+{
+  writeData(0, 1, BLOCK_COUNT, VDO_SUCCESS);
+  setupSlabLoadingLatch(getSlabNumber(0));
+  vdo_lazy_ref_count_loading = true;
+  restartVDO(false);
+
+  CU_ASSERT(vdo_get_slab_depot_unrecovered_slab_count(vdo->depot) > 0);
+  assertLoading(true);
+  releaseAllSlabLatches(vdo->depot->slab_count);
+}
+
+/**
+ * Action to get the status of the slab to check.
+ **/
+static void getSlabStatus(struct vdo_completion *completion)
+{
+  slabStatus = slabToCheck->status;
+  vdo_finish_completion(completion, VDO_SUCCESS);
+}
+
+/**
+ * Test that blocks in slabs whose reference counts have not yet been loaded
+ * can be read, overwritten, and discarded.
+ **/
+static void testLazyLoad(void)
+{
+  writeAndRestartLazily();
+  verifyData(0, 1, BLOCK_COUNT);
+
+  // Overwriting and discarding decrement lazily loaded slabs.
+  writeData(0, NEW_DATA, OVERWRITE_COUNT, VDO_SUCCESS);
+  discardData(OVERWRITE_COUNT, DISCARD_COUNT, VDO_SUCCESS);
+  waitForSlabsRecovered(LOAD_TIMEOUT);
+  assertLoading(false);
+
+  block_count_t used = BLOCK_COUNT - DISCARD_COUNT;
+  CU_ASSERT_EQUAL(getDataBlocksUsed(), used);
+  verifyData(0, NEW_DATA, OVERWRITE_COUNT);
+  verifyZeros(OVERWRITE_COUNT, DISCARD_COUNT);
+  verifyData(OVERWRITE_COUNT + DISCARD_COUNT,
+             1 + OVERWRITE_COUNT + DISCARD_COUNT,
+             BLOCK_COUNT - OVERWRITE_COUNT - DISCARD_COUNT);
+
+  // An eager load must find the same reference counts.
+  vdo_lazy_ref_count_loading = false;
+  restartVDO(false);
+  CU_ASSERT_EQUAL(getDataBlocksUsed(), used);
+  verifyData(0, NEW_DATA, OVERWRITE_COUNT);
+}
+
+/**
+ * Test that a suspend while reference counts are loading in the background
+ * does not lose any of them.
+ **/
+static void testSuspendWhileLoading(void)
+{
+  writeAndRestartLazily();
+  performSuccessfulSuspendAndResume(false);
+  waitForSlabsRecovered(LOAD_TIMEOUT);
+  CU_ASSERT_EQUAL(getDataBlocksUsed(), BLOCK_COUNT);
+  verifyData(0, 1, BLOCK_COUNT);
+}
+
+/**
+ * Test that a decrement to a slab which is still waiting to be loaded makes
+ * it the next slab to load.
+ **/
+static void testDecrementPromotesSlab(void)
+{
+  block_count_t count = vdo->depot->slab_config.data_blocks + 1;
+  writeData(0, 1, count, VDO_SUCCESS);
+  slab_count_t firstSlab = getSlabNumber(0);
+  slab_count_t lastSlab  = getSlabNumber(count - 1);
+  CU_ASSERT_NOT_EQUAL(firstSlab, lastSlab);
+
+  // Hold the loading of both slabs so that one of them is left waiting.
+  setupSlabLoadingLatch(firstSlab);
+  setupSlabLoadingLatch(lastSlab);
+  vdo_lazy_ref_count_loading = true;
+  restartVDO(false);
+
+  slab_count_t           slabCount    = vdo->depot->slab_count;
+  bool                   firstLoading
+    = (waitForAnySlabToLatch(slabCount) == firstSlab);
+  logical_block_number_t lbn          = (firstLoading ? count - 1 : 0);
+  slabToCheck = vdo->depot->slabs[firstLoading ? lastSlab : firstSlab];
+  thread_id_t threadID = slabToCheck->allocator->thread_id;
+  performSuccessfulActionOnThread(getSlabStatus, threadID);
+  CU_ASSERT_EQUAL(slabStatus, VDO_SLAB_REQUIRES_SCRUBBING);
+
+  discardData(lbn, 1, VDO_SUCCESS);
+  performSuccessfulActionOnThread(getSlabStatus, threadID);
+  CU_ASSERT_EQUAL(slabStatus, VDO_SLAB_REQUIRES_HIGH_PRIORITY_SCRUBBING);
+
+  releaseAllSlabLatches(slabCount);
+  waitForSlabsRecovered(LOAD_TIMEOUT);
+  CU_ASSERT_EQUAL(getDataBlocksUsed(), count - 1);
+  verifyZeros(lbn, 1);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "lazily loaded slabs are usable",  testLazyLoad              },
+  { "suspend while loading",           testSuspendWhileLoading   },
+  { "decrements promote slabs",        testDecrementPromotesSlab },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "lazy reference count loading (LazyRefCountLoad_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDown,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
@@ -0,0 +1,228 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "uds-threads.h"
+
+#include "block-map-tree.h"
+#include "constants.h"
+#include "io-submitter.h"
+#include "thread-config.h"
+#include "vdo.h"
+
+#include "asyncLayer.h"
+#include "asyncVIO.h"
+#include "ioRequest.h"
+#include "mutexUtils.h"
+#include "ramLayer.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+enum {
+  LEAF_PAGES  = 8,
+  /*
+   * Consecutive leaf pages belong to different tree roots, so only use pages
+   * of the first root. Once that root's interior pages exist, each of its
+   * leaf pages is allocated right after the previous one.
+   */
+  PAGE_STRIDE = DEFAULT_VDO_BLOCK_MAP_TREE_ROOT_COUNT,
+};
+
+static physical_block_number_t leafPBNs[LEAF_PAGES];
+static uint64_t                mergedWrites;
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .mappableBlocks     = 1024,
+    .logicalBlocks      = (LEAF_PAGES * PAGE_STRIDE
+                           * VDO_BLOCK_MAP_ENTRIES_PER_PAGE),
+    .logicalThreadCount = 1,
+    .dataFormatter      = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+}
+
+/**
+ * Get the first logical block mapped by one of the test's leaf pages.
+ *
+ * @param page  The index of the leaf page among the test's pages
+ *
+ * @return The first logical block of the page
+ **/
+static logical_block_number_t getLeafLBN(page_count_t page)
+{
+  return (page * PAGE_STRIDE * VDO_BLOCK_MAP_ENTRIES_PER_PAGE);
+}
+
+/**
+ * Allocate the test's leaf pages and check that they are adjacent, so that
+ * writes of all of them can be merged.
+ **/
+static void allocateLeafPages(void)
+{
+  for (page_count_t page = 0; page < LEAF_PAGES; page++) {
+    zeroData(getLeafLBN(page), 1, VDO_SUCCESS);
+    discardData(getLeafLBN(page), 1, VDO_SUCCESS);
+    leafPBNs[page]
+      = vdo_find_block_map_page_pbn(vdo->block_map, page * PAGE_STRIDE);
+    CU_ASSERT_EQUAL(leafPBNs[page], leafPBNs[0] + page);
+  }
+}
+
+/**
+ * Dirty every leaf page.
+ **/
+static void writeLeafPages(void)
+{
+  for (page_count_t page = 0; page < LEAF_PAGES; page++) {
+    writeData(getLeafLBN(page), getLeafLBN(page), 1, VDO_SUCCESS);
+  }
+}
+
+/**
+ * Check that every leaf page was saved.
+ **/
+static void verifyLeafPages(void)
+{
+  for (page_count_t page = 0; page < LEAF_PAGES; page++) {
+    verifyData(getLeafLBN(page), getLeafLBN(page), 1);
+  }
+}
+
+/**
+ * Implements BlockCondition.
+ **/
+static bool isLeafPageWrite(struct vdo_completion *completion,
+                            void                  *context
+                            __attribute__((unused)))
+{
+  return (vioTypeIs(completion, VIO_TYPE_BLOCK_MAP)
+          && isMetadataWrite(completion));
+}
+
+/**
+ * Record the number of merged metadata writes.
+ *
+ * Implements vdo_action.
+ **/
+static void recordMergedWrites(struct vdo_completion *completion)
+{
+  mergedWrites = atomic64_read(&vdo->stats.bios_meta_merged.write);
+  vdo_finish_completion(completion, VDO_SUCCESS);
+}
+
+/**
+ * Stop the VDO.
+ *
+ * Implements the thread function of uds_create_thread().
+ **/
+static void stopVDOOnThread(void *arg __attribute__((unused)))
+{
+  stopVDO();
+}
+
+/**
+ * Stop the VDO while holding the first leaf page write it issues, so that
+ * the bio zone can not submit that write before the other leaf pages are
+ * submitted.
+ *
+ * @return The number of metadata writes merged while the write was held
+ **/
+static uint64_t stopHoldingFirstLeafPageWrite(void)
+{
+  struct thread *stopper;
+  setBlockVIOCompletionEnqueueHook(isLeafPageWrite, true);
+  VDO_ASSERT_SUCCESS(uds_create_thread(stopVDOOnThread, NULL, "stopper",
+                                       &stopper));
+  waitForBlockedVIO();
+
+  /*
+   * The page cache submits a batch of page writes from a single callback, so
+   * once the logical zone thread runs another action, every leaf page has
+   * been submitted.
+   */
+  thread_id_t logicalThread
+    = vdo_get_logical_zone_thread(vdo->thread_config, 0);
+  performSuccessfulActionOnThread(recordMergedWrites, logicalThread);
+  releaseBlockedVIO();
+  VDO_ASSERT_SUCCESS(uds_join_threads(stopper));
+  return mergedWrites;
+}
+
+/**
+ * Check that the leaf pages on disk match those on another layer.
+ *
+ * @param expected  The layer with the expected leaf pages
+ **/
+static void assertLeafPagesMatch(PhysicalLayer *expected)
+{
+  PhysicalLayer *layer = getSynchronousLayer();
+  char expectedPage[VDO_BLOCK_SIZE];
+  char actualPage[VDO_BLOCK_SIZE];
+  for (page_count_t page = 0; page < LEAF_PAGES; page++) {
+    VDO_ASSERT_SUCCESS(expected->reader(expected, leafPBNs[page], 1,
+                                        expectedPage));
+    VDO_ASSERT_SUCCESS(layer->reader(layer, leafPBNs[page], 1, actualPage));
+    UDS_ASSERT_EQUAL_BYTES(expectedPage, actualPage, VDO_BLOCK_SIZE);
+  }
+}
+
+/**
+ * Test that saving adjacent leaf pages merges their writes, and that the
+ * merged writes leave the same pages on disk as unmerged ones.
+ **/
+static void testMergedMetadata(void)
+{
+  allocateLeafPages();
+  stopVDO();
+  PhysicalLayer *allocated = cloneRAMLayer(getSynchronousLayer());
+
+  startVDO(VDO_CLEAN);
+  disableMetadataMerging();
+  writeLeafPages();
+  CU_ASSERT_EQUAL(stopHoldingFirstLeafPageWrite(), 0);
+  PhysicalLayer *unmerged = cloneRAMLayer(getSynchronousLayer());
+
+  // Save the same pages from the same starting point with merging.
+  copyRAMLayer(getSynchronousLayer(), allocated);
+  allocated->destroy(&allocated);
+  startVDO(VDO_CLEAN);
+  vdo_merge_metadata_bios = true;
+  writeLeafPages();
+  CU_ASSERT(stopHoldingFirstLeafPageWrite() > 0);
+  assertLeafPagesMatch(unmerged);
+  unmerged->destroy(&unmerged);
+
+  startVDO(VDO_CLEAN);
+  verifyLeafPages();
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "merged metadata matches unmerged", testMergedMetadata },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "metadata bio merging tests (MetadataMerging_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDownVDOTest,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
@@ -42,6 +42,53 @@ static void doMurmurHash(const void *buffer, size_t length)
   murmurhash3_128(buffer, length, 0x62ea60be, &chunkName);
 }
 
+/**
+ * Hash a number of 4K blocks scattered through the buffer, either one at a
+ * time or in batches as the VDO write path does.
+ *
+ * @param batched     Whether to hash the blocks in batches
+ * @param iterations  The number of blocks to hash
+ **/
+static void testBlocks(bool batched, unsigned int iterations)
+{
+  enum {
+    BLOCK_SIZE = 4096,
+    STRIDE     = BLOCK_SIZE + PREFETCH_AVOIDANCE_GAP,
+    BLOCKS     = TESTSIZE / STRIDE,
+  };
+  const void *blocks[MURMURHASH3_LANES];
+  struct uds_chunk_name names[MURMURHASH3_LANES];
+  void *outs[MURMURHASH3_LANES];
+  unsigned int i;
+  for (i = 0; i < MURMURHASH3_LANES; i++) {
+    outs[i] = &names[i];
+  }
+
+  unsigned int block = 0;
+  uint64_t startTime = cpuTime();
+  for (i = 0; i < iterations; i += MURMURHASH3_LANES) {
+    for (unsigned int lane = 0; lane < MURMURHASH3_LANES; lane++) {
+      blocks[lane] = buffer + ((size_t) block * STRIDE);
+      block = (block + 1) % BLOCKS;
+    }
+
+    if (batched) {
+      murmurhash3_128_multiple(blocks, MURMURHASH3_LANES, BLOCK_SIZE,
+                               0x62ea60be, outs);
+    } else {
+      for (unsigned int lane = 0; lane < MURMURHASH3_LANES; lane++) {
+        murmurhash3_128(blocks[lane], BLOCK_SIZE, 0x62ea60be, outs[lane]);
+      }
+    }
+  }
+  uint64_t duration = cpuTime() - startTime;
+  double perHash = (double) duration / i;
+  printf("%8u %s 4K blocks: %5.2fs (%.3fus/hash, %5.1fMB/s)\n",
+         i, (batched ? "batched  " : "per-block"), duration * 1.0e-6,
+         perHash, (1.0e6 * BLOCK_SIZE / (1024 * 1024)) / perHash);
+}
+
+/**********************************************************************/
 static void test(size_t        startingOffset,
                  size_t        length,
                  unsigned int  iterations)
@@ -119,5 +166,9 @@ int main(void)
   test(0, 256-10, smallIterations);
   printf("Small, unaligned:\n");
   test(3, 256, smallIterations);
+
+  printf("Data blocks, %u lanes:\n", MURMURHASH3_LANES);
+  testBlocks(false, medium4KIterations);
+  testBlocks(true, medium4KIterations);
   return 0;
 }
@@ -7,6 +7,7 @@
  */
 
 #include <linux/murmurhash3.h>
+#include <stdlib.h>
 
 #include "albtest.h"
 #include "assertions.h"
@@ -66,10 +67,91 @@ static void testChunkName(void)
   checkChunkName(input2, result2);
 }
 
+/**********************************************************************/
+static void testMultipleHashes(void)
+{
+  enum {
+    KEY_COUNT = (2 * MURMURHASH3_LANES) + 1,
+    KEY_SIZE  = 4096 + 7,
+  };
+  static char keyData[KEY_COUNT][KEY_SIZE];
+  const void *keys[KEY_COUNT];
+  struct uds_chunk_name names[KEY_COUNT];
+  void *outs[KEY_COUNT];
+  for (unsigned int i = 0; i < KEY_COUNT; i++) {
+    for (unsigned int j = 0; j < KEY_SIZE; j++) {
+      keyData[i][j] = random() & 0xff;
+    }
+    keys[i] = keyData[i];
+    outs[i] = &names[i];
+  }
+
+  // Check every key count and a variety of lengths, including partial blocks.
+  const int lengths[] = { 0, 1, 15, 16, 31, 4096, KEY_SIZE };
+  for (unsigned int l = 0; l < ARRAY_SIZE(lengths); l++) {
+    for (unsigned int count = 0; count <= KEY_COUNT; count++) {
+      memset(names, 0, sizeof(names));
+      murmurhash3_128_multiple(keys, count, lengths[l], 0x62ea60be, outs);
+      for (unsigned int i = 0; i < count; i++) {
+        struct uds_chunk_name expected;
+        murmurhash3_128(keys[i], lengths[l], 0x62ea60be, &expected);
+        UDS_ASSERT_BLOCKNAME_EQUAL(expected.name, names[i].name);
+      }
+    }
+  }
+}
+
+/**********************************************************************/
+static void testCopyingHash(void)
+{
+  enum { KEY_SIZE = 4096 + 7 };
+  static uint64_t keyData[(KEY_SIZE / sizeof(uint64_t)) + 1];
+  static uint64_t copyData[(KEY_SIZE / sizeof(uint64_t)) + 1];
+  char *key = (char *) keyData;
+  char *copy = (char *) copyData;
+
+  const int lengths[] = { 0, 1, 15, 16, 31, 4096, KEY_SIZE };
+  for (unsigned int l = 0; l < ARRAY_SIZE(lengths); l++) {
+    int length = lengths[l];
+    struct uds_chunk_name expected, name;
+
+    // All zeros.
+    memset(key, 0, KEY_SIZE);
+    memset(copy, 0xff, KEY_SIZE);
+    murmurhash3_128(key, length, 0x62ea60be, &expected);
+    CU_ASSERT_TRUE(murmurhash3_128_copy(key, copy, length, 0x62ea60be,
+                                        &name));
+    UDS_ASSERT_BLOCKNAME_EQUAL(expected.name, name.name);
+    UDS_ASSERT_EQUAL_BYTES(key, copy, length);
+    if (length == 0) {
+      continue;
+    }
+
+    // A single nonzero byte in the body or the tail.
+    key[length - 1] = 1;
+    murmurhash3_128(key, length, 0x62ea60be, &expected);
+    CU_ASSERT_FALSE(murmurhash3_128_copy(key, copy, length, 0x62ea60be,
+                                         &name));
+    UDS_ASSERT_BLOCKNAME_EQUAL(expected.name, name.name);
+    UDS_ASSERT_EQUAL_BYTES(key, copy, length);
+
+    // Random data.
+    for (int j = 0; j < length; j++) {
+      key[j] = random() & 0xff;
+    }
+    murmurhash3_128(key, length, 0x62ea60be, &expected);
+    murmurhash3_128_copy(key, copy, length, 0x62ea60be, &name);
+    UDS_ASSERT_BLOCKNAME_EQUAL(expected.name, name.name);
+    UDS_ASSERT_EQUAL_BYTES(key, copy, length);
+  }
+}
+
 /**********************************************************************/
 static CU_TestInfo murmurTests[] = {
-  {"murmurhash3_128",     testHash128 },
-  {"murmurHashChunkName", testChunkName },
+  {"murmurhash3_128",          testHash128 },
+  {"murmurHashChunkName",      testChunkName },
+  {"murmurhash3_128_multiple", testMultipleHashes },
+  {"murmurhash3_128_copy",     testCopyingHash },
   CU_TEST_INFO_NULL,
 };
 
@@ -26,6 +26,7 @@
 #include "mutexUtils.h"
 #include "packerUtils.h"
 #include "testBIO.h"
+#include "testTimer.h"
 #include "vdoAsserts.h"
 #include "vdoTestBase.h"
 
@@ -175,6 +176,11 @@ static void bestFitTest(void)
   CU_ASSERT_EQUAL(DEFAULT_PACKER_BINS, stats.compressed_blocks_written);
   CU_ASSERT_EQUAL(stats.compressed_fragments_in_packer, 0);
 
+  // Every block was compressed as part of some compression batch.
+  CU_ASSERT_EQUAL(2 * DEFAULT_PACKER_BINS, stats.compression_batch_blocks);
+  CU_ASSERT_TRUE(stats.compression_batches > 0);
+  CU_ASSERT_TRUE(stats.compression_batches <= stats.compression_batch_blocks);
+
   // Each bin should be empty.
   expectedSlotsUsed = 0;
   performSuccessfulActionOnThread(checkBins,
@@ -326,6 +332,134 @@ static void removeVIOsTest(void)
   CU_ASSERT_EQUAL(getPhysicalBlocksFree(), freeBlocks - 2);
 }
 
+/**
+ * Launch writes of fragments and wait for all of them to reach the packer.
+ *
+ * @param requests  The array in which to store the requests, indexed by LBN
+ * @param start     The LBN of the first fragment
+ * @param count     The number of fragments to write
+ **/
+static void launchFragments(IORequest              **requests,
+                            logical_block_number_t   start,
+                            block_count_t            count)
+{
+  packedItemCount = 0;
+  targetItemCount = count;
+  packed = false;
+  for (logical_block_number_t lbn = start; lbn < start + count; lbn++) {
+    requests[lbn] = launchIndexedWrite(lbn, 1, lbn + 1);
+  }
+
+  waitForState(&packed);
+}
+
+/**
+ * Fill the bins so that the fullest bin is only three quarters full when
+ * no bin has room for the next fragment, even though two fragments in other
+ * bins would exactly fill a compressed block.
+ *
+ * @param bestFit        Whether to use best-fit packing
+ * @param expectedBytes  The expected size of the data in the block written
+ **/
+static void packAcrossBins(bool bestFit, block_size_t expectedBytes)
+{
+  enum {
+    FRAGMENT_COUNT = DEFAULT_PACKER_BINS + 2,
+  };
+
+  IORequest    *requests[FRAGMENT_COUNT];
+  block_size_t  small = (binSize * 45) / 100;
+
+  vdo_best_fit_packing = bestFit;
+  shouldQueue = false;
+  setCompletionEnqueueHook(wrapIfLeavingCompressor);
+
+  // Two fragments which share the first bin.
+  compressedSizes[0] = small;
+  compressedSizes[1] = (binSize * 30) / 100;
+  launchFragments(requests, 0, 2);
+
+  // Fragments which each need a bin, but which exactly fill a block with the
+  // first fragment.
+  for (logical_block_number_t lbn = 2; lbn <= DEFAULT_PACKER_BINS; lbn++) {
+    compressedSizes[lbn] = binSize - small;
+  }
+  launchFragments(requests, 2, DEFAULT_PACKER_BINS - 1);
+
+  // A fragment for which no bin has room.
+  compressedSizes[DEFAULT_PACKER_BINS + 1] = (binSize * 60) / 100;
+  launchFragments(requests, DEFAULT_PACKER_BINS + 1, 1);
+
+  struct packer_statistics stats = vdo_get_packer_statistics(vdo->packer);
+  CU_ASSERT_EQUAL(1, stats.compressed_blocks_written);
+  CU_ASSERT_EQUAL(2, stats.compressed_fragments_written);
+  CU_ASSERT_EQUAL(expectedBytes, stats.compressed_fragment_bytes);
+
+  requestFlushPacker();
+  for (block_count_t i = 0; i < FRAGMENT_COUNT; i++) {
+    awaitAndFreeSuccessfulRequest(UDS_FORGET(requests[i]));
+  }
+
+  vdo_best_fit_packing = false;
+}
+
+/**
+ * Test that an overflowing bin is written out when best-fit packing is off.
+ **/
+static void firstFitOverflowTest(void)
+{
+  packAcrossBins(false, ((binSize * 45) / 100) + ((binSize * 30) / 100));
+}
+
+/**
+ * Test that best-fit packing writes the best combination of fragments from
+ * all the bins when a bin overflows.
+ **/
+static void bestFitOverflowTest(void)
+{
+  packAcrossBins(true, binSize);
+}
+
+/**
+ * Test that bins which have waited longer than the packer deadline are
+ * written out without waiting for them to fill.
+ **/
+static void deadlineTest(void)
+{
+  IORequest *requests[3];
+
+  vdo_set_packer_deadline_interval(100);
+  shouldQueue = false;
+  setCompletionEnqueueHook(wrapIfLeavingCompressor);
+
+  // Two fragments which share a bin are written together.
+  compressedSizes[0] = binSize / 4;
+  compressedSizes[1] = binSize / 4;
+  launchFragments(requests, 0, 2);
+  CU_ASSERT_TRUE(fireTimers(getNextTimeout()));
+  awaitAndFreeSuccessfulRequest(UDS_FORGET(requests[0]));
+  awaitAndFreeSuccessfulRequest(UDS_FORGET(requests[1]));
+
+  struct packer_statistics stats = vdo_get_packer_statistics(vdo->packer);
+  CU_ASSERT_EQUAL(1, stats.deadline_bins_written);
+  CU_ASSERT_EQUAL(1, stats.compressed_blocks_written);
+  CU_ASSERT_EQUAL(2, stats.compressed_fragments_written);
+
+  // A fragment alone in a bin is written uncompressed.
+  compressedSizes[2] = binSize / 4;
+  launchFragments(requests, 2, 1);
+  CU_ASSERT_TRUE(fireTimers(getNextTimeout()));
+  awaitAndFreeSuccessfulRequest(UDS_FORGET(requests[2]));
+
+  stats = vdo_get_packer_statistics(vdo->packer);
+  CU_ASSERT_EQUAL(2, stats.deadline_bins_written);
+  CU_ASSERT_EQUAL(1, stats.compressed_blocks_written);
+  CU_ASSERT_EQUAL(0, stats.compressed_fragments_in_packer);
+  verifyData(0, 1, 3);
+
+  vdo_set_packer_deadline_interval(0);
+}
+
 /**********************************************************************/
 
 static CU_TestInfo packerTests[] = {
@@ -334,6 +468,9 @@ static CU_TestInfo packerTests[] = {
   { "bin boundary test",              binBoundaryTest            },
   { "best fit test",                  bestFitTest                },
   { "remove vios test",               removeVIOsTest             },
+  { "first fit overflow test",        firstFitOverflowTest       },
+  { "best fit overflow test",         bestFitOverflowTest        },
+  { "deadline test",                  deadlineTest               },
   CU_TEST_INFO_NULL
 };
 
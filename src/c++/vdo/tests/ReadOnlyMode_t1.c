@@ -40,6 +40,7 @@ static void initializeReadOnlyModeT1(void)
     .journalBlocks  = 4,
   };
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
 }
 
 /**
@@ -71,6 +71,7 @@ static void initializeRebuildT1(void)
     .physicalThreadCount = 1,
   };
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
 
   expectedLogicalBlocksUsed = 0;
 }
@@ -189,6 +189,7 @@ static void createLayerAndJournal(void)
     .noIndexRegion  = true,
   };
   initializeBasicTest(&testParameters);
+  disableMetadataMerging();
 
   threadConfig = makeOneThreadConfig();
   VDO_ASSERT_SUCCESS(vdo_make_read_only_notifier(false,
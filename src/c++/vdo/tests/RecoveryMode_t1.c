@@ -9,6 +9,7 @@
 #include "albtest.h"
 
 #include "memory-alloc.h"
+#include "time-utils.h"
 
 #include "bio.h"
 #include "block-allocator.h"
@@ -43,6 +44,8 @@ typedef struct {
 enum {
   DEFAULT_MAPPABLE = 750,
   INJECTED_ERROR   = VDO_STATUS_CODE_LAST + 1,
+  // Seconds to allow for a second slab to start scrubbing
+  SCRUB_TIMEOUT    = 60,
 };
 
 /*
@@ -101,6 +104,8 @@ static struct vdo_slab       *latchedSlab;
 static struct slab_scrubber  *scrubber;
 static bool                   scrubberSuspending;
 static slab_count_t           slabsToScrub;
+static unsigned int           activeScrubs;
+static unsigned int           savedScrubDepth;
 
 /**********************************************************************/
 static block_count_t getBlocksAllocated(void)
@@ -129,6 +134,7 @@ static void initializeRecoveryModeT1(block_count_t mappableBlocks)
   };
 
   initializeRecoveryModeTest(&parameters);
+  savedScrubDepth = vdo_slab_scrub_depth;
 
   // Initialize all the important parts of the block map tree.
   CU_ASSERT_EQUAL(getPhysicalBlocksFree(), 32);
@@ -161,6 +167,15 @@ static void initializeRecoveryModeT1(block_count_t mappableBlocks)
   latchedSlab       = NULL;
 }
 
+/**
+ * Test-specific tear down.
+ **/
+static void tearDownRecoveryModeT1(void)
+{
+  vdo_set_slab_scrub_depth(savedScrubDepth);
+  tearDownRecoveryModeTest();
+}
+
 /**
  * Write blocks one slab at a time.
  **/
@@ -712,6 +727,46 @@ static void testSuspendAndResumeWhileScrubbing(void)
   releaseAllSlabLatches(totalSlabs);
 }
 
+/**
+ * An action to count the slabs being scrubbed.
+ **/
+static void countActiveScrubs(struct vdo_completion *completion)
+{
+  activeScrubs = scrubber->active_count;
+  vdo_complete_completion(completion);
+}
+
+/**
+ * Test that a scrubber with more than one context scrubs slabs concurrently.
+ **/
+static void testConcurrentScrubbing(void)
+{
+  initializeRecoveryModeT1(DEFAULT_MAPPABLE);
+  block_count_t totalFreeBlocks = getPhysicalBlocksFree();
+  writeBlocksSlabwise(dataPerSlab, 1, totalFreeBlocks, VDO_SUCCESS);
+
+  crashVDO();
+  vdo_set_slab_scrub_depth(2);
+  startAndWaitForVDOInRecovery(false, VDO_DIRTY);
+
+  // While one slab is latched, a second must start scrubbing.
+  struct block_allocator *allocator = vdo->depot->allocators[0];
+  scrubber = allocator->slab_scrubber;
+  CU_ASSERT_EQUAL(scrubber->context_count, 2);
+  ktime_t deadline
+    = current_time_ns(CLOCK_MONOTONIC) + seconds_to_ktime(SCRUB_TIMEOUT);
+  do {
+    CU_ASSERT(current_time_ns(CLOCK_MONOTONIC) < deadline);
+    performSuccessfulActionOnThread(countActiveScrubs, allocator->thread_id);
+  } while (activeScrubs < 2);
+
+  releaseAllSlabLatches(totalSlabs);
+  waitForRecoveryDone();
+  CU_ASSERT_FALSE(checkInRecovery());
+  CU_ASSERT(READ_ONCE(scrubber->slabs_scrubbed) > 0);
+  verifyData(dataPerSlab, 1, totalFreeBlocks);
+}
+
 /**
  * Test that during the recovery, if a clean slab's reference count load is
  * deferred, its slab journal needs to be flushed before making a decision on
@@ -855,6 +910,7 @@ static CU_TestInfo tests[] = {
   { "Free space wait doesn't hang on error",    testSlabScrubbingErrorHang },
   { "Requeue unrecovered slab",                 testRequeueUnrecoveredSlab },
   { "Suspend and resume while scrubbing", testSuspendAndResumeWhileScrubbing },
+  { "Scrub slabs concurrently",                 testConcurrentScrubbing    },
   { "vdo_slab journal flush on clean slabs",    testSlabJournalFlush       },
   { "Compress during recovery",                 testRecoveryCompress       },
   { "Fully operable after recovery",            testPostRecoveryMode       },
@@ -866,7 +922,7 @@ static CU_SuiteInfo suite = {
   .name                     = "VDO recovery mode tests (RecoveryMode_t1)",
   .initializerWithArguments = NULL,
   .initializer              = NULL,
-  .cleaner                  = tearDownRecoveryModeTest,
+  .cleaner                  = tearDownRecoveryModeT1,
   .tests                    = tests
 };
 
@@ -0,0 +1,111 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * Performance testing of free block allocation from nearly full slabs, where
+ * each allocation follows the freeing of a random block.
+ *
+ * $Id$
+ */
+
+#include "assertions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memory-alloc.h"
+#include "time-utils.h"
+
+#include "ref-counts.h"
+#include "slab.h"
+#include "status-codes.h"
+
+#include "slabUtils.h"
+
+enum {
+  SLAB_SIZE    = (1 << 23),
+  JOURNAL_SIZE = 2,
+  // The number of blocks freed and reallocated at each fullness
+  CHURN_COUNT  = (1 << 18),
+};
+
+static struct vdo_slab   *slab;
+static struct ref_counts *refs;
+
+/**
+ * Free a provisionally referenced block.
+ *
+ * @param pbn  The physical block number to free
+ **/
+static void freeBlock(physical_block_number_t pbn)
+{
+  bool                       wasFree;
+  struct reference_operation operation = {
+    .pbn  = pbn,
+    .type = VDO_JOURNAL_DATA_DECREMENT,
+  };
+  CU_ASSERT_EQUAL(VDO_SUCCESS,
+                  vdo_adjust_reference_count(refs, operation, NULL,
+                                             &wasFree));
+}
+
+/**
+ * Pick a random allocated block.
+ *
+ * @return The physical block number of the block
+ **/
+static physical_block_number_t pickAllocatedBlock(void)
+{
+  for (;;) {
+    physical_block_number_t pbn = random() % refs->block_count;
+    if (refs->counters[pbn] == PROVISIONAL_REFERENCE_COUNT) {
+      return pbn;
+    }
+  }
+}
+
+/**
+ * Time allocations from a slab with a given fraction of its blocks in use.
+ *
+ * @param permille  The number of blocks in use per thousand
+ **/
+static void testFullness(unsigned int permille)
+{
+  block_count_t target
+    = ((uint64_t) refs->block_count * (1000 - permille)) / 1000;
+
+  vdo_reset_reference_counts(refs);
+  vdo_reset_search_cursor(refs);
+  while (vdo_get_unreferenced_block_count(refs) > target) {
+    physical_block_number_t pbn = random() % refs->block_count;
+    CU_ASSERT_EQUAL(VDO_SUCCESS,
+                    vdo_provisionally_reference_block(refs, pbn, NULL));
+  }
+
+  ktime_t start = current_time_ns(CLOCK_MONOTONIC);
+  for (unsigned int i = 0; i < CHURN_COUNT; i++) {
+    physical_block_number_t pbn;
+    freeBlock(pickAllocatedBlock());
+    CU_ASSERT_EQUAL(VDO_SUCCESS,
+                    vdo_allocate_unreferenced_block(refs, &pbn));
+  }
+
+  ktime_t duration = current_time_ns(CLOCK_MONOTONIC) - start;
+  printf("%5.1f%% full: %6.3fs (%7.1f ns/allocation)\n",
+         permille / 10.0, duration * 1.0e-9,
+         (double) duration / CHURN_COUNT);
+}
+
+int main(void)
+{
+  srand(42);
+  slab = makeStandaloneSlab(SLAB_SIZE, JOURNAL_SIZE);
+  refs = slab->reference_counts;
+  testFullness(950);
+  testFullness(990);
+  testFullness(999);
+
+  freeStandaloneSlab(UDS_FORGET(slab));
+  return 0;
+}
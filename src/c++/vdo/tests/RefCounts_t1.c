@@ -76,6 +76,7 @@ static void initializeRefCountsT1(void)
     .noIndexRegion = true,
   };
   initializeBasicTest(&testParameters);
+  disableMetadataMerging();
 
   // This test assumes reference blocks are initialized to zero. So
   // clear out RAM layer with zeros.
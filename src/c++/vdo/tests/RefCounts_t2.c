@@ -8,6 +8,7 @@
 
 #include "albtest.h"
 
+#include <linux/bitops.h>
 #include <stdlib.h>
 
 #include "assertions.h"
@@ -16,13 +17,12 @@
 #include "syscalls.h"
 #include "time-utils.h"
 
-#include "block-allocator.h"
 #include "journal-point.h"
 #include "ref-counts.h"
 #include "slab.h"
-#include "slab-depot.h"
 #include "status-codes.h"
 
+#include "slabUtils.h"
 #include "vdoAsserts.h"
 #include "vdoTestBase.h"
 
@@ -30,42 +30,25 @@ enum {
   SLAB_SIZE    = (1 << 23),
   COUNT        = 100000,
   JOURNAL_SIZE = 2,
+  // The number of counters summarized by each bit of full_chunks
+  CHUNK_SIZE   = 64,
 };
 
-static struct ref_counts      *refs;
-static struct slab_depot      *depot;
-static struct block_allocator  allocator;
-static struct vdo_slab        *slab;
+static struct ref_counts *refs;
+static struct vdo_slab   *slab;
 
 /**********************************************************************/
 static void initializeRefCounts(void)
 {
   srand(42);
-  VDO_ASSERT_SUCCESS(UDS_ALLOCATE_EXTENDED(struct slab_depot, 1,
-                                           struct block_allocator *,
-                                           __func__, &depot));
-  depot->allocators[0] = &allocator;
-  allocator.depot      = depot;
-
-  VDO_ASSERT_SUCCESS(vdo_configure_slab(SLAB_SIZE, JOURNAL_SIZE,
-                                        &depot->slab_config));
-  VDO_ASSERT_SUCCESS(vdo_make_slab(0, &allocator, 0, NULL, 0, false, &slab));
-  VDO_ASSERT_SUCCESS(vdo_allocate_ref_counts_for_slab(slab));
-
-  /*
-   * Set the slab to be unrecovered so that slab journal locks will be ignored.
-   * Since this test doesn't maintain the correct lock invariants, it would
-   * fail on a lock count underflow otherwise.
-   */
-  vdo_mark_slab_unrecovered(slab);
+  slab = makeStandaloneSlab(SLAB_SIZE, JOURNAL_SIZE);
   refs = slab->reference_counts;
 }
 
 /**********************************************************************/
 static void tearDownRefCounts(void)
 {
-  UDS_FREE(depot);
-  vdo_free_slab(UDS_FORGET(slab));
+  freeStandaloneSlab(UDS_FORGET(slab));
 }
 
 /**
@@ -173,13 +156,63 @@ static void testMostlyFullArray(void)
 static void testFullArray(void)
 {
   // Incref all blocks except the last.
-  block_count_t dataBlocks = depot->slab_config.data_blocks;
+  block_count_t dataBlocks = refs->block_count;
   for (size_t k = 1; k < dataBlocks - 1; k++) {
     setReferenceCount(k, 1);
   }
   performanceTest(dataBlocks);
 }
 
+/**
+ * Free a provisionally referenced block.
+ *
+ * @param pbn  The physical block number to free
+ **/
+static void freeProvisionalBlock(physical_block_number_t pbn)
+{
+  bool                       wasFree;
+  enum reference_status      refStatus;
+  struct reference_operation operation = {
+    .pbn  = pbn,
+    .type = VDO_JOURNAL_DATA_DECREMENT,
+  };
+  VDO_ASSERT_SUCCESS(vdo_adjust_reference_count(refs, operation, NULL,
+                                                &wasFree));
+  VDO_ASSERT_SUCCESS(vdo_get_reference_status(refs, pbn, &refStatus));
+  CU_ASSERT_EQUAL(refStatus, RS_FREE);
+}
+
+/**
+ * Test that chunks of counters found to be full are skipped, and that a
+ * block freed in such a chunk is found again.
+ **/
+static void testFullChunks(void)
+{
+  physical_block_number_t pbn;
+  while (vdo_allocate_unreferenced_block(refs, &pbn) == VDO_SUCCESS) {
+  }
+
+  // Free a block in each of chunks 5 and 40 of the first reference block.
+  freeProvisionalBlock((5 * CHUNK_SIZE) + 3);
+  freeProvisionalBlock((40 * CHUNK_SIZE) + 7);
+
+  // Finding them marks each chunk before them full.
+  VDO_ASSERT_SUCCESS(vdo_allocate_unreferenced_block(refs, &pbn));
+  CU_ASSERT_EQUAL(pbn, (5 * CHUNK_SIZE) + 3);
+  VDO_ASSERT_SUCCESS(vdo_allocate_unreferenced_block(refs, &pbn));
+  CU_ASSERT_EQUAL(pbn, (40 * CHUNK_SIZE) + 7);
+  CU_ASSERT_TRUE(test_bit(2, refs->full_chunks));
+  CU_ASSERT_TRUE(test_bit(39, refs->full_chunks));
+
+  // Freeing a block in a full chunk makes it searchable again.
+  freeProvisionalBlock(2 * CHUNK_SIZE);
+  CU_ASSERT_FALSE(test_bit(2, refs->full_chunks));
+  vdo_reset_search_cursor(refs);
+  VDO_ASSERT_SUCCESS(vdo_allocate_unreferenced_block(refs, &pbn));
+  CU_ASSERT_EQUAL(pbn, 2 * CHUNK_SIZE);
+  CU_ASSERT_EQUAL(vdo_allocate_unreferenced_block(refs, &pbn), VDO_NO_SPACE);
+}
+
 /**
  * Test all free block positions are found correctly for a given refcount
  * array length.
@@ -246,6 +279,7 @@ static CU_TestInfo tests[] = {
   { "90% full array",          testMostlyFullArray },
   { "99.6% full array",        testVeryFullArray   },
   { "100% full slab",          testFullArray       },
+  { "full chunks",             testFullChunks      },
   { "all small arrays",        testAllSmallArrays  },
   CU_TEST_INFO_NULL,
 };
@@ -47,6 +47,7 @@ static void initialize(void)
   };
 
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
 
   // Make sure the first tree is allocated down to the first leaf.
   writeData(0, 0, 1, VDO_SUCCESS);
@@ -92,6 +92,7 @@ static void initializeRebuildTest(void)
     .physicalThreadCount = 1,
   };
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
 
   // Populate the entire block map tree, add slabs, then save and restart
   // the VDO.
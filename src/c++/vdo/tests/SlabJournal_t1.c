@@ -170,6 +170,7 @@ static void vioIsLatched(struct vio *vio)
 static void slabJournalTestInitialization(block_count_t vioPoolSize)
 {
   initializeVDOTest(&TEST_PARAMETERS);
+  disableMetadataMerging();
   depot   = vdo->depot;
   slab    = depot->slabs[0];
   journal = slab->journal;
@@ -76,6 +76,7 @@ static void initializeRebuildTest(void)
     .slabJournalBlocks = SLAB_JOURNAL_BLOCKS,
   };
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
 
   depot      = vdo->depot;
   slabConfig = depot->slab_config;
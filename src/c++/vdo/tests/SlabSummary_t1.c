@@ -135,6 +135,7 @@ static void initializeSlabSummary(void)
     .noIndexRegion  = true,
   };
   initializeBasicTest(&testParameters);
+  disableMetadataMerging();
 
   VDO_ASSERT_SUCCESS(vdo_make_fixed_layout(BLOCK_COUNT, 0, &layout));
 
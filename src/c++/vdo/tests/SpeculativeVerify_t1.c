@@ -0,0 +1,119 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "albtest.h"
+
+#include "dedupe.h"
+#include "statistics.h"
+#include "vdo.h"
+
+#include "blockMapUtils.h"
+#include "dataBlocks.h"
+#include "ioRequest.h"
+#include "vdoAsserts.h"
+#include "vdoTestBase.h"
+
+static bool savedSpeculativeVerify;
+
+/**
+ * Test-specific initialization.
+ **/
+static void initialize(void)
+{
+  const TestParameters parameters = {
+    .mappableBlocks      = 64,
+    .hashZoneThreadCount = 1,
+    .dataFormatter       = fillWithOffsetPlusOne,
+  };
+  initializeVDOTest(&parameters);
+  savedSpeculativeVerify = vdo_speculative_verify;
+}
+
+/**
+ * Test-specific tear down.
+ **/
+static void tearDown(void)
+{
+  vdo_speculative_verify = savedSpeculativeVerify;
+  tearDownVDOTest();
+}
+
+/**
+ * Check the speculative verification statistics.
+ *
+ * @param hits       The expected number of matching speculative verifies
+ * @param rollbacks  The expected number of mismatched speculative verifies
+ **/
+static void assertSpeculativeStatistics(uint64_t hits, uint64_t rollbacks)
+{
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.hash_lock.speculative_verify_hits, hits);
+  CU_ASSERT_EQUAL(stats.hash_lock.speculative_verify_rollbacks, rollbacks);
+}
+
+/**
+ * Test that verification launched from the PBN lock step deduplicates
+ * matching data and rolls back to writing on a mismatch.
+ **/
+static void testSpeculativeVerify(void)
+{
+  vdo_speculative_verify = true;
+  writeData(0, 0, 1, VDO_SUCCESS);
+  writeData(1, 0, 1, VDO_SUCCESS);
+  assertSpeculativeStatistics(1, 0);
+  CU_ASSERT_EQUAL(lookupLBN(1).pbn, lookupLBN(0).pbn);
+
+  // Change the contents of the duplicate behind VDO's back.
+  physical_block_number_t stalePBN = lookupLBN(0).pbn;
+  char buffer[VDO_BLOCK_SIZE];
+  fillWithOffsetPlusOne(buffer, 47);
+  VDO_ASSERT_SUCCESS(layer->writer(layer, stalePBN, 1, buffer));
+
+  writeData(2, 0, 1, VDO_SUCCESS);
+  assertSpeculativeStatistics(1, 1);
+  CU_ASSERT_NOT_EQUAL(lookupLBN(2).pbn, stalePBN);
+  verifyData(2, 0, 1);
+}
+
+/**
+ * Test that verification still works when speculation is disabled.
+ **/
+static void testNonSpeculativeVerify(void)
+{
+  vdo_speculative_verify = false;
+  writeData(0, 0, 1, VDO_SUCCESS);
+  writeData(1, 0, 1, VDO_SUCCESS);
+  assertSpeculativeStatistics(0, 0);
+  CU_ASSERT_EQUAL(lookupLBN(1).pbn, lookupLBN(0).pbn);
+
+  struct vdo_statistics stats;
+  vdo_fetch_statistics(vdo, &stats);
+  CU_ASSERT_EQUAL(stats.hash_lock.dedupe_advice_valid, 1);
+}
+
+/**********************************************************************/
+
+static CU_TestInfo vdoTests[] = {
+  { "speculative verification",     testSpeculativeVerify    },
+  { "non-speculative verification", testNonSpeculativeVerify },
+  CU_TEST_INFO_NULL,
+};
+
+static CU_SuiteInfo vdoSuite = {
+  .name                     = "speculative verification tests (SpeculativeVerify_t1)",
+  .initializerWithArguments = NULL,
+  .initializer              = initialize,
+  .cleaner                  = tearDown,
+  .tests                    = vdoTests,
+};
+
+CU_SuiteInfo *initializeModule(void)
+{
+  return &vdoSuite;
+}
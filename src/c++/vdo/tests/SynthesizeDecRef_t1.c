@@ -78,6 +78,7 @@ static void initializeTest(void)
     .dataFormatter     = fillWithOffsetPlusOne,
   };
   initializeVDOTest(&parameters);
+  disableMetadataMerging();
   block_count_t logicalBlocks = getTestConfig().config.logical_blocks;
   initializeLatchUtils(DIV_ROUND_UP(logicalBlocks,
                                     VDO_BLOCK_MAP_ENTRIES_PER_PAGE),
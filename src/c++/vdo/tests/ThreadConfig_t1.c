@@ -68,6 +68,10 @@ static void testOneThreadConfig(void)
   CU_ASSERT_EQUAL(0, vdo_get_physical_zone_thread(config, 0));
   CU_ASSERT_EQUAL(0, vdo_get_hash_zone_thread(config, 0));
 
+  // A thread doing all the zone work is never bound to a node.
+  CU_ASSERT_EQUAL(NUMA_NO_NODE, vdo_get_logical_zone_node(config, 0));
+  CU_ASSERT_EQUAL(NUMA_NO_NODE, vdo_get_thread_node(config, 0));
+
   assertThreadName(config, 0, "reqQ", -1);
 
   thread_id_t baseID = 1;
@@ -126,6 +130,10 @@ static void testBasicThreadConfig(void)
   for (zone_count_t zone = 0; zone < LOGICAL_ZONES; zone++) {
     CU_ASSERT_EQUAL(baseID + zone, vdo_get_logical_zone_thread(config, zone));
     assertThreadName(config, baseID + zone, "logQ", zone);
+
+    // User space has a single memory node, so no thread is bound.
+    CU_ASSERT_EQUAL(NUMA_NO_NODE, vdo_get_logical_zone_node(config, zone));
+    CU_ASSERT_EQUAL(NUMA_NO_NODE, vdo_get_thread_node(config, baseID + zone));
   }
   baseID += LOGICAL_ZONES;
 
@@ -158,17 +166,79 @@ static void testBasicThreadConfig(void)
   vdo_free_thread_config(config);
 }
 
+enum {
+  NODE_SPREAD_ZONES = 5,
+};
+
+/**
+ * Make a thread config with several logical zones and check the node to
+ * which each logical zone thread is bound.
+ *
+ * @param expectedNodes  The expected node of each logical zone
+ **/
+static void assertLogicalZoneNodes(const int expectedNodes[NODE_SPREAD_ZONES])
+{
+  struct thread_config *config;
+  struct thread_count_config counts = {
+    .logical_zones = NODE_SPREAD_ZONES,
+    .physical_zones = 1,
+    .hash_zones = 1,
+    .bio_threads = 1,
+    .bio_ack_threads = 1,
+  };
+  VDO_ASSERT_SUCCESS(vdo_make_thread_config(counts, &config));
+
+  for (zone_count_t zone = 0; zone < NODE_SPREAD_ZONES; zone++) {
+    thread_id_t thread = vdo_get_logical_zone_thread(config, zone);
+    CU_ASSERT_EQUAL(expectedNodes[zone],
+                    vdo_get_logical_zone_node(config, zone));
+    CU_ASSERT_EQUAL(expectedNodes[zone], vdo_get_thread_node(config, thread));
+  }
+
+  vdo_free_thread_config(config);
+}
+
+/**********************************************************************/
+static void testNodeSpread(void)
+{
+  // The logical zones take turns on the nodes.
+  set_fake_node_count(3);
+  const int allNodes[NODE_SPREAD_ZONES] = { 0, 1, 2, 0, 1 };
+  assertLogicalZoneNodes(allNodes);
+
+  // A node with memory but no CPUs is skipped.
+  node_clear_state(1, N_CPU);
+  const int cpuNodes[NODE_SPREAD_ZONES] = { 0, 2, 0, 2, 0 };
+  assertLogicalZoneNodes(cpuNodes);
+
+  // So is a node with CPUs but no memory, leaving nothing to spread over.
+  node_clear_state(2, N_MEMORY);
+  const int noNodes[NODE_SPREAD_ZONES] = {
+    NUMA_NO_NODE, NUMA_NO_NODE, NUMA_NO_NODE, NUMA_NO_NODE, NUMA_NO_NODE,
+  };
+  assertLogicalZoneNodes(noNodes);
+}
+
+/**
+ * Restore the single node of user space.
+ **/
+static void tearDown(void)
+{
+  set_fake_node_count(1);
+}
+
 /**********************************************************************/
 static CU_TestInfo tests[] = {
   { "test the single-thread configuration",       testOneThreadConfig   },
   { "test a basic multiple-thread configuration", testBasicThreadConfig },
+  { "test spreading logical zones over nodes",    testNodeSpread        },
   CU_TEST_INFO_NULL
 };
 
 static CU_SuiteInfo suite = {
   .name        = "struct thread_config tests (ThreadConfig_t1)",
   .initializer = NULL,
-  .cleaner     = NULL,
+  .cleaner     = tearDown,
   .tests       = tests,
 };
 
@@ -46,6 +46,7 @@ static bool            signalOnTear;
 static void initializeTornWritesT1(void)
 {
   initializeVDOTest(&TEST_PARAMETERS);
+  disableMetadataMerging();
   hookFired = false;
 }
 
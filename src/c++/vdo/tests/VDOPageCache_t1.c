@@ -52,6 +52,7 @@ static sequence_number_t        period;
 static struct vdo_page_cache   *cache;
 static CacheEntryUID            nextCacheEntryUID = 0x1020304000000001UL;
 static struct block_map_zone    zone;
+static unsigned int             savedDirtyTarget;
 
 typedef struct {
   sequence_number_t dirtyPeriod;
@@ -62,6 +63,8 @@ typedef struct {
 enum {
   SMALL_CACHE_SIZE = 4,
   LARGE_CACHE_SIZE = 8,
+  SCAN_START       = 100,
+  SCAN_LENGTH      = 64,
   PAGE_DATA_SIZE   = VDO_BLOCK_SIZE - sizeof(TestPageHeader),
 };
 
@@ -186,11 +189,15 @@ static void allowEnteringAction(struct vdo_completion *completion)
  * Initialize test.
  *
  * @param cacheSize   The number of pages in the cache
+ * @param policy      The cache replacement policy
  * @param maximumAge  The maximum age of a dirty page
  **/
-static void initialize(page_count_t cacheSize, sequence_number_t maximumAge)
+static void initializeWithPolicy(page_count_t                cacheSize,
+                                 enum vdo_page_cache_policy  policy,
+                                 sequence_number_t           maximumAge)
 {
   initializeBasicTest(&defaultParameters);
+  disableMetadataMerging();
   VDO_ASSERT_SUCCESS(make_int_map(cacheSize, 0, &pageMap));
   threadConfig = makeOneThreadConfig();
   VDO_ASSERT_SUCCESS(vdo_make_read_only_notifier(false,
@@ -210,6 +217,7 @@ static void initialize(page_count_t cacheSize, sequence_number_t maximumAge)
                                    &zone.tree_zone.vio_pool));
   VDO_ASSERT_SUCCESS(vdo_make_page_cache(vdo,
                                          cacheSize,
+                                         policy,
                                          validatePage,
                                          checkPageWritten,
                                          sizeof(CacheEntryUID),
@@ -224,6 +232,18 @@ static void initialize(page_count_t cacheSize, sequence_number_t maximumAge)
   vdo_set_page_cache_initial_period(cache, 1);
   period = 1;
   maxPBN = 0;
+  savedDirtyTarget = vdo_block_map_dirty_target;
+}
+
+/**
+ * Initialize test with an LRU cache.
+ *
+ * @param cacheSize   The number of pages in the cache
+ * @param maximumAge  The maximum age of a dirty page
+ **/
+static void initialize(page_count_t cacheSize, sequence_number_t maximumAge)
+{
+  initializeWithPolicy(cacheSize, VDO_PAGE_CACHE_POLICY_LRU, maximumAge);
 }
 
 /**
@@ -250,6 +270,7 @@ static void finishVDOPageCacheT1(void)
   vdo_free_read_only_notifier(UDS_FORGET(zone.read_only_notifier));
   vdo_free_thread_config(UDS_FORGET(threadConfig));
   free_int_map(UDS_FORGET(pageMap));
+  vdo_set_block_map_dirty_target(savedDirtyTarget);
   tearDownVDOTest();
 }
 
@@ -392,6 +413,21 @@ static void flushCacheAction(struct vdo_completion *completion)
                      initiateDrain);
 }
 
+/**
+ * Assert that no page in the cache is busy.
+ **/
+static void assertNoPagesBusy(void)
+{
+  for (unsigned int s = 0; s < cache->segment_count; s++) {
+    struct page_cache_segment *segment = &cache->segments[s];
+    for (struct page_info *info = segment->infos;
+         info < segment->infos + segment->page_count;
+         info++) {
+      CU_ASSERT_EQUAL(info->busy, 0);
+    }
+  }
+}
+
 /**********************************************************************/
 static void testBasic(void)
 {
@@ -403,10 +439,7 @@ static void testBasic(void)
   CU_ASSERT_EQUAL(READ_ONCE(cache->stats.failed_reads), 0);
   CU_ASSERT_EQUAL(READ_ONCE(cache->stats.failed_writes), 0);
 
-  for (struct page_info *info = cache->infos; info < cache->infos + cache->page_count;
-       info++) {
-    CU_ASSERT_EQUAL(info->busy, 0);
-  }
+  assertNoPagesBusy();
 
   TestCompletion completions[5];
   for (page_number_t i = 0; i < 5; i++) {
@@ -468,11 +501,7 @@ static void testBasic(void)
 
   performSuccessfulAction(flushCacheAction);
 
-  for (struct page_info *info = cache->infos;
-       info < cache->infos + cache->page_count;
-       info++) {
-    CU_ASSERT_EQUAL(info->busy, 0);
-  }
+  assertNoPagesBusy();
 
   CU_ASSERT_EQUAL(READ_ONCE(cache->stats.dirty_pages), 0);
 }
@@ -618,11 +647,7 @@ static void testReadOnly(void)
   performActionExpectResult(flushCacheAction, VDO_READ_ONLY);
 
   // No pages should be busy.
-  for (struct page_info *info = cache->infos;
-       info < cache->infos + cache->page_count;
-       info++) {
-    CU_ASSERT_EQUAL(info->busy, 0);
-  }
+  assertNoPagesBusy();
 
 
   CU_ASSERT_EQUAL(READ_ONCE(cache->stats.dirty_pages), 2);
@@ -957,21 +982,329 @@ static void testAgeDirtyPages(void)
   CU_ASSERT_EQUAL(READ_ONCE(cache->stats.dirty_pages), 0);
 
   // Nothing should be busy
-  for (struct page_info *info = cache->infos;
-       info < cache->infos + cache->page_count;
-       info++) {
-    CU_ASSERT_EQUAL(info->busy, 0);
+  assertNoPagesBusy();
+}
+
+/**
+ * Test that once more than the dirty target of the cache is dirty, the
+ * oldest pages are written out early, a limited number per period, and that
+ * pages are paced out as their era nears expiry.
+ **/
+static void testEarlyWriteback(void)
+{
+  initialize(LARGE_CACHE_SIZE, 4);
+  vdo_set_block_map_dirty_target(50);
+
+  // Dirty every other page so that no writes are coalesced.
+  for (page_number_t i = 0; i < LARGE_CACHE_SIZE; i++) {
+    accessPage(2 * i);
+    touchPage(2 * i, period);
   }
+
+  // Only a quarter of the cache is written per period.
+  advanceAndAssert(8, 6);
+  advanceAndAssert(6, 4);
+  // At the target, pages are paced out once their era is close to expiring.
+  advanceAndAssert(4, 3);
+  // The rest are written when their era expires.
+  advanceAndAssert(3, 0);
+
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_written_early), 5);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_coalesced), 0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.max_pages_per_journal_block), 3);
+  assertNoPagesBusy();
+}
+
+/**
+ * Test that the dirty neighbors of an expiring page are saved with it.
+ **/
+static void testCoalescedWriteback(void)
+{
+  initialize(LARGE_CACHE_SIZE, 2);
+  vdo_set_block_map_dirty_target(50);
+  for (page_number_t i = 0; i < SMALL_CACHE_SIZE; i++) {
+    accessPage(i);
+  }
+
+  // Dirty page 0 in period 1, and pages 1 and 2 in period 2.
+  touchPage(0, period);
+  advanceAndAssert(1, 1);
+  touchPages(1, 3, period);
+
+  // Pages 1 and 2 are written along with page 0 when its era expires.
+  advanceAndAssert(3, 0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_coalesced), 2);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_written_early), 0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.max_pages_per_journal_block), 3);
+  assertNoPagesBusy();
+}
+
+/**
+ * Make page 0 hot by using it again after it has been evicted, then scan
+ * many more pages than the cache holds, using each of them twice.
+ **/
+static void scanPastHotPage(void)
+{
+  for (page_number_t i = 0; i <= LARGE_CACHE_SIZE; i++) {
+    accessPage(i);
+  }
+
+  accessPage(0);
+  accessPage(0);
+  for (page_number_t i = SCAN_START; i < SCAN_START + SCAN_LENGTH; i++) {
+    accessPage(i);
+    accessPage(i);
+  }
+}
+
+/**********************************************************************/
+static void testLRUScan(void)
+{
+  initialize(LARGE_CACHE_SIZE, 1);
+  scanPastHotPage();
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.cold_hits), 0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.hot_hits), SCAN_LENGTH + 1);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.ghost_hits), 0);
+
+  // The scan has evicted page 0.
+  uint64_t loaded = READ_ONCE(cache->stats.pages_loaded);
+  accessPage(0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_loaded), loaded + 1);
+}
+
+/**********************************************************************/
+static void test2QScan(void)
+{
+  initializeWithPolicy(LARGE_CACHE_SIZE, VDO_PAGE_CACHE_POLICY_2Q, 1);
+  scanPastHotPage();
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.cold_hits), SCAN_LENGTH);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.hot_hits), 1);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.ghost_hits), 1);
+
+  // The scan only cycled through the cold queue, so page 0 is still cached.
+  uint64_t loaded = READ_ONCE(cache->stats.pages_loaded);
+  accessPage(0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_loaded), loaded);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.hot_hits), 2);
+}
+
+static page_count_t              newCacheSize;
+static page_count_t              shortfall;
+static struct page_cache_segment newSegment;
+
+/**
+ * Action to resize the cache within the slots it has.
+ **/
+static void resizeCacheAction(struct vdo_completion *completion)
+{
+  shortfall = vdo_resize_page_cache(cache, newCacheSize);
+  vdo_finish_completion(completion, VDO_SUCCESS);
+}
+
+/**
+ * Action to add new slots to the cache.
+ **/
+static void addSegmentAction(struct vdo_completion *completion)
+{
+  vdo_finish_completion(completion,
+                        vdo_add_page_cache_segment(cache, &newSegment));
+}
+
+/**
+ * Resize the cache as vdo_resize_block_map_cache() does for each zone.
+ *
+ * @param pageCount  The new size of the cache
+ **/
+static void resizeCache(page_count_t pageCount)
+{
+  newCacheSize = pageCount;
+  performSuccessfulAction(resizeCacheAction);
+  if (shortfall > 0) {
+    VDO_ASSERT_SUCCESS(vdo_make_page_cache_segment(cache, shortfall,
+                                                   &newSegment));
+    performSuccessfulAction(addSegmentAction);
+  }
+
+  CU_ASSERT_EQUAL(cache->page_count, pageCount);
+}
+
+/**
+ * Access a range of pages.
+ *
+ * @param start  The first page to access
+ * @param end    The page after the last one to access
+ **/
+static void accessPages(page_number_t start, page_number_t end)
+{
+  for (page_number_t i = start; i < end; i++) {
+    accessPage(i);
+  }
+}
+
+/**
+ * Test growing a cache, and then shrinking it while some of the pages beyond
+ * the new size are dirty or busy.
+ **/
+static void testResize(void)
+{
+  initialize(SMALL_CACHE_SIZE, 4);
+  resizeCache(LARGE_CACHE_SIZE);
+  CU_ASSERT_EQUAL(cache->segment_count, 2);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.free_pages), LARGE_CACHE_SIZE);
+
+  // The grown cache holds every page.
+  accessPages(0, LARGE_CACHE_SIZE);
+  accessPages(0, LARGE_CACHE_SIZE);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_loaded), LARGE_CACHE_SIZE);
+
+  // The new slots hold pages 4 to 7; dirty two of them and hold another.
+  touchPage(4, period);
+  touchPage(5, period);
+  TestCompletion busy;
+  initializeTestCompletion(&busy);
+  getReadablePage(6, &busy);
+
+  // The clean idle page is evicted at once, and the dirty ones are written.
+  resizeCache(SMALL_CACHE_SIZE);
+  syncCache();
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.dirty_pages), 0);
+  CU_ASSERT_EQUAL(cache->retired_count, 3);
+  CU_ASSERT_EQUAL(cache->segment_count, 2);
+
+  // Releasing the busy page frees the new slots.
+  performPageAction(&busy, vdo_release_page_completion);
+  CU_ASSERT_EQUAL(cache->segment_count, 1);
+  CU_ASSERT_EQUAL(cache->slot_count, SMALL_CACHE_SIZE);
+  CU_ASSERT_EQUAL(cache->retired_count, 0);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.clean_pages), SMALL_CACHE_SIZE);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.free_pages), 0);
+
+  // The pages in the old slots are still cached, the others are not.
+  uint64_t loaded = READ_ONCE(cache->stats.pages_loaded);
+  accessPages(0, SMALL_CACHE_SIZE);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_loaded), loaded);
+  accessPage(4);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_loaded), loaded + 1);
+  assertNoPagesBusy();
+}
+
+/**
+ * Test that growing a cache which is still shrinking reuses the slots being
+ * retired, along with the pages in them.
+ **/
+static void testRegrow(void)
+{
+  initializeWithPolicy(SMALL_CACHE_SIZE, VDO_PAGE_CACHE_POLICY_2Q, 1);
+  resizeCache(LARGE_CACHE_SIZE);
+  accessPages(0, LARGE_CACHE_SIZE);
+
+  TestCompletion busy;
+  initializeTestCompletion(&busy);
+  getReadablePage(7, &busy);
+  resizeCache(SMALL_CACHE_SIZE);
+  CU_ASSERT_EQUAL(cache->retired_count, SMALL_CACHE_SIZE - 1);
+  CU_ASSERT_EQUAL(cache->cold_target, SMALL_CACHE_SIZE / 4);
+
+  // Growing again needs no new slots.
+  resizeCache(LARGE_CACHE_SIZE);
+  CU_ASSERT_EQUAL(shortfall, 0);
+  CU_ASSERT_EQUAL(cache->segment_count, 2);
+  CU_ASSERT_EQUAL(cache->retired_count, 0);
+  CU_ASSERT_EQUAL(cache->cold_target, LARGE_CACHE_SIZE / 4);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.free_pages), SMALL_CACHE_SIZE - 1);
+
+  // The busy page stayed in the cache, and is no longer retiring.
+  uint64_t loaded = READ_ONCE(cache->stats.pages_loaded);
+  performPageAction(&busy, vdo_release_page_completion);
+  accessPage(7);
+  CU_ASSERT_EQUAL(READ_ONCE(cache->stats.pages_loaded), loaded);
+  CU_ASSERT_EQUAL(cache->segment_count, 2);
+}
+
+/**
+ * Hold every page in the cache, and launch a get which must wait for a page
+ * to become free.
+ *
+ * @param busy        The completions with which to hold the pages
+ * @param pageNumber  The page for the get which must wait
+ * @param waiting     The completion for the get which must wait
+ **/
+static void fillCacheAndWait(TestCompletion *busy,
+                             page_number_t   pageNumber,
+                             TestCompletion *waiting)
+{
+  for (page_number_t i = 0; i < cache->page_count; i++) {
+    initializeTestCompletion(&busy[i]);
+    getReadablePage(i, &busy[i]);
+  }
+
+  initializeTestCompletion(waiting);
+  getRequested = false;
+  launchPageGet(pageNumber, false, waiting, NULL);
+  waitForState(&getRequested);
+  CU_ASSERT_TRUE(has_waiters(&cache->free_waiters));
+}
+
+/**
+ * Release a set of pages.
+ *
+ * @param completions  The completions holding the pages
+ * @param count        The number of pages
+ **/
+static void releasePages(TestCompletion *completions, page_count_t count)
+{
+  for (page_count_t i = 0; i < count; i++) {
+    performPageAction(&completions[i], vdo_release_page_completion);
+  }
+}
+
+/**
+ * Test that growing a cache gives the new slots to gets which are waiting
+ * for free pages, whether the slots are new or were being retired.
+ **/
+static void testGrowFreesWaiters(void)
+{
+  initialize(SMALL_CACHE_SIZE, 4);
+  TestCompletion busy[SMALL_CACHE_SIZE];
+  TestCompletion waiting;
+  fillCacheAndWait(busy, SMALL_CACHE_SIZE, &waiting);
+
+  resizeCache(LARGE_CACHE_SIZE);
+  CU_ASSERT_EQUAL(shortfall, LARGE_CACHE_SIZE - SMALL_CACHE_SIZE);
+  awaitSuccessfulCompletion(&waiting);
+
+  // The waiting get holds a page in a new slot, so shrinking retires it.
+  releasePages(busy, SMALL_CACHE_SIZE);
+  resizeCache(SMALL_CACHE_SIZE);
+  CU_ASSERT_EQUAL(cache->segment_count, 2);
+
+  TestCompletion waiting2;
+  fillCacheAndWait(busy, SMALL_CACHE_SIZE + 1, &waiting2);
+  resizeCache(LARGE_CACHE_SIZE);
+  CU_ASSERT_EQUAL(shortfall, 0);
+  awaitSuccessfulCompletion(&waiting2);
+
+  releasePages(busy, SMALL_CACHE_SIZE);
+  performPageAction(&waiting, vdo_release_page_completion);
+  performPageAction(&waiting2, vdo_release_page_completion);
+  assertNoPagesBusy();
 }
 
 /**********************************************************************/
 
 static CU_TestInfo vdoPageCacheTests[] = {
-  { "basic functionality", testBasic         },
-  { "read-only",           testReadOnly      },
-  { "busy cache page",     testBusyCachePage },
-  { "access mode",         testAccessMode    },
-  { "age dirty eras",      testAgeDirtyPages },
+  { "basic functionality",    testBasic              },
+  { "read-only",              testReadOnly           },
+  { "busy cache page",        testBusyCachePage      },
+  { "access mode",            testAccessMode         },
+  { "age dirty eras",         testAgeDirtyPages      },
+  { "early writeback",        testEarlyWriteback     },
+  { "coalesced writeback",    testCoalescedWriteback },
+  { "LRU scan",               testLRUScan            },
+  { "2Q scan",                test2QScan             },
+  { "resize",                 testResize             },
+  { "regrow while shrinking", testRegrow             },
+  { "grow frees waiters",     testGrowFreesWaiters   },
   CU_TEST_INFO_NULL,
 };
 
@@ -324,6 +324,30 @@ static void assertStartStopExpectation(int result)
   }
 }
 
+/**
+ * Discard a run of blocks by zeroing them, as thin provisioned storage would.
+ *
+ * @param layer       The layer holding the blocks
+ * @param startBlock  The first block to discard
+ * @param blockCount  The number of blocks to discard
+ *
+ * @return VDO_SUCCESS or an error
+ **/
+static int discardBlocks(PhysicalLayer           *layer,
+                         physical_block_number_t  startBlock,
+                         block_count_t            blockCount)
+{
+  static char zeroBlock[VDO_BLOCK_SIZE];
+  for (block_count_t i = 0; i < blockCount; i++) {
+    int result = layer->writer(layer, startBlock + i, 1, zeroBlock);
+    if (result != VDO_SUCCESS) {
+      return result;
+    }
+  }
+
+  return VDO_SUCCESS;
+}
+
 /**
  * Process a single bio.
  *
@@ -352,7 +376,11 @@ static int processBIO(struct bio *bio)
   assertNotInIndexRegion(vio->physical);
 
   int result;
-  if (bio_data_dir(bio) == WRITE) {
+  if (bio_op(bio) == REQ_OP_DISCARD) {
+    result = discardBlocks(ramLayer,
+                           vio->physical,
+                           bio->bi_iter.bi_size / VDO_BLOCK_SIZE);
+  } else if (bio_data_dir(bio) == WRITE) {
     result = ramLayer->writer(ramLayer,
                               vio->physical,
                               vio->block_count,
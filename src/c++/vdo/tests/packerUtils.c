@@ -130,13 +130,15 @@ void waitForDataVIOToReachPacker(void)
 
 /**
  * Wrap the user space lz4 compressor to have the same interface as the one
- * we use in the kernel.
+ * we use in the kernel. The user space compressor has no acceleration factor,
+ * so it is ignored.
  **/
-int LZ4_compress_default(const char *source,
-                         char *dest,
-                         int isize,
-                         int maxOutputSize,
-                         void *context)
+int LZ4_compress_fast(const char *source,
+                      char *dest,
+                      int isize,
+                      int maxOutputSize,
+                      int acceleration __attribute__((unused)),
+                      void *context)
 {
   return (READ_ONCE(packingPrevented)
           ? VDO_BLOCK_SIZE
@@ -38,6 +38,7 @@ void initializeRecoveryModeTest(const TestParameters *testParameters)
   VDO_ASSERT_SUCCESS(uds_init_cond(&condition));
   VDO_ASSERT_SUCCESS(make_int_map(8, 0, &latchedVIOs));
   initializeVDOTest(testParameters);
+  disableMetadataMerging();
 }
 
 /**********************************************************************/
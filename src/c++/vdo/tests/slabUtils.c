@@ -0,0 +1,54 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#include "slabUtils.h"
+
+#include "memory-alloc.h"
+
+#include "block-allocator.h"
+#include "ref-counts.h"
+#include "slab-depot.h"
+#include "status-codes.h"
+
+#include "vdoAsserts.h"
+
+static struct block_allocator allocator;
+
+/**********************************************************************/
+struct vdo_slab *makeStandaloneSlab(block_count_t slabSize,
+                                    block_count_t journalBlocks)
+{
+  struct slab_depot *depot;
+  VDO_ASSERT_SUCCESS(UDS_ALLOCATE_EXTENDED(struct slab_depot, 1,
+                                           struct block_allocator *,
+                                           __func__, &depot));
+  depot->allocators[0] = &allocator;
+  allocator.depot      = depot;
+
+  VDO_ASSERT_SUCCESS(vdo_configure_slab(slabSize, journalBlocks,
+                                        &depot->slab_config));
+  struct vdo_slab *slab;
+  VDO_ASSERT_SUCCESS(vdo_make_slab(0, &allocator, 0, NULL, 0, false, &slab));
+  VDO_ASSERT_SUCCESS(vdo_allocate_ref_counts_for_slab(slab));
+
+  /*
+   * Set the slab to be unrecovered so that slab journal locks will be ignored.
+   * Since the tests don't maintain the correct lock invariants, they would
+   * fail on a lock count underflow otherwise.
+   */
+  vdo_mark_slab_unrecovered(slab);
+  return slab;
+}
+
+/**********************************************************************/
+void freeStandaloneSlab(struct vdo_slab *slab)
+{
+  struct slab_depot *depot = slab->allocator->depot;
+  vdo_free_slab(slab);
+  UDS_FREE(depot);
+}
@@ -0,0 +1,36 @@
+/*
+ * %COPYRIGHT%
+ *
+ * %LICENSE%
+ *
+ * $Id$
+ */
+
+#ifndef SLAB_UTILS_H
+#define SLAB_UTILS_H
+
+#include "slab.h"
+
+/**
+ * Make a slab with reference counts which does not belong to a VDO. The slab
+ * is marked unrecovered so that its reference count updates ignore slab
+ * journal locks, which tests using it need not maintain. Only one such slab
+ * may exist at a time.
+ *
+ * @param slabSize      The number of blocks in the slab
+ * @param journalBlocks The number of slab journal blocks in the slab
+ *
+ * @return The slab
+ **/
+struct vdo_slab *makeStandaloneSlab(block_count_t slabSize,
+                                    block_count_t journalBlocks)
+  __attribute__((warn_unused_result));
+
+/**
+ * Free a slab made by makeStandaloneSlab().
+ *
+ * @param slab  The slab to free
+ **/
+void freeStandaloneSlab(struct vdo_slab *slab);
+
+#endif // SLAB_UTILS_H
@@ -347,6 +347,7 @@ TestConfiguration makeTestConfiguration(const TestParameters *parameters)
       .logical_block_size = VDO_BLOCK_SIZE,
       .physical_blocks    = params.physicalBlocks + indexBlocks,
       .compression        = params.enableCompression,
+      .compression_acceleration = DEFAULT_VDO_COMPRESSION_ACCELERATION,
       .deduplication      = !params.disableDeduplication,
     },
     .indexConfig         = indexConfig,
@@ -9,11 +9,13 @@
 #include "vdoTestBase.h"
 
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <linux/kobject.h>
 
 #include "memory-alloc.h"
 #include "syscalls.h"
+#include "time-utils.h"
 
 #include "admin-state.h"
 #include "block-map.h"
@@ -21,6 +23,7 @@
 #include "device-config.h"
 #include "device-registry.h"
 #include "instance-number.h"
+#include "io-submitter.h"
 #include "num-utils.h"
 #include "recovery-journal.h"
 #include "slab-depot.h"
@@ -336,6 +339,14 @@ void tearDownVDOTest(void)
    * hangs is tricky.
    */
   data_vio_count = MAXIMUM_VDO_USER_VIOS;
+  // Likewise for tests which turned off metadata merging.
+  vdo_merge_metadata_bios = true;
+}
+
+/**********************************************************************/
+void disableMetadataMerging(void)
+{
+  vdo_merge_metadata_bios = false;
 }
 
 /**********************************************************************/
@@ -444,6 +455,17 @@ void waitForRecoveryDone(void)
   }
 }
 
+/**********************************************************************/
+void waitForSlabsRecovered(unsigned int timeout)
+{
+  ktime_t deadline
+    = current_time_ns(CLOCK_MONOTONIC) + seconds_to_ktime(timeout);
+  while (vdo_get_slab_depot_unrecovered_slab_count(vdo->depot) > 0) {
+    CU_ASSERT(current_time_ns(CLOCK_MONOTONIC) < deadline);
+    usleep(1000);
+  }
+}
+
 /**
  * A vdo_action to enable VDO compression from the request thread.
  **/
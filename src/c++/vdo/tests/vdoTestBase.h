@@ -183,6 +183,13 @@ void initializeTestWithSynchronousLayer(const TestParameters *parameters,
  **/
 void tearDownVDOTest(void);
 
+/**
+ * Turn off metadata bio merging until the end of the current test. Tests which
+ * hold individual metadata vios must do this, since any vio merged with a held
+ * vio would be held as well.
+ **/
+void disableMetadataMerging(void);
+
 /**
  * Perform an action on a specified callback thread and assert that the result
  * is as expected.
@@ -255,6 +262,14 @@ void rebuildReadOnlyVDO(void);
  **/
 void waitForRecoveryDone(void);
 
+/**
+ * Wait until every slab of the VDO has been recovered, which includes having
+ * had its reference counts loaded, and assert that this happens in time.
+ *
+ * @param timeout  The number of seconds to wait before failing
+ **/
+void waitForSlabsRecovered(unsigned int timeout);
+
 /**
  * Set the compression state of the VDO.
  *
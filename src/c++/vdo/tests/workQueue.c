@@ -194,6 +194,14 @@ int make_work_queue(const char *thread_name_prefix,
   return VDO_SUCCESS;
 }
 
+/*****************************************************************************/
+void bind_work_queue_to_node(struct vdo_work_queue *queue
+                             __attribute__((unused)),
+                             int node __attribute__((unused)))
+{
+  // User space tests run on a single node.
+}
+
 /*****************************************************************************/
 void free_work_queue(struct vdo_work_queue *queue)
 {
@@ -437,6 +437,7 @@ sub generateHeader {
   $self->blankLine();
 
   my $headerText = <<"EOH";
+#include "compressed-block.h"
 #include "math.h"
 #include "statistics.h"
 #include "status-codes.h"